@@ -117,6 +117,23 @@ class Stream : public Print
     char* readCharsUntil(char terminator, size_t max = 512);
     ////////////////////////////////////////////////////////////
 
+    // KH, bulk hooks. The defaults go through read(), streams buffering data
+    // in memory override them so readBytes() & co. copy and scan whole runs.
+
+    // Copies up to length bytes available now, never waits
+    virtual size_t readAvailable(char *buffer, size_t length);
+
+    // Contiguous run of buffered bytes, not consumed. 0 if none or unsupported
+    virtual size_t peekSpan(const char **data)
+    {
+      (void) data;
+      return 0;
+    }
+
+    // Drops length bytes seen through peekSpan()
+    virtual void consume(size_t length);
+    ////////////////////////////////////////////////////////////
+
     int getReadError()
     {
       return read_error;
@@ -139,6 +156,8 @@ class Stream : public Print
     int timedRead();
     int timedPeek();
     int peekNextDigit();
+    bool timedWait(bool *waiting, unsigned long *startMillis);
+    void readStringBlocks(int terminator, String &str, size_t max);
     //////
 
   private:
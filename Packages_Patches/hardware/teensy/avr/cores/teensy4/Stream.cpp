@@ -41,12 +41,29 @@ int Stream::timedRead()
     yield();
   } while (millis() - startMillis < _timeout);
 
-  Serial.print(("timedRead timeout = "));
-  Serial.println(_timeout);
-
   return -1;     // -1 indicates timeout
 }
 
+// private method for the bulk readers, called when nothing is available.
+// The timeout starts with the first empty call after data, so millis() is
+// only read while waiting. Returns false once timed out.
+bool Stream::timedWait(bool *waiting, unsigned long *startMillis)
+{
+  if (!*waiting)
+  {
+    *waiting = true;
+    *startMillis = millis();
+  }
+  else if (millis() - *startMillis >= _timeout)
+  {
+    return false;
+  }
+
+  yield();
+
+  return true;
+}
+
 // private method to peek stream with timeout
 int Stream::timedPeek()
 {
@@ -92,6 +109,29 @@ int Stream::peekNextDigit()
 // Public Methods
 //////////////////////////////////////////////////////////////
 
+size_t Stream::readAvailable(char *buffer, size_t length)
+{
+  size_t count = 0;
+
+  while (count < length)
+  {
+    int c = read();
+
+    if (c < 0)
+      break;
+
+    buffer[count++] = (char)c;
+  }
+
+  return count;
+}
+
+void Stream::consume(size_t length)
+{
+  while (length-- && (read() >= 0))
+    ;
+}
+
 void Stream::setTimeout(unsigned long timeout)  // sets the maximum number of milliseconds to wait
 {
   _timeout = timeout;
@@ -273,19 +313,23 @@ size_t Stream::readBytes(char *buffer, size_t length)
     return 0;
 
   size_t count = 0;
+  bool waiting = false;
+  unsigned long startMillis = 0;
 
   while (count < length)
   {
-    int c = timedRead();
+    size_t n = readAvailable(buffer + count, length - count);
 
-    if (c < 0)
+    if (n > 0)
+    {
+      count += n;
+      waiting = false;
+    }
+    else if (!timedWait(&waiting, &startMillis))
     {
       setReadError();
       break;
     }
-
-    *buffer++ = (char)c;
-    count++;
   }
 
   return count;
@@ -306,139 +350,168 @@ size_t Stream::readBytesUntil(char terminator, char *buffer, size_t length)
 
   length--;
   size_t index = 0;
+  bool waiting = false;
+  unsigned long startMillis = 0;
 
   while (index < length)
   {
-    int c = timedRead();
+    const char *data;
+    size_t n = peekSpan(&data);
 
-    if (c == terminator)
-      break;
+    if (n > 0)
+    {
+      if (n > length - index)
+        n = length - index;
 
-    if (c < 0)
+      const char *hit = (const char *) memchr(data, terminator, n);
+      size_t count = hit ? (size_t) (hit - data) : n;
+
+      memcpy(buffer + index, data, count);
+      index += count;
+      consume(hit ? count + 1 : count);
+      waiting = false;
+
+      if (hit)
+        break;
+
+      continue;
+    }
+
+    int c = read();
+
+    if (c >= 0)
+    {
+      if (c == terminator)
+        break;
+
+      buffer[index++] = (char)c;
+      waiting = false;
+    }
+    else if (!timedWait(&waiting, &startMillis))
     {
       setReadError();
       break;
     }
-
-    *buffer++ = (char)c;
-    index++;
   }
 
-  *buffer = 0;
+  buffer[index] = 0;
   return index; // return number of characters, not including null terminator
 }
 
-#if 1
-// From nRF52
-
-String Stream::readString(size_t max)
+// Appends len bytes without NUL to str, in chunks as String has no
+// portable (ptr, len) append
+static void appendChars(String &str, const char *data, size_t len)
 {
-  String ret;
-  int c = timedRead();
+  char chunk[65];
 
-  while (c >= 0)
+  while (len > 0)
   {
-    ret += (char)c;
-    c = timedRead();
-  }
+    size_t n = (len < sizeof(chunk) - 1) ? len : sizeof(chunk) - 1;
 
-  return ret;
-}
+    memcpy(chunk, data, n);
+    chunk[n] = 0;
+    str += chunk;
 
-char readStringBuffer[2048];
+    data += n;
+    len -= n;
+  }
+}
 
-char* Stream::readCharsUntil(char terminator, size_t max)
+String Stream::readString(size_t max)
 {
-  uint16_t offset = 0;
-
-  int c = timedRead();
+  String str;
 
-  readStringBuffer[offset++] = c;
+  readStringBlocks(-1, str, max);
 
-  while (c >= 0 && c != terminator)
-  {
-    c = timedRead();
+  return str;
+}
 
-    readStringBuffer[offset++] = c;
-  }
+String Stream::readStringUntil(char terminator, size_t max)
+{
+  String str;
 
-  readStringBuffer[offset] = 0;
+  readStringBlocks((uint8_t) terminator, str, max);
 
-  return readStringBuffer;
+  return str;
 }
 
-String Stream::readStringUntil(char terminator, size_t max)
+// Reads into str until terminator (not stored), NUL, max bytes or timeout.
+// Shared by readString() / readStringUntil(), terminator -1 => none
+void Stream::readStringBlocks(int terminator, String &str, size_t max)
 {
-  String ret;
-  uint16_t offset = 0;
+  size_t length = 0;
+  bool waiting = false;
+  unsigned long startMillis = 0;
 
-  int c = timedRead();
+  while (length < max)
+  {
+    const char *data;
+    size_t n = peekSpan(&data);
 
-  readStringBuffer[offset++] = c;
+    if (n > 0)
+    {
+      if (n > max - length)
+        n = max - length;
 
-  while (c >= 0 && c != terminator)
-  {
-    c = timedRead();
+      size_t count = 0;
 
-    readStringBuffer[offset++] = c;
-  }
+      while ((count < n) && (data[count] != 0) && ((uint8_t) data[count] != terminator))
+        count++;
 
-  readStringBuffer[offset] = 0;
+      str.reserve(str.length() + count);
+      appendChars(str, data, count);
+      length += count;
+      waiting = false;
 
-  ret = String(readStringBuffer);
+      if (count < n)
+      {
+        // consume the terminator / NUL as well
+        consume(count + 1);
+        break;
+      }
 
-  return String(readStringBuffer);
-}
+      consume(count);
 
-#else
+      continue;
+    }
 
-String Stream::readString(size_t max)
-{
-  String str;
-  size_t length = 0;
+    int c = read();
 
-  while (length < max)
-  {
-    int c = timedRead();
+    if (c >= 0)
+    {
+      if ((c == 0) || (c == terminator))
+        break;
 
-    if (c < 0)
+      str += (char)c;
+      length++;
+      waiting = false;
+    }
+    else if (!timedWait(&waiting, &startMillis))
     {
       setReadError();
       break;  // timeout
     }
-
-    if (c == 0)
-      break;
-
-    str += (char)c;
-    length++;
   }
-
-  return str;
 }
 
-String Stream::readStringUntil(char terminator, size_t max)
+char readStringBuffer[2048];
+
+char* Stream::readCharsUntil(char terminator, size_t max)
 {
-  String str;
-  size_t length = 0;
+  uint16_t offset = 0;
 
-  while (length < max)
-  {
-    int c = timedRead();
+  int c = timedRead();
 
-    if (c < 0)
-    {
-      setReadError();
-      break;  // timeout
-    }
+  readStringBuffer[offset++] = c;
 
-    if (c == 0 || c == terminator)
-      break;
+  while (c >= 0 && c != terminator)
+  {
+    c = timedRead();
 
-    str += (char)c;
-    length++;
+    readStringBuffer[offset++] = c;
   }
 
-  return str;
+  readStringBuffer[offset] = 0;
+
+  return readStringBuffer;
 }
-#endif
@@ -0,0 +1,565 @@
+/****************************************************************************************************************************
+  AsyncTCP_Bench.ino
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+  Licensed under GPLv3 license
+ *****************************************************************************************************************************/
+
+/*
+  Throughput / latency benchmark of AsyncServer driven by BENCH_CLIENTS
+  concurrent AsyncClients, in four scenarios:
+
+    bulk    clients stream data, the server discards it          => MB/s
+    echo    one message in flight per client, echoed back        => round trip latency
+    rpc     small request, larger response                       => request latency
+    churn   connect, 1 byte request / reply, close               => connections/s
+
+  Each scenario prints a human readable summary ('#' lines) and one JSON
+  line, so results can be collected with grep '^{' and compared between
+  versions. Cycles are CPU cycles (DWT on Teensy, TSC on x86 hosts).
+
+  On Teensy 4.1 the clients connect to the board itself, which needs
+  LWIP_NETIF_LOOPBACK in QNEthernet's lwipopts.h, or to BENCH_PEER_IP
+  running a second copy of this sketch.
+
+  On the host build (extras/host) latency, loss and bandwidth of the
+  simulated link are set with BENCH_LINK_*:
+
+    EXTRA_FLAGS="-DBENCH_LINK_LATENCY_US=500 -DBENCH_LINK_LOSS_PPM=1000" \
+      LWIP_DIR=~/src/lwip extras/host/build.sh examples/AsyncTCP_Bench/AsyncTCP_Bench.ino
+*/
+
+#if !defined(TEENSY41_ASYNC_TCP_HOST)
+  #if !( defined(CORE_TEENSY) && defined(__IMXRT1062__) && defined(ARDUINO_TEENSY41) )
+    #error Only Teensy 4.1 supported
+  #endif
+
+  #include <QNEthernet.h>
+  using namespace qindesign::network;
+#endif
+
+#define _TEENSY41_ASYNC_TCP_LOGLEVEL_       1
+
+#include "Teensy41_AsyncTCP.h"
+
+#include "BenchStats.h"
+
+/////////////////////////////////////////////////
+
+#ifndef BENCH_CLIENTS
+  #define BENCH_CLIENTS             4
+#endif
+
+#ifndef BENCH_DURATION_MS
+  #define BENCH_DURATION_MS         5000
+#endif
+
+#ifndef BENCH_PORT
+  #define BENCH_PORT                5001
+#endif
+
+#ifndef BENCH_BULK_CHUNK
+  #define BENCH_BULK_CHUNK          1460
+#endif
+
+#ifndef BENCH_ECHO_SIZE
+  #define BENCH_ECHO_SIZE           64
+#endif
+
+#ifndef BENCH_RPC_REQUEST
+  #define BENCH_RPC_REQUEST         32
+#endif
+
+#ifndef BENCH_RPC_RESPONSE
+  #define BENCH_RPC_RESPONSE        512
+#endif
+
+#ifndef BENCH_LINK_LATENCY_US
+  #define BENCH_LINK_LATENCY_US     0
+#endif
+
+#ifndef BENCH_LINK_LOSS_PPM
+  #define BENCH_LINK_LOSS_PPM       0
+#endif
+
+#ifndef BENCH_LINK_KBPS
+  #define BENCH_LINK_KBPS           0
+#endif
+
+// Max time to wait for all connections to go away between scenarios
+#define BENCH_DRAIN_MS              3000
+
+/////////////////////////////////////////////////
+
+typedef enum
+{
+  BENCH_BULK,
+  BENCH_ECHO,
+  BENCH_RPC,
+  BENCH_CHURN,
+  BENCH_DONE
+} benchScenario_t;
+
+typedef enum
+{
+  PHASE_START,
+  PHASE_RUN,
+  PHASE_DRAIN
+} benchPhase_t;
+
+static const char * scenarioName[] = { "bulk", "echo", "rpc", "churn" };
+
+typedef struct
+{
+  AsyncClient * client;
+  uint32_t      sentAt;
+  size_t        expected;
+  size_t        received;
+} BenchConn;
+
+typedef struct
+{
+  size_t        requestBytes;
+} BenchServerConn;
+
+/////////////////////////////////////////////////
+
+static AsyncServer *    server;
+static IPAddress        serverIP;
+
+static benchScenario_t  scenario = BENCH_BULK;
+static benchPhase_t     phase = PHASE_START;
+static bool             measuring = false;
+
+static BenchConn        conns[BENCH_CLIENTS];
+static int              liveClients = 0;
+static int              liveServerConns = 0;
+
+static uint32_t         startMs;
+static uint32_t         startUs;
+static uint32_t         elapsedUs;
+static uint64_t         startCycles;
+static uint64_t         elapsedCycles;
+static uint32_t         drainMs;
+
+static uint64_t         rxBytes;
+static uint64_t         txBytes;
+static uint32_t         messages;
+static uint32_t         connections;
+static uint32_t         errors;
+
+static BenchHistogram   latency;
+
+static char             payload[BENCH_BULK_CHUNK > BENCH_RPC_RESPONSE ? BENCH_BULK_CHUNK : BENCH_RPC_RESPONSE];
+
+/////////////////////////////////////////////////
+
+static void bulkPump(BenchConn *bc)
+{
+  AsyncClient *c = bc->client;
+  bool added = false;
+
+  // payload is static, no need to copy it into lwIP
+  while (measuring && c->space() > 0)
+  {
+    size_t n = c->add(payload, std::min((size_t) BENCH_BULK_CHUNK, c->space()), 0);
+
+    if (n == 0)
+      break;
+
+    txBytes += n;
+    added = true;
+  }
+
+  if (added)
+    c->send();
+}
+
+/////////////////////////////////////////////////
+
+static void sendRequest(BenchConn *bc)
+{
+  size_t size = (scenario == BENCH_ECHO) ? BENCH_ECHO_SIZE : BENCH_RPC_REQUEST;
+
+  bc->expected = (scenario == BENCH_ECHO) ? BENCH_ECHO_SIZE : BENCH_RPC_RESPONSE;
+  bc->received = 0;
+  bc->sentAt = micros();
+
+  if (bc->client->write(payload, size) != size)
+    errors++;
+  else
+    txBytes += size;
+}
+
+/////////////////////////////////////////////////
+
+static void onClientData(void *arg, AsyncClient *c, void *data, size_t len)
+{
+  (void) data;
+
+  BenchConn *bc = (BenchConn *) arg;
+
+  if (scenario == BENCH_CHURN)
+  {
+    c->close();
+    return;
+  }
+
+  bc->received += len;
+
+  if (bc->received < bc->expected)
+    return;
+
+  if (measuring)
+  {
+    latency.record(micros() - bc->sentAt);
+    messages++;
+    rxBytes += bc->received;
+
+    sendRequest(bc);
+  }
+}
+
+/////////////////////////////////////////////////
+
+static void onClientConnect(void *arg, AsyncClient *c)
+{
+  BenchConn *bc = (BenchConn *) arg;
+
+  c->setNoDelay(true);
+
+  switch (scenario)
+  {
+    case BENCH_BULK:
+      bulkPump(bc);
+      break;
+
+    case BENCH_ECHO:
+    case BENCH_RPC:
+      sendRequest(bc);
+      break;
+
+    case BENCH_CHURN:
+      bc->sentAt = micros();
+      c->write(payload, 1);
+      break;
+
+    default:
+      break;
+  }
+}
+
+/////////////////////////////////////////////////
+
+static void onClientDisconnect(void *arg, AsyncClient *c)
+{
+  BenchConn *bc = (BenchConn *) arg;
+
+  if ((scenario == BENCH_CHURN) && measuring)
+  {
+    connections++;
+    latency.record(micros() - bc->sentAt);
+  }
+
+  bc->client = NULL;
+  liveClients--;
+
+  delete c;
+}
+
+/////////////////////////////////////////////////
+
+static bool startClient(BenchConn *bc)
+{
+  AsyncClient *c = new (std::nothrow) AsyncClient();
+
+  if (c == NULL)
+  {
+    errors++;
+    return false;
+  }
+
+  bc->client = c;
+  liveClients++;
+
+  c->onConnect(onClientConnect, bc);
+  c->onData(onClientData, bc);
+  c->onDisconnect(onClientDisconnect, bc);
+  c->onError([](void *arg, AsyncClient * c, err_t error)
+  {
+    (void) arg;
+    (void) c;
+    (void) error;
+
+    errors++;
+  }, bc);
+  c->onAck([](void *arg, AsyncClient * c, size_t len, uint32_t time)
+  {
+    (void) c;
+    (void) len;
+    (void) time;
+
+    if (scenario == BENCH_BULK)
+      bulkPump((BenchConn *) arg);
+  }, bc);
+
+  if (!c->connect(serverIP, BENCH_PORT))
+  {
+    // onDisconnect / onError follow
+    errors++;
+  }
+
+  return true;
+}
+
+/////////////////////////////////////////////////
+
+static void onServerClient(void *arg, AsyncClient *c)
+{
+  (void) arg;
+
+  BenchServerConn *sc = new (std::nothrow) BenchServerConn();
+
+  if (sc == NULL)
+  {
+    c->close(true);
+    return;
+  }
+
+  sc->requestBytes = 0;
+  liveServerConns++;
+
+  c->setNoDelay(true);
+
+  c->onData([](void *arg, AsyncClient * c, void *data, size_t len)
+  {
+    BenchServerConn *sc = (BenchServerConn *) arg;
+
+    switch (scenario)
+    {
+      case BENCH_BULK:
+        if (measuring)
+          rxBytes += len;
+
+        break;
+
+      case BENCH_ECHO:
+      case BENCH_CHURN:
+        if (c->write((const char *) data, len, ASYNC_WRITE_FLAG_COPY) != len)
+          errors++;
+
+        break;
+
+      case BENCH_RPC:
+        sc->requestBytes += len;
+
+        while (sc->requestBytes >= BENCH_RPC_REQUEST)
+        {
+          sc->requestBytes -= BENCH_RPC_REQUEST;
+
+          if (c->write(payload, BENCH_RPC_RESPONSE, 0) != BENCH_RPC_RESPONSE)
+            errors++;
+        }
+
+        break;
+
+      default:
+        break;
+    }
+  }, sc);
+
+  c->onDisconnect([](void *arg, AsyncClient * c)
+  {
+    delete (BenchServerConn *) arg;
+    liveServerConns--;
+
+    delete c;
+  }, sc);
+}
+
+/////////////////////////////////////////////////
+
+static void report()
+{
+  double seconds = elapsedUs / 1e6;
+  uint64_t bytes = rxBytes + txBytes;
+  double mbps = rxBytes / seconds / 1e6;
+  double cyclesPerByte = bytes ? (double) elapsedCycles / bytes : 0;
+
+  Serial.print("# ");
+  Serial.print(scenarioName[scenario]);
+  Serial.print(": ");
+  Serial.print(mbps, 3);
+  Serial.print(" MB/s, ");
+  Serial.print(messages / seconds, 1);
+  Serial.print(" msg/s, ");
+  Serial.print(connections / seconds, 1);
+  Serial.print(" conn/s, p50/p99/p999 = ");
+  Serial.print(latency.percentile(0.5));
+  Serial.print("/");
+  Serial.print(latency.percentile(0.99));
+  Serial.print("/");
+  Serial.print(latency.percentile(0.999));
+  Serial.print(" us, ");
+  Serial.print(cyclesPerByte, 2);
+  Serial.print(" cycles/byte, errors = ");
+  Serial.println(errors);
+
+  Serial.printf("{\"version\":\"%s\",\"board\":\"%s\",\"scenario\":\"%s\",\"clients\":%d,\"duration_us\":%lu,"
+                "\"rx_bytes\":%llu,\"tx_bytes\":%llu,\"mb_per_s\":%.3f,\"messages\":%lu,\"msg_per_s\":%.1f,"
+                "\"connections\":%lu,\"conn_per_s\":%.1f,\"lat_min_us\":%lu,\"lat_p50_us\":%lu,\"lat_p99_us\":%lu,"
+                "\"lat_p999_us\":%lu,\"lat_max_us\":%lu,\"cycles\":%llu,\"cycles_per_byte\":%.2f,\"errors\":%lu,"
+                "\"link_latency_us\":%d,\"link_loss_ppm\":%d,\"link_kbps\":%d}\r\n",
+                TEENSY41_ASYNC_TCP_VERSION, BOARD_NAME, scenarioName[scenario], BENCH_CLIENTS, (unsigned long) elapsedUs,
+                (unsigned long long) rxBytes, (unsigned long long) txBytes, mbps, (unsigned long) messages, messages / seconds,
+                (unsigned long) connections, connections / seconds, (unsigned long) latency.min(),
+                (unsigned long) latency.percentile(0.5), (unsigned long) latency.percentile(0.99),
+                (unsigned long) latency.percentile(0.999), (unsigned long) latency.max(),
+                (unsigned long long) elapsedCycles, cyclesPerByte, (unsigned long) errors,
+                BENCH_LINK_LATENCY_US, BENCH_LINK_LOSS_PPM, BENCH_LINK_KBPS);
+}
+
+/////////////////////////////////////////////////
+
+static void startScenario()
+{
+  rxBytes = txBytes = 0;
+  messages = connections = errors = 0;
+  latency.reset();
+
+  measuring = true;
+  startMs = millis();
+  startUs = micros();
+  startCycles = benchCycles();
+
+  if (scenario != BENCH_CHURN)
+  {
+    for (int i = 0; i < BENCH_CLIENTS; i++)
+      startClient(&conns[i]);
+  }
+}
+
+/////////////////////////////////////////////////
+
+static void stopScenario()
+{
+  elapsedUs = micros() - startUs;
+  elapsedCycles = benchCycles() - startCycles;
+  measuring = false;
+
+  for (int i = 0; i < BENCH_CLIENTS; i++)
+  {
+    if (conns[i].client)
+      conns[i].client->close();
+  }
+
+  drainMs = millis();
+}
+
+/////////////////////////////////////////////////
+
+void setup()
+{
+  Serial.begin(115200);
+
+  while (!Serial && millis() < 5000);
+
+  Serial.print("\nStart AsyncTCP_Bench on ");
+  Serial.println(BOARD_NAME);
+  Serial.println(TEENSY41_ASYNC_TCP_VERSION);
+
+  for (size_t i = 0; i < sizeof(payload); i++)
+    payload[i] = 'a' + (i % 26);
+
+#if defined(TEENSY41_ASYNC_TCP_HOST)
+  host_link_config_t link = { BENCH_LINK_LATENCY_US, BENCH_LINK_LOSS_PPM, BENCH_LINK_KBPS, 1 };
+
+  host_stack_set_link(&link);
+  serverIP = host_stack_ip();
+#else
+  Ethernet.begin();
+
+  if (!Ethernet.waitForLocalIP(10000))
+  {
+    Serial.println("No IP address, stopping");
+
+    while (true)
+      delay(1000);
+  }
+
+  #if defined(BENCH_PEER_IP)
+    serverIP = IPAddress(BENCH_PEER_IP);
+  #else
+    serverIP = Ethernet.localIP();
+  #endif
+#endif
+
+  Serial.print("Server @ ");
+  Serial.println(serverIP);
+
+  server = new AsyncServer(BENCH_PORT);
+  server->onClient(onServerClient, NULL);
+  server->begin();
+}
+
+/////////////////////////////////////////////////
+
+void loop()
+{
+  // Keeps the extended cycle counter from missing a wrap
+  benchCycles();
+
+  switch (phase)
+  {
+    case PHASE_START:
+      startScenario();
+      phase = PHASE_RUN;
+
+      break;
+
+    case PHASE_RUN:
+      if (scenario == BENCH_CHURN)
+      {
+        for (int i = 0; i < BENCH_CLIENTS; i++)
+        {
+          if (conns[i].client == NULL)
+            startClient(&conns[i]);
+        }
+      }
+
+      if (millis() - startMs >= BENCH_DURATION_MS)
+      {
+        stopScenario();
+        phase = PHASE_DRAIN;
+      }
+
+      break;
+
+    case PHASE_DRAIN:
+      if (((liveClients == 0) && (liveServerConns == 0)) || (millis() - drainMs >= BENCH_DRAIN_MS))
+      {
+        report();
+
+        scenario = (benchScenario_t) (scenario + 1);
+        phase = PHASE_START;
+
+        if (scenario == BENCH_DONE)
+        {
+          Serial.println("# done");
+
+#if defined(TEENSY41_ASYNC_TCP_HOST)
+          host_exit(errors ? 1 : 0);
+#else
+
+          while (true)
+            delay(1000);
+
+#endif
+        }
+      }
+
+      break;
+  }
+}
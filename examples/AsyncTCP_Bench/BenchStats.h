@@ -0,0 +1,172 @@
+/****************************************************************************************************************************
+  BenchStats.h
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+  Licensed under GPLv3 license
+ *****************************************************************************************************************************/
+
+// Cycle counter and latency histogram shared by the benchmark scenarios
+
+#pragma once
+
+#ifndef BENCH_STATS_H
+#define BENCH_STATS_H
+
+#include <Arduino.h>
+
+#if defined(TEENSY41_ASYNC_TCP_HOST) && ( defined(__x86_64__) || defined(__i386__) )
+  #include <x86intrin.h>
+#elif defined(TEENSY41_ASYNC_TCP_HOST)
+  #include <time.h>
+#endif
+
+/////////////////////////////////////////////////
+
+// 64 bit CPU cycle count. On Teensy the 32 bit DWT counter wraps every ~7 s
+// at 600 MHz, so this must be called at least that often (loop() does).
+inline uint64_t benchCycles()
+{
+#if defined(TEENSY41_ASYNC_TCP_HOST) && ( defined(__x86_64__) || defined(__i386__) )
+  return __rdtsc();
+#elif defined(TEENSY41_ASYNC_TCP_HOST)
+  // No portable cycle counter, report nanoseconds instead
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#else
+  static uint32_t last = 0;
+  static uint64_t high = 0;
+
+  uint32_t now = ARM_DWT_CYCCNT;
+
+  if (now < last)
+    high += 1ULL << 32;
+
+  last = now;
+
+  return high | now;
+#endif
+}
+
+/////////////////////////////////////////////////
+
+/*
+  Log-linear latency histogram in microseconds: 16 linear sub buckets per
+  power of two, i.e. <= 6.25% relative error, fixed 2 KB, no allocation.
+*/
+class BenchHistogram
+{
+  public:
+    BenchHistogram()
+    {
+      reset();
+    }
+
+    void reset()
+    {
+      memset(_buckets, 0, sizeof(_buckets));
+      _count = 0;
+      _sum = 0;
+      _min = UINT32_MAX;
+      _max = 0;
+    }
+
+    void record(uint32_t us)
+    {
+      _buckets[_index(us)]++;
+      _count++;
+      _sum += us;
+
+      if (us < _min)
+        _min = us;
+
+      if (us > _max)
+        _max = us;
+    }
+
+    uint32_t count() const
+    {
+      return _count;
+    }
+
+    uint32_t min() const
+    {
+      return _count ? _min : 0;
+    }
+
+    uint32_t max() const
+    {
+      return _max;
+    }
+
+    uint32_t mean() const
+    {
+      return _count ? (uint32_t) (_sum / _count) : 0;
+    }
+
+    // Upper bound of the bucket holding the given quantile, 0 < q <= 1
+    uint32_t percentile(double q) const
+    {
+      if (_count == 0)
+        return 0;
+
+      uint64_t rank = (uint64_t) (q * _count + 0.5);
+
+      if (rank == 0)
+        rank = 1;
+
+      uint64_t seen = 0;
+
+      for (uint32_t i = 0; i < BUCKETS; i++)
+      {
+        seen += _buckets[i];
+
+        if (seen >= rank)
+        {
+          uint32_t upper = _upper(i);
+
+          return (upper < _max) ? upper : _max;
+        }
+      }
+
+      return _max;
+    }
+
+  private:
+    static const uint32_t SUB     = 16;
+    static const uint32_t BUCKETS = 32 * SUB;
+
+    uint32_t _buckets[BUCKETS];
+    uint32_t _count;
+    uint64_t _sum;
+    uint32_t _min;
+    uint32_t _max;
+
+    static uint32_t _index(uint32_t v)
+    {
+      if (v < SUB)
+        return v;
+
+      uint32_t msb = 31 - __builtin_clz(v);               // >= 4
+      uint32_t sub = (v >> (msb - 4)) & (SUB - 1);
+
+      return (msb - 3) * SUB + sub;
+    }
+
+    static uint32_t _upper(uint32_t index)
+    {
+      if (index < SUB)
+        return index;
+
+      uint32_t msb = index / SUB + 3;
+      uint32_t sub = index % SUB;
+
+      return ((SUB + sub + 1) << (msb - 4)) - 1;
+    }
+};
+
+#endif    // BENCH_STATS_H
@@ -0,0 +1,975 @@
+/****************************************************************************************************************************
+  AsyncTCP_Soak.ino
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+  Licensed under GPLv3 license
+ *****************************************************************************************************************************/
+
+/*
+  Connection churn soak test. SOAK_PARALLEL peers keep connecting to an
+  AsyncServer, cycling through these patterns:
+
+    normal      request, read the reply, close
+    rst         request a large reply, abort (RST) on the first data
+    half-close  request, then FIN right away, keep reading until the server closes
+    idle        connect and send nothing, the server's RX timeout closes it
+    never-read  request a large reply and never read it (zero window)
+
+  rst and half-close peers are raw lwIP pcbs, the others AsyncClients.
+  Every SOAK_WRAPPER_EVERY connections a SyncClient and an AsyncPrinter
+  round also runs, including their operator= hand over paths.
+
+  Once per SOAK_SAMPLE_MS the sketch records live AsyncClient objects, live
+  server connections, heap in use and its high-water, the largest free heap
+  block (Teensy only) and pbuf pool / TCP pcb usage. At the end the mean of
+  the last third of the samples is compared with the first third (after
+  warm-up), a metric that grew by more than SOAK_TREND_PERCENT (and
+  SOAK_TREND_SLACK_*) fails the run, as do AsyncClients left alive once all
+  connections are gone.
+
+  On Teensy 4.1 the peers connect to the board itself, which needs
+  LWIP_NETIF_LOOPBACK in QNEthernet's lwipopts.h. On the host build:
+
+    LWIP_DIR=~/src/lwip extras/host/build.sh examples/AsyncTCP_Soak/AsyncTCP_Soak.ino
+*/
+
+#if !defined(TEENSY41_ASYNC_TCP_HOST)
+  #if !( defined(CORE_TEENSY) && defined(__IMXRT1062__) && defined(ARDUINO_TEENSY41) )
+    #error Only Teensy 4.1 supported
+  #endif
+
+  #include <QNEthernet.h>
+  using namespace qindesign::network;
+#endif
+
+#define _TEENSY41_ASYNC_TCP_LOGLEVEL_       1
+
+#include "Teensy41_AsyncTCP.h"
+
+#include "SyncClient.hpp"
+#include "SyncClient_Impl.h"
+
+#include "lwip/tcp.h"
+#include "lwip/stats.h"
+
+#include <malloc.h>
+
+/////////////////////////////////////////////////
+
+#ifndef SOAK_PORT
+  #define SOAK_PORT                 5002
+#endif
+
+#ifndef SOAK_PARALLEL
+  #define SOAK_PARALLEL             16
+#endif
+
+// Stop after this many connections ...
+#ifndef SOAK_CONNECTIONS
+  #define SOAK_CONNECTIONS          5000
+#endif
+
+// ... or after this many seconds, 0 => no time limit
+#ifndef SOAK_DURATION_S
+  #define SOAK_DURATION_S           0
+#endif
+
+#ifndef SOAK_SAMPLE_MS
+  #define SOAK_SAMPLE_MS            1000
+#endif
+
+#ifndef SOAK_WARMUP_SAMPLES
+  #define SOAK_WARMUP_SAMPLES       3
+#endif
+
+#ifndef SOAK_MAX_SAMPLES
+  #define SOAK_MAX_SAMPLES          512
+#endif
+
+// Server side policy
+#ifndef SOAK_IDLE_TIMEOUT_S
+  #define SOAK_IDLE_TIMEOUT_S       2
+#endif
+
+#ifndef SOAK_STALL_MS
+  #define SOAK_STALL_MS             1500
+#endif
+
+// A never-read peer goes away after this long
+#ifndef SOAK_NEVER_READ_MS
+  #define SOAK_NEVER_READ_MS        3000
+#endif
+
+// A connection still open after this long is stuck, and fails the run
+#ifndef SOAK_SLOT_TIMEOUT_MS
+  #define SOAK_SLOT_TIMEOUT_MS      15000
+#endif
+
+#ifndef SOAK_SMALL_RESPONSE
+  #define SOAK_SMALL_RESPONSE       64
+#endif
+
+#ifndef SOAK_LARGE_RESPONSE
+  #define SOAK_LARGE_RESPONSE       16384
+#endif
+
+#ifndef SOAK_WRAPPER_EVERY
+  #define SOAK_WRAPPER_EVERY        100
+#endif
+
+// Trend limits, growth must exceed both to fail
+#ifndef SOAK_TREND_PERCENT
+  #define SOAK_TREND_PERCENT        10
+#endif
+
+#ifndef SOAK_TREND_SLACK_BYTES
+  #define SOAK_TREND_SLACK_BYTES    8192
+#endif
+
+#ifndef SOAK_TREND_SLACK_COUNT
+  #define SOAK_TREND_SLACK_COUNT    4
+#endif
+
+// Upper bound of the largest free block probe
+#define SOAK_PROBE_MAX              (512 * 1024)
+
+#define SOAK_DRAIN_MS               (SOAK_SLOT_TIMEOUT_MS + 5000)
+
+/////////////////////////////////////////////////
+
+typedef enum
+{
+  SOAK_NORMAL,
+  SOAK_RST,
+  SOAK_HALF_CLOSE,
+  SOAK_IDLE,
+  SOAK_NEVER_READ,
+  SOAK_PATTERN_MAX
+} soakPattern_t;
+
+static const char * patternName[SOAK_PATTERN_MAX] = { "normal", "rst", "half-close", "idle", "never-read" };
+
+typedef struct
+{
+  bool            busy;
+  bool            closeRequested;
+  soakPattern_t   pattern;
+  uint32_t        startMs;
+  AsyncClient *   client;
+  struct tcp_pcb *pcb;
+  size_t          received;
+} SoakSlot;
+
+typedef struct
+{
+  size_t          pending;
+  uint32_t        lastProgressMs;
+} SoakServerConn;
+
+typedef struct
+{
+  uint32_t        ms;
+  uint32_t        connections;
+  int32_t         liveClients;
+  int32_t         liveServerConns;
+  int32_t         heapUsed;
+  int32_t         heapHighWater;
+  int32_t         largestFree;      // -1 => not available
+  int32_t         pbufUsed;         // -1 => lwIP stats off
+  int32_t         tcpPcbs;
+} SoakSample;
+
+/////////////////////////////////////////////////
+
+static AsyncServer *  server;
+static IPAddress      serverIP;
+
+static SoakSlot       slots[SOAK_PARALLEL];
+static uint32_t       nextPattern = 0;
+
+static uint32_t       started = 0;
+static uint32_t       completed[SOAK_PATTERN_MAX];
+static uint32_t       connectFailures = 0;
+static uint32_t       stuck = 0;
+static uint32_t       stalls = 0;
+static uint32_t       wrapperRounds = 0;
+static uint32_t       wrapperFailures = 0;
+
+static int32_t        liveClients = 0;          // AsyncClient objects, from the allocator below
+static int32_t        liveServerConns = 0;
+static int32_t        heapHighWater = 0;
+
+static SoakSample     samples[SOAK_MAX_SAMPLES];
+static size_t         sampleCount = 0;
+static uint32_t       sampleInterval = SOAK_SAMPLE_MS;
+static uint32_t       lastSampleMs;
+static uint32_t       startMs;
+
+static bool           draining = false;
+static uint32_t       drainStartMs;
+
+static char           payload[TCP_MSS];
+
+/////////////////////////////////////////////////
+// AsyncClient objects are counted through their memory class
+/////////////////////////////////////////////////
+
+static void * countingAlloc(size_t size)
+{
+  void *ptr = malloc(size);
+
+  if (ptr)
+    liveClients++;
+
+  return ptr;
+}
+
+static void countingFree(void *ptr)
+{
+  if (ptr)
+    liveClients--;
+
+  free(ptr);
+}
+
+/////////////////////////////////////////////////
+// Metrics
+/////////////////////////////////////////////////
+
+static int32_t heapUsed()
+{
+#if defined(TEENSY41_ASYNC_TCP_HOST) && defined(__GLIBC__) && ((__GLIBC__ > 2) || (__GLIBC_MINOR__ >= 33))
+  struct mallinfo2 mi = mallinfo2();
+
+  return (int32_t) (mi.uordblks + mi.hblkhd);
+#else
+  struct mallinfo mi = mallinfo();
+
+  return (int32_t) mi.uordblks;
+#endif
+}
+
+static int32_t largestFreeBlock()
+{
+#if defined(TEENSY41_ASYNC_TCP_HOST)
+  // glibc grows the heap on demand, a probe says nothing about fragmentation
+  return -1;
+#else
+  size_t lo = 0;
+  size_t hi = SOAK_PROBE_MAX;
+
+  while (lo < hi)
+  {
+    size_t mid = (lo + hi + 1) / 2;
+    void *ptr = malloc(mid);
+
+    if (ptr)
+    {
+      free(ptr);
+      lo = mid;
+    }
+    else
+    {
+      hi = mid - 1;
+    }
+  }
+
+  return (int32_t) lo;
+#endif
+}
+
+static int32_t mempUsed(int pool)
+{
+#if LWIP_STATS && MEMP_STATS
+  return lwip_stats.memp[pool]->used;
+#else
+  (void) pool;
+
+  return -1;
+#endif
+}
+
+static void takeSample()
+{
+  if (sampleCount == SOAK_MAX_SAMPLES)
+  {
+    // Keep every other sample and halve the rate, so any run length fits
+    for (size_t i = 0; i < SOAK_MAX_SAMPLES / 2; i++)
+      samples[i] = samples[2 * i + 1];
+
+    sampleCount = SOAK_MAX_SAMPLES / 2;
+    sampleInterval *= 2;
+  }
+
+  SoakSample &s = samples[sampleCount++];
+
+  s.ms = millis() - startMs;
+  s.connections = started;
+  s.liveClients = liveClients;
+  s.liveServerConns = liveServerConns;
+  s.heapUsed = heapUsed();
+  heapHighWater = std::max(heapHighWater, s.heapUsed);
+  s.heapHighWater = heapHighWater;
+  s.largestFree = largestFreeBlock();
+  s.pbufUsed = mempUsed(MEMP_PBUF_POOL);
+  s.tcpPcbs = mempUsed(MEMP_TCP_PCB);
+
+  Serial.printf("# t=%lus conns=%lu clients=%ld server=%ld heap=%ld hw=%ld largest=%ld pbuf=%ld pcbs=%ld\r\n",
+                (unsigned long) (s.ms / 1000), (unsigned long) s.connections, (long) s.liveClients,
+                (long) s.liveServerConns, (long) s.heapUsed, (long) s.heapHighWater, (long) s.largestFree,
+                (long) s.pbufUsed, (long) s.tcpPcbs);
+}
+
+/////////////////////////////////////////////////
+// Server under test
+/////////////////////////////////////////////////
+
+static void serverPump(SoakServerConn *sc, AsyncClient *c)
+{
+  bool added = false;
+
+  while ((sc->pending > 0) && (c->space() > 0))
+  {
+    size_t n = std::min(std::min(sc->pending, c->space()), sizeof(payload));
+
+    // payload is static, no need to copy it into lwIP
+    if (c->add(payload, n, 0) == 0)
+      break;
+
+    sc->pending -= n;
+    added = true;
+  }
+
+  if (added)
+    c->send();
+}
+
+static void onServerClient(void *arg, AsyncClient *c)
+{
+  (void) arg;
+
+  SoakServerConn *sc = new (std::nothrow) SoakServerConn();
+
+  if (sc == NULL)
+  {
+    c->close(true);
+    return;
+  }
+
+  sc->pending = 0;
+  sc->lastProgressMs = millis();
+  liveServerConns++;
+
+  c->setNoDelay(true);
+  c->setRxTimeout(SOAK_IDLE_TIMEOUT_S);
+
+  c->onData([](void *arg, AsyncClient * c, void *data, size_t len)
+  {
+    SoakServerConn *sc = (SoakServerConn *) arg;
+
+    for (size_t i = 0; i < len; i++)
+      sc->pending += (((char *) data)[i] == 'L') ? SOAK_LARGE_RESPONSE : SOAK_SMALL_RESPONSE;
+
+    sc->lastProgressMs = millis();
+    serverPump(sc, c);
+  }, sc);
+
+  c->onAck([](void *arg, AsyncClient * c, size_t len, uint32_t time)
+  {
+    (void) len;
+    (void) time;
+
+    SoakServerConn *sc = (SoakServerConn *) arg;
+
+    sc->lastProgressMs = millis();
+    serverPump(sc, c);
+  }, sc);
+
+  c->onPoll([](void *arg, AsyncClient * c)
+  {
+    SoakServerConn *sc = (SoakServerConn *) arg;
+
+    if ((sc->pending > 0) && (millis() - sc->lastProgressMs >= SOAK_STALL_MS))
+    {
+      // Peer stopped reading, give up on it
+      stalls++;
+      sc->pending = 0;
+      c->close();
+
+      return;
+    }
+
+    serverPump(sc, c);
+  }, sc);
+
+  c->onDisconnect([](void *arg, AsyncClient * c)
+  {
+    delete (SoakServerConn *) arg;
+    liveServerConns--;
+
+    delete c;
+  }, sc);
+}
+
+/////////////////////////////////////////////////
+// Peers
+/////////////////////////////////////////////////
+
+static void slotDone(SoakSlot *slot)
+{
+  if (!slot->busy)
+    return;
+
+  completed[slot->pattern]++;
+  slot->busy = false;
+  slot->client = NULL;
+  slot->pcb = NULL;
+}
+
+static void rawDetach(struct tcp_pcb *pcb)
+{
+  tcp_arg(pcb, NULL);
+  tcp_recv(pcb, NULL);
+  tcp_err(pcb, NULL);
+}
+
+static err_t rawRecv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+  (void) err;
+
+  SoakSlot *slot = (SoakSlot *) arg;
+
+  if (p == NULL)
+  {
+    // Server closed, half-close peer is done
+    rawDetach(pcb);
+    slotDone(slot);
+
+    if (tcp_close(pcb) != ERR_OK)
+    {
+      tcp_abort(pcb);
+
+      return ERR_ABRT;
+    }
+
+    return ERR_OK;
+  }
+
+  slot->received += p->tot_len;
+  tcp_recved(pcb, p->tot_len);
+  pbuf_free(p);
+
+  if (slot->pattern == SOAK_RST)
+  {
+    rawDetach(pcb);
+    slotDone(slot);
+    tcp_abort(pcb);
+
+    return ERR_ABRT;
+  }
+
+  return ERR_OK;
+}
+
+static void rawErr(void *arg, err_t err)
+{
+  (void) err;
+
+  // pcb is already gone
+  slotDone((SoakSlot *) arg);
+}
+
+static err_t rawConnected(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+  (void) err;
+
+  SoakSlot *slot = (SoakSlot *) arg;
+  char request = (slot->pattern == SOAK_RST) ? 'L' : 'S';
+
+  tcp_write(pcb, &request, 1, TCP_WRITE_FLAG_COPY);
+
+  if (slot->pattern == SOAK_HALF_CLOSE)
+    tcp_shutdown(pcb, 0, 1);
+  else
+    tcp_output(pcb);
+
+  return ERR_OK;
+}
+
+static bool startRawPeer(SoakSlot *slot)
+{
+  struct tcp_pcb *pcb = tcp_new();
+
+  if (pcb == NULL)
+    return false;
+
+  ip_addr_t addr;
+
+  addr.addr = serverIP;
+
+  tcp_arg(pcb, slot);
+  tcp_recv(pcb, rawRecv);
+  tcp_err(pcb, rawErr);
+
+  if (tcp_connect(pcb, &addr, SOAK_PORT, rawConnected) != ERR_OK)
+  {
+    rawDetach(pcb);
+    tcp_abort(pcb);
+
+    return false;
+  }
+
+  slot->pcb = pcb;
+
+  return true;
+}
+
+static bool startClientPeer(SoakSlot *slot)
+{
+  AsyncClient *c = new (std::nothrow) AsyncClient();
+
+  if (c == NULL)
+    return false;
+
+  c->onConnect([](void *arg, AsyncClient * c)
+  {
+    SoakSlot *slot = (SoakSlot *) arg;
+
+    if (slot->pattern == SOAK_NORMAL)
+      c->write("S", 1, ASYNC_WRITE_FLAG_COPY);
+    else if (slot->pattern == SOAK_NEVER_READ)
+      c->write("L", 1, ASYNC_WRITE_FLAG_COPY);
+  }, slot);
+
+  c->onData([](void *arg, AsyncClient * c, void *data, size_t len)
+  {
+    (void) data;
+
+    SoakSlot *slot = (SoakSlot *) arg;
+
+    if (slot->pattern == SOAK_NEVER_READ)
+    {
+      // Keeps the window closed
+      c->ackLater();
+
+      return;
+    }
+
+    slot->received += len;
+
+    // Closed from loop(), not from inside the callback
+    if (slot->received >= SOAK_SMALL_RESPONSE)
+      slot->closeRequested = true;
+  }, slot);
+
+  c->onDisconnect([](void *arg, AsyncClient * c)
+  {
+    slotDone((SoakSlot *) arg);
+
+    delete c;
+  }, slot);
+
+  slot->client = c;
+
+  if (!c->connect(serverIP, SOAK_PORT))
+  {
+    slot->client = NULL;
+    delete c;
+
+    return false;
+  }
+
+  return true;
+}
+
+static void startSlot(SoakSlot *slot)
+{
+  slot->busy = true;
+  slot->closeRequested = false;
+  slot->pattern = (soakPattern_t) (nextPattern++ % SOAK_PATTERN_MAX);
+  slot->startMs = millis();
+  slot->client = NULL;
+  slot->pcb = NULL;
+  slot->received = 0;
+
+  started++;
+
+  bool ok;
+
+  if ((slot->pattern == SOAK_RST) || (slot->pattern == SOAK_HALF_CLOSE))
+    ok = startRawPeer(slot);
+  else
+    ok = startClientPeer(slot);
+
+  if (!ok)
+  {
+    connectFailures++;
+    slot->busy = false;
+  }
+}
+
+static void checkSlot(SoakSlot *slot)
+{
+  uint32_t age = millis() - slot->startMs;
+
+  if (slot->client && slot->closeRequested)
+  {
+    slot->closeRequested = false;
+    slot->client->close(true);
+
+    return;
+  }
+
+  if (slot->client && (slot->pattern == SOAK_NEVER_READ) && (age >= SOAK_NEVER_READ_MS))
+  {
+    slot->client->close(true);
+
+    return;
+  }
+
+  if (age >= SOAK_SLOT_TIMEOUT_MS)
+  {
+    stuck++;
+
+    Serial.printf("# stuck %s connection, %lu bytes received\r\n", patternName[slot->pattern],
+                  (unsigned long) slot->received);
+
+    if (slot->client)
+    {
+      slot->client->close(true);
+    }
+    else if (slot->pcb)
+    {
+      struct tcp_pcb *pcb = slot->pcb;
+
+      rawDetach(pcb);
+      slotDone(slot);
+      tcp_abort(pcb);
+    }
+    else
+    {
+      slotDone(slot);
+    }
+  }
+}
+
+/////////////////////////////////////////////////
+// SyncClient / AsyncPrinter round, blocking
+/////////////////////////////////////////////////
+
+static bool waitFor(bool (*done)(void *), void *arg, uint32_t timeoutMs)
+{
+  uint32_t start = millis();
+
+  while (!done(arg))
+  {
+    if (millis() - start >= timeoutMs)
+      return false;
+
+    delay(1);
+  }
+
+  return true;
+}
+
+static void wrapperRound()
+{
+  bool ok = true;
+
+  wrapperRounds++;
+
+  {
+    SyncClient owner;
+
+    {
+      // Connection handed out of a scope through operator=
+      SyncClient sync;
+
+      // connect(IPAddress, port) is ambiguous when CONST is empty
+      if (sync._connect(serverIP, SOAK_PORT))
+        owner = sync;
+      else
+        ok = false;
+    }
+
+    if (owner.connected())
+    {
+      owner.write((uint8_t) 'S');
+
+      ok = waitFor([](void *arg)
+      {
+        return ((SyncClient *) arg)->available() >= SOAK_SMALL_RESPONSE;
+      }, &owner, 2000) && ok;
+
+      while (owner.available() > 0)
+        owner.read();
+
+      owner.stop();
+
+      // Same object, second connection
+      if (owner._connect(serverIP, SOAK_PORT))
+        owner.stop();
+      else
+        ok = false;
+    }
+  }
+
+  {
+    AsyncPrinter printer;
+    size_t received = 0;
+
+    if (printer.connect(serverIP, SOAK_PORT))
+    {
+      AsyncPrinter other;
+
+      // Takes the client over from printer
+      other = printer;
+
+      other.onData([](void *arg, AsyncPrinter * p, uint8_t *data, size_t len)
+      {
+        (void) p;
+        (void) data;
+
+        *(size_t *) arg += len;
+      }, &received);
+
+      other.write((uint8_t) 'S');
+
+      ok = waitFor([](void *arg)
+      {
+        return *(size_t *) arg >= SOAK_SMALL_RESPONSE;
+      }, &received, 2000) && ok;
+
+      other.close();
+    }
+    else
+    {
+      ok = false;
+    }
+  }
+
+  if (!ok)
+    wrapperFailures++;
+}
+
+/////////////////////////////////////////////////
+// Verdict
+/////////////////////////////////////////////////
+
+typedef int32_t (*SoakMetric)(const SoakSample &s);
+
+static bool checkTrend(const char *name, SoakMetric metric, int32_t slack, bool downIsBad)
+{
+  size_t first = std::min((size_t) SOAK_WARMUP_SAMPLES, sampleCount);
+  size_t n = (sampleCount - first) / 3;
+
+  if (n == 0)
+  {
+    Serial.printf("# %s: not enough samples\r\n", name);
+
+    return true;
+  }
+
+  double head = 0;
+  double tail = 0;
+
+  for (size_t i = 0; i < n; i++)
+  {
+    head += metric(samples[first + i]);
+    tail += metric(samples[sampleCount - n + i]);
+  }
+
+  head /= n;
+  tail /= n;
+
+  if (head < 0)
+  {
+    // Not available on this build
+    return true;
+  }
+
+  double growth = downIsBad ? (head - tail) : (tail - head);
+  double limit = std::max((double) slack, head * SOAK_TREND_PERCENT / 100.0);
+  bool ok = growth <= limit;
+
+  Serial.printf("# %-16s first %.1f, last %.1f%s\r\n", name, head, tail, ok ? "" : "  <== TREND");
+
+  return ok;
+}
+
+static bool finish()
+{
+  bool ok = true;
+
+  ok &= checkTrend("live clients", [](const SoakSample & s)
+  {
+    return s.liveClients;
+  }, SOAK_TREND_SLACK_COUNT, false);
+
+  ok &= checkTrend("server conns", [](const SoakSample & s)
+  {
+    return s.liveServerConns;
+  }, SOAK_TREND_SLACK_COUNT, false);
+
+  ok &= checkTrend("heap used", [](const SoakSample & s)
+  {
+    return s.heapUsed;
+  }, SOAK_TREND_SLACK_BYTES, false);
+
+  ok &= checkTrend("heap high-water", [](const SoakSample & s)
+  {
+    return s.heapHighWater;
+  }, SOAK_TREND_SLACK_BYTES, false);
+
+  ok &= checkTrend("largest free", [](const SoakSample & s)
+  {
+    return s.largestFree;
+  }, SOAK_TREND_SLACK_BYTES, true);
+
+  ok &= checkTrend("pbuf pool", [](const SoakSample & s)
+  {
+    return s.pbufUsed;
+  }, SOAK_TREND_SLACK_COUNT, false);
+
+  // Everything is closed now, nothing may be left behind
+  if ((liveClients != 0) || (liveServerConns != 0))
+  {
+    Serial.printf("# leaked: %ld AsyncClient objects, %ld server connections\r\n", (long) liveClients,
+                  (long) liveServerConns);
+    ok = false;
+  }
+
+  if (stuck || wrapperFailures)
+    ok = false;
+
+  const SoakSample &last = samples[sampleCount - 1];
+
+  Serial.print("# ");
+
+  for (int i = 0; i < SOAK_PATTERN_MAX; i++)
+    Serial.printf("%s=%lu ", patternName[i], (unsigned long) completed[i]);
+
+  Serial.printf("wrapper=%lu\r\n", (unsigned long) wrapperRounds);
+
+  Serial.printf("{\"version\":\"%s\",\"board\":\"%s\",\"result\":\"%s\",\"duration_ms\":%lu,\"connections\":%lu,"
+                "\"connect_failures\":%lu,\"stuck\":%lu,\"stalls\":%lu,\"wrapper_rounds\":%lu,\"wrapper_failures\":%lu,"
+                "\"live_clients\":%ld,\"live_server_conns\":%ld,\"heap_used\":%ld,\"heap_high_water\":%ld,"
+                "\"largest_free\":%ld,\"pbuf_used\":%ld,\"tcp_pcbs\":%ld}\r\n",
+                TEENSY41_ASYNC_TCP_VERSION, BOARD_NAME, ok ? "pass" : "fail", (unsigned long) last.ms,
+                (unsigned long) started, (unsigned long) connectFailures, (unsigned long) stuck, (unsigned long) stalls,
+                (unsigned long) wrapperRounds, (unsigned long) wrapperFailures, (long) liveClients,
+                (long) liveServerConns, (long) last.heapUsed, (long) heapHighWater, (long) last.largestFree,
+                (long) last.pbufUsed, (long) last.tcpPcbs);
+
+  return ok;
+}
+
+/////////////////////////////////////////////////
+
+void setup()
+{
+  Serial.begin(115200);
+
+  while (!Serial && millis() < 5000);
+
+  Serial.print("\nStart AsyncTCP_Soak on ");
+  Serial.println(BOARD_NAME);
+  Serial.println(TEENSY41_ASYNC_TCP_VERSION);
+
+  for (size_t i = 0; i < sizeof(payload); i++)
+    payload[i] = 'a' + (i % 26);
+
+  // AsyncClient objects go through the counting allocator
+  AsyncTCPMemory::setRegionAllocator(ATCP_MEM_USER, countingAlloc, countingFree);
+  AsyncTCPMemory::setRegion(ATCP_MEM_CLIENT, ATCP_MEM_USER);
+
+#if defined(TEENSY41_ASYNC_TCP_HOST)
+  serverIP = host_stack_ip();
+#else
+  Ethernet.begin();
+
+  if (!Ethernet.waitForLocalIP(10000))
+  {
+    Serial.println("No IP address, stopping");
+
+    while (true)
+      delay(1000);
+  }
+
+  serverIP = Ethernet.localIP();
+#endif
+
+  server = new AsyncServer(SOAK_PORT);
+  server->onClient(onServerClient, NULL);
+  server->begin();
+
+  startMs = millis();
+  lastSampleMs = startMs;
+  takeSample();
+}
+
+/////////////////////////////////////////////////
+
+void loop()
+{
+  // Handlers run from here with ASYNC_TCP_DEFERRED_EVENTS, no-op otherwise
+  AsyncTCPEvents::drain();
+
+  uint32_t now = millis();
+  bool busy = false;
+
+  for (int i = 0; i < SOAK_PARALLEL; i++)
+  {
+    if (slots[i].busy)
+    {
+      checkSlot(&slots[i]);
+      busy |= slots[i].busy;
+    }
+    else if (!draining)
+    {
+      startSlot(&slots[i]);
+      busy = true;
+
+      if ((started % SOAK_WRAPPER_EVERY) == 0)
+        wrapperRound();
+    }
+  }
+
+  if (now - lastSampleMs >= sampleInterval)
+  {
+    lastSampleMs = now;
+    takeSample();
+  }
+
+  if (!draining)
+  {
+    if ((started >= SOAK_CONNECTIONS) || (SOAK_DURATION_S && (now - startMs >= SOAK_DURATION_S * 1000UL)))
+    {
+      draining = true;
+      drainStartMs = now;
+    }
+
+    return;
+  }
+
+  // Let the server side finish too
+  if ((busy || (liveServerConns > 0)) && (now - drainStartMs < SOAK_DRAIN_MS))
+    return;
+
+  takeSample();
+
+  bool ok = finish();
+
+  Serial.println(ok ? "# PASS" : "# FAIL");
+
+#if defined(TEENSY41_ASYNC_TCP_HOST)
+  host_exit(ok ? 0 : 1);
+#else
+
+  while (true)
+    delay(1000);
+
+#endif
+}
@@ -0,0 +1,1163 @@
+/****************************************************************************************************************************
+  AsyncTCP_MicroBench.cpp
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+/*
+  Microbenchmarks of the byte moving paths: cbuf, the terminator scans and
+  the AsyncPrinter / SyncClient / AsyncTCPbuffer wrappers. Built with
+
+    HOST_NO_MAIN=1 LWIP_DIR=~/src/lwip extras/host/build.sh \
+      extras/host/bench/AsyncTCP_MicroBench.cpp
+
+  and run as ./AsyncTCP_MicroBench [name filter]. Every benchmark repeats
+  its loop until it has run for at least MICROBENCH_MIN_TIME_MS and reports
+  ns per iteration, ns per byte and allocations per iteration. malloc()
+  calls are counted on glibc without ASan, library buffers always through
+  AsyncTCPMemory. One JSON line per benchmark follows the table.
+
+  The wrapper benchmarks need a connected AsyncClient. Its peer is a raw
+  lwIP pcb in the same process on the host netif, which either discards
+  what it gets or streams a fixed pattern, so everything measured above
+  tcp_write() / tcp_recv() is library code. The client rows are the bare
+  AsyncClient on the same peer, the difference is the wrapper cost.
+*/
+
+#include "Teensy41_AsyncTCP.h"
+
+#include "SyncClient.hpp"
+#include "SyncClient_Impl.h"
+
+#include "Teensy41_AsyncTCP_Buffer.hpp"
+#include "Teensy41_AsyncTCP_Buffer_Impl.h"
+
+#include "lwip/tcp.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include <vector>
+
+/////////////////////////////////////////////////
+
+#ifndef MICROBENCH_MIN_TIME_MS
+  #define MICROBENCH_MIN_TIME_MS    200
+#endif
+
+#define MICROBENCH_SINK_PORT        7001
+#define MICROBENCH_SOURCE_PORT      7002
+
+// Line length of the streamed pattern
+#define MICROBENCH_LINE             64
+
+/////////////////////////////////////////////////
+
+#if defined(__has_feature)
+  #if __has_feature(address_sanitizer)
+    #define MICROBENCH_ASAN         1
+  #endif
+#endif
+
+#if defined(__SANITIZE_ADDRESS__)
+  #define MICROBENCH_ASAN           1
+#endif
+
+#if defined(__GLIBC__) && !defined(MICROBENCH_ASAN)
+
+#define MICROBENCH_COUNT_MALLOC     1
+
+static uint64_t mallocCount = 0;
+
+extern "C"
+{
+  void * __libc_malloc(size_t size);
+  void * __libc_calloc(size_t count, size_t size);
+  void * __libc_realloc(void *ptr, size_t size);
+  void   __libc_free(void *ptr);
+
+  void * malloc(size_t size) __THROW
+  {
+    mallocCount++;
+    return __libc_malloc(size);
+  }
+
+  void * calloc(size_t count, size_t size) __THROW
+  {
+    mallocCount++;
+    return __libc_calloc(count, size);
+  }
+
+  void * realloc(void *ptr, size_t size) __THROW
+  {
+    mallocCount++;
+    return __libc_realloc(ptr, size);
+  }
+
+  void free(void *ptr) __THROW
+  {
+    __libc_free(ptr);
+  }
+}
+
+#else
+
+#define MICROBENCH_COUNT_MALLOC     0
+
+#endif
+
+/////////////////////////////////////////////////
+
+template <class T> inline void benchKeep(const T &value)
+{
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+static uint64_t nowNs()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t libAllocs()
+{
+  uint64_t n = 0;
+
+  for (int r = 0; r < ATCP_MEM_REGION_MAX; r++)
+    n += AsyncTCPMemory::stats((atcpMemRegion_t) r).allocs;
+
+  return n;
+}
+
+/////////////////////////////////////////////////
+
+// while (state.keepRunning()) { one iteration }
+class MicroBenchState
+{
+  public:
+    MicroBenchState(uint64_t iterations) : bytesPerIteration(0), _left(iterations), _started(false),
+      _startNs(0), _elapsedNs(0), _startMallocs(0), _mallocs(0), _startLibAllocs(0), _libAllocs(0), _error(NULL) {}
+
+    inline bool keepRunning()
+    {
+      if (_left > 0)
+      {
+        if (!_started)
+          _start();
+
+        _left--;
+
+        return true;
+      }
+
+      _stop();
+
+      return false;
+    }
+
+    // Ends the benchmark early, it is reported as failed
+    void fail(const char *why)
+    {
+      _error = why;
+      _left = 0;
+    }
+
+    size_t bytesPerIteration;
+
+    uint64_t elapsedNs() const
+    {
+      return _elapsedNs;
+    }
+
+    uint64_t mallocs() const
+    {
+      return _mallocs;
+    }
+
+    uint64_t libAllocs() const
+    {
+      return _libAllocs;
+    }
+
+    const char * error() const
+    {
+      return _error;
+    }
+
+  private:
+    void _start()
+    {
+      _started = true;
+
+#if MICROBENCH_COUNT_MALLOC
+      _startMallocs = mallocCount;
+#endif
+      _startLibAllocs = ::libAllocs();
+      _startNs = nowNs();
+    }
+
+    void _stop()
+    {
+      uint64_t now = nowNs();
+
+      if (!_started)
+        return;
+
+      _elapsedNs = now - _startNs;
+#if MICROBENCH_COUNT_MALLOC
+      _mallocs = mallocCount - _startMallocs;
+#endif
+      _libAllocs = ::libAllocs() - _startLibAllocs;
+      _started = false;
+    }
+
+    uint64_t      _left;
+    bool          _started;
+    uint64_t      _startNs;
+    uint64_t      _elapsedNs;
+    uint64_t      _startMallocs;
+    uint64_t      _mallocs;
+    uint64_t      _startLibAllocs;
+    uint64_t      _libAllocs;
+    const char *  _error;
+};
+
+typedef void (*MicroBenchFn)(MicroBenchState &state);
+
+typedef struct
+{
+  const char *  name;
+  MicroBenchFn  fn;
+} MicroBench;
+
+/////////////////////////////////////////////////
+
+static char benchData[16384];
+static char lineData[16384];      // '\n' every MICROBENCH_LINE bytes
+static char scanData[4096];       // no terminator at all
+
+static void fillPatterns()
+{
+  for (size_t i = 0; i < sizeof(benchData); i++)
+  {
+    benchData[i] = 'a' + (i % 26);
+    lineData[i] = ((i % MICROBENCH_LINE) == (MICROBENCH_LINE - 1)) ? '\n' : benchData[i];
+  }
+
+  memset(scanData, 'x', sizeof(scanData));
+}
+
+/////////////////////////////////////////////////
+// cbuf
+/////////////////////////////////////////////////
+
+static void cbuf_byte_write_read(MicroBenchState &state)
+{
+  cbuf buf(4096);
+
+  state.bytesPerIteration = 1024;
+
+  while (state.keepRunning())
+  {
+    for (int i = 0; i < 1024; i++)
+      buf.write((char) i);
+
+    int sum = 0;
+
+    for (int i = 0; i < 1024; i++)
+      sum += buf.read();
+
+    benchKeep(sum);
+  }
+}
+
+static void cbuf_byte_peek_remove(MicroBenchState &state)
+{
+  cbuf buf(4096);
+
+  state.bytesPerIteration = 1024;
+
+  while (state.keepRunning())
+  {
+    buf.write(benchData, 1024);
+
+    int sum = 0;
+
+    for (int i = 0; i < 1024; i++)
+    {
+      sum += buf.peek();
+      buf.remove(1);
+    }
+
+    benchKeep(sum);
+  }
+}
+
+template <size_t CHUNK> static void cbuf_bulk_write_read(MicroBenchState &state)
+{
+  // Large enough that the indices rarely wrap
+  cbuf buf(sizeof(benchData) + 1);
+  static char out[CHUNK];
+
+  state.bytesPerIteration = CHUNK;
+
+  while (state.keepRunning())
+  {
+    buf.write(benchData, CHUNK);
+    buf.read(out, CHUNK);
+    benchKeep(out[0]);
+  }
+}
+
+template <size_t CHUNK> static void cbuf_bulk_peek_remove(MicroBenchState &state)
+{
+  cbuf buf(sizeof(benchData) + 1);
+  static char out[CHUNK];
+
+  state.bytesPerIteration = CHUNK;
+
+  while (state.keepRunning())
+  {
+    buf.write(benchData, CHUNK);
+    buf.peek(out, CHUNK);
+    buf.remove(CHUNK);
+    benchKeep(out[0]);
+  }
+}
+
+template <size_t CHUNK> static void cbuf_wrap_write_read(MicroBenchState &state)
+{
+  // 1.5 chunks of storage, nearly every write and read is split in two
+  cbuf buf(CHUNK + CHUNK / 2 + 1);
+  static char out[CHUNK];
+
+  state.bytesPerIteration = CHUNK;
+
+  while (state.keepRunning())
+  {
+    buf.write(benchData, CHUNK);
+    buf.read(out, CHUNK);
+    benchKeep(out[0]);
+  }
+}
+
+template <size_t CHUNK> static void cbuf_spans_write_read(MicroBenchState &state)
+{
+  cbuf buf(CHUNK + CHUNK / 2 + 1);
+  static char out[CHUNK];
+
+  state.bytesPerIteration = CHUNK;
+
+  while (state.keepRunning())
+  {
+    char *w1, *w2;
+    size_t wl1, wl2;
+
+    buf.writeSpans(&w1, &wl1, &w2, &wl2);
+    wl1 = std::min(wl1, CHUNK);
+    memcpy(w1, benchData, wl1);
+    memcpy(w2, benchData + wl1, CHUNK - wl1);
+    buf.commitWrite(CHUNK);
+
+    const char *r1, *r2;
+    size_t rl1, rl2;
+
+    buf.readSpans(&r1, &rl1, &r2, &rl2);
+    memcpy(out, r1, rl1);
+    memcpy(out + rl1, r2, CHUNK - rl1);
+    buf.commitRead(CHUNK);
+
+    benchKeep(out[0]);
+  }
+}
+
+static void cbuf_resize(MicroBenchState &state)
+{
+  // 64 => 8192 bytes by doubling, with some data to carry over
+  while (state.keepRunning())
+  {
+    cbuf buf(64);
+
+    buf.write(benchData, 48);
+
+    for (size_t size = 128; size <= 8192; size *= 2)
+      buf.resize(size);
+
+    benchKeep(buf.available());
+  }
+}
+
+static void cbuf_resizeAdd(MicroBenchState &state)
+{
+  // TX buffer growing by one MSS whenever it fills up
+  state.bytesPerIteration = 8 * TCP_MSS;
+
+  while (state.keepRunning())
+  {
+    cbuf buf(TCP_MSS + 1);
+
+    for (int i = 0; i < 8; i++)
+    {
+      buf.write(benchData, TCP_MSS);
+      buf.resizeAdd(TCP_MSS);
+    }
+
+    benchKeep(buf.available());
+  }
+}
+
+/////////////////////////////////////////////////
+
+static cbuf_pow2<16384> pow2Buf;
+
+static void cbuf_pow2_byte_write_read(MicroBenchState &state)
+{
+  state.bytesPerIteration = 1024;
+
+  while (state.keepRunning())
+  {
+    for (int i = 0; i < 1024; i++)
+      pow2Buf.write((char) i);
+
+    int sum = 0;
+
+    for (int i = 0; i < 1024; i++)
+      sum += pow2Buf.read();
+
+    benchKeep(sum);
+  }
+}
+
+template <size_t CHUNK> static void cbuf_pow2_bulk_write_read(MicroBenchState &state)
+{
+  static char out[CHUNK];
+
+  state.bytesPerIteration = CHUNK;
+
+  while (state.keepRunning())
+  {
+    pow2Buf.write(benchData, CHUNK);
+    pow2Buf.read(out, CHUNK);
+    benchKeep(out[0]);
+  }
+}
+
+/////////////////////////////////////////////////
+// Terminator scans, 4 KB without a match
+/////////////////////////////////////////////////
+
+static void scan_bytewise(MicroBenchState &state)
+{
+  state.bytesPerIteration = sizeof(scanData);
+
+  while (state.keepRunning())
+  {
+    size_t i = 0;
+
+    while ((i < sizeof(scanData)) && (scanData[i] != '\n') && (scanData[i] != 0))
+      i++;
+
+    benchKeep(i);
+  }
+}
+
+static void scan_memchr(MicroBenchState &state)
+{
+  state.bytesPerIteration = sizeof(scanData);
+
+  while (state.keepRunning())
+  {
+    benchKeep(memchr(scanData, '\n', sizeof(scanData)));
+  }
+}
+
+static void scan_find_terminator(MicroBenchState &state)
+{
+  state.bytesPerIteration = sizeof(scanData);
+
+  while (state.keepRunning())
+  {
+    benchKeep(atcp_find_terminator(scanData, sizeof(scanData), '\n'));
+  }
+}
+
+static void scan_delimiter_crlfcrlf(MicroBenchState &state)
+{
+  AsyncTCPDelimiter delimiter;
+
+  delimiter.set("\r\n\r\n");
+  state.bytesPerIteration = sizeof(scanData);
+
+  while (state.keepRunning())
+  {
+    bool found;
+
+    benchKeep(delimiter.feed(scanData, sizeof(scanData), &found));
+  }
+}
+
+/////////////////////////////////////////////////
+// Raw lwIP peer for the wrapper benchmarks
+/////////////////////////////////////////////////
+
+static struct tcp_pcb * sinkListen;
+static struct tcp_pcb * sourceListen;
+static struct tcp_pcb * sourcePcb;
+static size_t           sourceOffset;
+
+static err_t peerRecv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+  (void) arg;
+  (void) err;
+
+  if (p == NULL)
+  {
+    if (pcb == sourcePcb)
+      sourcePcb = NULL;
+
+    tcp_arg(pcb, NULL);
+    tcp_sent(pcb, NULL);
+    tcp_recv(pcb, NULL);
+    tcp_err(pcb, NULL);
+    tcp_close(pcb);
+
+    return ERR_OK;
+  }
+
+  tcp_recved(pcb, p->tot_len);
+  pbuf_free(p);
+
+  return ERR_OK;
+}
+
+static void peerErr(void *arg, err_t err)
+{
+  (void) err;
+
+  if (arg)
+    sourcePcb = NULL;
+}
+
+// Streams lineData forever, from ROM style memory without copying
+static void sourceFill()
+{
+  struct tcp_pcb *pcb = sourcePcb;
+
+  if (pcb == NULL)
+    return;
+
+  bool queued = false;
+
+  while (tcp_sndbuf(pcb) > 0)
+  {
+    size_t len = std::min((size_t) tcp_sndbuf(pcb), std::min((size_t) TCP_MSS, sizeof(lineData) - sourceOffset));
+
+    if (tcp_write(pcb, lineData + sourceOffset, len, 0) != ERR_OK)
+      break;
+
+    sourceOffset = (sourceOffset + len) % sizeof(lineData);
+    queued = true;
+  }
+
+  if (queued)
+    tcp_output(pcb);
+}
+
+static err_t sourceSent(void *arg, struct tcp_pcb *pcb, u16_t len)
+{
+  (void) arg;
+  (void) pcb;
+  (void) len;
+
+  sourceFill();
+
+  return ERR_OK;
+}
+
+static err_t peerAccept(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+  if ((err != ERR_OK) || (pcb == NULL))
+    return ERR_VAL;
+
+  tcp_recv(pcb, peerRecv);
+
+  if (arg)
+  {
+    // Source side
+    sourcePcb = pcb;
+    sourceOffset = 0;
+
+    tcp_arg(pcb, pcb);
+    tcp_err(pcb, peerErr);
+    tcp_sent(pcb, sourceSent);
+    sourceFill();
+  }
+
+  return ERR_OK;
+}
+
+static struct tcp_pcb * peerListen(uint16_t port, bool source)
+{
+  struct tcp_pcb *pcb = tcp_new();
+
+  if ((pcb == NULL) || (tcp_bind(pcb, IP_ADDR_ANY, port) != ERR_OK))
+    return NULL;
+
+  pcb = tcp_listen(pcb);
+
+  // Any non NULL arg marks the source listener
+  tcp_arg(pcb, source ? pcb : NULL);
+  tcp_accept(pcb, peerAccept);
+
+  return pcb;
+}
+
+static void settle(uint32_t ms)
+{
+  uint32_t start = millis();
+
+  while (millis() - start < ms)
+    yield();
+}
+
+static AsyncClient * peerConnect(MicroBenchState &state, uint16_t port)
+{
+  AsyncClient *client = new AsyncClient();
+
+  if (!client)
+  {
+    state.fail("out of client memory");
+
+    return NULL;
+  }
+
+  client->setNoDelay(true);
+
+  if (client->connect(host_stack_ip(), port))
+  {
+    uint32_t start = millis();
+
+    while (!client->connected() && (millis() - start < 1000))
+      yield();
+  }
+
+  if (!client->connected())
+  {
+    state.fail("connect to the peer failed");
+    delete client;
+
+    return NULL;
+  }
+
+  return client;
+}
+
+static void closeAndDelete(AsyncClient *client)
+{
+  client->onDisconnect([](void *arg, AsyncClient * c)
+  {
+    (void) arg;
+    delete c;
+  }, NULL);
+
+  client->close(true);
+  settle(5);
+}
+
+/////////////////////////////////////////////////
+// Write paths, into the sink
+/////////////////////////////////////////////////
+
+template <size_t CHUNK> static void client_write(MicroBenchState &state)
+{
+  AsyncClient *client = peerConnect(state, MICROBENCH_SINK_PORT);
+
+  if (!client)
+    return;
+
+  state.bytesPerIteration = CHUNK;
+
+  while (state.keepRunning())
+  {
+    while (client->connected() && (client->space() < CHUNK))
+      yield();
+
+    if (client->write(benchData, CHUNK, ASYNC_WRITE_FLAG_COPY) != CHUNK)
+      state.fail("write failed");
+  }
+
+  closeAndDelete(client);
+}
+
+template <size_t CHUNK> static void printer_write(MicroBenchState &state)
+{
+  AsyncClient *client = peerConnect(state, MICROBENCH_SINK_PORT);
+
+  if (!client)
+    return;
+
+  AsyncPrinter printer(client, TCP_MSS);
+
+  state.bytesPerIteration = CHUNK;
+
+  while (state.keepRunning())
+  {
+    if (printer.write((const uint8_t *) benchData, CHUNK) != CHUNK)
+      state.fail("write failed");
+  }
+
+  // deletes the client from onDisconnect
+  printer.close();
+  settle(5);
+}
+
+static void printer_write_byte(MicroBenchState &state)
+{
+  AsyncClient *client = peerConnect(state, MICROBENCH_SINK_PORT);
+
+  if (!client)
+    return;
+
+  AsyncPrinter printer(client, TCP_MSS);
+
+  state.bytesPerIteration = 64;
+
+  while (state.keepRunning())
+  {
+    for (int i = 0; i < 64; i++)
+      printer.write((uint8_t) benchData[i]);
+  }
+
+  printer.close();
+  settle(5);
+}
+
+template <size_t CHUNK> static void syncclient_write(MicroBenchState &state)
+{
+  AsyncClient *client = peerConnect(state, MICROBENCH_SINK_PORT);
+
+  if (!client)
+    return;
+
+  SyncClient sync(client, TCP_MSS);
+
+  state.bytesPerIteration = CHUNK;
+
+  while (state.keepRunning())
+  {
+    size_t done = 0;
+
+    while (sync.connected() && (done < CHUNK))
+    {
+      done += sync.write((const uint8_t *) benchData + done, CHUNK - done);
+
+      if (done < CHUNK)
+        yield();
+    }
+
+    if (done != CHUNK)
+      state.fail("write failed");
+  }
+
+  sync.stop();
+  settle(5);
+}
+
+static void syncclient_write_byte(MicroBenchState &state)
+{
+  AsyncClient *client = peerConnect(state, MICROBENCH_SINK_PORT);
+
+  if (!client)
+    return;
+
+  SyncClient sync(client, TCP_MSS);
+
+  state.bytesPerIteration = 64;
+
+  while (state.keepRunning())
+  {
+    for (int i = 0; i < 64; i++)
+    {
+      while (sync.connected() && (sync.write((uint8_t) benchData[i]) == 0))
+        yield();
+    }
+  }
+
+  sync.stop();
+  settle(5);
+}
+
+/////////////////////////////////////////////////
+// Read paths, from the source
+/////////////////////////////////////////////////
+
+static size_t clientReceived;
+
+template <size_t CHUNK> static void client_read(MicroBenchState &state)
+{
+  AsyncClient *client = peerConnect(state, MICROBENCH_SOURCE_PORT);
+
+  if (!client)
+    return;
+
+  client->onData([](void *arg, AsyncClient * c, void *data, size_t len)
+  {
+    (void) arg;
+    (void) c;
+
+    benchKeep(((char *) data)[0]);
+    clientReceived += len;
+  }, NULL);
+
+  clientReceived = 0;
+  state.bytesPerIteration = CHUNK;
+
+  size_t target = 0;
+
+  while (state.keepRunning())
+  {
+    target += CHUNK;
+
+    while (client->connected() && (clientReceived < target))
+      yield();
+  }
+
+  closeAndDelete(client);
+}
+
+template <size_t CHUNK> static void syncclient_read(MicroBenchState &state)
+{
+  AsyncClient *client = peerConnect(state, MICROBENCH_SOURCE_PORT);
+
+  if (!client)
+    return;
+
+  SyncClient sync(client, TCP_MSS);
+  static uint8_t out[CHUNK];
+
+  state.bytesPerIteration = CHUNK;
+
+  while (state.keepRunning())
+  {
+    size_t done = 0;
+
+    while (sync.connected() && (done < CHUNK))
+    {
+      int n = sync.read(out + done, CHUNK - done);
+
+      if (n > 0)
+        done += n;
+      else
+        yield();
+    }
+
+    benchKeep(out[0]);
+  }
+
+  sync.stop();
+  settle(5);
+}
+
+static void syncclient_read_byte(MicroBenchState &state)
+{
+  AsyncClient *client = peerConnect(state, MICROBENCH_SOURCE_PORT);
+
+  if (!client)
+    return;
+
+  SyncClient sync(client, TCP_MSS);
+
+  state.bytesPerIteration = 64;
+
+  while (state.keepRunning())
+  {
+    int sum = 0;
+
+    for (int i = 0; (i < 64) && sync.connected(); )
+    {
+      int c = sync.read();
+
+      if (c < 0)
+      {
+        yield();
+        continue;
+      }
+
+      sum += c;
+      i++;
+    }
+
+    benchKeep(sum);
+  }
+
+  sync.stop();
+  settle(5);
+}
+
+static void syncclient_readStringUntil(MicroBenchState &state)
+{
+  AsyncClient *client = peerConnect(state, MICROBENCH_SOURCE_PORT);
+
+  if (!client)
+    return;
+
+  SyncClient sync(client, TCP_MSS);
+
+  state.bytesPerIteration = MICROBENCH_LINE;
+
+  while (state.keepRunning())
+  {
+    String line = sync.readStringUntil('\n');
+
+    if (line.length() != MICROBENCH_LINE - 1)
+      state.fail("short line");
+  }
+
+  sync.stop();
+  settle(5);
+}
+
+/////////////////////////////////////////////////
+// AsyncTCPbuffer::_rxData, fed directly
+/////////////////////////////////////////////////
+
+class BenchTCPbuffer : public AsyncTCPbuffer
+{
+  public:
+    BenchTCPbuffer(AsyncClient *c) : AsyncTCPbuffer(c) {}
+
+    using AsyncTCPbuffer::_rxData;
+};
+
+static BenchTCPbuffer * benchBuffer;
+static String           benchLine;
+static size_t           benchLines;
+
+static void rearmLine(bool ok, void *ret)
+{
+  (void) ok;
+  (void) ret;
+
+  benchLines++;
+  benchLine = String();
+  benchBuffer->readStringUntil('\n', &benchLine, rearmLine);
+}
+
+template <size_t CHUNK> static void tcpbuffer_rxData_lines(MicroBenchState &state)
+{
+  // A connected client so _rxData() accepts data, the sink never sends any
+  AsyncClient *client = peerConnect(state, MICROBENCH_SINK_PORT);
+
+  if (!client)
+    return;
+
+  benchBuffer = new BenchTCPbuffer(client);
+  benchLines = 0;
+  benchBuffer->readStringUntil('\n', &benchLine, rearmLine);
+
+  state.bytesPerIteration = CHUNK;
+
+  size_t offset = 0;
+
+  while (state.keepRunning())
+  {
+    benchBuffer->_rxData((uint8_t *) lineData + offset, CHUNK);
+    offset = (offset + CHUNK) % (sizeof(lineData) - CHUNK);
+  }
+
+  benchKeep(benchLines);
+
+  // deletes the buffer and the client from onDisconnect
+  benchBuffer->close();
+  benchBuffer = NULL;
+  settle(5);
+}
+
+template <size_t CHUNK> static void tcpbuffer_rxData_free(MicroBenchState &state)
+{
+  AsyncClient *client = peerConnect(state, MICROBENCH_SINK_PORT);
+
+  if (!client)
+    return;
+
+  BenchTCPbuffer *buffer = new BenchTCPbuffer(client);
+
+  buffer->onData([](uint8_t *payload, size_t length)
+  {
+    benchKeep(payload[0]);
+    return length;
+  });
+
+  state.bytesPerIteration = CHUNK;
+
+  while (state.keepRunning())
+  {
+    buffer->_rxData((uint8_t *) benchData, CHUNK);
+  }
+
+  buffer->close();
+  settle(5);
+}
+
+/////////////////////////////////////////////////
+
+static const MicroBench benchmarks[] =
+{
+  { "cbuf/byte_write_read",                 cbuf_byte_write_read },
+  { "cbuf/byte_peek_remove",                cbuf_byte_peek_remove },
+  { "cbuf/bulk_write_read/16",              cbuf_bulk_write_read<16> },
+  { "cbuf/bulk_write_read/256",             cbuf_bulk_write_read<256> },
+  { "cbuf/bulk_write_read/1460",            cbuf_bulk_write_read<1460> },
+  { "cbuf/bulk_peek_remove/16",             cbuf_bulk_peek_remove<16> },
+  { "cbuf/bulk_peek_remove/1460",           cbuf_bulk_peek_remove<1460> },
+  { "cbuf/wrap_write_read/16",              cbuf_wrap_write_read<16> },
+  { "cbuf/wrap_write_read/1460",            cbuf_wrap_write_read<1460> },
+  { "cbuf/spans_write_read/1460",           cbuf_spans_write_read<1460> },
+  { "cbuf/resize/64-8192",                  cbuf_resize },
+  { "cbuf/resizeAdd/8xMSS",                 cbuf_resizeAdd },
+  { "cbuf_pow2/byte_write_read",            cbuf_pow2_byte_write_read },
+  { "cbuf_pow2/bulk_write_read/16",         cbuf_pow2_bulk_write_read<16> },
+  { "cbuf_pow2/bulk_write_read/1460",       cbuf_pow2_bulk_write_read<1460> },
+
+  { "scan/bytewise/4096",                   scan_bytewise },
+  { "scan/memchr/4096",                     scan_memchr },
+  { "scan/find_terminator/4096",            scan_find_terminator },
+  { "scan/delimiter_crlfcrlf/4096",         scan_delimiter_crlfcrlf },
+
+  { "client/write/64",                      client_write<64> },
+  { "client/write/1460",                    client_write<1460> },
+  { "printer/write_byte",                   printer_write_byte },
+  { "printer/write/64",                     printer_write<64> },
+  { "printer/write/1460",                   printer_write<1460> },
+  { "syncclient/write_byte",                syncclient_write_byte },
+  { "syncclient/write/64",                  syncclient_write<64> },
+  { "syncclient/write/1460",                syncclient_write<1460> },
+
+  { "client/read/4096",                     client_read<4096> },
+  { "syncclient/read_byte",                 syncclient_read_byte },
+  { "syncclient/read/64",                   syncclient_read<64> },
+  { "syncclient/read/4096",                 syncclient_read<4096> },
+  { "syncclient/readStringUntil",           syncclient_readStringUntil },
+
+  { "tcpbuffer/rxData_free/1460",           tcpbuffer_rxData_free<1460> },
+  { "tcpbuffer/rxData_lines/64",            tcpbuffer_rxData_lines<64> },
+  { "tcpbuffer/rxData_lines/1460",          tcpbuffer_rxData_lines<1460> },
+};
+
+/////////////////////////////////////////////////
+
+static void runBenchmark(const MicroBench &bench, std::vector<char> &json)
+{
+  uint64_t iterations = 1;
+  const uint64_t minNs = (uint64_t) MICROBENCH_MIN_TIME_MS * 1000000ULL;
+
+  while (true)
+  {
+    MicroBenchState state(iterations);
+
+    bench.fn(state);
+
+    if (state.error())
+    {
+      printf("%-36s FAILED: %s\n", bench.name, state.error());
+
+      return;
+    }
+
+    uint64_t ns = state.elapsedNs();
+
+    if ((ns < minNs) && (iterations < 1000000000ULL))
+    {
+      // Aim 20% past the minimum, at most 10x per round
+      uint64_t next = (ns > 0) ? (uint64_t) (iterations * 1.2 * minNs / ns) : iterations * 10;
+
+      iterations = std::max(iterations + 1, std::min(next, iterations * 10));
+
+      continue;
+    }
+
+    double nsPerOp = (double) ns / iterations;
+    double nsPerByte = state.bytesPerIteration ? nsPerOp / state.bytesPerIteration : 0;
+    double mallocsPerOp = (double) state.mallocs() / iterations;
+    double libAllocsPerOp = (double) state.libAllocs() / iterations;
+
+    printf("%-36s %12llu %12.1f %10.3f %10.3f %10.3f\n", bench.name, (unsigned long long) iterations, nsPerOp,
+           nsPerByte, mallocsPerOp, libAllocsPerOp);
+
+    char line[512];
+    int n = snprintf(line, sizeof(line),
+                     "{\"version\":\"%s\",\"benchmark\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.2f,"
+                     "\"bytes_per_op\":%zu,\"ns_per_byte\":%.4f,\"mallocs_per_op\":%.4f,\"lib_allocs_per_op\":%.4f,"
+                     "\"mallocs_counted\":%s}\n",
+                     TEENSY41_ASYNC_TCP_VERSION, bench.name, (unsigned long long) iterations, nsPerOp,
+                     state.bytesPerIteration, nsPerByte, mallocsPerOp, libAllocsPerOp,
+                     MICROBENCH_COUNT_MALLOC ? "true" : "false");
+
+    json.insert(json.end(), line, line + std::min(n, (int) sizeof(line) - 1));
+
+    return;
+  }
+}
+
+/////////////////////////////////////////////////
+
+int main(int argc, char **argv)
+{
+  const char *filter = (argc > 1) ? argv[1] : NULL;
+
+  host_stack_init();
+  fillPatterns();
+
+  sinkListen = peerListen(MICROBENCH_SINK_PORT, false);
+  sourceListen = peerListen(MICROBENCH_SOURCE_PORT, true);
+
+  if ((sinkListen == NULL) || (sourceListen == NULL))
+  {
+    printf("peer listen failed\n");
+
+    return 1;
+  }
+
+  printf("%s, min time %d ms, malloc counting %s\n\n", TEENSY41_ASYNC_TCP_VERSION, MICROBENCH_MIN_TIME_MS,
+         MICROBENCH_COUNT_MALLOC ? "on" : "off");
+  printf("%-36s %12s %12s %10s %10s %10s\n", "benchmark", "iterations", "ns/op", "ns/byte", "mallocs/op",
+         "lib/op");
+
+  std::vector<char> json;
+
+  for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+  {
+    if (filter && !strstr(benchmarks[i].name, filter))
+      continue;
+
+    runBenchmark(benchmarks[i], json);
+    fflush(stdout);
+  }
+
+  printf("\n");
+  fwrite(json.data(), 1, json.size(), stdout);
+
+  return 0;
+}
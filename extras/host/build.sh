@@ -0,0 +1,76 @@
+#!/bin/bash
+#
+# Host (Linux) build of Teensy41_AsyncTCP against upstream lwIP (NO_SYS)
+#
+#   LWIP_DIR=~/src/lwip ./extras/host/build.sh harness.cpp [output]
+#
+# The harness is a sketch style .cpp / .ino with setup() and loop(), or its
+# own main() when HOST_NO_MAIN=1. It includes Teensy41_AsyncTCP.h as usual.
+#
+# Environment:
+#   LWIP_DIR      lwIP 2.1 or newer source tree (required)
+#   CXX, CC       compilers, default g++ / gcc
+#   OPT           optimization flags, default -O2 -g
+#   SANITIZE      e.g. address,undefined
+#   EXTRA_FLAGS   added to every compile, e.g. -D_TEENSY41_ASYNC_TCP_LOGLEVEL_=4
+#                 or -DTEENSY41_ASYNC_TCP_COMPILED=1 for the compiled library layout
+#   BUILD_DIR     objects, default extras/host/build
+
+set -e
+
+HOST_DIR="$(cd "$(dirname "$0")" && pwd)"
+ROOT_DIR="$(cd "$HOST_DIR/../.." && pwd)"
+
+if [ -z "$LWIP_DIR" ] || [ ! -d "$LWIP_DIR/src/core" ]; then
+  echo "LWIP_DIR must point at an lwIP source tree (lwip/src/core missing)" >&2
+  exit 1
+fi
+
+if [ -z "$1" ]; then
+  echo "usage: LWIP_DIR=... $0 harness.cpp [output]" >&2
+  exit 1
+fi
+
+HARNESS="$1"
+OUTPUT="${2:-$(basename "${HARNESS%.*}")}"
+
+CC="${CC:-gcc}"
+CXX="${CXX:-g++}"
+OPT="${OPT:--O2 -g}"
+BUILD_DIR="${BUILD_DIR:-$HOST_DIR/build}"
+
+FLAGS="$OPT -DTEENSY41_ASYNC_TCP_HOST=1 $EXTRA_FLAGS"
+
+if [ -n "$SANITIZE" ]; then
+  FLAGS="$FLAGS -fsanitize=$SANITIZE -fno-omit-frame-pointer"
+fi
+
+INCLUDES="-I$HOST_DIR/shims -I$HOST_DIR -I$ROOT_DIR/Packages_Patches/hardware/teensy/avr/cores/teensy4 \
+          -I$ROOT_DIR/src -I$LWIP_DIR/src/include"
+
+mkdir -p "$BUILD_DIR/lwip"
+
+# lwIP core, rebuilt when a source or the host options are newer
+OBJS=""
+
+for src in "$LWIP_DIR"/src/core/*.c "$LWIP_DIR"/src/core/ipv4/*.c "$LWIP_DIR"/src/api/err.c; do
+  obj="$BUILD_DIR/lwip/$(basename "${src%.c}").o"
+
+  if [ ! -f "$obj" ] || [ "$src" -nt "$obj" ] || [ "$HOST_DIR/shims/lwipopts.h" -nt "$obj" ]; then
+    $CC $FLAGS $INCLUDES -c "$src" -o "$obj"
+  fi
+
+  OBJS="$OBJS $obj"
+done
+
+SOURCES="$HOST_DIR/host_arduino.cpp $HOST_DIR/host_netif.cpp \
+         $ROOT_DIR/Packages_Patches/hardware/teensy/avr/cores/teensy4/Stream.cpp \
+         $ROOT_DIR/src/Teensy41_AsyncTCP.cpp"
+
+if [ "$HOST_NO_MAIN" != "1" ]; then
+  SOURCES="$SOURCES $HOST_DIR/host_main.cpp"
+fi
+
+$CXX -std=gnu++17 $FLAGS $INCLUDES -x c++ "$HARNESS" -x none $SOURCES $OBJS -o "$OUTPUT"
+
+echo "built $OUTPUT"
@@ -0,0 +1,214 @@
+/****************************************************************************************************************************
+  host_arduino.cpp
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+#include "Arduino.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "host_netif.h"
+
+/////////////////////////////////////////////////
+
+HostSerial Serial;
+
+/////////////////////////////////////////////////
+
+static uint64_t host_clock_us()
+{
+  static uint64_t start = 0;
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  uint64_t now = (uint64_t) ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+
+  if (start == 0)
+    start = now;
+
+  return now - start;
+}
+
+/////////////////////////////////////////////////
+
+uint32_t millis()
+{
+  return (uint32_t) (host_clock_us() / 1000);
+}
+
+/////////////////////////////////////////////////
+
+uint32_t micros()
+{
+  return (uint32_t) host_clock_us();
+}
+
+/////////////////////////////////////////////////
+
+void yield()
+{
+  host_stack_poll();
+}
+
+/////////////////////////////////////////////////
+
+// Keeps the stack running while "sleeping", like the target's yield() does
+void delay(uint32_t ms)
+{
+  uint32_t start = millis();
+
+  do
+  {
+    yield();
+    usleep(100);
+  } while (millis() - start < ms);
+}
+
+/////////////////////////////////////////////////
+
+void delayMicroseconds(uint32_t us)
+{
+  uint32_t start = micros();
+
+  while (micros() - start < us)
+    ;
+}
+
+/////////////////////////////////////////////////
+/////////////////////////////////////////////////
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+  size_t count = 0;
+
+  while (size--)
+  {
+    if (!write(*buffer++))
+      break;
+
+    count++;
+  }
+
+  return count;
+}
+
+/////////////////////////////////////////////////
+
+size_t Print::printNumber(unsigned long long n, int base)
+{
+  char buf[8 * sizeof(n) + 1];
+  char *p = buf + sizeof(buf) - 1;
+
+  *p = 0;
+
+  if (base < 2)
+    base = 10;
+
+  do
+  {
+    unsigned digit = n % base;
+
+    *--p = (digit < 10) ? ('0' + digit) : ('A' + digit - 10);
+    n /= base;
+  } while (n);
+
+  return write(p);
+}
+
+/////////////////////////////////////////////////
+
+size_t Print::printNumber(long long n, int base)
+{
+  if ((n < 0) && (base == 10))
+    return print('-') + printNumber(- (unsigned long long) n, base);
+
+  return printNumber((unsigned long long) n, base);
+}
+
+/////////////////////////////////////////////////
+
+size_t Print::print(double n, int digits)
+{
+  char buf[64];
+
+  snprintf(buf, sizeof(buf), "%.*f", digits, n);
+
+  return write(buf);
+}
+
+/////////////////////////////////////////////////
+
+size_t Print::print(const void *ptr)
+{
+  char buf[24];
+
+  snprintf(buf, sizeof(buf), "%p", ptr);
+
+  return write(buf);
+}
+
+/////////////////////////////////////////////////
+
+int Print::printf(const char *format, ...)
+{
+  char buf[256];
+  va_list args;
+
+  va_start(args, format);
+  int len = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+
+  if (len < 0)
+    return len;
+
+  if ((size_t) len >= sizeof(buf))
+    len = sizeof(buf) - 1;
+
+  return write((const uint8_t *) buf, len);
+}
+
+/////////////////////////////////////////////////
+/////////////////////////////////////////////////
+
+size_t HostSerial::write(uint8_t c)
+{
+  return fwrite(&c, 1, 1, stdout);
+}
+
+/////////////////////////////////////////////////
+
+size_t HostSerial::write(const uint8_t *buffer, size_t size)
+{
+  return fwrite(buffer, 1, size, stdout);
+}
+
+/////////////////////////////////////////////////
+
+void HostSerial::flush()
+{
+  fflush(stdout);
+}
@@ -0,0 +1,65 @@
+/****************************************************************************************************************************
+  host_main.cpp
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+// Runs a sketch style harness (setup() / loop()) on the host stack
+
+#include "Arduino.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host_netif.h"
+
+/////////////////////////////////////////////////
+
+static bool host_exit_requested = false;
+static int  host_exit_code = 0;
+
+/////////////////////////////////////////////////
+
+void host_exit(int code)
+{
+  host_exit_requested = true;
+  host_exit_code = code;
+}
+
+/////////////////////////////////////////////////
+
+int main()
+{
+  host_stack_init();
+
+  setup();
+
+  while (!host_exit_requested)
+  {
+    loop();
+    yield();
+  }
+
+  fflush(stdout);
+
+  return host_exit_code;
+}
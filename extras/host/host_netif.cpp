@@ -0,0 +1,237 @@
+/****************************************************************************************************************************
+  host_netif.cpp
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+#include "host_netif.h"
+
+#include <stdlib.h>
+
+#include <deque>
+
+#include "Arduino.h"
+
+extern "C"
+{
+  #include "lwip/init.h"
+  #include "lwip/netif.h"
+  #include "lwip/ip4.h"
+  #include "lwip/pbuf.h"
+  #include "lwip/timeouts.h"
+  #include "lwip/stats.h"
+  #include "lwip/memp.h"
+}
+
+/////////////////////////////////////////////////
+
+typedef struct
+{
+  struct pbuf *p;
+  uint64_t     due;
+} host_packet_t;
+
+static struct netif                 host_if;
+static host_link_config_t           host_link;
+static host_link_stats_t            host_stats;
+static std::deque<host_packet_t>    host_wire;
+static uint64_t                     host_tx_free_at = 0;
+static bool                         host_polling = false;
+static bool                         host_started = false;
+
+/////////////////////////////////////////////////
+
+static uint64_t host_now_us()
+{
+  static uint64_t high = 0;
+  static uint32_t last = 0;
+
+  uint32_t now = micros();
+
+  if (now < last)
+    high += 1ULL << 32;
+
+  last = now;
+
+  return high | now;
+}
+
+/////////////////////////////////////////////////
+
+static err_t host_if_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr)
+{
+  (void) netif;
+  (void) ipaddr;
+
+  host_stats.packets++;
+  host_stats.bytes += p->tot_len;
+
+  if (host_link.lossPpm && ((uint32_t) (rand_r(&host_link.seed) % 1000000) < host_link.lossPpm))
+  {
+    host_stats.dropped++;
+
+    return ERR_OK;
+  }
+
+  // lwIP keeps p for retransmission, the wire needs its own copy
+  struct pbuf *q = pbuf_clone(PBUF_RAW, PBUF_POOL, p);
+
+  if (q == NULL)
+  {
+    host_stats.overruns++;
+
+    return ERR_OK;
+  }
+
+  uint64_t now = host_now_us();
+  uint64_t sent = now;
+
+  if (host_link.bandwidthKbps)
+  {
+    sent = (host_tx_free_at > now) ? host_tx_free_at : now;
+    sent += ((uint64_t) p->tot_len * 8 * 1000) / host_link.bandwidthKbps;
+    host_tx_free_at = sent;
+  }
+
+  host_wire.push_back({ q, sent + host_link.latencyUs });
+
+  host_stats.queued = host_wire.size();
+
+  if (host_stats.queued > host_stats.queuedHighWater)
+    host_stats.queuedHighWater = host_stats.queued;
+
+  return ERR_OK;
+}
+
+/////////////////////////////////////////////////
+
+static err_t host_if_init(struct netif *netif)
+{
+  netif->name[0] = 'h';
+  netif->name[1] = 'p';
+  netif->output = host_if_output;
+  netif->mtu = 1500;
+  netif->flags = NETIF_FLAG_LINK_UP;
+
+  return ERR_OK;
+}
+
+/////////////////////////////////////////////////
+
+void host_stack_init(const host_link_config_t *config)
+{
+  if (host_started)
+    return;
+
+  host_stack_set_link(config);
+
+  lwip_init();
+
+  ip4_addr_t ip, mask, gw;
+
+  IP4_ADDR(&ip, 10, 0, 0, 1);
+  IP4_ADDR(&mask, 255, 255, 255, 0);
+  IP4_ADDR(&gw, 10, 0, 0, 254);
+
+  netif_add(&host_if, &ip, &mask, &gw, NULL, host_if_init, ip4_input);
+  netif_set_default(&host_if);
+  netif_set_up(&host_if);
+  netif_set_link_up(&host_if);
+
+  host_started = true;
+}
+
+/////////////////////////////////////////////////
+
+void host_stack_set_link(const host_link_config_t *config)
+{
+  if (config)
+    host_link = *config;
+  else
+    memset(&host_link, 0, sizeof(host_link));
+}
+
+/////////////////////////////////////////////////
+
+void host_stack_poll()
+{
+  // lwIP callbacks may end up in yield() again
+  if (!host_started || host_polling)
+    return;
+
+  host_polling = true;
+
+  uint64_t now = host_now_us();
+
+  while (!host_wire.empty() && (host_wire.front().due <= now))
+  {
+    struct pbuf *p = host_wire.front().p;
+
+    host_wire.pop_front();
+    host_if.input(p, &host_if);
+  }
+
+  host_stats.queued = host_wire.size();
+
+  sys_check_timeouts();
+
+  host_polling = false;
+}
+
+/////////////////////////////////////////////////
+
+IPAddress host_stack_ip()
+{
+  return IPAddress(10, 0, 0, 1);
+}
+
+/////////////////////////////////////////////////
+
+const host_link_stats_t & host_link_stats()
+{
+  return host_stats;
+}
+
+/////////////////////////////////////////////////
+
+size_t host_pbuf_pool_used()
+{
+  return lwip_stats.memp[MEMP_PBUF_POOL]->used;
+}
+
+size_t host_pbuf_pool_max()
+{
+  return lwip_stats.memp[MEMP_PBUF_POOL]->max;
+}
+
+size_t host_pbuf_pool_size()
+{
+  return lwip_stats.memp[MEMP_PBUF_POOL]->avail;
+}
+
+/////////////////////////////////////////////////
+
+// NO_SYS time base of the lwIP timers
+extern "C" u32_t sys_now(void)
+{
+  return millis();
+}
@@ -0,0 +1,87 @@
+/****************************************************************************************************************************
+  host_netif.h
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_HOST_NETIF_H_
+#define _TEENSY41_ASYNC_TCP_HOST_NETIF_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "IPAddress.h"
+
+/////////////////////////////////////////////////
+
+/*
+  In-process network for the host build. A single lwIP stack with one netif
+  whose output is piped back into its own input, so an AsyncServer and its
+  AsyncClients on host_stack_ip() talk through real TCP segments. Each
+  packet can be delayed, rate limited or dropped to emulate a link.
+
+  Everything runs from host_stack_poll(), which yield() / delay() call.
+*/
+
+typedef struct
+{
+  uint32_t  latencyUs;        // one way delay per packet
+  uint32_t  lossPpm;          // packets dropped per million
+  uint32_t  bandwidthKbps;    // serialization rate, 0 => unlimited
+  uint32_t  seed;             // loss pattern
+} host_link_config_t;
+
+typedef struct
+{
+  uint64_t  packets;          // handed to the link
+  uint64_t  bytes;
+  uint64_t  dropped;          // by lossPpm
+  uint64_t  overruns;         // no pbuf to receive into
+  size_t    queued;           // packets in flight now
+  size_t    queuedHighWater;
+} host_link_stats_t;
+
+/////////////////////////////////////////////////
+
+// lwip_init() and netif setup, config NULL => ideal link
+void host_stack_init(const host_link_config_t *config = NULL);
+
+// Change the link, applies to packets sent from now on
+void host_stack_set_link(const host_link_config_t *config);
+
+// Delivers due packets and runs the lwIP timers
+void host_stack_poll();
+
+IPAddress host_stack_ip();
+
+const host_link_stats_t & host_link_stats();
+
+// Used / high-water / error counts of the lwIP pbuf pool
+size_t host_pbuf_pool_used();
+size_t host_pbuf_pool_max();
+size_t host_pbuf_pool_size();
+
+/////////////////////////////////////////////////
+
+#endif    // _TEENSY41_ASYNC_TCP_HOST_NETIF_H_
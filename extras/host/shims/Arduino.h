@@ -0,0 +1,106 @@
+/****************************************************************************************************************************
+  Arduino.h
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+// Host (Linux) stand-in for the Teensy core's Arduino.h, just what the
+// library, the patched Stream and the host harnesses use.
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_HOST_ARDUINO_H_
+#define _TEENSY41_ASYNC_TCP_HOST_ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <algorithm>
+
+typedef bool      boolean;
+typedef uint8_t   byte;
+
+#include "WString.h"
+#include "Print.h"
+#include "Stream.h"
+#include "IPAddress.h"
+
+/////////////////////////////////////////////////
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+// Runs the host lwIP stack, like the Ethernet loop does from yield() on target
+void yield();
+
+/////////////////////////////////////////////////
+
+// Teensy PSRAM allocator, plain heap on the host
+inline void * extmem_malloc(size_t size)
+{
+  return malloc(size);
+}
+
+inline void extmem_free(void *ptr)
+{
+  free(ptr);
+}
+
+/////////////////////////////////////////////////
+
+class HostSerial : public Print
+{
+  public:
+    void begin(uint32_t baud)
+    {
+      (void) baud;
+    }
+
+    operator bool()
+    {
+      return true;
+    }
+
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
+
+    using Print::write;
+
+    void flush();
+};
+
+extern HostSerial Serial;
+
+/////////////////////////////////////////////////
+
+// Sketch style harnesses: host_main.cpp calls setup() once, then loop()
+// and yield() until host_exit() is called.
+void setup();
+void loop();
+void host_exit(int code);
+
+#endif    // _TEENSY41_ASYNC_TCP_HOST_ARDUINO_H_
@@ -0,0 +1,110 @@
+/****************************************************************************************************************************
+  IPAddress.h
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+// Host IPAddress, stored in network byte order like lwIP's ip4_addr_t
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_HOST_IPADDRESS_H_
+#define _TEENSY41_ASYNC_TCP_HOST_IPADDRESS_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include "WString.h"
+
+class IPAddress
+{
+  public:
+    IPAddress()
+    {
+      _address.dword = 0;
+    }
+
+    IPAddress(uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4)
+    {
+      _address.bytes[0] = b1;
+      _address.bytes[1] = b2;
+      _address.bytes[2] = b3;
+      _address.bytes[3] = b4;
+    }
+
+    IPAddress(uint32_t address)
+    {
+      _address.dword = address;
+    }
+
+    IPAddress(const uint8_t *address)
+    {
+      memcpy(_address.bytes, address, sizeof(_address.bytes));
+    }
+
+    operator uint32_t() const
+    {
+      return _address.dword;
+    }
+
+    bool operator == (const IPAddress &addr) const
+    {
+      return _address.dword == addr._address.dword;
+    }
+
+    bool operator != (const IPAddress &addr) const
+    {
+      return _address.dword != addr._address.dword;
+    }
+
+    uint8_t operator [] (int index) const
+    {
+      return _address.bytes[index];
+    }
+
+    uint8_t & operator [] (int index)
+    {
+      return _address.bytes[index];
+    }
+
+    String toString() const
+    {
+      String str(_address.bytes[0]);
+
+      for (int i = 1; i < 4; i++)
+      {
+        str += '.';
+        str += String((unsigned int) _address.bytes[i]);
+      }
+
+      return str;
+    }
+
+  private:
+    union
+    {
+      uint8_t   bytes[4];
+      uint32_t  dword;
+    } _address;
+};
+
+#endif    // _TEENSY41_ASYNC_TCP_HOST_IPADDRESS_H_
@@ -0,0 +1,107 @@
+/****************************************************************************************************************************
+  Print.h
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+// Host Print, the subset of the Teensy core's Print in use
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_HOST_PRINT_H_
+#define _TEENSY41_ASYNC_TCP_HOST_PRINT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "WString.h"
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+class Print
+{
+  public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t b) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+
+    size_t write(const char *str)
+    {
+      return str ? write((const uint8_t *) str, strlen(str)) : 0;
+    }
+
+    size_t write(const char *buffer, size_t size)
+    {
+      return write((const uint8_t *) buffer, size);
+    }
+
+    virtual int availableForWrite()
+    {
+      return 0;
+    }
+
+    virtual void flush() {}
+
+    size_t print(const char *str)                     { return write(str); }
+    size_t print(const String &str)                   { return write((const uint8_t *) str.c_str(), str.length()); }
+    size_t print(char c)                              { return write((uint8_t) c); }
+    size_t print(int n, int base = DEC)               { return printNumber(n, base); }
+    size_t print(unsigned int n, int base = DEC)      { return printNumber(n, base); }
+    size_t print(long n, int base = DEC)              { return printNumber(n, base); }
+    size_t print(unsigned long n, int base = DEC)     { return printNumber(n, base); }
+    size_t print(long long n, int base = DEC)         { return printNumber(n, base); }
+    size_t print(unsigned long long n, int base = DEC) { return printNumber(n, base); }
+    size_t print(double n, int digits = 2);
+    size_t print(const void *ptr);
+
+    size_t println()                                  { return write("\r\n"); }
+
+    template <typename T> size_t println(const T &value)
+    {
+      size_t n = print(value);
+      return n + println();
+    }
+
+    template <typename T> size_t println(const T &value, int format)
+    {
+      size_t n = print(value, format);
+      return n + println();
+    }
+
+    int printf(const char *format, ...) __attribute__ ((format (printf, 2, 3)));
+
+  private:
+    size_t printNumber(long long n, int base);
+    size_t printNumber(unsigned long long n, int base);
+
+    size_t printNumber(int n, int base)               { return printNumber((long long) n, base); }
+    size_t printNumber(long n, int base)              { return printNumber((long long) n, base); }
+    size_t printNumber(unsigned int n, int base)      { return printNumber((unsigned long long) n, base); }
+    size_t printNumber(unsigned long n, int base)     { return printNumber((unsigned long long) n, base); }
+};
+
+#endif    // _TEENSY41_ASYNC_TCP_HOST_PRINT_H_
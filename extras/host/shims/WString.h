@@ -0,0 +1,209 @@
+/****************************************************************************************************************************
+  WString.h
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+// Host String, std::string based, with the Arduino API subset in use
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_HOST_WSTRING_H_
+#define _TEENSY41_ASYNC_TCP_HOST_WSTRING_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+
+class String
+{
+  public:
+    String(const char *cstr = "") : _s(cstr ? cstr : "") {}
+    String(const char *cstr, unsigned int length) : _s(cstr, length) {}
+    String(const std::string &s) : _s(s) {}
+    explicit String(char c) : _s(1, c) {}
+    explicit String(int value, unsigned char base = 10)           { _fromInt(value, base); }
+    explicit String(unsigned int value, unsigned char base = 10)  { _fromUInt(value, base); }
+    explicit String(long value, unsigned char base = 10)          { _fromInt(value, base); }
+    explicit String(unsigned long value, unsigned char base = 10) { _fromUInt(value, base); }
+
+    inline unsigned int length() const
+    {
+      return _s.size();
+    }
+
+    inline const char * c_str() const
+    {
+      return _s.c_str();
+    }
+
+    unsigned char reserve(unsigned int size)
+    {
+      _s.reserve(size);
+      return 1;
+    }
+
+    unsigned char concat(const String &str)           { _s += str._s; return 1; }
+    unsigned char concat(const char *cstr)            { if (cstr) _s += cstr; return cstr != NULL; }
+    unsigned char concat(const char *cstr, unsigned int length) { _s.append(cstr, length); return 1; }
+    unsigned char concat(char c)                      { _s += c; return 1; }
+    unsigned char concat(int value)                   { return concat(String(value)); }
+    unsigned char concat(unsigned int value)          { return concat(String(value)); }
+    unsigned char concat(long value)                  { return concat(String(value)); }
+    unsigned char concat(unsigned long value)         { return concat(String(value)); }
+
+    template <typename T> String & operator += (const T &rhs)
+    {
+      concat(rhs);
+      return *this;
+    }
+
+    String & operator += (const char *cstr)
+    {
+      concat(cstr);
+      return *this;
+    }
+
+    friend String operator + (const String &lhs, const String &rhs)
+    {
+      return String(lhs._s + rhs._s);
+    }
+
+    friend String operator + (const String &lhs, const char *rhs)
+    {
+      return String(lhs._s + (rhs ? rhs : ""));
+    }
+
+    bool operator == (const String &rhs) const    { return _s == rhs._s; }
+    bool operator == (const char *rhs) const      { return _s == (rhs ? rhs : ""); }
+    bool operator != (const String &rhs) const    { return _s != rhs._s; }
+    bool operator != (const char *rhs) const      { return !(*this == rhs); }
+    bool equals(const String &rhs) const          { return _s == rhs._s; }
+
+    char charAt(unsigned int index) const         { return (index < _s.size()) ? _s[index] : 0; }
+    char operator [] (unsigned int index) const   { return charAt(index); }
+    char & operator [] (unsigned int index)       { return _s[index]; }
+
+    int indexOf(char c, unsigned int from = 0) const
+    {
+      size_t pos = _s.find(c, from);
+      return (pos == std::string::npos) ? -1 : (int) pos;
+    }
+
+    int indexOf(const String &str, unsigned int from = 0) const
+    {
+      size_t pos = _s.find(str._s, from);
+      return (pos == std::string::npos) ? -1 : (int) pos;
+    }
+
+    bool startsWith(const String &prefix) const
+    {
+      return _s.compare(0, prefix._s.size(), prefix._s) == 0;
+    }
+
+    bool endsWith(const String &suffix) const
+    {
+      return (_s.size() >= suffix._s.size()) && (_s.compare(_s.size() - suffix._s.size(), suffix._s.size(), suffix._s) == 0);
+    }
+
+    String substring(unsigned int from) const
+    {
+      return (from < _s.size()) ? String(_s.substr(from)) : String();
+    }
+
+    String substring(unsigned int from, unsigned int to) const
+    {
+      if (from > to)
+        std::swap(from, to);
+
+      return (from < _s.size()) ? String(_s.substr(from, to - from)) : String();
+    }
+
+    void remove(unsigned int index)
+    {
+      if (index < _s.size())
+        _s.erase(index);
+    }
+
+    void remove(unsigned int index, unsigned int count)
+    {
+      if (index < _s.size())
+        _s.erase(index, count);
+    }
+
+    void trim()
+    {
+      size_t first = _s.find_first_not_of(" \t\r\n");
+
+      if (first == std::string::npos)
+      {
+        _s.clear();
+        return;
+      }
+
+      _s = _s.substr(first, _s.find_last_not_of(" \t\r\n") - first + 1);
+    }
+
+    long toInt() const
+    {
+      return strtol(_s.c_str(), NULL, 10);
+    }
+
+  private:
+    std::string _s;
+
+    void _fromUInt(unsigned long value, unsigned char base)
+    {
+      char buf[8 * sizeof(long) + 1];
+      char *p = buf + sizeof(buf) - 1;
+
+      *p = 0;
+
+      if (base < 2)
+        base = 10;
+
+      do
+      {
+        unsigned long digit = value % base;
+
+        *--p = (digit < 10) ? ('0' + digit) : ('A' + digit - 10);
+        value /= base;
+      } while (value);
+
+      _s = p;
+    }
+
+    void _fromInt(long value, unsigned char base)
+    {
+      if ((value < 0) && (base == 10))
+      {
+        _fromUInt(- (unsigned long) value, base);
+        _s.insert(0, 1, '-');
+      }
+      else
+      {
+        _fromUInt((unsigned long) value, base);
+      }
+    }
+};
+
+#endif    // _TEENSY41_ASYNC_TCP_HOST_WSTRING_H_
@@ -0,0 +1,99 @@
+/****************************************************************************************************************************
+  lwipopts.h
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+// lwIP options of the host build: raw API only (NO_SYS), IPv4, no ARP.
+// Sizes roughly follow QNEthernet's defaults so buffer behaviour matches
+// the target. Checksums are off like with the i.MX RT ENET offload.
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_HOST_LWIPOPTS_H_
+#define _TEENSY41_ASYNC_TCP_HOST_LWIPOPTS_H_
+
+#define NO_SYS                          1
+#define SYS_LIGHTWEIGHT_PROT            0
+#define LWIP_TIMERS                     1
+
+#define LWIP_SOCKET                     0
+#define LWIP_NETCONN                    0
+
+#define LWIP_IPV4                       1
+#define LWIP_IPV6                       0
+#define LWIP_ARP                        0
+#define LWIP_ETHERNET                   0
+#define LWIP_ICMP                       1
+#define LWIP_UDP                        1
+#define LWIP_DNS                        1
+#define LWIP_DHCP                       0
+#define LWIP_AUTOIP                     0
+#define LWIP_IGMP                       0
+
+// Packets for our own address must go out through host_netif's pipe
+#define LWIP_NETIF_LOOPBACK             0
+#define LWIP_HAVE_LOOPIF                0
+
+#define CHECKSUM_GEN_IP                 0
+#define CHECKSUM_GEN_TCP                0
+#define CHECKSUM_GEN_UDP                0
+#define CHECKSUM_GEN_ICMP               0
+#define CHECKSUM_CHECK_IP               0
+#define CHECKSUM_CHECK_TCP              0
+#define CHECKSUM_CHECK_UDP              0
+#define CHECKSUM_CHECK_ICMP             0
+
+/////////////////////////////////////////////////
+
+// Heap from malloc so sanitizers see every allocation, pools stay pools
+// so their usage can be tracked
+#define MEM_LIBC_MALLOC                 1
+#define MEM_ALIGNMENT                   8
+
+#define PBUF_POOL_SIZE                  256
+#define MEMP_NUM_PBUF                   64
+#define MEMP_NUM_TCP_PCB                128
+#define MEMP_NUM_TCP_PCB_LISTEN         8
+#define MEMP_NUM_TCP_SEG                512
+#define MEMP_NUM_UDP_PCB                4
+#define MEMP_NUM_SYS_TIMEOUT            16
+
+/////////////////////////////////////////////////
+
+#define TCP_MSS                         1460
+#define TCP_WND                         (4 * TCP_MSS)
+#define TCP_SND_BUF                     (4 * TCP_MSS)
+#define TCP_SND_QUEUELEN                (4 * TCP_SND_BUF / TCP_MSS)
+#define TCP_LISTEN_BACKLOG              1
+#define LWIP_TCP_KEEPALIVE              1
+#define TCP_QUEUE_OOSEQ                 1
+
+/////////////////////////////////////////////////
+
+#define LWIP_STATS                      1
+#define MEM_STATS                       1
+#define MEMP_STATS                      1
+#define TCP_STATS                       1
+#define LWIP_STATS_DISPLAY              0
+
+#endif    // _TEENSY41_ASYNC_TCP_HOST_LWIPOPTS_H_
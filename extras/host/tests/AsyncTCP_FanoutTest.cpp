@@ -0,0 +1,238 @@
+/****************************************************************************************************************************
+  AsyncTCP_FanoutTest.cpp
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+/*
+  Shared payloads (ASYNC_TCP_FANOUT) over loopback connections: one payload
+  broadcast to several subscribers by reference, and a subscriber that
+  stops reading, so its queue fills up under ATCP_FANOUT_DROP and then
+  ATCP_FANOUT_COALESCE. Checks what every subscriber receives, the stats,
+  and that each payload is freed once the last ACK is in.
+
+    SANITIZE=address,undefined LWIP_DIR=~/src/lwip ./extras/host/build.sh \
+      extras/host/tests/AsyncTCP_FanoutTest.cpp
+*/
+
+#define ASYNC_TCP_FANOUT          1
+
+#include "Teensy41_AsyncTCP.h"
+
+#include "host_test.h"
+
+/////////////////////////////////////////////////
+
+#define FANOUT_TEST_PORT          7401
+#define FANOUT_TEST_SLOW_PORT     7402
+
+#define FANOUT_TEST_SUBSCRIBERS   3
+
+/////////////////////////////////////////////////
+
+static size_t payloadBytes()
+{
+  return AsyncTCPMemory::classStats(ATCP_MEM_TX_BUFFER).current;
+}
+
+/////////////////////////////////////////////////
+
+static void testBroadcast()
+{
+  HostTestServer srv(FANOUT_TEST_PORT);
+
+  std::string rx[FANOUT_TEST_SUBSCRIBERS];
+  AsyncClient *sub[FANOUT_TEST_SUBSCRIBERS];
+
+  for (int i = 0; i < FANOUT_TEST_SUBSCRIBERS; i++)
+    sub[i] = host_test_connect(FANOUT_TEST_PORT, &rx[i]);
+
+  HOST_CHECK(host_wait([&]() { return srv.peers.size() == FANOUT_TEST_SUBSCRIBERS; }));
+
+  std::string frame = host_test_pattern(1000);
+  size_t before = payloadBytes();
+
+  AsyncTCPPayload *p = AsyncTCPPayload::create(frame.data(), frame.size());
+
+  HOST_CHECK(p != NULL);
+
+  // One block for all subscribers
+  HOST_CHECK(payloadBytes() - before < frame.size() + 100);
+
+  for (auto &peer : srv.peers)
+    HOST_CHECK(peer.client->sendShared(p));
+
+  HOST_CHECK(p->refs() == FANOUT_TEST_SUBSCRIBERS + 1);
+
+  p->unref();
+
+  HOST_CHECK(host_wait([&]()
+  {
+    for (auto &peer : srv.peers)
+    {
+      if (peer.client->fanoutPending())
+        return false;
+    }
+
+    return true;
+  }));
+
+  for (int i = 0; i < FANOUT_TEST_SUBSCRIBERS; i++)
+    HOST_CHECK(rx[i] == frame);
+
+  for (auto &peer : srv.peers)
+    HOST_CHECK(peer.client->fanoutStats()->queued == 1);
+
+  // Released by the last ACK
+  HOST_CHECK(payloadBytes() == before);
+
+  for (int i = 0; i < FANOUT_TEST_SUBSCRIBERS; i++)
+    delete sub[i];
+}
+
+/////////////////////////////////////////////////
+
+struct SlowSubscriber
+{
+  std::string rx;
+  bool        hold;
+};
+
+static void testSlowSubscriber()
+{
+  HostTestServer srv(FANOUT_TEST_SLOW_PORT);
+
+  SlowSubscriber slow = { std::string(), true };
+  AsyncClient *sub = host_test_connect(FANOUT_TEST_SLOW_PORT);
+
+  // Not acking what was read closes the window, the publisher backs up
+  sub->onData([](void *arg, AsyncClient * c, void *data, size_t len)
+  {
+    SlowSubscriber *s = (SlowSubscriber *) arg;
+
+    s->rx.append((const char *) data, len);
+
+    if (s->hold)
+      c->ackLater();
+  }, &slow);
+
+  HOST_CHECK(host_wait([&]() { return srv.peers.size() == 1; }));
+
+  AsyncClient *pub = srv.peers[0].client;
+  const atcpFanoutStats_t *stats = pub->fanoutStats();
+
+  size_t before = payloadBytes();
+  std::vector<int> expected;
+  int k = 0;
+  uint32_t refused = 0;
+  bool settled = false;
+
+  auto publish = [&](int id) -> bool
+  {
+    std::string frame(2000, 'A' + (id % 26));
+    AsyncTCPPayload *p = AsyncTCPPayload::create(frame.data(), frame.size());
+
+    HOST_CHECK(p != NULL);
+
+    uint32_t coalesced = stats->coalesced;
+    bool ok = pub->sendShared(p);
+
+    p->unref();
+
+    // Model of the queue: a coalesced payload replaces the newest one
+    if (ok && (stats->coalesced != coalesced))
+      expected.back() = id;
+    else if (ok)
+      expected.push_back(id);
+
+    return ok;
+  };
+
+  // Under ATCP_FANOUT_DROP until the queue stays full after ACKs settle
+  while (k < 64)
+  {
+    bool ok = publish(k++);
+
+    if (!ok)
+    {
+      refused++;
+
+      if (settled)
+        break;
+
+      host_run(500);
+      settled = true;
+    }
+    else
+    {
+      settled = false;
+      host_run(20);
+    }
+  }
+
+  HOST_CHECK(k < 64);
+  HOST_CHECK(pub->fanoutPending() == ASYNC_TCP_FANOUT_DEPTH);
+  HOST_CHECK(stats->dropped == refused);
+
+  // Coalesced payloads replace the newest unsent one, they are not queued
+  pub->setFanoutPolicy(ATCP_FANOUT_COALESCE);
+
+  uint32_t queued = stats->queued;
+
+  HOST_CHECK(publish(k++));
+  HOST_CHECK(publish(k++));
+  HOST_CHECK(stats->coalesced == 2);
+  HOST_CHECK(stats->queued == queued);
+  HOST_CHECK(stats->queued == expected.size());
+  HOST_CHECK(pub->fanoutPending() == ASYNC_TCP_FANOUT_DEPTH);
+
+  // Read again, everything still queued goes out
+  slow.hold = false;
+  sub->ack((size_t) -1);
+
+  std::string want;
+
+  for (int id : expected)
+    want.append(2000, 'A' + (id % 26));
+
+  HOST_CHECK(host_wait([&]() { return (slow.rx.size() == want.size()) && (pub->fanoutPending() == 0); }, 5000));
+  HOST_CHECK(slow.rx == want);
+  HOST_CHECK(stats->aborted == 0);
+  HOST_CHECK(payloadBytes() == before);
+
+  delete sub;
+}
+
+/////////////////////////////////////////////////
+
+void setup()
+{
+  testBroadcast();
+  testSlowSubscriber();
+
+  printf("ok fanout\n");
+  host_exit(0);
+}
+
+void loop()
+{
+}
@@ -0,0 +1,207 @@
+/****************************************************************************************************************************
+  AsyncTCP_FrameCodecTest.cpp
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+/*
+  AsyncFrameCodec over loopback connections: a varint prefix wider than 32
+  bits is refused through onOversize() and aborts the connection, instead
+  of being truncated to a short length. A client going back to raw mode
+  gets the window the codec held for a partial frame.
+
+    SANITIZE=address,undefined LWIP_DIR=~/src/lwip ./extras/host/build.sh \
+      extras/host/tests/AsyncTCP_FrameCodecTest.cpp
+*/
+
+#include "Teensy41_AsyncTCP.h"
+
+#include "host_test.h"
+
+/////////////////////////////////////////////////
+
+#define FRAME_TEST_VARINT_PORT    7601
+#define FRAME_TEST_RAW_PORT       7602
+
+/////////////////////////////////////////////////
+
+/*
+  Codec on the server side of a connection. The codec must go before its
+  client, so the disconnect handler deletes both and clears the peer slot.
+*/
+struct FrameTestPeer
+{
+  HostTestServer           *srv;
+  AsyncFrameCodec          *codec;
+  std::vector<std::string>  frames;
+  size_t                    oversize;
+  bool                      oversized;
+  bool                      closed;
+};
+
+static void frameTestAttach(FrameTestPeer *t, atcpFramePrefix_t prefix)
+{
+  AsyncClient *c = t->srv->peers[0].client;
+
+  t->codec = new AsyncFrameCodec(c, prefix);
+  t->oversize = 0;
+  t->oversized = false;
+  t->closed = false;
+
+  HOST_CHECK(t->codec != NULL);
+
+  t->codec->onFrame([](void *arg, AsyncFrameCodec * f, uint8_t *payload, size_t len)
+  {
+    (void) f;
+    ((FrameTestPeer *) arg)->frames.push_back(std::string((const char *) payload, len));
+  }, t);
+
+  t->codec->onOversize([](void *arg, AsyncFrameCodec * f, size_t len)
+  {
+    (void) f;
+    FrameTestPeer *t = (FrameTestPeer *) arg;
+
+    t->oversize = len;
+    t->oversized = true;
+  }, t);
+
+  c->onDisconnect([](void *arg, AsyncClient * c)
+  {
+    FrameTestPeer *t = (FrameTestPeer *) arg;
+
+    delete t->codec;
+    t->codec = NULL;
+
+    t->srv->peers[0].client = NULL;
+    t->closed = true;
+
+    delete c;
+  }, t);
+}
+
+/////////////////////////////////////////////////
+
+static void testVarintOver32Bits()
+{
+  HostTestServer srv(FRAME_TEST_VARINT_PORT);
+  AsyncClient *c = host_test_connect(FRAME_TEST_VARINT_PORT);
+
+  HOST_CHECK(host_wait([&]() { return srv.peers.size() == 1; }));
+
+  FrameTestPeer t;
+
+  t.srv = &srv;
+  frameTestAttach(&t, ATCP_FRAME_PREFIX_VARINT);
+
+  host_test_write(c, std::string("\x02hi", 3));
+  HOST_CHECK(host_wait([&]() { return t.frames.size() == 1; }));
+  HOST_CHECK(t.frames[0] == "hi");
+
+  // 2^32 as LEB128, the 5th byte has bit 4 set. Truncated it reads as an
+  // empty frame and the bytes after it get framed out of sync.
+  host_test_write(c, std::string("\x80\x80\x80\x80\x10" "\x01" "x", 7));
+
+  HOST_CHECK(host_wait([&]() { return t.closed; }));
+  HOST_CHECK(t.oversized && (t.oversize == (size_t) -1));
+  HOST_CHECK(t.frames.size() == 1);
+  HOST_CHECK(host_wait([&]() { return !c->connected(); }));
+
+  delete c;
+}
+
+/////////////////////////////////////////////////
+
+static void testRawAfterCodec()
+{
+  HostTestServer srv(FRAME_TEST_RAW_PORT);
+  AsyncClient *c = host_test_connect(FRAME_TEST_RAW_PORT);
+
+  HOST_CHECK(host_wait([&]() { return srv.peers.size() == 1; }));
+
+  FrameTestPeer t;
+
+  t.srv = &srv;
+  frameTestAttach(&t, ATCP_FRAME_PREFIX_32);
+
+  host_test_write(c, std::string("\0\0\0\x02ok", 6));
+  HOST_CHECK(host_wait([&]() { return t.frames.size() == 1; }));
+
+  // A partial frame above TCP_MSS, below ASYNC_TCP_FRAME_ACK_AHEAD: not acked yet
+  size_t partial = 2000;
+
+  host_test_write(c, std::string("\0\0\x0B\xB8", 4) + host_test_pattern(partial));
+  host_run(200);
+
+  HOST_CHECK(t.frames.size() == 1);
+
+  // Raw mode from here, nothing is acked while reading
+  AsyncClient *peer = srv.peers[0].client;
+  std::string held;
+
+  delete t.codec;
+  t.codec = NULL;
+
+  peer->onData([](void *arg, AsyncClient * c, void *data, size_t len)
+  {
+    ((std::string *) arg)->append((const char *) data, len);
+    c->ackLater();
+  }, &held);
+
+  // Without the window of the partial frame back, this stops short by it
+  std::string bulk = host_test_pattern(3 * TCP_WND);
+  size_t sent = 0;
+
+  HOST_CHECK(host_wait([&]()
+  {
+    size_t n = c->space();
+
+    if (n > bulk.size() - sent)
+      n = bulk.size() - sent;
+
+    if (n)
+    {
+      sent += c->add(bulk.data() + sent, n);
+      c->send();
+    }
+
+    return (held.size() >= TCP_WND - TCP_MSS);
+  }, 5000));
+
+  HOST_CHECK(held == bulk.substr(0, held.size()));
+
+  delete c;
+}
+
+/////////////////////////////////////////////////
+
+void setup()
+{
+  testVarintOver32Bits();
+  testRawAfterCodec();
+
+  printf("ok frame codec\n");
+  host_exit(0);
+}
+
+void loop()
+{
+}
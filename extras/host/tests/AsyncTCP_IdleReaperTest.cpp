@@ -0,0 +1,106 @@
+/****************************************************************************************************************************
+  AsyncTCP_IdleReaperTest.cpp
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+/*
+  Idle reaper (ASYNC_TCP_IDLE_REAPER) over loopback connections: at
+  setMaxClients() a new client closes the least recently active one, and
+  under PCB pressure the poll closes the clients idle for minIdleMs.
+
+    SANITIZE=address,undefined LWIP_DIR=~/src/lwip ./extras/host/build.sh \
+      extras/host/tests/AsyncTCP_IdleReaperTest.cpp
+*/
+
+#define ASYNC_TCP_IDLE_REAPER     1
+
+#include "Teensy41_AsyncTCP.h"
+
+#include "host_test.h"
+
+/////////////////////////////////////////////////
+
+#define REAPER_TEST_PORT          7501
+
+#define REAPER_TEST_CLIENTS       4
+
+/////////////////////////////////////////////////
+
+static void testReaper()
+{
+  HostTestServer srv(REAPER_TEST_PORT);
+  AsyncClient *c[REAPER_TEST_CLIENTS];
+
+  srv.server.setMaxClients(REAPER_TEST_CLIENTS - 1);
+
+  for (int i = 0; i < REAPER_TEST_CLIENTS - 1; i++)
+  {
+    c[i] = host_test_connect(REAPER_TEST_PORT);
+    HOST_CHECK(host_wait([&]() { return srv.peers.size() == (size_t) i + 1; }));
+
+    host_run(20);
+  }
+
+  HOST_CHECK(srv.server.clients() == REAPER_TEST_CLIENTS - 1);
+
+  // Activity makes the oldest client the most recent one
+  host_test_write(c[0], "hello");
+  HOST_CHECK(host_wait([&]() { return srv.peers[0].rx == "hello"; }));
+
+  // At maxClients the least recently active one, the second, is closed
+  c[REAPER_TEST_CLIENTS - 1] = host_test_connect(REAPER_TEST_PORT);
+
+  HOST_CHECK(host_wait([&]() { return srv.disconnects == 1; }));
+  HOST_CHECK(srv.peers[1].client == NULL);
+  HOST_CHECK(srv.server.reaped() == 1);
+  HOST_CHECK(srv.server.clients() == REAPER_TEST_CLIENTS - 1);
+  HOST_CHECK(host_wait([&]() { return !c[1]->connected(); }));
+
+  // Every free PCB short of the threshold, idle clients go on the next polls
+  srv.server.setMaxClients(0);
+  srv.server.setReapThreshold(MEMP_NUM_TCP_PCB, 0, 200);
+
+  HOST_CHECK(host_wait([&]() { return srv.server.clients() == 0; }, 5000));
+  HOST_CHECK(srv.server.reaped() == REAPER_TEST_CLIENTS);
+  HOST_CHECK(srv.disconnects == REAPER_TEST_CLIENTS);
+
+  for (int i = 0; i < REAPER_TEST_CLIENTS; i++)
+  {
+    HOST_CHECK(host_wait([&]() { return !c[i]->connected(); }));
+    delete c[i];
+  }
+}
+
+/////////////////////////////////////////////////
+
+void setup()
+{
+  testReaper();
+
+  printf("ok idle reaper\n");
+  host_exit(0);
+}
+
+void loop()
+{
+}
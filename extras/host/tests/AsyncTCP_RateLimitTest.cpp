@@ -0,0 +1,150 @@
+/****************************************************************************************************************************
+  AsyncTCP_RateLimitTest.cpp
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+/*
+  Token bucket shaping (ASYNC_TCP_RATE_LIMIT) over loopback connections:
+  a client limited on its own, and a server whose accepted clients share one
+  aggregate bucket. Checks the bytes arrive intact and not faster than
+  burst + rate * time allows.
+
+    SANITIZE=address,undefined LWIP_DIR=~/src/lwip ./extras/host/build.sh \
+      extras/host/tests/AsyncTCP_RateLimitTest.cpp
+*/
+
+#define ASYNC_TCP_RATE_LIMIT      1
+
+#include "Teensy41_AsyncTCP.h"
+
+#include "host_test.h"
+
+/////////////////////////////////////////////////
+
+#define RATE_TEST_PORT            7101
+#define RATE_TEST_AGG_PORT        7102
+
+#define RATE_TEST_RATE            20000
+#define RATE_TEST_BURST           2000
+
+/////////////////////////////////////////////////
+
+static void testClientLimit()
+{
+  HostTestServer srv(RATE_TEST_PORT);
+  AsyncClient *c = host_test_connect(RATE_TEST_PORT);
+
+  HOST_CHECK(c->setRateLimit(RATE_TEST_RATE, RATE_TEST_BURST));
+  HOST_CHECK(c->rateLimit() != NULL);
+  HOST_CHECK(c->space() <= RATE_TEST_BURST);
+
+  std::string data = host_test_pattern(10000);
+  uint32_t start = millis();
+
+  host_test_write(c, data);
+  HOST_CHECK(host_wait([&]() { return srv.peers[0].rx.size() == data.size(); }));
+
+  uint32_t elapsed = millis() - start;
+
+  // (10000 - burst) / rate = 400 ms, less a tick of slack
+  HOST_CHECK(elapsed >= 400 - 2 * ASYNC_TCP_RATE_TICK_MS);
+  HOST_CHECK(srv.peers[0].rx == data);
+  HOST_CHECK(c->rateLimit()->passed() == data.size());
+  HOST_CHECK(c->rateLimit()->throttled() > 0);
+
+  // rate 0 removes the limit
+  HOST_CHECK(c->setRateLimit(0, 0));
+  HOST_CHECK(c->rateLimit() == NULL);
+
+  delete c;
+}
+
+/////////////////////////////////////////////////
+
+static void testServerAggregate()
+{
+  HostTestServer srv(RATE_TEST_AGG_PORT);
+
+  HOST_CHECK(srv.server.setRateLimit(RATE_TEST_RATE, RATE_TEST_BURST));
+
+  std::string rx[2];
+  AsyncClient *c[2];
+
+  for (int i = 0; i < 2; i++)
+    c[i] = host_test_connect(RATE_TEST_AGG_PORT, &rx[i]);
+
+  HOST_CHECK(host_wait([&]() { return srv.peers.size() == 2; }));
+
+  std::string data = host_test_pattern(3000);
+  uint32_t start = millis();
+  size_t sent[2] = { 0, 0 };
+
+  // Both accepted clients send at once, the shared bucket splits the rate
+  HOST_CHECK(host_wait([&]()
+  {
+    for (int i = 0; i < 2; i++)
+    {
+      AsyncClient *p = srv.peers[i].client;
+      size_t n = p->space();
+
+      if (n > data.size() - sent[i])
+        n = data.size() - sent[i];
+
+      if (n)
+      {
+        sent[i] += p->add(data.data() + sent[i], n);
+        p->send();
+      }
+    }
+
+    return (rx[0].size() == data.size()) && (rx[1].size() == data.size());
+  }, 5000));
+
+  uint32_t elapsed = millis() - start;
+
+  // (6000 - burst) / rate = 200 ms
+  HOST_CHECK(elapsed >= 200 - 2 * ASYNC_TCP_RATE_TICK_MS);
+  HOST_CHECK((rx[0] == data) && (rx[1] == data));
+  HOST_CHECK(srv.server.rateLimit()->passed() == 2 * data.size());
+
+  for (int i = 0; i < 2; i++)
+    delete c[i];
+}
+
+/////////////////////////////////////////////////
+
+void setup()
+{
+  testClientLimit();
+  testServerAggregate();
+
+  host_run(100);
+  HOST_CHECK(AsyncTCPShaper::waiting() == 0);
+
+  printf("ok rate limit\n");
+  host_exit(0);
+}
+
+void loop()
+{
+}
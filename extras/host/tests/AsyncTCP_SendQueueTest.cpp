@@ -0,0 +1,127 @@
+/****************************************************************************************************************************
+  AsyncTCP_SendQueueTest.cpp
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+/*
+  Bulk and urgent send queues (ASYNC_TCP_PRIORITY_QUEUES) over a loopback
+  connection: urgent data queued behind a large bulk transfer overtakes the
+  queued part of it, every byte arrives once, the queue limit refuses the
+  excess, and close drops what is still queued.
+
+    SANITIZE=address,undefined LWIP_DIR=~/src/lwip ./extras/host/build.sh \
+      extras/host/tests/AsyncTCP_SendQueueTest.cpp
+*/
+
+#define ASYNC_TCP_PRIORITY_QUEUES   1
+
+#include "Teensy41_AsyncTCP.h"
+
+#include "host_test.h"
+
+/////////////////////////////////////////////////
+
+#define QUEUE_TEST_PORT             7201
+#define QUEUE_TEST_CLOSE_PORT       7202
+#define QUEUE_TEST_BULK             50000
+
+/////////////////////////////////////////////////
+
+static void testUrgentOvertakes()
+{
+  HostTestServer srv(QUEUE_TEST_PORT);
+  AsyncClient *c = host_test_connect(QUEUE_TEST_PORT);
+
+  std::string bulk(QUEUE_TEST_BULK, 'b');
+
+  HOST_CHECK(c->queue(bulk.data(), bulk.size()) == bulk.size());
+  HOST_CHECK(c->queued(ATCP_SEND_BULK) > 0);
+
+  // Only what lwIP already holds is ahead of it
+  HOST_CHECK(c->queue("PING", 4, ATCP_SEND_URGENT) == 4);
+
+  std::string &rx = srv.peers[0].rx;
+
+  HOST_CHECK(host_wait([&]() { return rx.size() == bulk.size() + 4; }, 5000));
+
+  size_t pos = rx.find("PING");
+
+  HOST_CHECK(pos != std::string::npos);
+  HOST_CHECK(pos <= TCP_SND_BUF);
+  HOST_CHECK(rx.substr(0, pos) + rx.substr(pos + 4) == bulk);
+
+  const atcpSendStats_t *b = c->sendStats(ATCP_SEND_BULK);
+  const atcpSendStats_t *u = c->sendStats(ATCP_SEND_URGENT);
+
+  HOST_CHECK((b->sent == bulk.size()) && (b->depth == 0) && (b->highWater == bulk.size()));
+  HOST_CHECK((u->sent == 4) && (u->depth == 0));
+  HOST_CHECK((b->refused == 0) && (u->refused == 0));
+  HOST_CHECK((c->queued(ATCP_SEND_BULK) == 0) && (c->queued(ATCP_SEND_URGENT) == 0));
+
+  // Past the limit nothing is queued
+  c->setQueueLimit(ATCP_SEND_BULK, 1000);
+
+  HOST_CHECK(c->queue(bulk.data(), bulk.size()) == 1000);
+  HOST_CHECK(b->refused == bulk.size() - 1000);
+  HOST_CHECK(host_wait([&]() { return rx.size() == bulk.size() + 4 + 1000; }));
+
+  delete c;
+}
+
+/////////////////////////////////////////////////
+
+static void testCloseDropsQueued()
+{
+  HostTestServer srv(QUEUE_TEST_CLOSE_PORT);
+  AsyncClient *c = host_test_connect(QUEUE_TEST_CLOSE_PORT);
+
+  std::string bulk(QUEUE_TEST_BULK, 'q');
+
+  HOST_CHECK(c->queue(bulk.data(), bulk.size()) == bulk.size());
+  HOST_CHECK(c->queued(ATCP_SEND_BULK) > 0);
+
+  // Queued bytes are dropped, not left behind a closed pcb
+  c->close(true);
+
+  HOST_CHECK(c->queued(ATCP_SEND_BULK) == 0);
+  HOST_CHECK(c->sendStats(ATCP_SEND_BULK)->depth == 0);
+  HOST_CHECK(host_wait([&]() { return srv.disconnects == 1; }));
+  HOST_CHECK(srv.peers[0].rx.size() < bulk.size());
+
+  delete c;
+}
+
+/////////////////////////////////////////////////
+
+void setup()
+{
+  testUrgentOvertakes();
+  testCloseDropsQueued();
+
+  printf("ok send queues\n");
+  host_exit(0);
+}
+
+void loop()
+{
+}
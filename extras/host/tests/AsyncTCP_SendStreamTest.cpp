@@ -0,0 +1,226 @@
+/****************************************************************************************************************************
+  AsyncTCP_SendStreamTest.cpp
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+/*
+  Pull based sending (ASYNC_TCP_SEND_STREAM) over a loopback connection:
+  a callback source that stalls once, a Stream source, and a stream cut
+  short by close(). Checks the bytes arrive in order, the completion
+  callback runs once with the right count, and the staging buffer is
+  released every time.
+
+    SANITIZE=address,undefined LWIP_DIR=~/src/lwip ./extras/host/build.sh \
+      extras/host/tests/AsyncTCP_SendStreamTest.cpp
+*/
+
+#define ASYNC_TCP_SEND_STREAM     1
+
+#include "Teensy41_AsyncTCP.h"
+
+#include "host_test.h"
+
+/////////////////////////////////////////////////
+
+#define STREAM_TEST_PORT          7301
+#define STREAM_TEST_STREAM_PORT   7302
+#define STREAM_TEST_CLOSE_PORT    7303
+
+/////////////////////////////////////////////////
+
+class PatternStream : public Stream
+{
+  public:
+    PatternStream(const std::string &data)
+      : _data(data)
+      , _pos(0)
+    {
+    }
+
+    int available()
+    {
+      return _data.size() - _pos;
+    }
+
+    int read()
+    {
+      return (_pos < _data.size()) ? (uint8_t) _data[_pos++] : -1;
+    }
+
+    int peek()
+    {
+      return (_pos < _data.size()) ? (uint8_t) _data[_pos] : -1;
+    }
+
+    size_t write(uint8_t b)
+    {
+      (void) b;
+      return 0;
+    }
+
+  private:
+    const std::string &_data;
+    size_t _pos;
+};
+
+/////////////////////////////////////////////////
+
+struct StreamResult
+{
+  int     calls;
+  size_t  sent;
+  bool    complete;
+};
+
+static void onStreamDone(void *arg, AsyncClient *c, size_t sent, bool complete)
+{
+  (void) c;
+  StreamResult *r = (StreamResult *) arg;
+
+  r->calls++;
+  r->sent = sent;
+  r->complete = complete;
+}
+
+static size_t stagingBytes()
+{
+  return AsyncTCPMemory::classStats(ATCP_MEM_TX_BUFFER).current;
+}
+
+/////////////////////////////////////////////////
+
+static void testSource()
+{
+  HostTestServer srv(STREAM_TEST_PORT);
+  AsyncClient *c = host_test_connect(STREAM_TEST_PORT);
+
+  std::string data = host_test_pattern(100000);
+  StreamResult r = { 0, 0, false };
+  size_t staging = stagingBytes();
+  size_t maxRequest = 0;
+  bool stalled = false;
+
+  HOST_CHECK(c->sendStream([&](uint8_t *buf, size_t len, size_t index) -> size_t
+  {
+    if (len > maxRequest)
+      maxRequest = len;
+
+    // Not ready once, the stream picks up again on the next ACK or poll
+    if ((index > 0) && !stalled)
+    {
+      stalled = true;
+      return 0;
+    }
+
+    memcpy(buf, data.data() + index, len);
+
+    return len;
+  }, data.size(), onStreamDone, &r));
+
+  // One at a time
+  HOST_CHECK(!c->sendStream([](uint8_t *, size_t, size_t) -> size_t { return 0; }, 10));
+  HOST_CHECK(stagingBytes() == staging + ASYNC_TCP_STREAM_CHUNK);
+
+  HOST_CHECK(host_wait([&]() { return srv.peers[0].rx.size() == data.size(); }, 5000));
+
+  HOST_CHECK(stalled);
+  HOST_CHECK(srv.peers[0].rx == data);
+  HOST_CHECK((r.calls == 1) && r.complete && (r.sent == data.size()));
+  HOST_CHECK(maxRequest <= ASYNC_TCP_STREAM_CHUNK);
+  HOST_CHECK(c->streamPending() == 0);
+  HOST_CHECK(stagingBytes() == staging);
+
+  delete c;
+}
+
+/////////////////////////////////////////////////
+
+static void testStream()
+{
+  HostTestServer srv(STREAM_TEST_STREAM_PORT);
+  AsyncClient *c = host_test_connect(STREAM_TEST_STREAM_PORT);
+
+  std::string data = host_test_pattern(20000, 7);
+  PatternStream stream(data);
+  StreamResult r = { 0, 0, false };
+
+  HOST_CHECK(c->sendStream(stream, data.size(), onStreamDone, &r));
+  HOST_CHECK(host_wait([&]() { return r.calls == 1; }, 5000));
+  HOST_CHECK(host_wait([&]() { return srv.peers[0].rx.size() == data.size(); }));
+
+  HOST_CHECK(r.complete && (r.sent == data.size()));
+  HOST_CHECK(srv.peers[0].rx == data);
+
+  delete c;
+}
+
+/////////////////////////////////////////////////
+
+static void testCloseMidway()
+{
+  HostTestServer srv(STREAM_TEST_CLOSE_PORT);
+  AsyncClient *c = host_test_connect(STREAM_TEST_CLOSE_PORT);
+
+  const size_t length = 1000000;
+  StreamResult r = { 0, 0, false };
+  size_t staging = stagingBytes();
+
+  HOST_CHECK(c->sendStream([](uint8_t *buf, size_t len, size_t index) -> size_t
+  {
+    for (size_t i = 0; i < len; i++)
+      buf[i] = 'a' + ((index + i) % 26);
+
+    return len;
+  }, length, onStreamDone, &r));
+
+  HOST_CHECK(host_wait([&]() { return srv.peers[0].rx.size() >= 10000; }));
+
+  c->close(true);
+
+  HOST_CHECK((r.calls == 1) && !r.complete);
+  HOST_CHECK((r.sent >= 10000) && (r.sent < length));
+  HOST_CHECK(c->streamPending() == 0);
+  HOST_CHECK(stagingBytes() == staging);
+
+  // What lwIP had taken is still delivered, in order
+  HOST_CHECK(host_wait([&]() { return srv.disconnects == 1; }));
+  HOST_CHECK(srv.peers[0].rx == host_test_pattern(r.sent));
+
+  delete c;
+}
+
+/////////////////////////////////////////////////
+
+void setup()
+{
+  testSource();
+  testStream();
+  testCloseMidway();
+
+  printf("ok send stream\n");
+  host_exit(0);
+}
+
+void loop()
+{
+}
@@ -0,0 +1,217 @@
+/****************************************************************************************************************************
+  host_test.h
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_HOST_TEST_H_
+#define _TEENSY41_ASYNC_TCP_HOST_TEST_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "host_netif.h"
+
+/////////////////////////////////////////////////
+
+/*
+  Helpers of the feature tests in this directory. A test is a sketch whose
+  setup() runs its checks in order over real connections on the host netif,
+  then calls host_exit(0). A failed check prints where and exits with 1.
+*/
+
+#define HOST_CHECK(cond) \
+  do { if (!(cond)) host_test_fail(__FILE__, __LINE__, #cond); } while (0)
+
+static void host_test_fail(const char *file, int line, const char *cond)
+{
+  printf("FAIL %s:%d: %s\n", file, line, cond);
+  fflush(stdout);
+
+  exit(1);
+}
+
+/////////////////////////////////////////////////
+
+// Runs the stack until cond() holds, false after ms
+template <typename F>
+static bool host_wait(F cond, uint32_t ms = 2000)
+{
+  uint32_t start = millis();
+
+  while (!cond())
+  {
+    if (millis() - start > ms)
+      return false;
+
+    yield();
+  }
+
+  return true;
+}
+
+static void host_run(uint32_t ms)
+{
+  uint32_t start = millis();
+
+  while (millis() - start < ms)
+    yield();
+}
+
+/////////////////////////////////////////////////
+
+/*
+  Server side of the test connections. Accepted clients are kept in order,
+  their received bytes appended to rx, and deleted on disconnect (the slot
+  turns NULL).
+*/
+struct HostTestPeer
+{
+  AsyncClient *client;
+  std::string  rx;
+};
+
+struct HostTestServer
+{
+  AsyncServer               server;
+  std::vector<HostTestPeer> peers;
+  size_t                    disconnects;
+
+  HostTestServer(uint16_t port)
+    : server(port)
+    , disconnects(0)
+  {
+    peers.reserve(64);
+
+    server.onClient([](void *arg, AsyncClient * c)
+    {
+      HostTestServer *s = (HostTestServer *) arg;
+      size_t index = s->peers.size();
+
+      s->peers.push_back({ c, std::string() });
+
+      c->onData([](void *arg, AsyncClient * c, void *data, size_t len)
+      {
+        (void) c;
+        std::string *rx = (std::string *) arg;
+
+        rx->append((const char *) data, len);
+      }, &s->peers[index].rx);
+
+      c->onDisconnect([](void *arg, AsyncClient * c)
+      {
+        HostTestServer *s = (HostTestServer *) arg;
+
+        for (auto &p : s->peers)
+        {
+          if (p.client == c)
+            p.client = NULL;
+        }
+
+        s->disconnects++;
+        delete c;
+      }, s);
+    }, this);
+
+    server.begin();
+  }
+
+  ~HostTestServer()
+  {
+    server.end();
+
+    for (auto &p : peers)
+    {
+      if (p.client)
+      {
+        p.client->onDisconnect(NULL, NULL);
+        delete p.client;
+      }
+    }
+  }
+};
+
+/////////////////////////////////////////////////
+
+// Client end of a test connection, its received bytes appended to *rx
+static AsyncClient * host_test_connect(uint16_t port, std::string *rx = NULL)
+{
+  AsyncClient *c = new AsyncClient();
+
+  HOST_CHECK(c != NULL);
+
+  if (rx)
+  {
+    c->onData([](void *arg, AsyncClient * c, void *data, size_t len)
+    {
+      (void) c;
+      ((std::string *) arg)->append((const char *) data, len);
+    }, rx);
+  }
+
+  HOST_CHECK(c->connect(host_stack_ip(), port));
+  HOST_CHECK(host_wait([c]() { return c->connected(); }));
+
+  return c;
+}
+
+// Pushes all of data through add() / send() as space() allows
+static void host_test_write(AsyncClient *c, const std::string &data, uint32_t ms = 5000)
+{
+  size_t sent = 0;
+
+  HOST_CHECK(host_wait([&]()
+  {
+    size_t n = c->space();
+
+    if (n > data.size() - sent)
+      n = data.size() - sent;
+
+    if (n)
+    {
+      sent += c->add(data.data() + sent, n);
+      c->send();
+    }
+
+    return (sent == data.size());
+  }, ms));
+}
+
+// Text of n bytes that shows reordering and loss
+static std::string host_test_pattern(size_t n, size_t seed = 0)
+{
+  std::string s(n, 0);
+
+  for (size_t i = 0; i < n; i++)
+    s[i] = 'a' + ((i + seed) % 26);
+
+  return s;
+}
+
+/////////////////////////////////////////////////
+
+#endif    // _TEENSY41_ASYNC_TCP_HOST_TEST_H_
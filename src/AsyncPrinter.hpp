@@ -38,6 +38,11 @@
 #include "Teensy41_AsyncTCP.hpp"
 
 #include "cbuf.hpp"
+#include "Teensy41_AsyncTCP_Scheduler.hpp"
+
+#if ASYNC_TCP_PACKET_ONLY
+  #error AsyncPrinter needs AsyncClient::onData(), not available with ASYNC_TCP_PACKET_ONLY
+#endif
 
 /////////////////////////////////////////////////
 
@@ -59,7 +64,15 @@ class AsyncPrinter: public Print
     cbuf *_tx_buffer;
     size_t _tx_buffer_size;
 
+#if ASYNC_TCP_TX_SCHEDULER
+    AsyncTCPFlow _flow;
+
+    static size_t _s_flowSend(void *arg, size_t budget);
+    static size_t _s_flowPending(void *arg);
+#endif
+
     void _onConnect(AsyncClient *c);
+    void _send();
 
   public:
     AsyncPrinter *next;
@@ -84,7 +97,15 @@ class AsyncPrinter: public Print
     bool connected();
     void close();
 
-    size_t _sendBuffer();
+#if ASYNC_TCP_TX_SCHEDULER
+    // Weight and queueing delay of this printer in the TX scheduler
+    AsyncTCPFlow & flow()
+    {
+      return _flow;
+    }
+#endif
+
+    size_t _sendBuffer(size_t budget = (size_t) -1);
     void _onData(void *data, size_t len);
     void _on_close();
     void _attachCallbacks();
@@ -33,6 +33,8 @@
 #ifndef _TEENSY41_ASYNC_PRINTER_IMPL_H_
 #define _TEENSY41_ASYNC_PRINTER_IMPL_H_
 
+#if !TEENSY41_ASYNC_TCP_COMPILED || defined(_TEENSY41_ASYNC_TCP_LIBRARY_)
+
 /////////////////////////////////////////////////
 
 AsyncPrinter::AsyncPrinter()
@@ -43,6 +45,9 @@ AsyncPrinter::AsyncPrinter()
   , _close_arg(NULL)
   , _tx_buffer(NULL)
   , _tx_buffer_size(TCP_MSS)
+#if ASYNC_TCP_TX_SCHEDULER
+  , _flow(_s_flowSend, _s_flowPending, this)
+#endif
   , next(NULL)
 {}
 
@@ -56,15 +61,20 @@ AsyncPrinter::AsyncPrinter(AsyncClient *client, size_t txBufLen)
   , _close_arg(NULL)
   , _tx_buffer(NULL)
   , _tx_buffer_size(txBufLen)
+#if ASYNC_TCP_TX_SCHEDULER
+  , _flow(_s_flowSend, _s_flowPending, this)
+#endif
   , next(NULL)
 {
   _attachCallbacks();
-  _tx_buffer = new (std::nothrow) cbuf(_tx_buffer_size);
+  _tx_buffer = new (std::nothrow) cbuf(_tx_buffer_size, ATCP_MEM_TX_BUFFER);
 
   if (_tx_buffer == NULL)
   {
     //What should we do?
   }
+  else if (_client != NULL)
+    _tx_buffer->setUsage(_client->memUsage());
 }
 
 /////////////////////////////////////////////////
@@ -157,8 +167,6 @@ int AsyncPrinter::connect(const char *host, uint16_t port)
 
 void AsyncPrinter::_onConnect(AsyncClient *c)
 {
-  (void) c;
-
   if (_tx_buffer != NULL)
   {
     cbuf *b = _tx_buffer;
@@ -166,7 +174,7 @@ void AsyncPrinter::_onConnect(AsyncClient *c)
     delete b;
   }
 
-  _tx_buffer = new (std::nothrow) cbuf(_tx_buffer_size);
+  _tx_buffer = new (std::nothrow) cbuf(_tx_buffer_size, ATCP_MEM_TX_BUFFER);
 
   if (!_tx_buffer)
   {
@@ -174,6 +182,8 @@ void AsyncPrinter::_onConnect(AsyncClient *c)
 	return;
   }
 
+  _tx_buffer->setUsage(c->memUsage());
+
   _attachCallbacks();
 }
 
@@ -201,7 +211,7 @@ AsyncPrinter & AsyncPrinter::operator=(const AsyncPrinter &other)
     delete b;
   }
 
-  _tx_buffer = new (std::nothrow) cbuf(other._tx_buffer_size);
+  _tx_buffer = new (std::nothrow) cbuf(other._tx_buffer_size, ATCP_MEM_TX_BUFFER);
 
   if (_tx_buffer == NULL)
   {
@@ -209,6 +219,10 @@ AsyncPrinter & AsyncPrinter::operator=(const AsyncPrinter &other)
   }
 
   _client = other._client;
+
+  if (_tx_buffer != NULL && _client != NULL)
+    _tx_buffer->setUsage(_client->memUsage());
+
   _attachCallbacks();
 
   return *this;
@@ -242,7 +256,7 @@ size_t AsyncPrinter::write(const uint8_t *data, size_t len)
     if (!connected())
       return 0; // or len - toSend;
 
-    _sendBuffer();
+    _send();
     toSend -= toWrite;
   }
 
@@ -254,7 +268,7 @@ size_t AsyncPrinter::write(const uint8_t *data, size_t len)
   if (!connected())
     return 0; // or len - toSend;
 
-  _sendBuffer();
+  _send();
 
   return len;
 }
@@ -276,43 +290,82 @@ void AsyncPrinter::close()
 
 /////////////////////////////////////////////////
 
-size_t AsyncPrinter::_sendBuffer()
+// Sends directly, or through the TX scheduler when this printer gets its turn
+void AsyncPrinter::_send()
+{
+#if ASYNC_TCP_TX_SCHEDULER
+  _flow.ready();
+#else
+  _sendBuffer();
+#endif
+}
+
+/////////////////////////////////////////////////
+
+#if ASYNC_TCP_TX_SCHEDULER
+size_t AsyncPrinter::_s_flowSend(void *arg, size_t budget)
+{
+  return ((AsyncPrinter*)(arg))->_sendBuffer(budget);
+}
+
+/////////////////////////////////////////////////
+
+size_t AsyncPrinter::_s_flowPending(void *arg)
+{
+  AsyncPrinter *p = (AsyncPrinter*)(arg);
+
+  return (p->connected() && p->_tx_buffer) ? p->_tx_buffer->available() : 0;
+}
+
+/////////////////////////////////////////////////
+#endif
+
+size_t AsyncPrinter::_sendBuffer(size_t budget)
 {
   size_t sent_total = 0;
 
   if (!connected() || !_client->canSend() || _tx_buffer->available() == 0)
     return 0;
 
-  // Try to push out as much data as the client can currently accept. The
-  // buffer contents must remain untouched until we know how many bytes were
-  // actually queued in lwIP, otherwise unsent bytes would be lost.
-  while (connected() && _client->canSend() && (_tx_buffer->available() > 0))
+  // Hand the ring memory straight to lwIP, which copies it into its own
+  // segments. Bytes are only released from the ring once lwIP queued them,
+  // otherwise unsent bytes would be lost.
+  while (connected() && _client->canSend() && (_tx_buffer->available() > 0) && (sent_total < budget))
   {
-    size_t available = _tx_buffer->available();
-    size_t sendable = _client->space();
+    const char *data1, *data2;
+    size_t len1, len2;
 
-    if (sendable < available)
-      available = sendable;
+    _tx_buffer->readSpans(&data1, &len1, &data2, &len2);
 
-    char *out = new (std::nothrow) char[available];
+    // At most budget bytes, from the first span on
+    size_t left = budget - sent_total;
 
-    if (out == NULL)
+    if (len1 >= left)
     {
-      // Connection should be aborted instead
-      ATCP_LOGERROR("AsyncPrinter:_sendBuffer: Error NULL out");
-      break;
+      len1 = left;
+      len2 = 0;
+    }
+    else if (len2 > left - len1)
+    {
+      len2 = left - len1;
     }
 
-    _tx_buffer->peek(out, available);
-    size_t sent = _client->write((const char*) out, available, ASYNC_WRITE_FLAG_COPY);
-    _tx_buffer->remove(sent);
-    delete[] out;
+    size_t sent = _client->add(data1, len1, ASYNC_WRITE_FLAG_COPY);
+
+    if (sent == len1 && len2 > 0)
+      sent += _client->add(data2, len2, ASYNC_WRITE_FLAG_COPY);
+
+    if (sent == 0)
+      break;
+
+    _tx_buffer->commitRead(sent);
+    _client->send();
 
     sent_total += sent;
 
     // If we could not send everything, leave remaining data in the buffer for
     // a later attempt.
-    if (sent != available)
+    if (sent != len1 + len2)
       break;
   }
 
@@ -354,7 +407,7 @@ void AsyncPrinter::_attachCallbacks()
   _client->onPoll([](void *obj, AsyncClient * c)
   {
     (void) c;
-    ((AsyncPrinter*)(obj))->_sendBuffer();
+    ((AsyncPrinter*)(obj))->_send();
   }, this);
 
   _client->onAck([](void *obj, AsyncClient * c, size_t len, uint32_t time)
@@ -362,7 +415,7 @@ void AsyncPrinter::_attachCallbacks()
     (void) c;
     (void) len;
     (void) time;
-    ((AsyncPrinter*)(obj))->_sendBuffer();
+    ((AsyncPrinter*)(obj))->_send();
   }, this);
 
   _client->onDisconnect([](void *obj, AsyncClient * c)
@@ -380,4 +433,6 @@ void AsyncPrinter::_attachCallbacks()
 
 /////////////////////////////////////////////////
 
+#endif    // TEENSY41_ASYNC_TCP_COMPILED
+
 #endif    // _TEENSY41_ASYNC_PRINTER_IMPL_H_
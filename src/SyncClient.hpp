@@ -43,7 +43,14 @@
 /////////////////////////////////////////////////
 
 #include "Client.h"
-#include <vector>
+
+#include "cbuf.hpp"
+#include "Teensy41_AsyncTCP_Search.hpp"
+
+extern "C"
+{
+  #include "lwip/pbuf.h"
+}
 
 // Needed for Arduino core releases prior to 2.5.0, because of changes
 // made to accommodate Arduino core 2.5.0
@@ -52,6 +59,13 @@
   #define CONST
 #endif
 
+// Upper bound of received, not yet read bytes held per SyncClient. Received
+// pbufs are only acked when read, so the peer is normally throttled by the
+// TCP window long before this is reached.
+#ifndef SYNC_CLIENT_MAX_RX_QUEUED
+  #define SYNC_CLIENT_MAX_RX_QUEUED     TCP_WND
+#endif
+
 /////////////////////////////////////////////////
 
 class AsyncClient;
@@ -62,15 +76,24 @@ class SyncClient: public Client
 {
   private:
     AsyncClient *_client;
-    std::vector<uint8_t> _tx_buffer;
-    size_t _tx_buffer_head;
+    cbuf *_tx_buffer;
     size_t _tx_buffer_size;
-    std::vector<uint8_t> _rx_buffer;
-    size_t _rx_buffer_head;
+    // RX queue of received pbufs, linked through pbuf->next
+    struct pbuf *_rx_head;
+    struct pbuf *_rx_tail;
+    size_t _rx_head_offset;
+    size_t _rx_queued;
+    size_t _rx_max_queued;
+    // Connection the buffers and queued pbufs are accounted to
+    AsyncTCPMemUsage *_usage;
     int *_ref;
 
     size_t _sendBuffer();
-    void _onData(void *data, size_t len);
+    void _onPacket(struct pbuf *pb);
+    size_t _rxRead(uint8_t *data, size_t len);
+    void _rxTakeFrom(SyncClient &other);
+    void _rxFree();
+    void _setUsage(AsyncTCPMemUsage *usage);
     void _onConnect(AsyncClient *c);
     void _onDisconnect();
     void _attachCallbacks();
@@ -144,6 +167,12 @@ class SyncClient: public Client
 
     void setTimeout(uint32_t seconds);
 
+    // Max received, not yet read bytes. Exceeding it aborts the connection.
+    void setRxBufferCap(size_t maxQueued)
+    {
+      _rx_max_queued = maxQueued;
+    }
+
     uint8_t status();
     uint8_t connected();
 
@@ -167,6 +196,17 @@ class SyncClient: public Client
     int peek();
     int read();
     int read(uint8_t *data, size_t len);
+
+    // Reads up to len bytes, stopping right after the delimiter (which is
+    // copied too). *found tells whether it was reached; a partial match is
+    // kept in the delimiter for the next call. -1 if nothing is queued.
+    int readUntil(AsyncTCPDelimiter &delimiter, uint8_t *data, size_t len, bool *found);
+
+    // Bulk hooks of the patched Stream (Packages_Patches), so readBytes(),
+    // readBytesUntil() and readStringUntil() work on whole pbufs
+    size_t readAvailable(char *buffer, size_t length);
+    size_t peekSpan(const char **data);
+    void consume(size_t length);
 };
 
 /////////////////////////////////////////////////
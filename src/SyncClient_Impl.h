@@ -33,6 +33,8 @@
 #ifndef _TEENSY41_ASYNC_TCP_SYNC_CLIENT_IMPL_H_
 #define _TEENSY41_ASYNC_TCP_SYNC_CLIENT_IMPL_H_
 
+#if !TEENSY41_ASYNC_TCP_COMPILED || defined(_TEENSY41_ASYNC_TCP_LIBRARY_)
+
 #include "Arduino.h"
 #include "SyncClient.hpp"
 
@@ -70,14 +72,17 @@ static_assert(LWIP_NETIF_TX_SINGLE_PBUF, "Required, tcp_write() must always copy
 
 SyncClient::SyncClient(size_t txBufLen)
   : _client(NULL)
-  , _tx_buffer()
-  , _tx_buffer_head(0)
+  , _tx_buffer(NULL)
   , _tx_buffer_size(txBufLen)
-  , _rx_buffer()
-  , _rx_buffer_head(0)
+  , _rx_head(NULL)
+  , _rx_tail(NULL)
+  , _rx_head_offset(0)
+  , _rx_queued(0)
+  , _rx_max_queued(SYNC_CLIENT_MAX_RX_QUEUED)
+  , _usage(NULL)
   , _ref(NULL)
 {
-  _tx_buffer.reserve(txBufLen);
+  _tx_buffer = new (std::nothrow) cbuf(_tx_buffer_size, ATCP_MEM_TX_BUFFER);
   ref();
 }
 
@@ -85,14 +90,21 @@ SyncClient::SyncClient(size_t txBufLen)
 
 SyncClient::SyncClient(AsyncClient *client, size_t txBufLen)
   : _client(client)
-  , _tx_buffer()
-  , _tx_buffer_head(0)
+  , _tx_buffer(NULL)
   , _tx_buffer_size(txBufLen)
-  , _rx_buffer()
-  , _rx_buffer_head(0)
+  , _rx_head(NULL)
+  , _rx_tail(NULL)
+  , _rx_head_offset(0)
+  , _rx_queued(0)
+  , _rx_max_queued(SYNC_CLIENT_MAX_RX_QUEUED)
+  , _usage(NULL)
   , _ref(NULL)
 {
-  _tx_buffer.reserve(txBufLen);
+  _tx_buffer = new (std::nothrow) cbuf(_tx_buffer_size, ATCP_MEM_TX_BUFFER);
+
+  if (_client != NULL)
+    _setUsage(_client->memUsage());
+
   if (ref() > 0 && _client != NULL)
     _attachCallbacks();
 }
@@ -103,6 +115,15 @@ SyncClient::~SyncClient()
 {
   if (0 == unref())
     _release();
+
+  _setUsage(NULL);
+
+  if (_tx_buffer != NULL)
+  {
+    cbuf *b = _tx_buffer;
+    _tx_buffer = NULL;
+    delete b;
+  }
 }
 
 /////////////////////////////////////////////////
@@ -111,17 +132,20 @@ void SyncClient::_release()
 {
   if (_client != NULL)
   {
+#if !ASYNC_TCP_PACKET_ONLY
     _client->onData(NULL, NULL);
+#endif
+    _client->onPacket(NULL, NULL);
     _client->onAck(NULL, NULL);
     _client->onPoll(NULL, NULL);
     _client->abort();
     _client = NULL;
   }
 
-  _tx_buffer.clear();
-  _tx_buffer_head = 0;
-  _rx_buffer.clear();
-  _rx_buffer_head = 0;
+  if (_tx_buffer != NULL)
+    _tx_buffer->flush();
+
+  _rxFree();
 }
 
 /////////////////////////////////////////////////
@@ -130,7 +154,7 @@ int SyncClient::ref()
 {
   if (_ref == NULL)
   {
-    _ref = new (std::nothrow) int;
+    _ref = (int *) AsyncTCPMemory::alloc(ATCP_MEM_OBJECT, sizeof(int));
 
     if (_ref != NULL)
       *_ref = 0;
@@ -153,7 +177,7 @@ int SyncClient::unref()
 
     if (0 == count)
     {
-      delete _ref;
+      AsyncTCPMemory::free(_ref);
       _ref = NULL;
     }
   }
@@ -277,11 +301,10 @@ SyncClient & SyncClient::operator=(const SyncClient &other)
   --*rhsref;
   // Transfer buffer contents and state
   _tx_buffer_size    = other._tx_buffer_size;
-  _tx_buffer         = other._tx_buffer;
-  _tx_buffer_head    = other._tx_buffer_head;
+  std::swap(_tx_buffer, const_cast<SyncClient&>(other)._tx_buffer);
   _client            = other._client;
-  _rx_buffer         = other._rx_buffer;
-  _rx_buffer_head    = other._rx_buffer_head;
+  _setUsage(_client ? _client->memUsage() : NULL);
+  _rxTakeFrom(const_cast<SyncClient&>(other));
 
   if (_client)
     _attachCallbacks();
@@ -307,18 +330,17 @@ SyncClient & SyncClient::operator=(const SyncClient &other)
 
   _tx_buffer_size = other._tx_buffer_size;
 
-  _tx_buffer.clear();
-  _tx_buffer_head = 0;
-  _rx_buffer.clear();
-  _rx_buffer_head = 0;
-
   if (other._client != NULL)
     _client = other._client;
 
-  _tx_buffer      = other._tx_buffer;
-  _tx_buffer_head = other._tx_buffer_head;
-  _rx_buffer      = other._rx_buffer;
-  _rx_buffer_head = other._rx_buffer_head;
+  // Staged TX data and queued pbufs can have only one owner, move them over
+  // with the callbacks. other keeps our emptied ring.
+  if (_tx_buffer != NULL)
+    _tx_buffer->flush();
+
+  std::swap(_tx_buffer, const_cast<SyncClient&>(other)._tx_buffer);
+  _setUsage(_client ? _client->memUsage() : NULL);
+  _rxTakeFrom(const_cast<SyncClient&>(other));
 
   if (_client)
     _attachCallbacks();
@@ -371,53 +393,203 @@ bool SyncClient::stop(unsigned int maxWaitMs)
 
 size_t SyncClient::_sendBuffer()
 {
-  if (_client == NULL)
+  if (_client == NULL || _tx_buffer == NULL)
     return 0;
 
-  if (!connected() || !_client->canSend() || (_tx_buffer_head >= _tx_buffer.size()))
+  if (!connected() || !_client->canSend() || _tx_buffer->empty())
     return 0;
 
   size_t sent_total = 0;
 
-  while (connected() && _client->canSend() && (_tx_buffer_head < _tx_buffer.size()))
+  while (connected() && _client->canSend() && !_tx_buffer->empty())
   {
-    size_t available = _tx_buffer.size() - _tx_buffer_head;
-    size_t sendable = _client->space();
-    if (sendable < available)
-      available = sendable;
+    const char *data1, *data2;
+    size_t len1, len2;
+
+    _tx_buffer->readSpans(&data1, &len1, &data2, &len2);
+
+    size_t sent = _client->add(data1, len1, ASYNC_WRITE_FLAG_COPY);
+
+    if (sent == len1 && len2 > 0)
+      sent += _client->add(data2, len2, ASYNC_WRITE_FLAG_COPY);
+
+    if (sent == 0)
+      break;
 
-    size_t sent = _client->write((const char*)(&_tx_buffer[_tx_buffer_head]), available, ASYNC_WRITE_FLAG_COPY);
-    _tx_buffer_head += sent;
+    _tx_buffer->commitRead(sent);
+    _client->send();
     sent_total += sent;
 
-    if (sent != available)
+    if (sent != len1 + len2)
       break;
+  }
+
+  return sent_total;
+}
+
+/////////////////////////////////////////////////
+
+/*
+  Received pbufs are kept as they are, linked through pbuf->next, and served
+  to read() / peek() directly. AsyncClient hands over ownership of each pbuf
+  in the onPacket() path, so no extra reference is taken. The data is acked
+  only when read, which lets the TCP window throttle a slow reader.
+*/
+void SyncClient::_onPacket(struct pbuf *pb)
+{
+  if (pb->len == 0)
+  {
+    _client->ackPacket(pb);
+    return;
+  }
+
+  if (_rx_queued + pb->len > _rx_max_queued)
+  {
+    // Over the RX cap; abort rather than silently drop data
+    ATCP_LOGERROR1("SyncClient::_onPacket: RX cap exceeded, queued =", _rx_queued);
+
+    pbuf_free(pb);
+    _client->abort();
+
+    return;
+  }
+
+  pb->next = NULL;
+
+  if (_rx_tail != NULL)
+    _rx_tail->next = pb;
+  else
+    _rx_head = pb;
+
+  _rx_tail = pb;
+  _rx_queued += pb->len;
+  _client->_rx_ack_len += pb->len;
+
+  AsyncTCPMemory::charge(ATCP_MEM_PBUF, pb->len);
+
+  if (_usage != NULL)
+    _usage->charge(ATCP_MEM_PBUF, pb->len);
+}
+
+/////////////////////////////////////////////////
 
-    if (_tx_buffer_head == _tx_buffer.size())
+size_t SyncClient::_rxRead(uint8_t *data, size_t len)
+{
+  size_t copied = 0;
+
+  while (_rx_head != NULL && copied < len)
+  {
+    size_t chunk = std::min(len - copied, (size_t) _rx_head->len - _rx_head_offset);
+
+    if (data != NULL)
+      memcpy(data + copied, static_cast<uint8_t*>(_rx_head->payload) + _rx_head_offset, chunk);
+
+    copied += chunk;
+    _rx_head_offset += chunk;
+
+    if (_rx_head_offset == _rx_head->len)
     {
-      _tx_buffer.clear();
-      _tx_buffer_head = 0;
+      pbuf *b = _rx_head;
+      _rx_head = b->next;
+      b->next = NULL;
+
+      AsyncTCPMemory::release(ATCP_MEM_PBUF, b->len);
+
+      if (_usage != NULL)
+        _usage->release(ATCP_MEM_PBUF, b->len);
+
+      pbuf_free(b);
+      _rx_head_offset = 0;
+
+      if (_rx_head == NULL)
+        _rx_tail = NULL;
     }
   }
 
-  return sent_total;
+  _rx_queued -= copied;
+
+  return copied;
+}
+
+/////////////////////////////////////////////////
+
+void SyncClient::_rxTakeFrom(SyncClient &other)
+{
+  if (&other == this)
+    return;
+
+  _rxFree();
+
+  // Queued pbufs change hands, so does their accounting
+  size_t held = other._rx_queued + other._rx_head_offset;
+
+  if (other._usage != NULL)
+    other._usage->release(ATCP_MEM_PBUF, held);
+
+  if (_usage != NULL)
+    _usage->charge(ATCP_MEM_PBUF, held);
+
+  _rx_head          = other._rx_head;
+  _rx_tail          = other._rx_tail;
+  _rx_head_offset   = other._rx_head_offset;
+  _rx_queued        = other._rx_queued;
+  _rx_max_queued    = other._rx_max_queued;
+
+  other._rx_head        = NULL;
+  other._rx_tail        = NULL;
+  other._rx_head_offset = 0;
+  other._rx_queued      = 0;
+}
+
+/////////////////////////////////////////////////
+
+void SyncClient::_rxFree()
+{
+  while (_rx_head != NULL)
+  {
+    pbuf *b = _rx_head;
+    _rx_head = b->next;
+    b->next = NULL;
+
+    AsyncTCPMemory::release(ATCP_MEM_PBUF, b->len);
+
+    if (_usage != NULL)
+      _usage->release(ATCP_MEM_PBUF, b->len);
+
+    pbuf_free(b);
+  }
+
+  _rx_tail = NULL;
+  _rx_head_offset = 0;
+  _rx_queued = 0;
 }
 
 /////////////////////////////////////////////////
 
-void SyncClient::_onData(void *data, size_t len)
+void SyncClient::_setUsage(AsyncTCPMemUsage *usage)
 {
-  _client->ackLater();
-  uint8_t *bytes = static_cast<uint8_t*>(data);
-  try
+  // The TX ring may have been swapped in from another SyncClient
+  if (_tx_buffer != NULL)
+    _tx_buffer->setUsage(usage);
+
+  if (usage == _usage)
+    return;
+
+  size_t held = _rx_queued + _rx_head_offset;
+
+  if (usage != NULL)
   {
-    _rx_buffer.insert(_rx_buffer.end(), bytes, bytes + len);
+    usage->ref();
+    usage->charge(ATCP_MEM_PBUF, held);
   }
-  catch (...)
+
+  if (_usage != NULL)
   {
-    // Ran out of memory; abort to avoid data corruption
-    _client->abort();
+    _usage->release(ATCP_MEM_PBUF, held);
+    _usage->unref();
   }
+
+  _usage = usage;
 }
 
 /////////////////////////////////////////////////
@@ -428,8 +600,9 @@ void SyncClient::_onDisconnect()
   {
     _client = NULL;
   }
-  _tx_buffer.clear();
-  _tx_buffer_head = 0;
+
+  if (_tx_buffer != NULL)
+    _tx_buffer->flush();
 }
 
 /////////////////////////////////////////////////
@@ -438,9 +611,12 @@ void SyncClient::_onConnect(AsyncClient *c)
 {
   _client = c;
 
-  _tx_buffer.clear();
-  _tx_buffer_head = 0;
-  _tx_buffer.reserve(_tx_buffer_size);
+  if (_tx_buffer != NULL)
+    _tx_buffer->flush();
+  else
+    _tx_buffer = new (std::nothrow) cbuf(_tx_buffer_size, ATCP_MEM_TX_BUFFER);
+
+  _setUsage(c->memUsage());
   _attachCallbacks_AfterConnected();
 }
 
@@ -465,10 +641,10 @@ void SyncClient::_attachCallbacks_AfterConnected()
     ((SyncClient*)(obj))->_sendBuffer();
   }, this);
 
-  _client->onData([](void *obj, AsyncClient * c, void *data, size_t len)
+  _client->onPacket([](void *obj, AsyncClient * c, struct pbuf * pb)
   {
     (void) c;
-    ((SyncClient*)(obj))->_onData(data, len);
+    ((SyncClient*)(obj))->_onPacket(pb);
   }, this);
 
   _client->onTimeout([](void *obj, AsyncClient * c, uint32_t time)
@@ -483,6 +659,9 @@ void SyncClient::_attachCallbacks_AfterConnected()
 
 void SyncClient::_attachCallbacks_Disconnect()
 {
+  // The blocking calls wait for these handlers inside delay()
+  _client->setDeferred(false);
+
   _client->onDisconnect([](void *obj, AsyncClient * c)
   {
     ((SyncClient*)(obj))->_onDisconnect();
@@ -499,6 +678,11 @@ size_t SyncClient::write(uint8_t data)
 
 /////////////////////////////////////////////////
 
+/*
+  Data goes straight to lwIP (one copy) while nothing is staged and the
+  sndbuf has room. Only the remainder is staged in the TX ring and pushed
+  out from onAck().
+*/
 size_t SyncClient::write(const uint8_t *data, size_t len)
 {
   if (_client == NULL || !connected())
@@ -508,28 +692,33 @@ size_t SyncClient::write(const uint8_t *data, size_t len)
 
   while (written < len)
   {
-    size_t buffered = _tx_buffer.size() - _tx_buffer_head;
-    size_t space = (_tx_buffer_size > buffered) ? (_tx_buffer_size - buffered) : 0;
-
-    if (space == 0)
+    if ((_tx_buffer == NULL || _tx_buffer->empty()) && _client->space() > 0)
     {
-      while (connected() && !_client->canSend())
-        delay(0);
+      written += _client->write((const char*) (data + written), len - written, ASYNC_WRITE_FLAG_COPY);
 
-      if (!connected())
-        return written;
+      if (written == len)
+        break;
+    }
 
-      _sendBuffer();
-      buffered = _tx_buffer.size() - _tx_buffer_head;
-      space = (_tx_buffer_size > buffered) ? (_tx_buffer_size - buffered) : 0;
+    if (_tx_buffer != NULL)
+    {
+      written += _tx_buffer->write((const char*) (data + written), len - written);
 
-      if (space == 0)
+      if (written == len)
         break;
     }
 
-    size_t toCopy = std::min(space, len - written);
-    _tx_buffer.insert(_tx_buffer.end(), data + written, data + written + toCopy);
-    written += toCopy;
+    // Ring full, wait for lwIP to take some of it
+    while (connected() && !_client->canSend())
+      delay(0);
+
+    if (!connected())
+      return written;
+
+    _sendBuffer();
+
+    if (_tx_buffer != NULL && _tx_buffer->full())
+      break;
   }
 
   if (connected() && _client->canSend())
@@ -542,43 +731,95 @@ size_t SyncClient::write(const uint8_t *data, size_t len)
 
 int SyncClient::available()
 {
-  return static_cast<int>(_rx_buffer.size() - _rx_buffer_head);
+  return static_cast<int>(_rx_queued);
 }
 
 /////////////////////////////////////////////////
 
 int SyncClient::peek()
 {
-  if (_rx_buffer_head >= _rx_buffer.size())
+  if (_rx_head == NULL)
     return -1;
-  return _rx_buffer[_rx_buffer_head];
+
+  return static_cast<uint8_t*>(_rx_head->payload)[_rx_head_offset];
 }
 
 /////////////////////////////////////////////////
 
 int SyncClient::read(uint8_t *data, size_t len)
 {
-  size_t available = _rx_buffer.size() - _rx_buffer_head;
-  if (available == 0)
+  if (_rx_queued == 0)
+    return -1;
+
+  size_t toRead = _rxRead(data, len);
+
+  if (toRead && connected())
+    _client->ack(toRead);
+
+  return static_cast<int>(toRead);
+}
+
+/////////////////////////////////////////////////
+
+int SyncClient::readUntil(AsyncTCPDelimiter &delimiter, uint8_t *data, size_t len, bool *found)
+{
+  *found = false;
+
+  if (_rx_queued == 0)
     return -1;
 
-  size_t toRead = std::min(len, available);
-  std::copy(_rx_buffer.begin() + _rx_buffer_head,
-            _rx_buffer.begin() + _rx_buffer_head + toRead,
-            data);
-  _rx_buffer_head += toRead;
-  if (_rx_buffer_head == _rx_buffer.size())
+  size_t copied = 0;
+
+  // Scan the queued pbufs in place, copying only what is consumed
+  for (pbuf *b = _rx_head; (b != NULL) && (copied < len) && !*found; b = b->next)
   {
-    _rx_buffer.clear();
-    _rx_buffer_head = 0;
+    size_t offset = (b == _rx_head) ? _rx_head_offset : 0;
+    size_t chunk = std::min(len - copied, (size_t) b->len - offset);
+
+    copied += delimiter.feed(static_cast<const char*>(b->payload) + offset, chunk, found);
   }
+
+  size_t toRead = _rxRead(data, copied);
+
   if (toRead && connected())
     _client->ack(toRead);
+
   return static_cast<int>(toRead);
 }
 
 /////////////////////////////////////////////////
 
+size_t SyncClient::readAvailable(char *buffer, size_t length)
+{
+  int res = read((uint8_t *) buffer, length);
+
+  return (res > 0) ? res : 0;
+}
+
+/////////////////////////////////////////////////
+
+size_t SyncClient::peekSpan(const char **data)
+{
+  if (_rx_head == NULL)
+    return 0;
+
+  *data = static_cast<const char*>(_rx_head->payload) + _rx_head_offset;
+
+  return _rx_head->len - _rx_head_offset;
+}
+
+/////////////////////////////////////////////////
+
+void SyncClient::consume(size_t length)
+{
+  size_t dropped = _rxRead(NULL, length);
+
+  if (dropped && connected())
+    _client->ack(dropped);
+}
+
+/////////////////////////////////////////////////
+
 int SyncClient::read()
 {
   uint8_t res = 0;
@@ -598,7 +839,7 @@ bool SyncClient::flush(unsigned int maxWaitMs)
   if (_client == NULL || !connected())
     return false;
 
-  if (_tx_buffer_head < _tx_buffer.size())
+  if (_tx_buffer != NULL && !_tx_buffer->empty())
   {
     while (connected() && !_client->canSend())
       delay(0);
@@ -609,9 +850,11 @@ bool SyncClient::flush(unsigned int maxWaitMs)
     _sendBuffer();
   }
 
-  return (_tx_buffer_head == _tx_buffer.size());
+  return (_tx_buffer == NULL || _tx_buffer->empty());
 }
 
 /////////////////////////////////////////////////
 
+#endif    // TEENSY41_ASYNC_TCP_COMPILED
+
 #endif    // _TEENSY41_ASYNC_TCP_SYNC_CLIENT_IMPL_H_
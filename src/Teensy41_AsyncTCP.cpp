@@ -0,0 +1,48 @@
+/****************************************************************************************************************************
+  Teensy41_AsyncTCP.cpp
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+// Compiled library layout, opt-in with the global build flag TEENSY41_ASYNC_TCP_COMPILED=1
+// (platformio.ini build_flags or boards.local.txt). Without it this file is empty and the
+// library stays header-only, Teensy41_AsyncTCP.h pulling the _Impl.h files in one sketch TU.
+//
+// With it, every sketch file may include Teensy41_AsyncTCP.h, the implementation is built once
+// here. Configuration macros such as ASYNC_TCP_STATIC_MEMORY or ASYNC_TCP_PACKET_ONLY change the
+// class layout, so they must also be global build flags, not #defines in the sketch
+
+#if TEENSY41_ASYNC_TCP_COMPILED
+
+#define _TEENSY41_ASYNC_TCP_LIBRARY_
+
+#include "Teensy41_AsyncTCP.h"
+
+#include "SyncClient.hpp"
+#include "SyncClient_Impl.h"
+
+#if !ASYNC_TCP_PACKET_ONLY
+  #include "Teensy41_AsyncTCP_Buffer.hpp"
+  #include "Teensy41_AsyncTCP_Buffer_Impl.h"
+#endif
+
+#endif    // TEENSY41_ASYNC_TCP_COMPILED
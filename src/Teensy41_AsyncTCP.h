@@ -57,6 +57,11 @@
   // Use true for NativeEthernet Library, false if using other Ethernet libraries
   #define USE_NATIVE_ETHERNET     false
   #define USE_QN_ETHERNET         true
+#elif defined(TEENSY41_ASYNC_TCP_HOST)
+  // Linux host build against upstream lwIP, see extras/host
+  #define BOARD_NAME              "HOST"
+  #define USE_NATIVE_ETHERNET     false
+  #define USE_QN_ETHERNET         true
 #else
   #error Only Teensy 4.1 supported
 #endif
@@ -69,15 +74,37 @@
   #define ASYNC_TCP_SSL_ENABLED       0
 #endif
 
+#include <Teensy41_AsyncTCP_Memory.hpp>
+#include <Teensy41_AsyncTCP_Memory_Impl.h>
+
 #include <Teensy41_AsyncTCP.hpp>
 #include <Teensy41_AsyncTCP_Impl.h>
+#include <Teensy41_AsyncTCP_Events_Impl.h>
+#include <Teensy41_AsyncTCP_RateLimit_Impl.h>
+#include <Teensy41_AsyncTCP_Fanout_Impl.h>
 
-#include <AsyncPrinter.hpp>
-#include <AsyncPrinter_Impl.h>
+#include <Teensy41_AsyncTCP_Scheduler.hpp>
+#include <Teensy41_AsyncTCP_Scheduler_Impl.h>
+
+#if !ASYNC_TCP_PACKET_ONLY
+  #include <AsyncPrinter.hpp>
+  #include <AsyncPrinter_Impl.h>
+#endif
 
 #include <cbuf.hpp>
 #include <cbuf_Impl.h>
 
+#include <cbuf_pow2.hpp>
+
+#include <Teensy41_AsyncTCP_ByteQueue.hpp>
+#include <Teensy41_AsyncTCP_ByteQueue_Impl.h>
+
+#include <Teensy41_AsyncTCP_Search.hpp>
+#include <Teensy41_AsyncTCP_Search_Impl.h>
+
+#include <Teensy41_AsyncTCP_Frame.hpp>
+#include <Teensy41_AsyncTCP_Frame_Impl.h>
+
 // KH, Not in use, keep for future
 //////////////////////
 //#include <SyncClient.hpp>
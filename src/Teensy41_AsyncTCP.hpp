@@ -66,12 +66,83 @@
   #warning ASYNC_TCP_SSL_ENABLED is not ready yet. Disable it
 #endif
 
-#define DEBUG_T41_ASYNC_TCP       true
+/*
+  Compile time feature selection of AsyncClient. Disabled features drop
+  their fields, callbacks and checks, the defaults keep the full client.
+*/
+
+// Connection IDs in ACErrorTracker, used by the debug logs
+#ifndef DEBUG_T41_ASYNC_TCP
+  #define DEBUG_T41_ASYNC_TCP           true
+#endif
+
+// ACK timeout tracking, onTimeout() / setAckTimeout(). Without it the
+// calls are kept but do nothing.
+#ifndef ASYNC_TCP_ACK_TIMEOUT
+  #define ASYNC_TCP_ACK_TIMEOUT         true
+#endif
+
+// Receive through onPacket() only, onData() is removed. AsyncPrinter and
+// AsyncTCPbuffer need onData() and are not available.
+#ifndef ASYNC_TCP_PACKET_ONLY
+  #define ASYNC_TCP_PACKET_ONLY         false
+#endif
+
+// Bulk and urgent send queues, queue() / sendStats(). Queued urgent data is
+// handed to lwIP before queued bulk data, with PSH and without Nagle delay.
+#ifndef ASYNC_TCP_PRIORITY_QUEUES
+  #define ASYNC_TCP_PRIORITY_QUEUES     false
+#endif
+
+// Send buffer bytes that queued bulk data leaves free for urgent data
+#ifndef ASYNC_TCP_URGENT_RESERVE
+  #define ASYNC_TCP_URGENT_RESERVE      536
+#endif
+
+// Default byte limit of each send queue, 0 => limited by the block pool only
+#ifndef ASYNC_TCP_SEND_QUEUE_LIMIT
+  #define ASYNC_TCP_SEND_QUEUE_LIMIT    0
+#endif
+
+// Pull based sending from a callback or Stream, sendStream()
+#ifndef ASYNC_TCP_SEND_STREAM
+  #define ASYNC_TCP_SEND_STREAM         false
+#endif
+
+// Staging buffer of a running sendStream(), the only memory it holds
+#ifndef ASYNC_TCP_STREAM_CHUNK
+  #define ASYNC_TCP_STREAM_CHUNK        1460
+#endif
+
+// AsyncServer keeps its clients in least recently active order and closes
+// the idle ones first under PCB / pbuf pressure, setMaxClients()
+#ifndef ASYNC_TCP_IDLE_REAPER
+  #define ASYNC_TCP_IDLE_REAPER         false
+#endif
+
+// Default thresholds of setReapThreshold(), 0 disables a check. Free pbufs
+// are only known with lwIP MEMP_STATS.
+#ifndef ASYNC_TCP_REAP_FREE_PCBS
+  #define ASYNC_TCP_REAP_FREE_PCBS      1
+#endif
+
+#ifndef ASYNC_TCP_REAP_FREE_PBUFS
+  #define ASYNC_TCP_REAP_FREE_PBUFS     0
+#endif
+
+#ifndef ASYNC_TCP_REAP_MIN_IDLE_MS
+  #define ASYNC_TCP_REAP_MIN_IDLE_MS    5000
+#endif
 
 /////////////////////////////////////////////
 #include <QNEthernet.h>
 
 #include "Teensy41_AsyncTCP_Debug.h"
+#include "Teensy41_AsyncTCP_Memory.hpp"
+#include "Teensy41_AsyncTCP_Events.hpp"
+#include "Teensy41_AsyncTCP_RateLimit.hpp"
+#include "Teensy41_AsyncTCP_Fanout.hpp"
+#include "Teensy41_AsyncTCP_ByteQueue.hpp"
 
 #include "IPAddress.h"
 #include <functional>
@@ -100,6 +171,22 @@ class ACErrorTracker;
 //will not send PSH flag, meaning that there should be more data to be sent before the application should react.
 #define ASYNC_WRITE_FLAG_MORE     0x02
 
+typedef enum
+{
+  ATCP_SEND_BULK,           // behind urgent data, leaves ASYNC_TCP_URGENT_RESERVE free
+  ATCP_SEND_URGENT,         // PSH, Nagle bypassed
+  ATCP_SEND_CLASS_MAX
+} atcpSendClass_t;
+
+typedef struct
+{
+  size_t    depth;          // bytes queued, not yet given to lwIP
+  size_t    highWater;      // max of depth
+  uint64_t  sent;           // bytes given to lwIP
+  uint32_t  writes;         // tcp_write calls
+  uint32_t  refused;        // bytes not queued, queue limit or pool exhausted
+} atcpSendStats_t;
+
 /////////////////////////////////////////////////////////////////
 
 struct tcp_pcb;
@@ -121,6 +208,14 @@ typedef std::function<void(void*, AsyncClient*, struct pbuf *pb)> AcPacketHandle
 typedef std::function<void(void*, AsyncClient*, uint32_t time)> AcTimeoutHandler;
 typedef std::function<void(void*, size_t event)> AsNotifyHandler;
 
+// Fills buf with up to len bytes of the stream from offset index, returns the
+// bytes read. 0 => nothing available now, asked again on the next ACK or poll.
+typedef std::function<size_t(uint8_t *buf, size_t len, size_t index)> AcStreamSource;
+
+// End of a sendStream(), sent bytes given to lwIP, complete false when the
+// connection closed or the stream was cancelled first
+typedef std::function<void(void*, AsyncClient*, size_t sent, bool complete)> AcStreamHandler;
+
 /////////////////////////////////////////////////
 
 enum error_events 
@@ -148,7 +243,9 @@ class ACErrorTracker
     err_t _close_error;
     int _errored;
     
+#if DEBUG_T41_ASYNC_TCP
     size_t _connectionId;
+#endif
 
 #ifdef DEBUG_MORE
     AsNotifyHandler _error_event_cb;
@@ -158,11 +255,13 @@ class ACErrorTracker
   protected:
     friend class AsyncClient;
     friend class AsyncServer;
+    friend class AsyncTCPEvents;
     
 #ifdef DEBUG_MORE
     void onErrorEvent(AsNotifyHandler cb, void *arg);
 #endif
 
+#if DEBUG_T41_ASYNC_TCP
     void setConnectionId(size_t id) 
     { 
       _connectionId = id;
@@ -172,6 +271,17 @@ class ACErrorTracker
     { 
       return _connectionId;
     } 
+#else
+    void setConnectionId(size_t id)
+    {
+      (void) id;
+    }
+
+    size_t getConnectionId()
+    {
+      return 0;
+    }
+#endif
 
     void setCloseError(err_t e);
     void setErrored(size_t errorEvent);
@@ -197,6 +307,9 @@ class ACErrorTracker
       ~ACErrorTracker() {}
 };
 
+// Tracker blocks also hold the shared_ptr control block (vtable, counts)
+#define ATCP_TRACKER_BLOCK_SIZE     (sizeof(ACErrorTracker) + 32)
+
 /////////////////////////////////////////////////////////////////
 
 class AsyncClient 
@@ -204,6 +317,10 @@ class AsyncClient
   protected:
     friend class AsyncTCPbuffer;
     friend class AsyncServer;
+    friend class SyncClient;
+    friend class AsyncFrameCodec;
+    friend class AsyncTCPEvents;
+    friend class AsyncTCPShaper;
     
     tcp_pcb* _pcb;
     AcConnectHandler  _connect_cb;
@@ -214,12 +331,16 @@ class AsyncClient
     void*             _sent_cb_arg;
     AcErrorHandler    _error_cb;
     void*             _error_cb_arg;
+#if !ASYNC_TCP_PACKET_ONLY
     AcDataHandler     _recv_cb;
     void*             _recv_cb_arg;
+#endif
     AcPacketHandler   _pb_cb;
     void*             _pb_cb_arg;
+#if ASYNC_TCP_ACK_TIMEOUT
     AcTimeoutHandler  _timeout_cb;
     void*             _timeout_cb_arg;
+#endif
     AcConnectHandler  _poll_cb;
     void*             _poll_cb_arg;
     bool              _pcb_busy;
@@ -238,11 +359,105 @@ class AsyncClient
     uint32_t  _rx_ack_len;
     uint32_t  _rx_last_packet;
     uint32_t  _rx_since_timeout;
+#if ASYNC_TCP_ACK_TIMEOUT
     uint32_t  _ack_timeout;
+#endif
     uint16_t  _connect_port;
+#if !ASYNC_TCP_PACKET_ONLY
     uint8_t   _recv_pbuf_flags;
+#endif
     
     std::shared_ptr<ACErrorTracker> _errorTracker;
+    AsyncTCPMemUsage *_memUsage;
+
+#if ASYNC_TCP_DEFERRED_EVENTS
+    bool      _deferred;
+#endif
+
+#if ASYNC_TCP_RATE_LIMIT
+    AsyncTCPTokenBucket *_bucket;
+    AsyncTCPTokenBucket *_aggregate;
+    AsyncClient         *_shaped_next;
+    bool                 _shaped_waiting;
+
+    void   _setAggregate(AsyncTCPTokenBucket *bucket);
+    size_t _shapedTokens();
+    size_t _shapedWake();
+    void   _shapedPoll();
+#endif
+
+    // Caps the send room to the tokens of the rate limit buckets
+    size_t _shape(size_t room);
+
+#if ASYNC_TCP_PRIORITY_QUEUES
+    AsyncTCPByteQueue _txq[ATCP_SEND_CLASS_MAX];
+    atcpSendStats_t   _txq_stats[ATCP_SEND_CLASS_MAX];
+
+    size_t _flushQueue(uint8_t sendClass, size_t reserve);
+#endif
+
+    // Hands queued data to lwIP, urgent first
+    void _flushQueues();
+
+    // Connection gone, queued data can't be sent
+    void _dropQueues();
+
+#if ASYNC_TCP_SEND_STREAM
+    AcStreamSource    _stream_src;
+    AcStreamHandler   _stream_cb;
+    void*             _stream_cb_arg;
+    char*             _stream_buf;
+    size_t            _stream_left;       // bytes not read from the source yet
+    size_t            _stream_sent;
+    uint16_t          _stream_off;        // staged bytes not written yet
+    uint16_t          _stream_len;
+#endif
+
+    // Pulls from the stream source as long as lwIP takes it
+    void _pumpStream();
+    void _endStream(bool complete);
+
+#if ASYNC_TCP_FANOUT
+    atcpFanoutEntry_t _fan[ASYNC_TCP_FANOUT_DEPTH];
+    atcpFanoutStats_t _fan_stats;
+    uint32_t          _tx_seq;            // bytes given to tcp_write
+    uint32_t          _tx_acked_seq;
+    uint8_t           _fan_head;
+    uint8_t           _fan_count;
+    uint8_t           _fan_policy;
+
+    // Drops ACKed payloads, or all of them once the pcb is gone
+    void _releaseFanout(bool all);
+#endif
+
+    // Writes queued shared payloads by reference
+    void _pumpFanout();
+
+#if ASYNC_TCP_IDLE_REAPER
+    AsyncServer      *_lru_owner;
+    AsyncClient      *_lru_prev;
+    AsyncClient      *_lru_next;
+#endif
+
+    // Moves the client to the most recently active end of its server list
+    void _touch();
+    void _lruRemove();
+
+    // Last receive, ACK or send
+    uint32_t _lastActive() const
+    {
+      return ((int32_t) (_pcb_sent_at - _rx_last_packet) > 0) ? _pcb_sent_at : _rx_last_packet;
+    }
+
+    // True while lwIP may still read a shared payload
+    bool _fanoutInFlight() const
+    {
+#if ASYNC_TCP_FANOUT
+      return _fan_count && (_fan[_fan_head].written > 0);
+#else
+      return false;
+#endif
+    }
 
     void _close();
     void _connected(std::shared_ptr<ACErrorTracker>& closeAbort, void* pcb, err_t err);
@@ -254,6 +469,23 @@ class AsyncClient
 
     void _poll(std::shared_ptr<ACErrorTracker>& closeAbort, tcp_pcb* pcb);
     void _sent(std::shared_ptr<ACErrorTracker>& closeAbort, tcp_pcb* pcb, uint16_t len);
+    void _recvPbufs(std::shared_ptr<ACErrorTracker>& closeAbort, tcp_pcb* pcb, pbuf* pb);
+
+    // True when the event was queued for AsyncTCPEvents::drain()
+    bool _defer(uint8_t type, void *target = NULL, uint32_t len = 0, uint32_t time = 0, int8_t err = 0)
+    {
+#if ASYNC_TCP_DEFERRED_EVENTS
+      return _deferred && AsyncTCPEvents::post(type, _errorTracker, target, len, time, err);
+#else
+      (void) type;
+      (void) target;
+      (void) len;
+      (void) time;
+      (void) err;
+
+      return false;
+#endif
+    }
     
 #if LWIP_VERSION_MAJOR == 1
     void _dns_found(struct ip_addr *ipaddr);
@@ -303,6 +535,15 @@ class AsyncClient
 
       ~AsyncClient();
 
+      // Heap allocated clients are placed according to ATCP_MEM_CLIENT.
+      // Both forms are noexcept: when the pool or heap is exhausted,
+      // new AsyncClient returns NULL without running the constructor. The
+      // error tracker block is reserved here too, so the constructor cannot
+      // run out of it. Clients not created by new have no such check.
+      static void * operator new(size_t size) noexcept;
+      static void * operator new(size_t size, const std::nothrow_t&) noexcept;
+      static void operator delete(void *ptr);
+
       AsyncClient & operator=(const AsyncClient &other);
       AsyncClient & operator+=(const AsyncClient &other);
 
@@ -331,12 +572,71 @@ class AsyncClient
       bool    send();//send all data added with the method above
       size_t  ack(size_t len); //ack data that you have not acked using the method below
       void    ackLater(){ _ack_pcb = false; } //will not ack the current packet. Call from onData
+#if !ASYNC_TCP_PACKET_ONLY
       bool    isRecvPush(){ return !!(_recv_pbuf_flags & PBUF_FLAG_PUSH); }
-      
-#if DEBUG_T41_ASYNC_TCP
-      size_t getConnectionId() const { return _errorTracker->getConnectionId();}
 #endif
 
+      // Handlers of this connection run from AsyncTCPEvents::drain(), default
+      // with ASYNC_TCP_DEFERRED_EVENTS. Already queued events are still delivered.
+#if ASYNC_TCP_DEFERRED_EVENTS
+      void setDeferred(bool deferred) { _deferred = deferred; }
+      bool isDeferred() const { return _deferred; }
+#else
+      void setDeferred(bool deferred) { (void) deferred; }
+      bool isDeferred() const { return false; }
+#endif
+
+      // Token bucket shaping of this connection, rate in bytes per second,
+      // burst in bytes, rate 0 removes it. Needs ASYNC_TCP_RATE_LIMIT.
+      bool setRateLimit(uint32_t rate, uint32_t burst);
+
+#if ASYNC_TCP_RATE_LIMIT
+      AsyncTCPTokenBucket * rateLimit() const { return _bucket; }
+#else
+      AsyncTCPTokenBucket * rateLimit() const { return NULL; }
+#endif
+
+      // Copies data to the send queue of its class and sends what fits, the
+      // rest follows on ACKs and polls. Urgent data overtakes queued bulk data,
+      // not data already given to lwIP by add() or earlier flushes. Queued
+      // bytes are dropped on close. Needs ASYNC_TCP_PRIORITY_QUEUES.
+      size_t queue(const char* data, size_t size, uint8_t sendClass = ATCP_SEND_BULK);
+      size_t queued(uint8_t sendClass) const;
+      void   setQueueLimit(uint8_t sendClass, size_t limit);
+
+      // NULL without ASYNC_TCP_PRIORITY_QUEUES
+      const atcpSendStats_t * sendStats(uint8_t sendClass) const;
+
+      // Sends length bytes pulled from source, only as many at a time as the
+      // send buffer takes, through one ASYNC_TCP_STREAM_CHUNK staging buffer.
+      // The source runs from the ACK and poll callbacks. cb runs once all
+      // bytes are given to lwIP, or on close / cancelStream(), and must not
+      // delete the client. One stream at a time. Needs ASYNC_TCP_SEND_STREAM.
+      bool   sendStream(AcStreamSource source, size_t length, AcStreamHandler cb = NULL, void* arg = 0);
+
+      // Reads what stream.available() reports, e.g. a File
+      bool   sendStream(Stream &stream, size_t length, AcStreamHandler cb = NULL, void* arg = 0);
+
+      void   cancelStream();
+
+      // Bytes of the running stream not given to lwIP yet, 0 when idle
+      size_t streamPending() const;
+
+      // Queues a shared payload, sent by reference and released once ACKed.
+      // false when the queue is full under ATCP_FANOUT_DROP, or after close().
+      // Needs ASYNC_TCP_FANOUT.
+      bool   sendShared(AsyncTCPPayload *payload);
+      void   setFanoutPolicy(uint8_t policy);
+
+      // Payloads queued or waiting for their ACK
+      size_t fanoutPending() const;
+
+      // NULL without ASYNC_TCP_FANOUT
+      const atcpFanoutStats_t * fanoutStats() const;
+
+      // 0 without DEBUG_T41_ASYNC_TCP
+      size_t getConnectionId() const { return _errorTracker->getConnectionId();}
+
 #if ASYNC_TCP_SSL_ENABLED
       SSL *getSSL();
 #endif
@@ -346,9 +646,23 @@ class AsyncClient
       //only when canSend() == true
       size_t write(const char* data, size_t size, uint8_t apiflags=0); 
 
-      uint8_t state();
+      // Hot path accessors, inline so they survive a compiled library build
+      inline uint8_t state()
+      {
+        return _pcb ? _pcb->state : 0;
+      }
+
       bool    connecting();
-      bool    connected();
+
+      inline bool connected()
+      {
+#if ASYNC_TCP_SSL_ENABLED
+        return ( _pcb && (_pcb->state == ESTABLISHED) && _handshake_done );
+#else
+        return ( _pcb && (_pcb->state == ESTABLISHED) );
+#endif
+      }
+
       bool    disconnecting();
       bool    disconnected();
       
@@ -365,6 +679,13 @@ class AsyncClient
       
       //no ACK timeout for the last sent packet in milliseconds
       void      setAckTimeout(uint32_t timeout);
+
+      // Memory held for this connection by the client and the wrappers and
+      // buffers attached to it, NULL without per connection accounting
+      AsyncTCPMemUsage * memUsage() const
+      {
+        return _memUsage;
+      }
       void      setNoDelay(bool nodelay);
       bool      getNoDelay();
       uint32_t  getRemoteAddress();
@@ -381,7 +702,9 @@ class AsyncClient
       void onDisconnect(AcConnectHandler cb, void* arg = 0);  //disconnected
       void onAck(AcAckHandler cb, void* arg = 0);             //ack received
       void onError(AcErrorHandler cb, void* arg = 0);         //unsuccessful connect or error
+#if !ASYNC_TCP_PACKET_ONLY
       void onData(AcDataHandler cb, void* arg = 0);           //data received (called if onPacket is not used)
+#endif
       void onPacket(AcPacketHandler cb, void* arg = 0);       //data received
       void onTimeout(AcTimeoutHandler cb, void* arg = 0);     //ack timeout
       void onPoll(AcConnectHandler cb, void* arg = 0);        //every 125ms when connected
@@ -410,12 +733,16 @@ class AsyncClient
 class AsyncServer 
 {
   protected:
+    friend class AsyncTCPEvents;
+    friend class AsyncClient;
+
     uint16_t          _port;
     IPAddress         _addr;
     bool              _noDelay;
     tcp_pcb*          _pcb;
     AcConnectHandler  _connect_cb;
     void*             _connect_cb_arg;
+    uint32_t          _refused;
     
 #if ASYNC_TCP_SSL_ENABLED
     struct pending_pcb *  _pending;
@@ -428,6 +755,24 @@ class AsyncServer
     int _event_count[EE_MAX];
 #endif
 
+#if ASYNC_TCP_RATE_LIMIT
+    AsyncTCPTokenBucket *_bucket;
+#endif
+
+#if ASYNC_TCP_IDLE_REAPER
+    AsyncClient      *_lru_head;        // least recently active
+    AsyncClient      *_lru_tail;
+    size_t            _lru_count;
+    size_t            _maxClients;
+    uint32_t          _reapIdleMs;
+    uint32_t          _reaped;
+    uint16_t          _reapFreePcbs;
+    uint16_t          _reapFreePbufs;
+
+    // Clients of all servers, PCB estimate without MEMP_STATS
+    static size_t     _lru_total;
+#endif
+
   public:
     AsyncServer(IPAddress addr, uint16_t port);
     AsyncServer(uint16_t port);
@@ -443,6 +788,37 @@ class AsyncServer
 
     void begin();
     void end();
+
+    // One token bucket shared by the clients accepted from now on, on top
+    // of their own limit. rate 0 removes it. Needs ASYNC_TCP_RATE_LIMIT.
+    bool setRateLimit(uint32_t rate, uint32_t burst);
+
+#if ASYNC_TCP_RATE_LIMIT
+    AsyncTCPTokenBucket * rateLimit() const { return _bucket; }
+#else
+    AsyncTCPTokenBucket * rateLimit() const { return NULL; }
+#endif
+
+    // At maxClients the least recently active client is closed for each new
+    // one, 0 => no limit. Needs ASYNC_TCP_IDLE_REAPER.
+    void setMaxClients(size_t maxClients);
+
+    // Below freePcbs free TCP PCBs or freePbufs free pool pbufs, clients idle
+    // for minIdleMs are closed, least recently active first, before
+    // tcp_kill_prio() picks by priority. 0 disables a check.
+    void setReapThreshold(uint16_t freePcbs, uint16_t freePbufs = ASYNC_TCP_REAP_FREE_PBUFS,
+                          uint32_t minIdleMs = ASYNC_TCP_REAP_MIN_IDLE_MS);
+
+    // Accepted clients still open, and the ones closed by the reaper
+    size_t clients() const;
+    uint32_t reaped() const;
+
+    // Connections aborted on accept, no memory for their client
+    uint32_t refused() const
+    {
+      return _refused;
+    }
+
     void setNoDelay(bool nodelay);
     bool getNoDelay();
     uint8_t status();
@@ -455,6 +831,16 @@ class AsyncServer
 #endif
 
   protected:
+#if ASYNC_TCP_IDLE_REAPER
+    void _lruLink(AsyncClient *c);
+    void _lruUnlink(AsyncClient *c);
+    void _lruDetach();
+    bool _underPressure();
+
+    // Closes least recently active clients, room for incoming new ones
+    void _reap(size_t incoming);
+#endif
+
     err_t _accept(tcp_pcb* newpcb, err_t err);
     static err_t _s_accept(void *arg, tcp_pcb* newpcb, err_t err);
     
@@ -38,10 +38,16 @@
 /////////////////////////////////////////////////
 
 #include <Arduino.h>
-#include <cbuf.hpp>
+#include "Teensy41_AsyncTCP_ByteQueue.hpp"
+#include "Teensy41_AsyncTCP_Search.hpp"
+#include "Teensy41_AsyncTCP_Scheduler.hpp"
 
 #include "Teensy41_AsyncTCP.hpp"
 
+#if ASYNC_TCP_PACKET_ONLY
+  #error AsyncTCPbuffer needs AsyncClient::onData(), not available with ASYNC_TCP_PACKET_ONLY
+#endif
+
 #include "Teensy41_AsyncTCP_Debug.h"
 
 /////////////////////////////////////////////////
@@ -52,7 +58,8 @@ typedef enum
   ATB_RX_MODE_FREE,
   ATB_RX_MODE_READ_BYTES,
   ATB_RX_MODE_TERMINATOR,
-  ATB_RX_MODE_TERMINATOR_STRING
+  ATB_RX_MODE_TERMINATOR_STRING,
+  ATB_RX_MODE_DELIMITER_STRING
 } atbRxMode_t;
 
 /////////////////////////////////////////////////
@@ -80,9 +87,13 @@ class AsyncTCPbuffer: public Print
 
     void readStringUntil(char terminator, String * str, AsyncTCPbufferDoneCb done);
 
-    // TODO implement read terminator non string
-    //void readBytesUntil(char terminator, char *buffer, size_t length, AsyncTCPbufferDoneCb done);
-    //void readBytesUntil(char terminator, uint8_t *buffer, size_t length, AsyncTCPbufferDoneCb done);
+    // Multi-byte delimiter, e.g. "\r\n\r\n". The delimiter is consumed but not stored.
+    void readStringUntil(const char *delimiter, String * str, AsyncTCPbufferDoneCb done);
+
+    // Stores up to length bytes, the terminator is consumed but not stored.
+    // done() gets a size_t* with the number of bytes stored.
+    void readBytesUntil(char terminator, char *buffer, size_t length, AsyncTCPbufferDoneCb done);
+    void readBytesUntil(char terminator, uint8_t *buffer, size_t length, AsyncTCPbufferDoneCb done);
 
     void readBytes(char *buffer, size_t length, AsyncTCPbufferDoneCb done);
     void readBytes(uint8_t *buffer, size_t length, AsyncTCPbufferDoneCb done);
@@ -90,6 +101,10 @@ class AsyncTCPbuffer: public Print
     // TODO implement
     // void setTimeout(size_t timeout);
 
+    // Cap bytes buffered per direction, 0 => limited by the block pool only.
+    // Past rxLimit the receive window is held closed until the data is read
+    void setBufferLimits(size_t txLimit, size_t rxLimit);
+
     void onData(AsyncTCPbufferDataCb cb);
     void onDisconnect(AsyncTCPbufferDisconnectCb cb);
 
@@ -103,26 +118,47 @@ class AsyncTCPbuffer: public Print
     void stop();
     void close();
 
+#if ASYNC_TCP_TX_SCHEDULER
+    // Weight and queueing delay of this buffer in the TX scheduler
+    AsyncTCPFlow & flow()
+    {
+      return _flow;
+    }
+#endif
+
   protected:
     AsyncClient* _client;
-    cbuf * _TXbufferRead;
-    cbuf * _TXbufferWrite;
-    cbuf * _RXbuffer;
+    AsyncTCPByteQueue _TXbuffer;
+    AsyncTCPByteQueue _RXbuffer;
     atbRxMode_t _RXmode;
     size_t _rxSize;
+    size_t _rxLimit;
     char _rxTerminator;
+    AsyncTCPDelimiter _rxDelimiter;
     uint8_t * _rxReadBytesPtr;
+    size_t _rxReadCount;
     String * _rxReadStringPtr;
 
     AsyncTCPbufferDataCb _cbRX;
     AsyncTCPbufferDoneCb _cbDone;
     AsyncTCPbufferDisconnectCb _cbDisconnect;
 
+#if ASYNC_TCP_TX_SCHEDULER
+    AsyncTCPFlow _flow;
+
+    static size_t _s_flowSend(void *arg, size_t budget);
+    static size_t _s_flowPending(void *arg);
+#endif
+
     void _attachCallbacks();
-    void _sendBuffer();
+    void _send();
+    size_t _sendBuffer(size_t budget = (size_t) -1);
     void _on_close();
     void _rxData(uint8_t *buf, size_t len);
+    void _drainRx();
     size_t _handleRxBuffer(uint8_t *buf, size_t len);
+    void _appendBytes(const char *data, size_t len);
+    void _appendDelimited(const char *data, size_t end);
 };
 
 /////////////////////////////////////////////////
@@ -35,6 +35,8 @@
 #ifndef _TEENSY41_ASYNC_TCP_BUFFER_IMPL_H_
 #define _TEENSY41_ASYNC_TCP_BUFFER_IMPL_H_
 
+#if !TEENSY41_ASYNC_TCP_COMPILED || defined(_TEENSY41_ASYNC_TCP_LIBRARY_)
+
 #include <Arduino.h>
 
 #include "Teensy41_AsyncTCP_Buffer.hpp"
@@ -42,25 +44,34 @@
 /////////////////////////////////////////////////
 
 AsyncTCPbuffer::AsyncTCPbuffer(AsyncClient* client)
+#if ASYNC_TCP_TX_SCHEDULER
+  : _flow(_s_flowSend, _s_flowPending, this)
+#endif
 {
   if (client == NULL)
   {
-    T41_ASYNC_LOGERROR("AsyncTCPbuffer: Error NULL client");
+    ATCP_LOGERROR("AsyncTCPbuffer: Error NULL client");
   }
 
   _client = client;
-  _TXbufferWrite = new (std::nothrow) cbuf(TCP_MSS);
-  _TXbufferRead = _TXbufferWrite;
-  _RXbuffer = new (std::nothrow) cbuf(TCP_MSS);
   _RXmode = ATB_RX_MODE_FREE;
   _rxSize = 0;
+  _rxLimit = 0;
   _rxTerminator = 0x00;
   _rxReadBytesPtr = NULL;
+  _rxReadCount = 0;
   _rxReadStringPtr = NULL;
   _cbDisconnect = NULL;
 
   _cbRX = NULL;
   _cbDone = NULL;
+
+  if (_client)
+  {
+    _TXbuffer.setUsage(_client->memUsage());
+    _RXbuffer.setUsage(_client->memUsage());
+  }
+
   _attachCallbacks();
 }
 
@@ -72,33 +83,6 @@ AsyncTCPbuffer::~AsyncTCPbuffer()
   {
     _client->close();
   }
-
-  if (_RXbuffer)
-  {
-    delete _RXbuffer;
-    _RXbuffer = NULL;
-  }
-
-  if (_TXbufferWrite)
-  {
-    // will be deleted in _TXbufferRead chain
-    _TXbufferWrite = NULL;
-  }
-
-  if (_TXbufferRead)
-  {
-    cbuf * next = _TXbufferRead->next;
-    delete _TXbufferRead;
-
-    while (next != NULL)
-    {
-      _TXbufferRead = next;
-      next = _TXbufferRead->next;
-      delete _TXbufferRead;
-    }
-
-    _TXbufferRead = NULL;
-  }
 }
 
 /////////////////////////////////////////////////
@@ -139,69 +123,23 @@ size_t AsyncTCPbuffer::write(const char *data, size_t len)
 */
 size_t AsyncTCPbuffer::write(const uint8_t *data, size_t len)
 {
-  if (_TXbufferWrite == NULL || _client == NULL || !_client->connected() || data == NULL || len == 0)
+  if (_client == NULL || !_client->connected() || data == NULL || len == 0)
   {
     return 0;
   }
 
-  size_t bytesLeft = len;
+  // Appends to pool blocks, no reallocation or copy of queued data
+  size_t queued = _TXbuffer.write((const char*) data, len);
 
-  while (bytesLeft)
+  if (queued < len)
   {
-    // Safety: bail if client died mid-loop
-    if (_client == NULL || !_client->connected())
-    {
-      break;
-    }
-
-    if (_TXbufferWrite == NULL)
-    {
-      T41_ASYNC_LOGERROR("AsyncTCPbuffer::write: _TXbufferWrite is NULL");
-      break;
-    }
-
-    size_t w = _TXbufferWrite->write((const char*) data, bytesLeft);
-    bytesLeft -= w;
-    data += w;
-    _sendBuffer();
-
-    if (bytesLeft == 0)
-    {
-      break;
-    }
-
-    // add new buffer since we have more data
-    if (_TXbufferWrite->full())
-    {
-      cbuf * next = new (std::nothrow) cbuf(TCP_MSS);
-
-      if (next == NULL)
-      {
-        T41_ASYNC_LOGERROR("AsyncTCPbuffer::write: Error out of Heap");
-        // Can't enqueue more; return what we managed to buffer
-        break;
-      }
-      else
-      {
-        T41_ASYNC_LOGDEBUG("AsyncTCPbuffer: new cbuf");
-      }
-
-      // add new buffer to chain (current cbuf)
-      _TXbufferWrite->next = next;
-
-      // move ptr for next data
-      _TXbufferWrite = next;
-    }
-    else if (w == 0)
-    {
-      // No progress (not full but nothing written) => avoid infinite loop
-      T41_ASYNC_LOGERROR("AsyncTCPbuffer::write: no progress, aborting");
-      break;
-    }
+    ATCP_LOGERROR("AsyncTCPbuffer::write: TX buffer limit reached");
   }
 
+  _send();
+
   // Return how many bytes we actually enqueued
-  return len - bytesLeft;
+  return queued;
 }
 
 /////////////////////////////////////////////////
@@ -214,8 +152,8 @@ void AsyncTCPbuffer::flush()
   // Drain the entire TX chain, not just the write buffer
   while (_client && connected())
   {
-    // If there is nothing pending in the current buffer and no next buffer, we are done
-    if (!_TXbufferRead || (_TXbufferRead->available() == 0 && _TXbufferRead->next == NULL))
+    // If there is nothing pending, we are done
+    if (_TXbuffer.empty())
     {
       break;
     }
@@ -231,7 +169,7 @@ void AsyncTCPbuffer::flush()
       return;
     }
 
-    _sendBuffer();
+    _send();
   }
 }
 
@@ -259,27 +197,69 @@ void AsyncTCPbuffer::readStringUntil(char terminator, String * str, AsyncTCPbuff
   _rxTerminator = terminator;
   _rxSize = 0;
   _RXmode = ATB_RX_MODE_TERMINATOR_STRING;
+
+  // Data may already be waiting
+  _drainRx();
 }
 
 /////////////////////////////////////////////////
 
-/*
-  void AsyncTCPbuffer::readBytesUntil(char terminator, char *buffer, size_t length, AsyncTCPbufferDoneCb done)
+void AsyncTCPbuffer::readStringUntil(const char *delimiter, String * str, AsyncTCPbufferDoneCb done)
+{
+  if (_client == NULL)
   {
-    _RXmode = ATB_RX_MODE_NONE;
-    _cbDone = done;
-    _rxReadBytesPtr = (uint8_t *) buffer;
-    _rxTerminator = terminator;
-    _rxSize = length;
-    _RXmode = ATB_RX_MODE_TERMINATOR;
-    _handleRxBuffer(NULL, 0);
+    return;
   }
 
-  void AsyncTCPbuffer::readBytesUntil(char terminator, uint8_t *buffer, size_t length, AsyncTCPbufferDoneCb done)
+  _RXmode = ATB_RX_MODE_NONE;
+
+  if (!_rxDelimiter.set(delimiter))
   {
-    readBytesUntil(terminator, (char *) buffer, length, done);
+    ATCP_LOGERROR("readStringUntil: invalid delimiter");
+
+    return;
   }
-*/
+
+  ASYNC_TCP_DEBUG("[A-TCP] readStringUntil delimiter length: %d\n", _rxDelimiter.length());
+
+  _cbDone = done;
+  _rxReadStringPtr = str;
+  _rxSize = 0;
+  _RXmode = ATB_RX_MODE_DELIMITER_STRING;
+
+  // Data may already be waiting
+  _drainRx();
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPbuffer::readBytesUntil(char terminator, char *buffer, size_t length, AsyncTCPbufferDoneCb done)
+{
+  if (_client == NULL)
+  {
+    return;
+  }
+
+  ASYNC_TCP_DEBUG("[A-TCP] readBytesUntil terminator: %02X length: %d\n", terminator, length);
+
+  _RXmode = ATB_RX_MODE_NONE;
+  _cbDone = done;
+  _rxReadBytesPtr = (uint8_t *) buffer;
+  _rxReadCount = 0;
+  _rxTerminator = terminator;
+  _rxSize = length;
+  _RXmode = ATB_RX_MODE_TERMINATOR;
+
+  // Data may already be waiting
+  _drainRx();
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPbuffer::readBytesUntil(char terminator, uint8_t *buffer, size_t length, AsyncTCPbufferDoneCb done)
+{
+  readBytesUntil(terminator, (char *) buffer, length, done);
+}
 
 /////////////////////////////////////////////////
 
@@ -297,6 +277,9 @@ void AsyncTCPbuffer::readBytes(char *buffer, size_t length, AsyncTCPbufferDoneCb
   _rxReadBytesPtr = (uint8_t *) buffer;
   _rxSize = length;
   _RXmode = ATB_RX_MODE_READ_BYTES;
+
+  // Data may already be waiting
+  _drainRx();
 }
 
 /////////////////////////////////////////////////
@@ -321,6 +304,23 @@ void AsyncTCPbuffer::onData(AsyncTCPbufferDataCb cb)
   _cbDone = NULL;
   _cbRX = cb;
   _RXmode = ATB_RX_MODE_FREE;
+
+  // Data may already be waiting
+  _drainRx();
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPbuffer::setBufferLimits(size_t txLimit, size_t rxLimit)
+{
+  _TXbuffer.setLimit(txLimit);
+
+  // Received bytes are already out of the pbuf by the time they reach us, so
+  // the RX limit throttles the peer by withholding acks instead of refusing data
+  _rxLimit = rxLimit;
+
+  if (_client)
+    _drainRx();
 }
 
 /////////////////////////////////////////////////
@@ -386,6 +386,7 @@ void AsyncTCPbuffer::stop()
       case ATB_RX_MODE_READ_BYTES:
       case ATB_RX_MODE_TERMINATOR:
       case ATB_RX_MODE_TERMINATOR_STRING:
+      case ATB_RX_MODE_DELIMITER_STRING:
         _RXmode = ATB_RX_MODE_NONE;
         _cbDone(false, NULL);
         break;
@@ -425,12 +426,12 @@ void AsyncTCPbuffer::_attachCallbacks()
 
     AsyncTCPbuffer* b = ((AsyncTCPbuffer*)(obj));
 
-    if ((b->_TXbufferRead != NULL) && !b->_TXbufferRead->empty())
+    if (!b->_TXbuffer.empty())
     {
-      b->_sendBuffer();
+      b->_send();
     }
 
-    //    if(!b->_RXbuffer->empty())
+    //    if(!b->_RXbuffer.empty())
     //    {
     //       b->_handleRxBuffer(NULL, 0);
     //    }
@@ -444,7 +445,7 @@ void AsyncTCPbuffer::_attachCallbacks()
 
     ATCP_LOGDEBUG("onAck");
 
-    ((AsyncTCPbuffer*)(obj))->_sendBuffer();
+    ((AsyncTCPbuffer*)(obj))->_send();
   }, this);
 
   _client->onDisconnect([](void *obj, AsyncClient * c)
@@ -492,83 +493,87 @@ void AsyncTCPbuffer::_attachCallbacks()
 /////////////////////////////////////////////////////////
 
 /**
-   send TX buffer if possible
+   send TX buffer now, or through the TX scheduler when this buffer gets its turn
 */
-void AsyncTCPbuffer::_sendBuffer()
+void AsyncTCPbuffer::_send()
 {
-  //ATCP_LOGDEBUG("_sendBuffer...");
+#if ASYNC_TCP_TX_SCHEDULER
+  _flow.ready();
+#else
+  _sendBuffer();
+#endif
+}
 
-  if (_client == NULL || _TXbufferRead == NULL)
-  {
-    return;
-  }
+/////////////////////////////////////////////////////////
 
-  size_t available = _TXbufferRead->available();
+#if ASYNC_TCP_TX_SCHEDULER
+size_t AsyncTCPbuffer::_s_flowSend(void *arg, size_t budget)
+{
+  return ((AsyncTCPbuffer*)(arg))->_sendBuffer(budget);
+}
 
-  if (available == 0 || !_client->connected() || !_client->canSend())
-  {
-    return;
-  }
+/////////////////////////////////////////////////////////
 
-  while (connected() && _client->canSend() && (_TXbufferRead->available() > 0))
-  {
-    size_t space = _client->space();
+size_t AsyncTCPbuffer::_s_flowPending(void *arg)
+{
+  AsyncTCPbuffer* b = ((AsyncTCPbuffer*)(arg));
 
-    if (space == 0)
-    {
-      break;
-    }
+  return (b->_client && b->_client->connected()) ? b->_TXbuffer.available() : 0;
+}
 
-    available = _TXbufferRead->available();
+/////////////////////////////////////////////////////////
+#endif
 
-    if (available > space)
-    {
-      available = space;
-    }
+/**
+   send up to budget bytes of the TX buffer if possible
+   @param budget
+   @return bytes queued to lwIP
+*/
+size_t AsyncTCPbuffer::_sendBuffer(size_t budget)
+{
+  //ATCP_LOGDEBUG("_sendBuffer...");
 
-    // Cap chunk size to reduce heap pressure and fragmentation
-    if (available > TCP_MSS)
-    {
-      available = TCP_MSS;
-    }
+  if (_client == NULL || _TXbuffer.empty() || !_client->connected() || !_client->canSend())
+  {
+    return 0;
+  }
 
-    // Use a stack buffer to avoid per-chunk heap alloc/free
-    char out[TCP_MSS];
+  size_t queued = 0;
 
-    // read data from buffer
-    _TXbufferRead->peek(out, available);
+  // pass the block memory directly, lwIP copies it into its segments
+  while (!_TXbuffer.empty() && (queued < budget))
+  {
+    const char *data;
+    size_t available;
 
-    // send data (ensure copy since 'out' is on the stack)
-    size_t send = _client->write((const char*) out, available, ASYNC_WRITE_FLAG_COPY);
-    if (send != available)
-    {
-      ATCP_LOGDEBUG3("_sendBuffer write failed send:", send, ", available:", available);
+    _TXbuffer.readSpans(&data, &available);
 
-      if (!connected())
-      {
-        ATCP_LOGDEBUG("incomplete transfer, connection lost.");
-      }
-    }
+    if (available > budget - queued)
+      available = budget - queued;
+
+    size_t send = _client->add(data, available, ASYNC_WRITE_FLAG_COPY);
 
-    // remove really sent data from buffer
-    _TXbufferRead->remove(send);
+    // remove really queued data from buffer, drained blocks go back to the pool
+    _TXbuffer.commitRead(send);
+    queued += send;
 
-    // if no progress, avoid spinning forever
-    if (send == 0)
+    if (send != available)
     {
+      ATCP_LOGDEBUG3("_sendBuffer write failed send:", send, ", available:", available);
       break;
     }
+  }
 
-    // if buffer is empty and there is another buffer in chain delete the empty one
-    if (_TXbufferRead->available() == 0 && _TXbufferRead->next != NULL)
-    {
-      cbuf * old = _TXbufferRead;
-      _TXbufferRead = _TXbufferRead->next;
-      delete old;
-
-      ATCP_LOGDEBUG("delete cbuf");
-    }
+  if (queued > 0)
+  {
+    _client->send();
+  }
+  else if (!connected())
+  {
+    ATCP_LOGDEBUG("incomplete transfer, connection lost.");
   }
+
+  return queued;
 }
 
 /////////////////////////////////////////////////////////
@@ -587,13 +592,6 @@ void AsyncTCPbuffer::_rxData(uint8_t *buf, size_t len)
     return;
   }
 
-  if (!_RXbuffer)
-  {
-    ATCP_LOGDEBUG("_rxData no _RXbuffer!");
-
-    return;
-  }
-
   ATCP_LOGDEBUG3("_rxData len:", len, ", RXmode:", _RXmode);
 
   size_t handled = 0;
@@ -605,7 +603,7 @@ void AsyncTCPbuffer::_rxData(uint8_t *buf, size_t len)
     len -= handled;
 
     // handle as much as possible before using the buffer
-    if (_RXbuffer->empty())
+    if (_RXbuffer.empty())
     {
       while (_RXmode != ATB_RX_MODE_NONE && handled != 0 && len > 0)
       {
@@ -618,39 +616,41 @@ void AsyncTCPbuffer::_rxData(uint8_t *buf, size_t len)
 
   if (len > 0)
   {
-    if (_RXbuffer->room() < len)
-    {
-      // to less space
-      ATCP_LOGDEBUG("_rxData buffer full try resize");
-      _RXbuffer->resizeAdd((len + _RXbuffer->room()));
-    }
-
-    size_t wrote = _RXbuffer->write((const char *) (buf), len);
+    // Appends to pool blocks, buffered data is never reallocated or copied.
+    // The queue itself is unlimited, _rxLimit is enforced through the TCP window
+    size_t wrote = _RXbuffer.write((const char *) (buf), len);
 
     if (wrote < len)
     {
-      // Attempt one more resize and retry for the remaining bytes
-      size_t remaining = len - wrote;
-      _RXbuffer->resizeAdd(remaining);
-      size_t wrote2 = _RXbuffer->write((const char *)(buf + wrote), remaining);
-      if (wrote2 < remaining)
-      {
-        size_t dropped = remaining - wrote2;
-        ATCP_LOGERROR("AsyncTCPbuffer::_rxData: RX buffer overflow; dropped bytes");
-        // Opportunistically deliver the undelivered tail directly if FREE mode has a consumer
-        if (_RXmode == ATB_RX_MODE_FREE && _cbRX && wrote2 < remaining)
-        {
-          size_t tail = remaining - wrote2;
-          (void)_cbRX((uint8_t *)(buf + wrote + wrote2), tail);
-        }
-      }
-    } // <-- MISSING BRACE FIXED HERE
+      // Block pool exhausted. The pbuf is released after this callback, so the
+      // tail cannot be kept: reset the connection rather than corrupt the stream
+      ATCP_LOGERROR("AsyncTCPbuffer::_rxData: RX block pool exhausted, closing");
+
+      // May run onDisconnect, which deletes this buffer
+      _client->close(true);
+
+      return;
+    }
   }
 
-  if (!_RXbuffer->empty() && _RXmode != ATB_RX_MODE_NONE)
+  _drainRx();
+
+  // Over the limit: leave this packet unacked so the peer's window closes.
+  // _drainRx() acks the withheld bytes once the buffer drops below the limit
+  if (_rxLimit && _RXbuffer.available() >= _rxLimit)
+    _client->ackLater();
+}
+
+/////////////////////////////////////////////////////////
+
+// Hands buffered data to the current read mode, then reopens the receive
+// window for any bytes withheld by _rxData()
+void AsyncTCPbuffer::_drainRx()
+{
+  if (!_RXbuffer.empty() && _RXmode != ATB_RX_MODE_NONE)
   {
     // handle as much as possible data in buffer
-    handled = _handleRxBuffer(NULL, 0);
+    size_t handled = _handleRxBuffer(NULL, 0);
 
     while (_RXmode != ATB_RX_MODE_NONE && handled != 0)
     {
@@ -658,25 +658,22 @@ void AsyncTCPbuffer::_rxData(uint8_t *buf, size_t len)
     }
   }
 
-  // clean up ram
-  if (_RXbuffer->empty() && _RXbuffer->room() != TCP_MSS)
-  {
-    _RXbuffer->resize(TCP_MSS);
-  }
+  if (_client && (!_rxLimit || _RXbuffer.available() < _rxLimit))
+    _client->ack((size_t) -1);
 }
 
 /////////////////////////////////////////////////////////
 
 size_t AsyncTCPbuffer::_handleRxBuffer(uint8_t *buf, size_t len)
 {
-  if (!_client || !_client->connected() || _RXbuffer == NULL)
+  if (!_client || !_client->connected())
   {
     return 0;
   }
 
   ATCP_LOGDEBUG3("_handleRxBuffer len:", len, ", RXmode:", _RXmode);
 
-  size_t BufferAvailable = _RXbuffer->available();
+  size_t BufferAvailable = _RXbuffer.available();
   size_t r = 0;
 
   if (_RXmode == ATB_RX_MODE_NONE)
@@ -692,21 +689,17 @@ size_t AsyncTCPbuffer::_handleRxBuffer(uint8_t *buf, size_t len)
 
     if (BufferAvailable > 0)
     {
-      // Process buffered data in chunks without heap allocs
+      // Hand buffered data to the consumer straight from the ring memory
       size_t totalRemoved = 0;
-      while (true)
-      {
-        size_t availNow = _RXbuffer->available();
-        if (availNow == 0)
-          break;
 
-        size_t toPeek = availNow;
-        if (toPeek > TCP_MSS) toPeek = TCP_MSS;
+      while (!_RXbuffer.empty())
+      {
+        const char *data;
+        size_t toPeek;
 
-        uint8_t chunk[TCP_MSS];
-        _RXbuffer->peek((char *)chunk, toPeek);
+        _RXbuffer.readSpans(&data, &toPeek);
 
-        size_t consumed = _cbRX(chunk, toPeek);
+        size_t consumed = _cbRX((uint8_t *) data, toPeek);
 
         if (consumed > toPeek)
           consumed = toPeek; // safety
@@ -714,13 +707,14 @@ size_t AsyncTCPbuffer::_handleRxBuffer(uint8_t *buf, size_t len)
         if (consumed == 0)
           break; // consumer can't take more now
 
-        _RXbuffer->remove(consumed);
+        _RXbuffer.commitRead(consumed);
         totalRemoved += consumed;
 
-        // If consumer did not consume the whole peeked chunk, stop to avoid re-sending
+        // If consumer did not consume the whole span, stop to avoid re-sending
         if (consumed < toPeek)
           break;
       }
+
       r = totalRemoved;
     }
 
@@ -746,12 +740,12 @@ size_t AsyncTCPbuffer::_handleRxBuffer(uint8_t *buf, size_t len)
 
     if (BufferAvailable)
     {
-      r = _RXbuffer->read((char *) _rxReadBytesPtr, _rxSize);
+      r = _RXbuffer.read((char *) _rxReadBytesPtr, _rxSize);
       _rxSize -= r;
       _rxReadBytesPtr += r;
     }
 
-    if (_RXbuffer->empty() && (len > 0) && buf)
+    if (_RXbuffer.empty() && (len > 0) && buf)
     {
       r = len;
 
@@ -778,7 +772,70 @@ size_t AsyncTCPbuffer::_handleRxBuffer(uint8_t *buf, size_t len)
   }
   else if (_RXmode == ATB_RX_MODE_TERMINATOR)
   {
-    // TODO implement read terminator non string
+    if (_rxReadBytesPtr == NULL || _cbDone == NULL)
+    {
+      return 0;
+    }
+
+    const char * data;
+    size_t dataLen;
+    size_t consumed = 0;
+    bool fromBuffer = !_RXbuffer.empty();
+
+    // Buffered block spans first, then the fresh data once the buffer is drained
+    while (true)
+    {
+      if (fromBuffer)
+      {
+        if (_RXbuffer.empty())
+        {
+          if (!buf || (len == 0))
+            break;
+
+          fromBuffer = false;
+          continue;
+        }
+
+        _RXbuffer.readSpans(&data, &dataLen);
+      }
+      else
+      {
+        if (!buf || (consumed >= len))
+          break;
+
+        data = (const char *) buf;
+        dataLen = len;
+      }
+
+      size_t limit = (dataLen < _rxSize) ? dataLen : _rxSize;
+      const char * hit = (const char *) memchr(data, _rxTerminator, limit);
+      size_t count = hit ? (size_t) (hit - data) : limit;
+      size_t used = hit ? count + 1 : count;
+
+      memcpy(_rxReadBytesPtr, data, count);
+      _rxReadBytesPtr += count;
+      _rxReadCount += count;
+      _rxSize -= count;
+
+      if (fromBuffer)
+        _RXbuffer.commitRead(used);
+      else
+        consumed = used;
+
+      if (hit || (_rxSize == 0))
+      {
+        _RXmode = ATB_RX_MODE_NONE;
+        _cbDone(true, &_rxReadCount);
+
+        break;
+      }
+
+      // Fresh data is handed over in one go
+      if (!fromBuffer)
+        break;
+    }
+
+    return consumed;
   }
   else if (_RXmode == ATB_RX_MODE_TERMINATOR_STRING)
   {
@@ -787,51 +844,96 @@ size_t AsyncTCPbuffer::_handleRxBuffer(uint8_t *buf, size_t len)
       return 0;
     }
 
-    // handle Buffer
-    if (BufferAvailable > 0)
+    // handle Buffer, one block span per scan
+    while (!_RXbuffer.empty())
     {
-      while (!_RXbuffer->empty())
+      const char * data;
+      size_t dataLen;
+
+      _RXbuffer.readSpans(&data, &dataLen);
+
+      size_t pos = atcp_find_terminator(data, dataLen, _rxTerminator);
+
+      _appendBytes(data, pos);
+
+      if (pos < dataLen)
       {
-        char c = _RXbuffer->read();
+        _RXbuffer.commitRead(pos + 1);
+        _RXmode = ATB_RX_MODE_NONE;
+        _cbDone(true, _rxReadStringPtr);
 
-        if (c == _rxTerminator || c == 0x00)
-        {
-          _RXmode = ATB_RX_MODE_NONE;
-          _cbDone(true, _rxReadStringPtr);
+        return 0;
+      }
 
-          return 0;
-        }
-        else
-        {
-          (*_rxReadStringPtr) += c;
-        }
+      _RXbuffer.commitRead(dataLen);
+    }
+
+    if ((len > 0) && buf)
+    {
+      size_t pos = atcp_find_terminator((const char *) buf, len, _rxTerminator);
+
+      _appendBytes((const char *) buf, pos);
+
+      if (pos < len)
+      {
+        _RXmode = ATB_RX_MODE_NONE;
+        _cbDone(true, _rxReadStringPtr);
+
+        return pos + 1;
       }
+
+      return len;
+    }
+  }
+  else if (_RXmode == ATB_RX_MODE_DELIMITER_STRING)
+  {
+    if (_rxReadStringPtr == NULL || _cbDone == NULL)
+    {
+      return 0;
     }
 
-    if (_RXbuffer->empty() && (len > 0) && buf)
+    bool found;
+
+    // handle Buffer, partial matches are carried between block spans
+    while (!_RXbuffer.empty())
     {
-      size_t newReadCount = 0;
+      const char * data;
+      size_t dataLen;
+
+      _RXbuffer.readSpans(&data, &dataLen);
 
-      while (newReadCount < len)
+      size_t end = _rxDelimiter.feed(data, dataLen, &found);
+
+      if (found)
       {
-        char c = (char) * buf;
-        buf++;
-        newReadCount++;
+        _appendDelimited(data, end);
+        _RXbuffer.commitRead(end);
+        _RXmode = ATB_RX_MODE_NONE;
+        _cbDone(true, _rxReadStringPtr);
 
-        if (c == _rxTerminator || c == 0x00)
-        {
-          _RXmode = ATB_RX_MODE_NONE;
-          _cbDone(true, _rxReadStringPtr);
+        return 0;
+      }
 
-          return newReadCount;
-        }
-        else
-        {
-          (*_rxReadStringPtr) += c;
-        }
+      _appendBytes(data, end);
+      _RXbuffer.commitRead(end);
+    }
+
+    if ((len > 0) && buf)
+    {
+      size_t end = _rxDelimiter.feed((const char *) buf, len, &found);
+
+      if (found)
+      {
+        _appendDelimited((const char *) buf, end);
+        _RXmode = ATB_RX_MODE_NONE;
+        _cbDone(true, _rxReadStringPtr);
+
+        return end;
       }
 
-      return newReadCount;
+      _appendBytes((const char *) buf, end);
+
+      return len;
     }
   }
 
@@ -840,4 +942,66 @@ size_t AsyncTCPbuffer::_handleRxBuffer(uint8_t *buf, size_t len)
 
 /////////////////////////////////////////////////////////
 
+// String::concat(const char *, unsigned int) is only public on some cores,
+// use it when it is, else append byte by byte. Both append by length, so NUL
+// bytes in binary payloads are kept.
+template<typename S>
+static inline auto atcp_concat(S & str, const char *data, size_t len, int) -> decltype(str.concat(data, (unsigned int) len), void())
+{
+  str.concat(data, (unsigned int) len);
+}
+
+template<typename S>
+static inline void atcp_concat(S & str, const char *data, size_t len, long)
+{
+  while (len--)
+    str.concat(*data++);
+}
+
+/////////////////////////////////////////////////////////
+
+// Appends len raw bytes to the pending String, reserving once
+void AsyncTCPbuffer::_appendBytes(const char *data, size_t len)
+{
+  if (len == 0)
+    return;
+
+  _rxReadStringPtr->reserve(_rxReadStringPtr->length() + len);
+
+  atcp_concat(*_rxReadStringPtr, data, len, 0);
+}
+
+/////////////////////////////////////////////////////////
+
+// Appends data[0..end) minus the delimiter ending at end. Delimiter bytes
+// that arrived with earlier chunks are already in the String and are cut off.
+void AsyncTCPbuffer::_appendDelimited(const char *data, size_t end)
+{
+  size_t delimLen = _rxDelimiter.length();
+  size_t inChunk = (end < delimLen) ? end : delimLen;
+
+  _appendBytes(data, end - inChunk);
+
+  if (delimLen > inChunk)
+  {
+    size_t strLen = _rxReadStringPtr->length();
+    size_t cut = delimLen - inChunk;
+
+    // substring() goes through a C string on some cores, copy by length instead
+    String head;
+
+    if (strLen > cut)
+    {
+      head.reserve(strLen - cut);
+      atcp_concat(head, _rxReadStringPtr->c_str(), strLen - cut, 0);
+    }
+
+    *_rxReadStringPtr = head;
+  }
+}
+
+/////////////////////////////////////////////////////////
+
+#endif    // TEENSY41_ASYNC_TCP_COMPILED
+
 #endif    // _TEENSY41_ASYNC_TCP_BUFFER_IMPL_H_
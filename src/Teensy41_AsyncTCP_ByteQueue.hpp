@@ -0,0 +1,182 @@
+/****************************************************************************************************************************
+  Teensy41_AsyncTCP_ByteQueue.hpp
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_BYTE_QUEUE_HPP_
+#define _TEENSY41_ASYNC_TCP_BYTE_QUEUE_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "Teensy41_AsyncTCP_Memory.hpp"
+
+/////////////////////////////////////////////////
+
+// Payload bytes per pool block
+#ifndef ASYNC_TCP_QUEUE_BLOCK_SIZE
+  #define ASYNC_TCP_QUEUE_BLOCK_SIZE          512
+#endif
+
+// Max number of blocks shared by all queues, 0 => limited by heap only
+#ifndef ASYNC_TCP_QUEUE_POOL_MAX_BLOCKS
+  #define ASYNC_TCP_QUEUE_POOL_MAX_BLOCKS     0
+#endif
+
+static_assert(ASYNC_TCP_QUEUE_BLOCK_SIZE <= 0xFFFF, "ASYNC_TCP_QUEUE_BLOCK_SIZE must fit in uint16_t");
+
+/////////////////////////////////////////////////
+
+struct atcp_block
+{
+  atcp_block *next;
+  uint16_t    start;
+  uint16_t    end;
+  char        data[ASYNC_TCP_QUEUE_BLOCK_SIZE];
+};
+
+/////////////////////////////////////////////////
+
+/*
+  Free list of fixed size blocks shared by all AsyncTCPByteQueue objects.
+  Blocks come from the heap the first time and are recycled afterwards, so
+  steady state traffic neither allocates nor fragments the heap.
+*/
+class AsyncTCPBlockPool
+{
+  public:
+    static atcp_block * get();
+    static void put(atcp_block *b);
+
+    // Hand idle blocks back to the heap
+    static void trim();
+
+    static void setMaxBlocks(size_t maxBlocks)
+    {
+      _maxBlocks = maxBlocks;
+    }
+
+    static size_t maxBlocks()
+    {
+      return _maxBlocks;
+    }
+
+    // Blocks allocated from the heap, in use or idle
+    static size_t totalBlocks()
+    {
+      return _totalBlocks;
+    }
+
+    static size_t freeBlocks()
+    {
+      return _freeBlocks;
+    }
+
+  private:
+    static atcp_block * _free;
+    static size_t _freeBlocks;
+    static size_t _totalBlocks;
+    static size_t _maxBlocks;
+};
+
+/////////////////////////////////////////////////
+
+/*
+  FIFO byte queue built from pool blocks. Append and consume are O(1) per
+  block and never move buffered bytes. Each queue can be capped with
+  setLimit(), the pool caps all queues together.
+*/
+class AsyncTCPByteQueue
+{
+  public:
+    AsyncTCPByteQueue(size_t limit = 0);
+    ~AsyncTCPByteQueue();
+
+    inline size_t available() const
+    {
+      return _size;
+    }
+
+    inline bool empty() const
+    {
+      return _size == 0;
+    }
+
+    // Bytes that can still be appended without exceeding the queue limit
+    size_t room() const;
+
+    void setLimit(size_t limit)
+    {
+      _limit = limit;
+    }
+
+    size_t getLimit() const
+    {
+      return _limit;
+    }
+
+    int peek();
+    size_t peek(char *dst, size_t size);
+
+    int read();
+    size_t read(char *dst, size_t size);
+
+    size_t write(char c);
+    size_t write(const char *src, size_t size);
+
+    void flush();
+    size_t remove(size_t size);
+
+    // First contiguous readable run, i.e. the rest of the head block
+    size_t readSpans(const char **data1, size_t *len1) const;
+    size_t commitRead(size_t size);
+
+    // Pool blocks currently held
+    size_t blocks() const
+    {
+      return _blocks;
+    }
+
+    // Attribute held blocks to a connection, NULL detaches. Holds a reference.
+    void setUsage(AsyncTCPMemUsage *usage);
+
+  private:
+    AsyncTCPByteQueue(const AsyncTCPByteQueue&);
+    AsyncTCPByteQueue& operator=(const AsyncTCPByteQueue&);
+
+    void _popHead();
+
+    atcp_block *_head;
+    atcp_block *_tail;
+    size_t _size;
+    size_t _limit;
+    size_t _blocks;
+    AsyncTCPMemUsage *_usage;
+};
+
+/////////////////////////////////////////////////
+
+#endif    // _TEENSY41_ASYNC_TCP_BYTE_QUEUE_HPP_
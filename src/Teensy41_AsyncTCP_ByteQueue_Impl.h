@@ -0,0 +1,358 @@
+/****************************************************************************************************************************
+  Teensy41_AsyncTCP_ByteQueue_Impl.h
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_BYTE_QUEUE_IMPL_H_
+#define _TEENSY41_ASYNC_TCP_BYTE_QUEUE_IMPL_H_
+
+#if !TEENSY41_ASYNC_TCP_COMPILED || defined(_TEENSY41_ASYNC_TCP_LIBRARY_)
+
+#include <new>
+
+#include "Teensy41_AsyncTCP_ByteQueue.hpp"
+
+/////////////////////////////////////////////////
+
+#if ASYNC_TCP_STATIC_MEMORY
+  static_assert(sizeof(atcp_block) <= ASYNC_TCP_STATIC_QUEUE_BLOCK_SIZE, "Increase ASYNC_TCP_STATIC_QUEUE_BLOCK_SIZE");
+#endif
+
+/////////////////////////////////////////////////
+
+atcp_block * AsyncTCPBlockPool::_free         = NULL;
+size_t       AsyncTCPBlockPool::_freeBlocks   = 0;
+size_t       AsyncTCPBlockPool::_totalBlocks  = 0;
+size_t       AsyncTCPBlockPool::_maxBlocks    = ASYNC_TCP_QUEUE_POOL_MAX_BLOCKS;
+
+/////////////////////////////////////////////////
+
+atcp_block * AsyncTCPBlockPool::get()
+{
+  atcp_block *b = _free;
+
+  if (b != NULL)
+  {
+    _free = b->next;
+    _freeBlocks--;
+  }
+  else
+  {
+    if (_maxBlocks && (_totalBlocks >= _maxBlocks))
+      return NULL;
+
+    b = (atcp_block *) AsyncTCPMemory::alloc(ATCP_MEM_QUEUE_BLOCK, sizeof(atcp_block));
+
+    if (b == NULL)
+      return NULL;
+
+    _totalBlocks++;
+  }
+
+  b->next = NULL;
+  b->start = 0;
+  b->end = 0;
+
+  return b;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPBlockPool::put(atcp_block *b)
+{
+  if (b == NULL)
+    return;
+
+  b->next = _free;
+  _free = b;
+  _freeBlocks++;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPBlockPool::trim()
+{
+  while (_free != NULL)
+  {
+    atcp_block *b = _free;
+    _free = b->next;
+    AsyncTCPMemory::free(b);
+
+    _freeBlocks--;
+    _totalBlocks--;
+  }
+}
+
+/////////////////////////////////////////////////
+/////////////////////////////////////////////////
+
+AsyncTCPByteQueue::AsyncTCPByteQueue(size_t limit)
+  : _head(NULL)
+  , _tail(NULL)
+  , _size(0)
+  , _limit(limit)
+  , _blocks(0)
+  , _usage(NULL)
+{
+}
+
+/////////////////////////////////////////////////
+
+AsyncTCPByteQueue::~AsyncTCPByteQueue()
+{
+  flush();
+  setUsage(NULL);
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPByteQueue::setUsage(AsyncTCPMemUsage *usage)
+{
+  if (usage == _usage)
+    return;
+
+  if (usage != NULL)
+  {
+    usage->ref();
+    usage->charge(ATCP_MEM_QUEUE_BLOCK, _blocks * sizeof(atcp_block));
+  }
+
+  if (_usage != NULL)
+  {
+    _usage->release(ATCP_MEM_QUEUE_BLOCK, _blocks * sizeof(atcp_block));
+    _usage->unref();
+  }
+
+  _usage = usage;
+}
+
+/////////////////////////////////////////////////
+
+size_t AsyncTCPByteQueue::room() const
+{
+  if (_limit == 0)
+    return (size_t) -1;
+
+  return (_size < _limit) ? (_limit - _size) : 0;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPByteQueue::_popHead()
+{
+  atcp_block *b = _head;
+
+  _head = b->next;
+
+  if (_head == NULL)
+    _tail = NULL;
+
+  _blocks--;
+
+  if (_usage != NULL)
+    _usage->release(ATCP_MEM_QUEUE_BLOCK, sizeof(atcp_block));
+
+  AsyncTCPBlockPool::put(b);
+}
+
+/////////////////////////////////////////////////
+
+int AsyncTCPByteQueue::peek()
+{
+  if (_size == 0)
+    return -1;
+
+  return static_cast<int>(_head->data[_head->start]);
+}
+
+/////////////////////////////////////////////////
+
+size_t AsyncTCPByteQueue::peek(char *dst, size_t size)
+{
+  size_t copied = 0;
+  atcp_block *b = _head;
+
+  while (b != NULL && copied < size)
+  {
+    size_t chunk = b->end - b->start;
+
+    if (chunk > size - copied)
+      chunk = size - copied;
+
+    memcpy(dst + copied, b->data + b->start, chunk);
+    copied += chunk;
+    b = b->next;
+  }
+
+  return copied;
+}
+
+/////////////////////////////////////////////////
+
+int AsyncTCPByteQueue::read()
+{
+  if (_size == 0)
+    return -1;
+
+  char result = _head->data[_head->start];
+  commitRead(1);
+
+  return static_cast<int>(result);
+}
+
+/////////////////////////////////////////////////
+
+size_t AsyncTCPByteQueue::read(char *dst, size_t size)
+{
+  size_t copied = peek(dst, size);
+
+  return commitRead(copied);
+}
+
+/////////////////////////////////////////////////
+
+size_t AsyncTCPByteQueue::write(char c)
+{
+  return write(&c, 1);
+}
+
+/////////////////////////////////////////////////
+
+size_t AsyncTCPByteQueue::write(const char *src, size_t size)
+{
+  size_t bytes_available = room();
+
+  if (size > bytes_available)
+    size = bytes_available;
+
+  size_t written = 0;
+
+  while (written < size)
+  {
+    if (_tail == NULL || _tail->end == ASYNC_TCP_QUEUE_BLOCK_SIZE)
+    {
+      atcp_block *b = AsyncTCPBlockPool::get();
+
+      if (b == NULL)
+        break;
+
+      _blocks++;
+
+      if (_usage != NULL)
+        _usage->charge(ATCP_MEM_QUEUE_BLOCK, sizeof(atcp_block));
+
+      if (_tail != NULL)
+        _tail->next = b;
+      else
+        _head = b;
+
+      _tail = b;
+    }
+
+    size_t chunk = ASYNC_TCP_QUEUE_BLOCK_SIZE - _tail->end;
+
+    if (chunk > size - written)
+      chunk = size - written;
+
+    memcpy(_tail->data + _tail->end, src + written, chunk);
+    _tail->end += chunk;
+    written += chunk;
+  }
+
+  _size += written;
+
+  return written;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPByteQueue::flush()
+{
+  while (_head != NULL)
+    _popHead();
+
+  _size = 0;
+}
+
+/////////////////////////////////////////////////
+
+size_t AsyncTCPByteQueue::remove(size_t size)
+{
+  commitRead(size);
+
+  return _size;
+}
+
+/////////////////////////////////////////////////
+
+size_t AsyncTCPByteQueue::readSpans(const char **data1, size_t *len1) const
+{
+  if (_head == NULL)
+  {
+    *data1 = NULL;
+    *len1 = 0;
+
+    return 0;
+  }
+
+  *data1 = _head->data + _head->start;
+  *len1 = _head->end - _head->start;
+
+  return *len1;
+}
+
+/////////////////////////////////////////////////
+
+size_t AsyncTCPByteQueue::commitRead(size_t size)
+{
+  if (size > _size)
+    size = _size;
+
+  size_t left = size;
+
+  while (left > 0)
+  {
+    size_t chunk = _head->end - _head->start;
+
+    if (chunk > left)
+    {
+      _head->start += left;
+      break;
+    }
+
+    left -= chunk;
+    _popHead();
+  }
+
+  _size -= size;
+
+  return size;
+}
+
+/////////////////////////////////////////////////
+
+#endif    // TEENSY41_ASYNC_TCP_COMPILED
+
+#endif    // _TEENSY41_ASYNC_TCP_BYTE_QUEUE_IMPL_H_
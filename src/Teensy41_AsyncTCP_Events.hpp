@@ -0,0 +1,169 @@
+/****************************************************************************************************************************
+  Teensy41_AsyncTCP_Events.hpp
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_EVENTS_HPP_
+#define _TEENSY41_ASYNC_TCP_EVENTS_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+
+/////////////////////////////////////////////////
+
+/*
+  Deferred dispatch. By default user handlers (onData, onAck, onPoll,
+  onClient, ...) run inside the lwIP callbacks, and a slow handler stalls
+  lwIP for every other connection. With ASYNC_TCP_DEFERRED_EVENTS the
+  callbacks only update the connection state and queue a compact event
+  (pbuf chain, lengths, error), the handlers then run from
+  AsyncTCPEvents::drain() called in loop().
+
+  Events hold the connection ACErrorTracker, so a client deleted before its
+  events are drained is detected with hasClient() as in the lwIP callbacks,
+  its queued pbufs are freed and its other events skipped. Until then the
+  tracker stays allocated, allow for it in ASYNC_TCP_STATIC_TRACKERS.
+
+  The receive window is only reopened (tcp_recved) once the data has been
+  delivered. When the queue is full, received data is refused with ERR_MEM
+  and lwIP offers it again from its timer, polls are dropped and other
+  events run in place, so the byte stream is never reordered.
+
+  Every client defaults to deferred dispatch, AsyncClient::setDeferred(false)
+  restores in place dispatch for one connection. SyncClient does so, its
+  blocking calls wait for its own handlers inside delay().
+*/
+#ifndef ASYNC_TCP_DEFERRED_EVENTS
+  #define ASYNC_TCP_DEFERRED_EVENTS     0
+#endif
+
+// Power of two
+#ifndef ASYNC_TCP_EVENT_QUEUE_SIZE
+  #define ASYNC_TCP_EVENT_QUEUE_SIZE    32
+#endif
+
+/////////////////////////////////////////////////
+
+class AsyncClient;
+class AsyncServer;
+class ACErrorTracker;
+
+typedef enum
+{
+  ATCP_EVENT_CONNECT,       // onConnect
+  ATCP_EVENT_DATA,          // onPacket / onData, pbuf chain
+  ATCP_EVENT_SENT,          // onAck, acked length and time
+  ATCP_EVENT_POLL,          // onPoll
+  ATCP_EVENT_TIMEOUT,       // onTimeout, elapsed time
+  ATCP_EVENT_ERROR,         // onError then onDisconnect
+  ATCP_EVENT_DISCARD,       // onDisconnect
+  ATCP_EVENT_ACCEPT,        // AsyncServer onClient
+  ATCP_EVENT_MAX
+} atcpEventType_t;
+
+typedef struct
+{
+  std::shared_ptr<ACErrorTracker> tracker;
+  void      *target;        // pbuf chain, or the AsyncServer of an accept
+  uint32_t  len;
+  uint32_t  time;
+  int8_t    err;
+  uint8_t   type;
+} atcpEvent_t;
+
+typedef struct
+{
+  uint32_t  queued;
+  uint32_t  delivered;
+  uint32_t  stale;          // client deleted before delivery
+  uint32_t  dropped;        // polls, queue full
+  uint32_t  refused;        // received data left to lwIP, queue full
+  uint32_t  inPlace;        // other events run in place, queue full
+  uint16_t  highWater;
+} atcpEventStats_t;
+
+/////////////////////////////////////////////////
+
+class AsyncTCPEvents
+{
+  public:
+#if ASYNC_TCP_DEFERRED_EVENTS
+    // Deliver queued events in order until the queue is empty or budgetUs
+    // has elapsed, 0 is no limit. Call from loop(), returns the number of
+    // events delivered. Handlers may call it again, it then returns 0.
+    static size_t drain(uint32_t budgetUs = 0);
+
+    static size_t pending()
+    {
+      return (uint16_t) (_head - _tail);
+    }
+
+    static const atcpEventStats_t & stats()
+    {
+      return _stats;
+    }
+#else
+    static size_t drain(uint32_t budgetUs = 0)
+    {
+      (void) budgetUs;
+
+      return 0;
+    }
+
+    static size_t pending()
+    {
+      return 0;
+    }
+#endif
+
+  protected:
+    friend class AsyncClient;
+    friend class AsyncServer;
+
+#if ASYNC_TCP_DEFERRED_EVENTS
+    // False when the queue is full, except for polls which are dropped
+    static bool post(uint8_t type, const std::shared_ptr<ACErrorTracker>& tracker, void *target = NULL,
+                     uint32_t len = 0, uint32_t time = 0, int8_t err = 0);
+
+    // Accepts of a server going away, the clients were never handed out
+    static void purge(AsyncServer *server);
+
+  private:
+    // Single producer (lwIP callbacks) and single consumer (drain), both in
+    // the NO_SYS main loop, free running indices
+    static atcpEvent_t        _queue[ASYNC_TCP_EVENT_QUEUE_SIZE];
+    static volatile uint16_t  _head;
+    static volatile uint16_t  _tail;
+    static bool               _draining;
+    static atcpEventStats_t   _stats;
+
+    static void _deliver(atcpEvent_t &event);
+#endif
+};
+
+/////////////////////////////////////////////////
+
+#endif    // _TEENSY41_ASYNC_TCP_EVENTS_HPP_
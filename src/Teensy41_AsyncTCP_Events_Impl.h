@@ -0,0 +1,242 @@
+/****************************************************************************************************************************
+  Teensy41_AsyncTCP_Events_Impl.h
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_EVENTS_IMPL_H_
+#define _TEENSY41_ASYNC_TCP_EVENTS_IMPL_H_
+
+#if !TEENSY41_ASYNC_TCP_COMPILED || defined(_TEENSY41_ASYNC_TCP_LIBRARY_)
+
+#if ASYNC_TCP_DEFERRED_EVENTS
+
+#include <Arduino.h>
+
+#include "Teensy41_AsyncTCP_Debug.h"
+#include "Teensy41_AsyncTCP_Events.hpp"
+
+/////////////////////////////////////////////////
+
+static_assert((ASYNC_TCP_EVENT_QUEUE_SIZE & (ASYNC_TCP_EVENT_QUEUE_SIZE - 1)) == 0,
+              "ASYNC_TCP_EVENT_QUEUE_SIZE must be a power of two");
+static_assert(ASYNC_TCP_EVENT_QUEUE_SIZE <= 32768, "ASYNC_TCP_EVENT_QUEUE_SIZE too large");
+
+#define ATCP_EVENT_MASK     (ASYNC_TCP_EVENT_QUEUE_SIZE - 1)
+
+atcpEvent_t       AsyncTCPEvents::_queue[ASYNC_TCP_EVENT_QUEUE_SIZE];
+volatile uint16_t AsyncTCPEvents::_head     = 0;
+volatile uint16_t AsyncTCPEvents::_tail     = 0;
+bool              AsyncTCPEvents::_draining = false;
+atcpEventStats_t  AsyncTCPEvents::_stats    = {};
+
+/////////////////////////////////////////////////
+
+bool AsyncTCPEvents::post(uint8_t type, const std::shared_ptr<ACErrorTracker>& tracker, void *target,
+                          uint32_t len, uint32_t time, int8_t err)
+{
+  if ((uint16_t) (_head - _tail) >= ASYNC_TCP_EVENT_QUEUE_SIZE)
+  {
+    ATCP_LOGDEBUG1("AsyncTCPEvents::post: queue full, type =", type);
+
+    if (type == ATCP_EVENT_POLL)
+    {
+      _stats.dropped++;
+
+      return true;
+    }
+
+    if (type == ATCP_EVENT_DATA)
+      _stats.refused++;
+    else
+      _stats.inPlace++;
+
+    return false;
+  }
+
+  atcpEvent_t &event = _queue[_head & ATCP_EVENT_MASK];
+
+  event.tracker = tracker;
+  event.target  = target;
+  event.len     = len;
+  event.time    = time;
+  event.err     = err;
+  event.type    = type;
+
+  // Held by the library until delivered
+  if (type == ATCP_EVENT_DATA)
+    AsyncTCPMemory::charge(ATCP_MEM_PBUF, ((pbuf *) target)->tot_len);
+
+  _head++;
+  _stats.queued++;
+
+  if (pending() > _stats.highWater)
+    _stats.highWater = pending();
+
+  return true;
+}
+
+/////////////////////////////////////////////////
+
+size_t AsyncTCPEvents::drain(uint32_t budgetUs)
+{
+  if (_draining)
+    return 0;
+
+  _draining = true;
+
+  uint32_t start = micros();
+  size_t delivered = 0;
+
+  while (_tail != _head)
+  {
+    // At least one event per call
+    if (budgetUs && delivered && ((micros() - start) >= budgetUs))
+      break;
+
+    // Free the slot before the handler runs, it may queue more events
+    atcpEvent_t event = std::move(_queue[_tail & ATCP_EVENT_MASK]);
+    _tail++;
+
+    _deliver(event);
+    delivered++;
+  }
+
+  _stats.delivered += delivered;
+  _draining = false;
+
+  return delivered;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPEvents::purge(AsyncServer *server)
+{
+  for (uint16_t i = _tail; i != _head; i++)
+  {
+    atcpEvent_t &event = _queue[i & ATCP_EVENT_MASK];
+
+    if ( (event.type == ATCP_EVENT_ACCEPT) && (event.target == server) && event.tracker->hasClient() )
+    {
+      // Delivered as stale once the client is gone
+      delete event.tracker->_client;
+    }
+  }
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPEvents::_deliver(atcpEvent_t &event)
+{
+  AsyncClient *c = event.tracker->_client;
+
+  if (event.type == ATCP_EVENT_DATA)
+    AsyncTCPMemory::release(ATCP_MEM_PBUF, ((pbuf *) event.target)->tot_len);
+
+  if (c == NULL)
+  {
+    ATCP_LOGDEBUG1("AsyncTCPEvents::_deliver: client gone, type =", event.type);
+
+    if (event.type == ATCP_EVENT_DATA)
+      pbuf_free((pbuf *) event.target);
+
+    _stats.stale++;
+
+    return;
+  }
+
+  switch (event.type)
+  {
+    case ATCP_EVENT_CONNECT:
+      if (c->_connect_cb)
+        c->_connect_cb(c->_connect_cb_arg, c);
+
+      break;
+
+    case ATCP_EVENT_DATA:
+      c->_recvPbufs(event.tracker, c->_pcb, (pbuf *) event.target);
+
+      break;
+
+    case ATCP_EVENT_SENT:
+      if (c->_sent_cb)
+        c->_sent_cb(c->_sent_cb_arg, c, event.len, event.time);
+
+      break;
+
+    case ATCP_EVENT_POLL:
+      if (c->_poll_cb)
+        c->_poll_cb(c->_poll_cb_arg, c);
+
+      break;
+
+#if ASYNC_TCP_ACK_TIMEOUT
+
+    case ATCP_EVENT_TIMEOUT:
+      if (c->_timeout_cb)
+        c->_timeout_cb(c->_timeout_cb_arg, c, event.time);
+
+      break;
+#endif
+
+    case ATCP_EVENT_ERROR:
+      if (c->_error_cb)
+        c->_error_cb(c->_error_cb_arg, c, event.err);
+
+      if (event.tracker->hasClient() && c->_discard_cb)
+        c->_discard_cb(c->_discard_cb_arg, c);
+
+      break;
+
+    case ATCP_EVENT_DISCARD:
+      if (c->_discard_cb)
+        c->_discard_cb(c->_discard_cb_arg, c);
+
+      break;
+
+    case ATCP_EVENT_ACCEPT:
+    {
+      AsyncServer *server = (AsyncServer *) event.target;
+
+      // onClient() removed meanwhile, nobody owns the client
+      if (server->_connect_cb)
+        server->_connect_cb(server->_connect_cb_arg, c);
+      else
+        delete c;
+
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
+/////////////////////////////////////////////////
+
+#endif    // ASYNC_TCP_DEFERRED_EVENTS
+
+#endif    // TEENSY41_ASYNC_TCP_COMPILED
+
+#endif    // _TEENSY41_ASYNC_TCP_EVENTS_IMPL_H_
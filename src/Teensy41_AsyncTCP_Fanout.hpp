@@ -0,0 +1,132 @@
+/****************************************************************************************************************************
+  Teensy41_AsyncTCP_Fanout.hpp
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_FANOUT_HPP_
+#define _TEENSY41_ASYNC_TCP_FANOUT_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/////////////////////////////////////////////////
+
+/*
+  Fan-out of one payload to many connections. With ASYNC_TCP_FANOUT an
+  AsyncTCPPayload holds a single copy of the data, and
+  AsyncClient::sendShared() hands it to lwIP by reference (no
+  ASYNC_WRITE_FLAG_COPY). Each client holds a reference until its bytes are
+  ACKed or the connection is gone, so RAM per broadcast does not grow with
+  the number of subscribers.
+
+  Every client queues up to ASYNC_TCP_FANOUT_DEPTH payloads. A slow
+  subscriber with a full queue either drops the new payload
+  (ATCP_FANOUT_DROP) or replaces its newest payload not yet sent
+  (ATCP_FANOUT_COALESCE), set with AsyncClient::setFanoutPolicy().
+
+  lwIP reads lent payloads until they are ACKed. close(false) therefore waits
+  up to ASYNC_MAX_ACK_TIME for them, and a close that cannot wait aborts the
+  connection instead.
+
+  Payloads are ATCP_MEM_TX_BUFFER blocks, header included.
+*/
+#ifndef ASYNC_TCP_FANOUT
+  #define ASYNC_TCP_FANOUT              0
+#endif
+
+#ifndef ASYNC_TCP_FANOUT_DEPTH
+  #define ASYNC_TCP_FANOUT_DEPTH        4
+#endif
+
+/////////////////////////////////////////////////
+
+typedef enum
+{
+  ATCP_FANOUT_DROP,         // full queue refuses the new payload
+  ATCP_FANOUT_COALESCE,     // new payload replaces the newest one not sent yet
+  ATCP_FANOUT_POLICY_MAX
+} atcpFanoutPolicy_t;
+
+typedef struct
+{
+  uint32_t  queued;         // payloads queued, not counting coalesced ones
+  uint32_t  dropped;        // payloads refused, queue full
+  uint32_t  coalesced;      // payloads replaced before any byte was sent
+  uint32_t  aborted;        // closes turned into aborts, payload still unacked
+} atcpFanoutStats_t;
+
+/////////////////////////////////////////////////
+
+class AsyncTCPPayload
+{
+  public:
+    // One copy of data, starts with the reference of the caller
+    static AsyncTCPPayload * create(const void *data, size_t len);
+
+    void ref()
+    {
+      _refs++;
+    }
+
+    void unref();
+
+    const char * data() const
+    {
+      return reinterpret_cast<const char *>(this) + sizeof(AsyncTCPPayload);
+    }
+
+    size_t length() const
+    {
+      return _len;
+    }
+
+    // Caller and clients still holding it
+    uint16_t refs() const
+    {
+      return _refs;
+    }
+
+  private:
+    AsyncTCPPayload(size_t len);
+    AsyncTCPPayload(const AsyncTCPPayload&);
+    AsyncTCPPayload& operator=(const AsyncTCPPayload&);
+
+    uint32_t  _len;
+    uint16_t  _refs;
+};
+
+/////////////////////////////////////////////////
+
+// A payload queued on one client
+typedef struct
+{
+  AsyncTCPPayload  *payload;
+  uint32_t          written;    // bytes given to lwIP
+  uint32_t          seqEnd;     // AsyncClient send sequence after the last of them
+} atcpFanoutEntry_t;
+
+/////////////////////////////////////////////////
+
+#endif    // _TEENSY41_ASYNC_TCP_FANOUT_HPP_
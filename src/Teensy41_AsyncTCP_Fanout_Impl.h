@@ -0,0 +1,88 @@
+/****************************************************************************************************************************
+  Teensy41_AsyncTCP_Fanout_Impl.h
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_FANOUT_IMPL_H_
+#define _TEENSY41_ASYNC_TCP_FANOUT_IMPL_H_
+
+#if !TEENSY41_ASYNC_TCP_COMPILED || defined(_TEENSY41_ASYNC_TCP_LIBRARY_)
+
+#if ASYNC_TCP_FANOUT
+
+#include <string.h>
+
+#include "Teensy41_AsyncTCP_Debug.h"
+#include "Teensy41_AsyncTCP_Fanout.hpp"
+
+/////////////////////////////////////////////////
+
+AsyncTCPPayload::AsyncTCPPayload(size_t len)
+  : _len(len)
+  , _refs(1)
+{
+}
+
+/////////////////////////////////////////////////
+
+AsyncTCPPayload * AsyncTCPPayload::create(const void *data, size_t len)
+{
+  if ( (data == NULL) || (len == 0) )
+    return NULL;
+
+  void *mem = AsyncTCPMemory::alloc(ATCP_MEM_TX_BUFFER, sizeof(AsyncTCPPayload) + len);
+
+  if (mem == NULL)
+  {
+    ATCP_LOGERROR1("AsyncTCPPayload: no memory, len =", len);
+
+    return NULL;
+  }
+
+  AsyncTCPPayload *p = new (mem) AsyncTCPPayload(len);
+
+  memcpy((char *) mem + sizeof(AsyncTCPPayload), data, len);
+
+  return p;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPPayload::unref()
+{
+  if (--_refs > 0)
+    return;
+
+  this->~AsyncTCPPayload();
+  AsyncTCPMemory::free(this);
+}
+
+/////////////////////////////////////////////////
+
+#endif    // ASYNC_TCP_FANOUT
+
+#endif    // TEENSY41_ASYNC_TCP_COMPILED
+
+#endif    // _TEENSY41_ASYNC_TCP_FANOUT_IMPL_H_
@@ -0,0 +1,237 @@
+/****************************************************************************************************************************
+  Teensy41_AsyncTCP_Frame.hpp
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_FRAME_HPP_
+#define _TEENSY41_ASYNC_TCP_FRAME_HPP_
+
+#include "Teensy41_AsyncTCP.hpp"
+#include "Teensy41_AsyncTCP_Memory.hpp"
+
+/////////////////////////////////////////////////
+
+// Largest accepted / sent payload. Bigger incoming frames abort the connection.
+#ifndef ASYNC_TCP_FRAME_MAX_SIZE
+  #define ASYNC_TCP_FRAME_MAX_SIZE          4096
+#endif
+
+// Bytes of a frame being assembled that may stay unacked. Keep it below
+// TCP_WND, or frames bigger than the window could never complete.
+#ifndef ASYNC_TCP_FRAME_ACK_AHEAD
+  #define ASYNC_TCP_FRAME_ACK_AHEAD         (TCP_WND / 2)
+#endif
+
+// Idle assembly buffers kept per size class
+#ifndef ASYNC_TCP_FRAME_POOL_MAX_FREE
+  #define ASYNC_TCP_FRAME_POOL_MAX_FREE     2
+#endif
+
+/////////////////////////////////////////////////
+
+typedef enum
+{
+  ATCP_FRAME_PREFIX_VARINT  = 0,      // LEB128, up to 5 bytes
+  ATCP_FRAME_PREFIX_8       = 1,
+  ATCP_FRAME_PREFIX_16      = 2,
+  ATCP_FRAME_PREFIX_32      = 4
+} atcpFramePrefix_t;
+
+typedef enum
+{
+  ATCP_FRAME_BIG_ENDIAN,
+  ATCP_FRAME_LITTLE_ENDIAN
+} atcpFrameEndian_t;
+
+/////////////////////////////////////////////////
+
+struct atcp_frame_buf
+{
+  atcp_frame_buf *next;
+  size_t          capacity;
+};
+
+/*
+  Power of two size classes of frame assembly buffers, shared by all codecs.
+  Buffers above the largest class are allocated and freed as needed.
+*/
+class AsyncFramePool
+{
+  public:
+    static uint8_t * get(size_t size);
+    static void put(uint8_t *data);
+
+    // Hand idle buffers back to the heap
+    static void trim();
+
+  private:
+    static const uint8_t _minShift = 6;
+    static const uint8_t _classes = 10;     // 64 bytes .. 32 KB
+
+    static atcp_frame_buf * _free[_classes];
+    static uint8_t _freeCount[_classes];
+};
+
+/////////////////////////////////////////////////
+
+class AsyncFrameCodec;
+
+typedef std::function<void(void*, AsyncFrameCodec*, uint8_t *payload, size_t len)> AcFrameHandler;
+typedef std::function<void(void*, AsyncFrameCodec*, size_t len)> AcFrameSizeHandler;
+
+/*
+  Length prefixed framing on top of an AsyncClient, installed as its
+  onPacket() handler.
+
+  RX: a frame lying completely inside one pbuf is handed to onFrame() in
+  place. Frames spanning pbufs are assembled in a pooled buffer. The payload
+  pointer is only valid during the callback.
+
+  Received bytes are acked when the frame they belong to has been delivered
+  (a partial frame at most ASYNC_TCP_FRAME_ACK_AHEAD bytes ahead). pause()
+  stops delivery and acking altogether, so the peer's window closes and it
+  is throttled until resume().
+
+  TX: send() writes prefix and payload in one go, lwIP puts them in the same
+  segment. It is all or nothing, so a frame must fit space().
+
+  The codec must be destroyed before its client. Deleting it, or closing the
+  client, from onFrame() / onOversize() or a handler they trigger is fine:
+  processing stops right there. Bytes it still holds are dropped and acked,
+  so the client can go on with onData() at its full window.
+*/
+class AsyncFrameCodec
+{
+  public:
+    AsyncFrameCodec(AsyncClient *client, atcpFramePrefix_t prefix = ATCP_FRAME_PREFIX_32,
+                    atcpFrameEndian_t endian = ATCP_FRAME_BIG_ENDIAN, size_t maxFrameSize = ASYNC_TCP_FRAME_MAX_SIZE);
+    ~AsyncFrameCodec();
+
+    void onFrame(AcFrameHandler cb, void* arg = 0);
+
+    // Peer announced a frame over maxFrameSize, the connection is aborted afterwards
+    void onOversize(AcFrameSizeHandler cb, void* arg = 0);
+
+    inline AsyncClient * client()
+    {
+      return _client;
+    }
+
+    void setMaxFrameSize(size_t maxFrameSize)
+    {
+      _maxFrameSize = maxFrameSize;
+    }
+
+    size_t getMaxFrameSize() const
+    {
+      return _maxFrameSize;
+    }
+
+    void setAckAhead(size_t ackAhead)
+    {
+      _ackAhead = ackAhead;
+    }
+
+    void pause();
+    void resume();
+
+    inline bool paused() const
+    {
+      return _paused;
+    }
+
+    // Received bytes not delivered yet
+    inline size_t queued() const
+    {
+      return _rx_queued;
+    }
+
+    // Prefix bytes needed for a payload of len bytes, 0 if it can't be encoded
+    size_t headerLength(size_t len) const;
+
+    bool canSend(size_t len);
+
+    // Returns len, or 0 if nothing was queued
+    size_t send(const void *payload, size_t len, uint8_t apiflags = ASYNC_WRITE_FLAG_COPY);
+
+  private:
+    typedef enum
+    {
+      FRAME_STATE_HEADER,
+      FRAME_STATE_PAYLOAD
+    } frameState_t;
+
+    AsyncClient * _client;
+    atcpFramePrefix_t _prefix;
+    atcpFrameEndian_t _endian;
+    size_t _maxFrameSize;
+    size_t _ackAhead;
+    bool _paused;
+    bool _failed;
+    bool _processing;
+
+    // Set while _process() runs, cleared by the destructor
+    bool * _alive;
+
+    AcFrameHandler _frame_cb;
+    void * _frame_cb_arg;
+    AcFrameSizeHandler _oversize_cb;
+    void * _oversize_cb_arg;
+
+    // Received, not yet consumed pbufs
+    struct pbuf *_rx_head;
+    struct pbuf *_rx_tail;
+    size_t _rx_head_offset;
+    size_t _rx_queued;
+    size_t _rx_unacked;
+
+    frameState_t _state;
+    uint8_t _hdr[5];
+    uint8_t _hdrLen;
+    size_t _frameLen;
+    uint8_t * _asm;
+    size_t _asmLen;
+
+    // Connection the queued pbufs and the assembly buffer are accounted to
+    AsyncTCPMemUsage * _usage;
+
+    AsyncFrameCodec(const AsyncFrameCodec&);
+    AsyncFrameCodec& operator=(const AsyncFrameCodec&);
+
+    void _onPacket(struct pbuf *pb);
+    void _process();
+    size_t _consume(uint8_t *data, size_t len);
+    bool _parseHeader(const uint8_t *hdr, size_t len, size_t *frameLen, size_t *used) const;
+    bool _startFrame(size_t frameLen);
+    void _deliver(uint8_t *payload, size_t len);
+    void _ack(size_t len);
+    void _fail();
+    void _rxFree();
+    void _asmFree();
+};
+
+/////////////////////////////////////////////////
+
+#endif    // _TEENSY41_ASYNC_TCP_FRAME_HPP_
@@ -0,0 +1,675 @@
+/****************************************************************************************************************************
+  Teensy41_AsyncTCP_Frame_Impl.h
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_FRAME_IMPL_H_
+#define _TEENSY41_ASYNC_TCP_FRAME_IMPL_H_
+
+#if !TEENSY41_ASYNC_TCP_COMPILED || defined(_TEENSY41_ASYNC_TCP_LIBRARY_)
+
+#include "Teensy41_AsyncTCP_Frame.hpp"
+
+/////////////////////////////////////////////////
+
+atcp_frame_buf * AsyncFramePool::_free[AsyncFramePool::_classes]      = {};
+uint8_t          AsyncFramePool::_freeCount[AsyncFramePool::_classes] = {};
+
+/////////////////////////////////////////////////
+
+uint8_t * AsyncFramePool::get(size_t size)
+{
+  uint8_t cls = 0;
+  size_t capacity = (size_t) 1 << _minShift;
+
+  while ((capacity < size) && (cls < _classes))
+  {
+    capacity <<= 1;
+    cls++;
+  }
+
+  atcp_frame_buf *b;
+
+  if (cls < _classes)
+  {
+    b = _free[cls];
+
+    if (b != NULL)
+    {
+      _free[cls] = b->next;
+      _freeCount[cls]--;
+
+      return (uint8_t *) (b + 1);
+    }
+  }
+  else
+  {
+    capacity = size;
+  }
+
+  b = (atcp_frame_buf *) AsyncTCPMemory::alloc(ATCP_MEM_FRAME, sizeof(atcp_frame_buf) + capacity);
+
+  if (b == NULL)
+    return NULL;
+
+  b->next = NULL;
+  b->capacity = capacity;
+
+  return (uint8_t *) (b + 1);
+}
+
+/////////////////////////////////////////////////
+
+void AsyncFramePool::put(uint8_t *data)
+{
+  if (data == NULL)
+    return;
+
+  atcp_frame_buf *b = ((atcp_frame_buf *) data) - 1;
+
+  uint8_t cls = 0;
+  size_t capacity = (size_t) 1 << _minShift;
+
+  while ((capacity < b->capacity) && (cls < _classes))
+  {
+    capacity <<= 1;
+    cls++;
+  }
+
+  if ((cls < _classes) && (capacity == b->capacity) && (_freeCount[cls] < ASYNC_TCP_FRAME_POOL_MAX_FREE))
+  {
+    b->next = _free[cls];
+    _free[cls] = b;
+    _freeCount[cls]++;
+
+    return;
+  }
+
+  AsyncTCPMemory::free(b);
+}
+
+/////////////////////////////////////////////////
+
+void AsyncFramePool::trim()
+{
+  for (uint8_t cls = 0; cls < _classes; cls++)
+  {
+    while (_free[cls] != NULL)
+    {
+      atcp_frame_buf *b = _free[cls];
+      _free[cls] = b->next;
+      AsyncTCPMemory::free(b);
+    }
+
+    _freeCount[cls] = 0;
+  }
+}
+
+/////////////////////////////////////////////////
+/////////////////////////////////////////////////
+
+AsyncFrameCodec::AsyncFrameCodec(AsyncClient *client, atcpFramePrefix_t prefix, atcpFrameEndian_t endian, size_t maxFrameSize)
+  : _client(client)
+  , _prefix(prefix)
+  , _endian(endian)
+  , _maxFrameSize(maxFrameSize)
+  , _ackAhead(ASYNC_TCP_FRAME_ACK_AHEAD)
+  , _paused(false)
+  , _failed(false)
+  , _processing(false)
+  , _alive(NULL)
+  , _frame_cb(0)
+  , _frame_cb_arg(0)
+  , _oversize_cb(0)
+  , _oversize_cb_arg(0)
+  , _rx_head(NULL)
+  , _rx_tail(NULL)
+  , _rx_head_offset(0)
+  , _rx_queued(0)
+  , _rx_unacked(0)
+  , _state(FRAME_STATE_HEADER)
+  , _hdrLen(0)
+  , _frameLen(0)
+  , _asm(NULL)
+  , _asmLen(0)
+  , _usage(NULL)
+{
+  if (_client)
+  {
+    _usage = _client->memUsage();
+
+    if (_usage)
+      _usage->ref();
+
+    _client->onPacket([](void *obj, AsyncClient * c, struct pbuf *pb)
+    {
+      (void) c;
+      static_cast<AsyncFrameCodec*>(obj)->_onPacket(pb);
+    }, this);
+  }
+}
+
+/////////////////////////////////////////////////
+
+AsyncFrameCodec::~AsyncFrameCodec()
+{
+  // Deleted from a callback, tell the running _process() to stop
+  if (_alive)
+    *_alive = false;
+
+  if (_client)
+  {
+    _client->onPacket(NULL, NULL);
+
+    // The client may go on in raw mode, give back the window held for
+    // bytes consumed or dropped here
+    if (_client->connected())
+      _client->ack(_rx_unacked + _rx_queued);
+  }
+
+  _rxFree();
+  _asmFree();
+
+  if (_usage)
+    _usage->unref();
+}
+
+/////////////////////////////////////////////////
+
+void AsyncFrameCodec::onFrame(AcFrameHandler cb, void* arg)
+{
+  _frame_cb = cb;
+  _frame_cb_arg = arg;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncFrameCodec::onOversize(AcFrameSizeHandler cb, void* arg)
+{
+  _oversize_cb = cb;
+  _oversize_cb_arg = arg;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncFrameCodec::pause()
+{
+  _paused = true;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncFrameCodec::resume()
+{
+  _paused = false;
+
+  // From within a callback the running _process() picks up again by itself
+  if (!_processing)
+    _process();
+}
+
+/////////////////////////////////////////////////
+
+size_t AsyncFrameCodec::headerLength(size_t len) const
+{
+  switch (_prefix)
+  {
+    case ATCP_FRAME_PREFIX_8:
+      return (len <= 0xFF) ? 1 : 0;
+
+    case ATCP_FRAME_PREFIX_16:
+      return (len <= 0xFFFF) ? 2 : 0;
+
+    case ATCP_FRAME_PREFIX_32:
+      return (len <= 0xFFFFFFFFUL) ? 4 : 0;
+
+    default:
+      break;
+  }
+
+  size_t hdrLen = 1;
+
+  while ((len >>= 7) != 0)
+    hdrLen++;
+
+  return (hdrLen <= 5) ? hdrLen : 0;
+}
+
+/////////////////////////////////////////////////
+
+bool AsyncFrameCodec::canSend(size_t len)
+{
+  size_t hdrLen = headerLength(len);
+
+  return _client && hdrLen && (len <= _maxFrameSize) && (_client->space() >= hdrLen + len);
+}
+
+/////////////////////////////////////////////////
+
+size_t AsyncFrameCodec::send(const void *payload, size_t len, uint8_t apiflags)
+{
+  if (!canSend(len) || ((len > 0) && (payload == NULL)))
+    return 0;
+
+  uint8_t hdr[5];
+  size_t hdrLen = headerLength(len);
+
+  if (_prefix == ATCP_FRAME_PREFIX_VARINT)
+  {
+    size_t v = len;
+
+    for (size_t i = 0; i < hdrLen; i++)
+    {
+      hdr[i] = (v & 0x7F) | ((i + 1 < hdrLen) ? 0x80 : 0);
+      v >>= 7;
+    }
+  }
+  else
+  {
+    for (size_t i = 0; i < hdrLen; i++)
+    {
+      size_t shift = (_endian == ATCP_FRAME_BIG_ENDIAN) ? 8 * (hdrLen - 1 - i) : 8 * i;
+
+      hdr[i] = (len >> shift) & 0xFF;
+    }
+  }
+
+  // MORE keeps the prefix in the segment the payload is appended to
+  if (_client->add((const char *) hdr, hdrLen, ASYNC_WRITE_FLAG_COPY | ASYNC_WRITE_FLAG_MORE) != hdrLen)
+    return 0;
+
+  if ((len > 0) && (_client->add((const char *) payload, len, apiflags) != len))
+  {
+    // A prefix without its payload would desync the peer
+    ATCP_LOGERROR1("AsyncFrameCodec::send: partial frame, len =", len);
+
+    _client->abort();
+
+    return 0;
+  }
+
+  if (!_client->send())
+    return 0;
+
+  return len;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncFrameCodec::_onPacket(struct pbuf *pb)
+{
+  if (_failed)
+  {
+    pbuf_free(pb);
+
+    return;
+  }
+
+  if (pb->len == 0)
+  {
+    _client->ackPacket(pb);
+
+    return;
+  }
+
+  pb->next = NULL;
+
+  if (_rx_tail != NULL)
+    _rx_tail->next = pb;
+  else
+    _rx_head = pb;
+
+  _rx_tail = pb;
+  _rx_queued += pb->len;
+  _client->_rx_ack_len += pb->len;
+
+  AsyncTCPMemory::charge(ATCP_MEM_PBUF, pb->len);
+
+  if (_usage)
+    _usage->charge(ATCP_MEM_PBUF, pb->len);
+
+  if (!_paused && !_processing)
+    _process();
+}
+
+/////////////////////////////////////////////////
+
+void AsyncFrameCodec::_process()
+{
+  // Callbacks, and the handlers of an abort(), may delete the codec. Nothing
+  // is touched after a callback once this turns false.
+  bool alive = true;
+
+  _alive = &alive;
+  _processing = true;
+
+  while ((_rx_head != NULL) && !_paused && !_failed)
+  {
+    uint8_t *data = static_cast<uint8_t*>(_rx_head->payload) + _rx_head_offset;
+    size_t used = _consume(data, _rx_head->len - _rx_head_offset);
+
+    if (!alive)
+      return;
+
+    if (_failed)
+      break;
+
+    _rx_head_offset += used;
+    _rx_queued -= used;
+    _rx_unacked += used;
+
+    if (_rx_head_offset == _rx_head->len)
+    {
+      pbuf *b = _rx_head;
+      _rx_head = b->next;
+      b->next = NULL;
+
+      AsyncTCPMemory::release(ATCP_MEM_PBUF, b->len);
+
+      if (_usage)
+        _usage->release(ATCP_MEM_PBUF, b->len);
+
+      pbuf_free(b);
+      _rx_head_offset = 0;
+
+      if (_rx_head == NULL)
+        _rx_tail = NULL;
+    }
+
+    // On a frame boundary everything consumed so far has been delivered
+    if (((_state == FRAME_STATE_HEADER) && (_hdrLen == 0)) || (_rx_unacked > _ackAhead))
+      _ack(_rx_unacked);
+  }
+
+  _processing = false;
+  _alive = NULL;
+}
+
+/////////////////////////////////////////////////
+
+size_t AsyncFrameCodec::_consume(uint8_t *data, size_t len)
+{
+  bool *alive = _alive;
+  size_t i = 0;
+
+  while ((i < len) && !_paused && !_failed)
+  {
+    if (_state == FRAME_STATE_HEADER)
+    {
+      size_t frameLen;
+      size_t used;
+
+      if ((_hdrLen == 0) && _parseHeader(data + i, len - i, &frameLen, &used))
+      {
+        i += used;
+      }
+      else
+      {
+        // Prefix split across pbufs
+        _hdr[_hdrLen++] = data[i++];
+
+        if (!_parseHeader(_hdr, _hdrLen, &frameLen, &used))
+          continue;
+
+        _hdrLen = 0;
+      }
+
+      if (!_startFrame(frameLen) || !*alive)
+        return i;
+
+      continue;
+    }
+
+    size_t avail = len - i;
+
+    if ((_asm == NULL) && (avail >= _frameLen))
+    {
+      // Whole frame in this pbuf, no copy
+      _state = FRAME_STATE_HEADER;
+      i += _frameLen;
+      _deliver(data + i - _frameLen, _frameLen);
+
+      if (!*alive)
+        return i;
+
+      continue;
+    }
+
+    if (_asm == NULL)
+    {
+      _asm = AsyncFramePool::get(_frameLen);
+      _asmLen = 0;
+
+      if (_asm == NULL)
+      {
+        ATCP_LOGERROR1("AsyncFrameCodec: no assembly buffer, len =", _frameLen);
+
+        _fail();
+
+        return i;
+      }
+
+      if (_usage)
+        _usage->charge(ATCP_MEM_FRAME, _frameLen);
+    }
+
+    size_t chunk = _frameLen - _asmLen;
+
+    if (chunk > avail)
+      chunk = avail;
+
+    memcpy(_asm + _asmLen, data + i, chunk);
+    _asmLen += chunk;
+    i += chunk;
+
+    if (_asmLen == _frameLen)
+    {
+      uint8_t *frame = _asm;
+      size_t frameLen = _frameLen;
+
+      _asm = NULL;
+      _state = FRAME_STATE_HEADER;
+
+      if (_usage)
+        _usage->release(ATCP_MEM_FRAME, frameLen);
+
+      _deliver(frame, frameLen);
+      AsyncFramePool::put(frame);
+
+      if (!*alive)
+        return i;
+    }
+  }
+
+  return i;
+}
+
+/////////////////////////////////////////////////
+
+// true once a full prefix is in hdr. A malformed varint, or one over 32 bits,
+// yields (size_t) -1.
+bool AsyncFrameCodec::_parseHeader(const uint8_t *hdr, size_t len, size_t *frameLen, size_t *used) const
+{
+  if (_prefix == ATCP_FRAME_PREFIX_VARINT)
+  {
+    uint32_t v = 0;
+
+    for (size_t i = 0; (i < len) && (i < 5); i++)
+    {
+      // Only the low 4 bits of the 5th byte fit, the rest would be lost
+      if ((i == 4) && (hdr[i] & 0x70))
+        break;
+
+      v |= (uint32_t) (hdr[i] & 0x7F) << (7 * i);
+
+      if (!(hdr[i] & 0x80))
+      {
+        *frameLen = v;
+        *used = i + 1;
+
+        return true;
+      }
+    }
+
+    if (len < 5)
+      return false;
+
+    *frameLen = (size_t) -1;
+    *used = 5;
+
+    return true;
+  }
+
+  size_t width = _prefix;
+
+  if (len < width)
+    return false;
+
+  uint32_t v = 0;
+
+  for (size_t i = 0; i < width; i++)
+  {
+    if (_endian == ATCP_FRAME_BIG_ENDIAN)
+      v = (v << 8) | hdr[i];
+    else
+      v |= (uint32_t) hdr[i] << (8 * i);
+  }
+
+  *frameLen = v;
+  *used = width;
+
+  return true;
+}
+
+/////////////////////////////////////////////////
+
+bool AsyncFrameCodec::_startFrame(size_t frameLen)
+{
+  if (frameLen > _maxFrameSize)
+  {
+    ATCP_LOGERROR1("AsyncFrameCodec: frame too large, len =", frameLen);
+
+    bool *alive = _alive;
+
+    if (_oversize_cb)
+      _oversize_cb(_oversize_cb_arg, this, frameLen);
+
+    if (!*alive)
+      return false;
+
+    _fail();
+
+    return false;
+  }
+
+  if (frameLen == 0)
+  {
+    _deliver(NULL, 0);
+
+    return true;
+  }
+
+  _state = FRAME_STATE_PAYLOAD;
+  _frameLen = frameLen;
+  _asmLen = 0;
+
+  return true;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncFrameCodec::_deliver(uint8_t *payload, size_t len)
+{
+  if (_frame_cb)
+    _frame_cb(_frame_cb_arg, this, payload, len);
+}
+
+/////////////////////////////////////////////////
+
+void AsyncFrameCodec::_ack(size_t len)
+{
+  if (len == 0)
+    return;
+
+  _rx_unacked -= len;
+
+  if (_client->connected())
+    _client->ack(len);
+}
+
+/////////////////////////////////////////////////
+
+void AsyncFrameCodec::_fail()
+{
+  _failed = true;
+
+  _rxFree();
+  _asmFree();
+
+  _client->abort();
+}
+
+/////////////////////////////////////////////////
+
+void AsyncFrameCodec::_rxFree()
+{
+  while (_rx_head != NULL)
+  {
+    pbuf *b = _rx_head;
+    _rx_head = b->next;
+    b->next = NULL;
+
+    AsyncTCPMemory::release(ATCP_MEM_PBUF, b->len);
+
+    if (_usage)
+      _usage->release(ATCP_MEM_PBUF, b->len);
+
+    pbuf_free(b);
+  }
+
+  _rx_tail = NULL;
+  _rx_head_offset = 0;
+  _rx_queued = 0;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncFrameCodec::_asmFree()
+{
+  if (_asm == NULL)
+    return;
+
+  AsyncFramePool::put(_asm);
+  _asm = NULL;
+
+  if (_usage)
+    _usage->release(ATCP_MEM_FRAME, _frameLen);
+}
+
+/////////////////////////////////////////////////
+
+#endif    // TEENSY41_ASYNC_TCP_COMPILED
+
+#endif    // _TEENSY41_ASYNC_TCP_FRAME_IMPL_H_
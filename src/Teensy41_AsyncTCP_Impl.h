@@ -101,6 +101,8 @@
 #ifndef _TEENSY41_ASYNC_TCP_IMPL_H_
 #define _TEENSY41_ASYNC_TCP_IMPL_H_
 
+#if !TEENSY41_ASYNC_TCP_COMPILED || defined(_TEENSY41_ASYNC_TCP_LIBRARY_)
+
 #include "Arduino.h"
 
 extern "C"
@@ -111,6 +113,10 @@ extern "C"
 #include "lwip/inet.h"
 #include "lwip/dns.h"
 #include "lwip/init.h"
+
+#if ASYNC_TCP_IDLE_REAPER
+  #include "lwip/stats.h"
+#endif
 }
 
 /////////////////////////////////////////////////
@@ -126,6 +132,9 @@ ACErrorTracker::ACErrorTracker(AsyncClient *c):
   _client(c)
   , _close_error(ERR_OK)
   , _errored(EE_OK)
+#if DEBUG_T41_ASYNC_TCP
+  , _connectionId(0)
+#endif
 #ifdef DEBUG_MORE
   , _error_event_cb(NULL)
   , _error_event_cb_arg(NULL)
@@ -203,6 +212,20 @@ err_t ACErrorTracker::getCallbackCloseError()
 /*
   Async TCP Client
 */
+#if ASYNC_TCP_STATIC_MEMORY
+  static_assert(sizeof(AsyncClient) <= ASYNC_TCP_STATIC_CLIENT_SIZE, "Increase ASYNC_TCP_STATIC_CLIENT_SIZE");
+  static_assert(ATCP_TRACKER_BLOCK_SIZE <= ASYNC_TCP_STATIC_TRACKER_SIZE, "Increase ASYNC_TCP_STATIC_TRACKER_SIZE");
+  static_assert(sizeof(AsyncTCPMemUsage) <= ASYNC_TCP_STATIC_TRACKER_SIZE, "Increase ASYNC_TCP_STATIC_TRACKER_SIZE");
+
+  #if ASYNC_TCP_SEND_STREAM
+    static_assert(ASYNC_TCP_STREAM_CHUNK <= ASYNC_TCP_STATIC_TX_BUFFER_SIZE, "Increase ASYNC_TCP_STATIC_TX_BUFFER_SIZE");
+  #endif
+#endif
+
+#if ASYNC_TCP_SEND_STREAM
+  static_assert(ASYNC_TCP_STREAM_CHUNK <= 0xFFFF, "ASYNC_TCP_STREAM_CHUNK must fit in uint16_t");
+#endif
+
 #if DEBUG_T41_ASYNC_TCP
   static size_t _connectionCount = 0;
 #endif
@@ -220,12 +243,16 @@ AsyncClient::AsyncClient(tcp_pcb * pcb):
   , _sent_cb_arg(0)
   , _error_cb(0)
   , _error_cb_arg(0)
+#if !ASYNC_TCP_PACKET_ONLY
   , _recv_cb(0)
   , _recv_cb_arg(0)
+#endif
   , _pb_cb(0)
   , _pb_cb_arg(0)
+#if ASYNC_TCP_ACK_TIMEOUT
   , _timeout_cb(0)
   , _timeout_cb_arg(0)
+#endif
   , _poll_cb(0)
   , _poll_cb_arg(0)
   , _pcb_busy(false)
@@ -242,10 +269,48 @@ AsyncClient::AsyncClient(tcp_pcb * pcb):
   , _rx_ack_len(0)
   , _rx_last_packet(0)
   , _rx_since_timeout(0)
+#if ASYNC_TCP_ACK_TIMEOUT
   , _ack_timeout(ASYNC_MAX_ACK_TIME)
+#endif
   , _connect_port(0)
+#if !ASYNC_TCP_PACKET_ONLY
   , _recv_pbuf_flags(0)
+#endif
   , _errorTracker(NULL)
+  , _memUsage(AsyncTCPMemUsage::create())
+#if ASYNC_TCP_DEFERRED_EVENTS
+  , _deferred(true)
+#endif
+#if ASYNC_TCP_RATE_LIMIT
+  , _bucket(NULL)
+  , _aggregate(NULL)
+  , _shaped_next(NULL)
+  , _shaped_waiting(false)
+#endif
+#if ASYNC_TCP_SEND_STREAM
+  , _stream_src(0)
+  , _stream_cb(0)
+  , _stream_cb_arg(0)
+  , _stream_buf(NULL)
+  , _stream_left(0)
+  , _stream_sent(0)
+  , _stream_off(0)
+  , _stream_len(0)
+#endif
+#if ASYNC_TCP_FANOUT
+  , _fan()
+  , _fan_stats()
+  , _tx_seq(0)
+  , _tx_acked_seq(0)
+  , _fan_head(0)
+  , _fan_count(0)
+  , _fan_policy(ATCP_FANOUT_DROP)
+#endif
+#if ASYNC_TCP_IDLE_REAPER
+  , _lru_owner(NULL)
+  , _lru_prev(NULL)
+  , _lru_next(NULL)
+#endif
   , prev(NULL)
   , next(NULL)
 {
@@ -287,7 +352,23 @@ AsyncClient::AsyncClient(tcp_pcb * pcb):
 #endif
   }
 
-  _errorTracker = std::make_shared<ACErrorTracker>(this);
+  _errorTracker = std::allocate_shared<ACErrorTracker>(AsyncTCPAllocator<ACErrorTracker, ATCP_MEM_TRACKER>(), this);
+
+  if (_memUsage)
+  {
+    _memUsage->charge(ATCP_MEM_CLIENT, sizeof(AsyncClient));
+    _memUsage->charge(ATCP_MEM_TRACKER, sizeof(ACErrorTracker));
+  }
+
+#if ASYNC_TCP_PRIORITY_QUEUES
+  memset(_txq_stats, 0, sizeof(_txq_stats));
+
+  for (uint8_t i = 0; i < ATCP_SEND_CLASS_MAX; i++)
+  {
+    _txq[i].setLimit(ASYNC_TCP_SEND_QUEUE_LIMIT);
+    _txq[i].setUsage(_memUsage);
+  }
+#endif
 
 #if DEBUG_T41_ASYNC_TCP
   _errorTracker->setConnectionId(++_connectionCount);
@@ -302,6 +383,54 @@ AsyncClient::~AsyncClient()
     _close();
 
   _errorTracker->clearClient();
+  _lruRemove();
+
+#if ASYNC_TCP_FANOUT
+  _releaseFanout(true);
+#endif
+
+#if ASYNC_TCP_RATE_LIMIT
+  AsyncTCPShaper::forget(this);
+
+  if (_bucket)
+    _bucket->unref();
+
+  if (_aggregate)
+    _aggregate->unref();
+#endif
+
+  if (_memUsage)
+  {
+    _memUsage->release(ATCP_MEM_CLIENT, sizeof(AsyncClient));
+    _memUsage->release(ATCP_MEM_TRACKER, sizeof(ACErrorTracker));
+    _memUsage->unref();
+  }
+}
+
+/////////////////////////////////////////////////
+
+void * AsyncClient::operator new(size_t size) noexcept
+{
+  // The constructor's tracker allocation cannot fail gracefully, take its
+  // block now. It stays reserved for the next client if this one fails.
+  if (!AsyncTCPMemory::reserve(ATCP_MEM_TRACKER, ATCP_TRACKER_BLOCK_SIZE))
+    return NULL;
+
+  return AsyncTCPMemory::alloc(ATCP_MEM_CLIENT, size);
+}
+
+/////////////////////////////////////////////////
+
+void * AsyncClient::operator new(size_t size, const std::nothrow_t&) noexcept
+{
+  return operator new(size);
+}
+
+/////////////////////////////////////////////////
+
+void AsyncClient::operator delete(void *ptr)
+{
+  AsyncTCPMemory::free(ptr);
 }
 
 /////////////////////////////////////////////////
@@ -326,7 +455,7 @@ inline void clearTcpCallbacks(tcp_pcb* pcb)
   if (_pcb)
   {
     //already connected
-    ATCP_LOGDEBUG1("connect: already connected, _pcb =", (uint32_t) _pcb );
+    ATCP_LOGDEBUG1("connect: already connected, _pcb =", (uintptr_t) _pcb );
 
     return false;
   }
@@ -595,6 +724,20 @@ size_t AsyncClient::add(const char* data, size_t size, uint8_t apiflags)
 
   _tx_unsent_len += will_send;
 
+#if ASYNC_TCP_FANOUT
+  _tx_seq += will_send;
+#endif
+
+#if ASYNC_TCP_RATE_LIMIT
+
+  if (_bucket)
+    _bucket->take(will_send);
+
+  if (_aggregate)
+    _aggregate->take(will_send);
+
+#endif
+
   return will_send;
 }
 
@@ -615,6 +758,7 @@ bool AsyncClient::send()
   {
     _pcb_busy = true;
     _pcb_sent_at = millis();
+    _touch();
     _tx_unacked_len += _tx_unsent_len;
     _tx_unsent_len = 0;
     return true;
@@ -632,7 +776,7 @@ size_t AsyncClient::ack(size_t len)
   if (len > _rx_ack_len)
     len = _rx_ack_len;
 
-  if (len)
+  if (len && _pcb)
     tcp_recved(_pcb, len);
 
   _rx_ack_len -= len;
@@ -710,7 +854,12 @@ void AsyncClient::_connected(std::shared_ptr<ACErrorTracker>& errorTracker, void
 
   }
 
-  if (_connect_cb)
+  // Data queued while connecting
+  _flushQueues();
+  _pumpFanout();
+  _pumpStream();
+
+  if (_connect_cb && !_defer(ATCP_EVENT_CONNECT))
     _connect_cb(_connect_cb_arg, this);
 
 #endif
@@ -722,6 +871,8 @@ void AsyncClient::_connected(std::shared_ptr<ACErrorTracker>& errorTracker, void
 
 void AsyncClient::_close()
 {
+  _lruRemove();
+
   if (_pcb)
   {
 #if ASYNC_TCP_SSL_ENABLED
@@ -734,7 +885,16 @@ void AsyncClient::_close()
 #endif
 
     clearTcpCallbacks(_pcb);
-    err_t err = tcp_close(_pcb);
+
+    err_t err = ERR_ABRT;
+
+    // lwIP would read lent payloads after their release, abort instead
+    if (!_fanoutInFlight())
+      err = tcp_close(_pcb);
+#if ASYNC_TCP_FANOUT
+    else
+      _fan_stats.aborted++;
+#endif
 
     if (ERR_OK == err)
     {
@@ -747,7 +907,14 @@ void AsyncClient::_close()
 
     _pcb = NULL;
 
-    if (_discard_cb)
+#if ASYNC_TCP_FANOUT
+    _releaseFanout(true);
+#endif
+
+    _endStream(false);
+    _dropQueues();
+
+    if (_discard_cb && !_defer(ATCP_EVENT_DISCARD))
       _discard_cb(_discard_cb_arg, this);
   }
 
@@ -774,6 +941,17 @@ void AsyncClient::_error(err_t err)
     _pcb = NULL;
   }
 
+#if ASYNC_TCP_FANOUT
+  _releaseFanout(true);
+#endif
+
+  _lruRemove();
+  _endStream(false);
+  _dropQueues();
+
+  if ( (_error_cb || _discard_cb) && _defer(ATCP_EVENT_ERROR, NULL, 0, 0, err) )
+    return;
+
   if (_error_cb)
     _error_cb(_error_cb_arg, this, err);
 
@@ -807,6 +985,12 @@ void AsyncClient::_sent(std::shared_ptr<ACErrorTracker>& errorTracker, tcp_pcb*
   _rx_last_packet  = millis();
   _tx_unacked_len -= len;
   _tx_acked_len   += len;
+  _touch();
+
+#if ASYNC_TCP_FANOUT
+  _tx_acked_seq += len;
+  _releaseFanout(false);
+#endif
 
   ATCP_LOGDEBUG3("_sent: ID =", errorTracker->getConnectionId(), ", len =", len);
   ATCP_LOGDEBUG3("unacked =", _tx_unacked_len, ", acked =", _tx_acked_len);
@@ -816,7 +1000,7 @@ void AsyncClient::_sent(std::shared_ptr<ACErrorTracker>& errorTracker, tcp_pcb*
     _pcb_busy = false;
     errorTracker->setCloseError(ERR_OK);
 
-    if (_sent_cb)
+    if (_sent_cb && !_defer(ATCP_EVENT_SENT, NULL, _tx_acked_len, (millis() - _pcb_sent_at)))
     {
       _sent_cb(_sent_cb_arg, this, _tx_acked_len, (millis() - _pcb_sent_at));
 
@@ -827,6 +1011,10 @@ void AsyncClient::_sent(std::shared_ptr<ACErrorTracker>& errorTracker, tcp_pcb*
     _tx_acked_len = 0;
   }
 
+  _flushQueues();
+  _pumpFanout();
+  _pumpStream();
+
   return;
 }
 
@@ -891,6 +1079,7 @@ void AsyncClient::_recv(std::shared_ptr<ACErrorTracker>& errorTracker, tcp_pcb*
   }
 
   _rx_last_packet = millis();
+  _touch();
   errorTracker->setCloseError(ERR_OK);
 
 #if ASYNC_TCP_SSL_ENABLED
@@ -916,6 +1105,15 @@ void AsyncClient::_recv(std::shared_ptr<ACErrorTracker>& errorTracker, tcp_pcb*
 
 #endif
 
+  _recvPbufs(errorTracker, pcb, pb);
+}
+
+/////////////////////////////////////////////////
+
+// Hands each pbuf of the chain to onPacket / onData. pcb is NULL when the
+// connection closed while the chain was queued for AsyncTCPEvents::drain().
+void AsyncClient::_recvPbufs(std::shared_ptr<ACErrorTracker>& errorTracker, tcp_pcb* pcb, pbuf* pb)
+{
   while (pb != NULL)
   {
     // IF this callback function returns ERR_OK or ERR_ABRT
@@ -947,17 +1145,19 @@ void AsyncClient::_recv(std::shared_ptr<ACErrorTracker>& errorTracker, tcp_pcb*
     }
     else
     {
+#if !ASYNC_TCP_PACKET_ONLY
       if (_recv_cb)
       {
         _recv_pbuf_flags = b->flags;
         _recv_cb(_recv_cb_arg, this, b->payload, b->len);
       }
+#endif
 
       if (errorTracker->hasClient())
       {
         if (!_ack_pcb)
           _rx_ack_len += b->len;
-        else
+        else if (pcb && _pcb)
           tcp_recved(pcb, b->len);
       }
 
@@ -979,25 +1179,46 @@ void AsyncClient::_poll(std::shared_ptr<ACErrorTracker>& errorTracker, tcp_pcb*
   // Close requested
   if (_close_pcb)
   {
+    // Wait a while for the ACK of lent payloads, rather than abort
+    if (_fanoutInFlight() && ((millis() - _pcb_sent_at) < ASYNC_MAX_ACK_TIME))
+      return;
+
     _close_pcb = false;
     _close();
 
     return;
   }
 
+#if ASYNC_TCP_IDLE_REAPER
+
+  // Pressure is checked from the polls of its clients, this one may go
+  if (_lru_owner)
+  {
+    _lru_owner->_reap(0);
+
+    if (!errorTracker->hasClient() || !_pcb)
+      return;
+  }
+
+#endif
+
   uint32_t now = millis();
 
+#if ASYNC_TCP_ACK_TIMEOUT
+
   // ACK Timeout
   if (_pcb_busy && _ack_timeout && (now - _pcb_sent_at) >= _ack_timeout)
   {
     _pcb_busy = false;
 
-    if (_timeout_cb)
+    if (_timeout_cb && !_defer(ATCP_EVENT_TIMEOUT, NULL, 0, (now - _pcb_sent_at)))
       _timeout_cb(_timeout_cb_arg, this, (now - _pcb_sent_at));
 
     return;
   }
 
+#endif
+
   // RX Timeout
   if (_rx_since_timeout && (now - _rx_last_packet) >= (_rx_since_timeout * 1000))
   {
@@ -1018,8 +1239,12 @@ void AsyncClient::_poll(std::shared_ptr<ACErrorTracker>& errorTracker, tcp_pcb*
 
 #endif
 
+  _flushQueues();
+  _pumpFanout();
+  _pumpStream();
+
   // Everything is fine
-  if (_poll_cb)
+  if (_poll_cb && !_defer(ATCP_EVENT_POLL))
     _poll_cb(_poll_cb_arg, this);
 
   return;
@@ -1043,6 +1268,9 @@ void AsyncClient::_poll(std::shared_ptr<ACErrorTracker>& errorTracker, tcp_pcb*
   }
   else
   {
+    if ( (_error_cb || _discard_cb) && _defer(ATCP_EVENT_ERROR, NULL, 0, 0, -55) )
+      return;
+
     if (_error_cb)
       _error_cb(_error_cb_arg, this, -55);
 
@@ -1088,6 +1316,23 @@ err_t AsyncClient::_s_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *pb, err
   AsyncClient *c = reinterpret_cast<AsyncClient*>(arg);
   auto errorTracker = c->getACErrorTracker();
 
+#if ASYNC_TCP_DEFERRED_EVENTS && !ASYNC_TCP_SSL_ENABLED
+
+  if (c->_deferred && tpcb && pb && (ERR_OK == err))
+  {
+    // Queue full, lwIP keeps the data and offers it again from its timer
+    if (!AsyncTCPEvents::post(ATCP_EVENT_DATA, errorTracker, pb))
+      return ERR_MEM;
+
+    c->_rx_last_packet = millis();
+    c->_touch();
+    errorTracker->setCloseError(ERR_OK);
+
+    return errorTracker->getCallbackCloseError();
+  }
+
+#endif
+
   c->_recv(errorTracker, tpcb, pb, err);
 
   return errorTracker->getCallbackCloseError();
@@ -1136,8 +1381,10 @@ void AsyncClient::_s_data(void *arg, struct tcp_pcb *tcp, uint8_t * data, size_t
 {
   AsyncClient *c = reinterpret_cast<AsyncClient*>(arg);
 
+#if !ASYNC_TCP_PACKET_ONLY
   if (c->_recv_cb)
     c->_recv_cb(c->_recv_cb_arg, c, data, len);
+#endif
 }
 
 /////////////////////////////////////////////////
@@ -1202,14 +1449,22 @@ uint32_t AsyncClient::getRxTimeout()
 
 uint32_t AsyncClient::getAckTimeout()
 {
+#if ASYNC_TCP_ACK_TIMEOUT
   return _ack_timeout;
+#else
+  return 0;
+#endif
 }
 
 /////////////////////////////////////////////////
 
 void AsyncClient::setAckTimeout(uint32_t timeout)
 {
+#if ASYNC_TCP_ACK_TIMEOUT
   _ack_timeout = timeout;
+#else
+  (void) timeout;
+#endif
 }
 
 /////////////////////////////////////////////////
@@ -1329,34 +1584,6 @@ SSL * AsyncClient::getSSL()
 
 /////////////////////////////////////////////////
 
-uint8_t AsyncClient::state()
-{
-  if (!_pcb)
-    return 0;
-
-  return _pcb->state;
-}
-
-/////////////////////////////////////////////////
-
-bool AsyncClient::connected()
-{
-  if (!_pcb)
-  {
-    ATCP_LOGDEBUG("connected: error NULL pcb");
-
-    return false;
-  }
-
-#if ASYNC_TCP_SSL_ENABLED
-  return ( (_pcb->state == ESTABLISHED) && _handshake_done );
-#else
-  return (_pcb->state == ESTABLISHED);
-#endif
-}
-
-/////////////////////////////////////////////////
-
 bool AsyncClient::connecting()
 {
   if (!_pcb)
@@ -1464,11 +1691,13 @@ void AsyncClient::onError(AcErrorHandler cb, void* arg)
 
 /////////////////////////////////////////////////
 
+#if !ASYNC_TCP_PACKET_ONLY
 void AsyncClient::onData(AcDataHandler cb, void* arg)
 {
   _recv_cb = cb;
   _recv_cb_arg = arg;
 }
+#endif
 
 /////////////////////////////////////////////////
 
@@ -1482,8 +1711,13 @@ void AsyncClient::onPacket(AcPacketHandler cb, void* arg)
 
 void AsyncClient::onTimeout(AcTimeoutHandler cb, void* arg)
 {
+#if ASYNC_TCP_ACK_TIMEOUT
   _timeout_cb = cb;
   _timeout_cb_arg = arg;
+#else
+  (void) cb;
+  (void) arg;
+#endif
 }
 
 /////////////////////////////////////////////////
@@ -1517,14 +1751,14 @@ size_t AsyncClient::space()
 #endif
     }
 
-    return s;
+    return _shape(s);
   }
 
 #else // ASYNC_TCP_SSL_ENABLED
 
   if ((_pcb != NULL) && (_pcb->state == ESTABLISHED))
   {
-    return tcp_sndbuf(_pcb);
+    return _shape(tcp_sndbuf(_pcb));
   }
 
 #endif // ASYNC_TCP_SSL_ENABLED
@@ -1534,122 +1768,791 @@ size_t AsyncClient::space()
 
 /////////////////////////////////////////////////
 
-void AsyncClient::ackPacket(struct pbuf * pb)
+bool AsyncClient::setRateLimit(uint32_t rate, uint32_t burst)
 {
-  if (!pb)
+#if ASYNC_TCP_RATE_LIMIT
+
+  if (rate == 0)
   {
-    return;
+    if (_bucket)
+    {
+      _bucket->unref();
+      _bucket = NULL;
+    }
+
+    return true;
   }
 
-  tcp_recved(_pcb, pb->len);
-  pbuf_free(pb);
+  if (_bucket)
+  {
+    _bucket->set(rate, burst);
+
+    return true;
+  }
+
+  _bucket = AsyncTCPTokenBucket::create(rate, burst);
+
+  return (_bucket != NULL);
+
+#else
+  (void) rate;
+  (void) burst;
+
+  return false;
+#endif
 }
 
 /////////////////////////////////////////////////
 
-const char * AsyncClient::errorToString(err_t error)
+size_t AsyncClient::_shape(size_t room)
 {
-  switch (error)
-  {
-    case ERR_OK:
-      return "OK";
+#if ASYNC_TCP_RATE_LIMIT
 
-    case ERR_MEM:
-      return "Out of memory error";
+  if (!_bucket && !_aggregate)
+    return room;
 
-    case ERR_BUF:
-      return "Buffer error";
+  size_t tokens = _shapedTokens();
 
-    case ERR_TIMEOUT:
-      return "Timeout";
+  if (tokens >= room)
+    return room;
 
-    case ERR_RTE:
-      return "Routing problem";
+  // Starved, poll again from the shaper timer once tokens are back
+  if (!_shaped_waiting && (tokens < _shapedWake()))
+  {
+    if (_bucket && (_bucket->_tokens < _shapedWake()))
+      _bucket->_throttled++;
 
-    case ERR_INPROGRESS:
-      return "Operation in progress";
+    if (_aggregate && (_aggregate->_tokens < _shapedWake()))
+      _aggregate->_throttled++;
 
-    case ERR_VAL:
-      return "Illegal value";
+    AsyncTCPShaper::wait(this);
+  }
 
-    case ERR_WOULDBLOCK:
-      return "Operation would block";
+  return tokens;
 
-    case ERR_USE:
-      return "Address in use";
+#else
+  return room;
+#endif
+}
 
-    case ERR_ALREADY:
-      return "Already connected";
+/////////////////////////////////////////////////
 
-    case ERR_CONN:
-      return "Not connected";
+#if ASYNC_TCP_RATE_LIMIT
+void AsyncClient::_setAggregate(AsyncTCPTokenBucket *bucket)
+{
+  if (bucket)
+    bucket->ref();
 
-    case ERR_IF:
-      return "Low-level netif error";
+  if (_aggregate)
+    _aggregate->unref();
 
-    case ERR_ABRT:
-      return "Connection aborted";
+  _aggregate = bucket;
+}
 
-    case ERR_RST:
-      return "Connection reset";
+/////////////////////////////////////////////////
 
-    case ERR_CLSD:
-      return "Connection closed";
+size_t AsyncClient::_shapedTokens()
+{
+  size_t tokens = (size_t) -1;
 
-    case ERR_ARG:
-      return "Illegal argument";
+  if (_bucket)
+    tokens = _bucket->available();
 
-    case -55:
-      return "DNS failed";
+  if (_aggregate)
+  {
+    size_t shared = _aggregate->available();
 
-    default:
-      return "UNKNOWN";
+    if (shared < tokens)
+      tokens = shared;
   }
+
+  return tokens;
 }
 
 /////////////////////////////////////////////////
 
-/*****************************************************
-  // Defined in ./lwip/src/include/lwip/tcpbase.h
-  enum tcp_state
-  {
-  CLOSED      = 0,
-  LISTEN      = 1,
-  SYN_SENT    = 2,
-  SYN_RCVD    = 3,
-  ESTABLISHED = 4,
-  FIN_WAIT_1  = 5,
-  FIN_WAIT_2  = 6,
-  CLOSE_WAIT  = 7,
-  CLOSING     = 8,
-  LAST_ACK    = 9,
-  TIME_WAIT   = 10
-  };
-*****************************************************/
+size_t AsyncClient::_shapedWake()
+{
+  size_t wake = ASYNC_TCP_RATE_WAKE_BYTES;
+
+  if (_bucket && (_bucket->_burst < wake))
+    wake = _bucket->_burst;
+
+  if (_aggregate && (_aggregate->_burst < wake))
+    wake = _aggregate->_burst;
+
+  return wake;
+}
 
 /////////////////////////////////////////////////
 
-const char * AsyncClient::stateToString()
+void AsyncClient::_shapedPoll()
 {
-  switch (state())
-  {
-    case CLOSED:
-      return "Closed";
+  _flushQueues();
+  _pumpFanout();
+  _pumpStream();
 
-    case LISTEN:
-      return "Listen";
+  if (_pcb && _poll_cb && !_defer(ATCP_EVENT_POLL))
+    _poll_cb(_poll_cb_arg, this);
+}
 
-    case SYN_SENT:
-      return "SYN Sent";
+/////////////////////////////////////////////////
+#endif
 
-    case SYN_RCVD:
-      return "SYN Received";
+size_t AsyncClient::queue(const char* data, size_t size, uint8_t sendClass)
+{
+#if ASYNC_TCP_PRIORITY_QUEUES
 
-    case ESTABLISHED:
-      return "Established";
+  if ( (sendClass >= ATCP_SEND_CLASS_MAX) || (data == NULL) || (size == 0) )
+    return 0;
 
-    case FIN_WAIT_1:
-      return "FIN Wait 1";
+  AsyncTCPByteQueue &q = _txq[sendClass];
+  atcpSendStats_t   &st = _txq_stats[sendClass];
+
+  size_t room = q.room();
+  size_t n = q.write(data, (size < room) ? size : room);
+
+  st.refused += size - n;
+  st.depth    = q.available();
+
+  if (st.depth > st.highWater)
+    st.highWater = st.depth;
+
+  _flushQueues();
+
+  return n;
+
+#else
+  (void) data;
+  (void) size;
+  (void) sendClass;
+
+  return 0;
+#endif
+}
+
+/////////////////////////////////////////////////
+
+size_t AsyncClient::queued(uint8_t sendClass) const
+{
+#if ASYNC_TCP_PRIORITY_QUEUES
+
+  if (sendClass < ATCP_SEND_CLASS_MAX)
+    return _txq[sendClass].available();
+
+#else
+  (void) sendClass;
+#endif
+
+  return 0;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncClient::setQueueLimit(uint8_t sendClass, size_t limit)
+{
+#if ASYNC_TCP_PRIORITY_QUEUES
+
+  if (sendClass < ATCP_SEND_CLASS_MAX)
+    _txq[sendClass].setLimit(limit);
+
+#else
+  (void) sendClass;
+  (void) limit;
+#endif
+}
+
+/////////////////////////////////////////////////
+
+const atcpSendStats_t * AsyncClient::sendStats(uint8_t sendClass) const
+{
+#if ASYNC_TCP_PRIORITY_QUEUES
+
+  if (sendClass < ATCP_SEND_CLASS_MAX)
+    return &_txq_stats[sendClass];
+
+#else
+  (void) sendClass;
+#endif
+
+  return NULL;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncClient::_flushQueues()
+{
+#if ASYNC_TCP_PRIORITY_QUEUES
+
+  if (!_pcb)
+    return;
+
+  size_t urgent = _flushQueue(ATCP_SEND_URGENT, 0);
+  size_t bulk   = 0;
+
+  // Bulk data only once the urgent queue is empty, and never into the
+  // room kept for the next urgent message
+  if (_txq[ATCP_SEND_URGENT].empty())
+  {
+    size_t reserve = ASYNC_TCP_URGENT_RESERVE;
+
+    if (reserve > TCP_SND_BUF / 2)
+      reserve = TCP_SND_BUF / 2;
+
+    bulk = _flushQueue(ATCP_SEND_BULK, reserve);
+  }
+
+  if (urgent && !tcp_nagle_disabled(_pcb))
+  {
+    // Out now even with unacked data in flight
+    tcp_nagle_disable(_pcb);
+    send();
+    tcp_nagle_enable(_pcb);
+  }
+  else if (urgent || bulk)
+  {
+    send();
+  }
+
+#endif
+}
+
+/////////////////////////////////////////////////
+
+void AsyncClient::_dropQueues()
+{
+#if ASYNC_TCP_PRIORITY_QUEUES
+
+  for (uint8_t i = 0; i < ATCP_SEND_CLASS_MAX; i++)
+  {
+    // Blocks go back to the pool now, not when the client is deleted
+    _txq[i].flush();
+    _txq_stats[i].depth = 0;
+  }
+
+#endif
+}
+
+/////////////////////////////////////////////////
+
+#if ASYNC_TCP_PRIORITY_QUEUES
+size_t AsyncClient::_flushQueue(uint8_t sendClass, size_t reserve)
+{
+  AsyncTCPByteQueue &q = _txq[sendClass];
+  atcpSendStats_t   &st = _txq_stats[sendClass];
+  size_t written = 0;
+
+  while (_pcb && !q.empty())
+  {
+    size_t room = space();
+
+    if (room <= reserve)
+      break;
+
+    const char *data;
+    size_t len;
+
+    q.readSpans(&data, &len);
+
+    if (len > room - reserve)
+      len = room - reserve;
+
+    // PSH on the last queued byte only, the block memory is recycled
+    uint8_t flags = ASYNC_WRITE_FLAG_COPY;
+
+    if (len < q.available())
+      flags |= ASYNC_WRITE_FLAG_MORE;
+
+    size_t n = add(data, len, flags);
+
+    if (n == 0)
+      break;
+
+    q.commitRead(n);
+    written += n;
+    st.writes++;
+  }
+
+  st.sent  += written;
+  st.depth  = q.available();
+
+  return written;
+}
+
+/////////////////////////////////////////////////
+#endif
+
+bool AsyncClient::sendStream(AcStreamSource source, size_t length, AcStreamHandler cb, void* arg)
+{
+#if ASYNC_TCP_SEND_STREAM
+
+  if (!_pcb || !source || (length == 0) || _stream_buf)
+    return false;
+
+  _stream_buf = (char *) AsyncTCPMemory::alloc(ATCP_MEM_TX_BUFFER, ASYNC_TCP_STREAM_CHUNK);
+
+  if (!_stream_buf)
+    return false;
+
+  if (_memUsage)
+    _memUsage->charge(ATCP_MEM_TX_BUFFER, ASYNC_TCP_STREAM_CHUNK);
+
+  _stream_src     = source;
+  _stream_cb      = cb;
+  _stream_cb_arg  = arg;
+  _stream_left    = length;
+  _stream_sent    = 0;
+  _stream_off     = 0;
+  _stream_len     = 0;
+
+  _pumpStream();
+
+  return true;
+
+#else
+  (void) source;
+  (void) length;
+  (void) cb;
+  (void) arg;
+
+  return false;
+#endif
+}
+
+/////////////////////////////////////////////////
+
+bool AsyncClient::sendStream(Stream &stream, size_t length, AcStreamHandler cb, void* arg)
+{
+  Stream *src = &stream;
+
+  return sendStream([src](uint8_t *buf, size_t len, size_t index) -> size_t
+  {
+    (void) index;
+
+    int avail = src->available();
+
+    if (avail <= 0)
+      return 0;
+
+    if ((size_t) avail < len)
+      len = avail;
+
+    return src->readBytes((char *) buf, len);
+  }, length, cb, arg);
+}
+
+/////////////////////////////////////////////////
+
+void AsyncClient::cancelStream()
+{
+  _endStream(false);
+}
+
+/////////////////////////////////////////////////
+
+size_t AsyncClient::streamPending() const
+{
+#if ASYNC_TCP_SEND_STREAM
+
+  if (_stream_buf)
+    return _stream_left + (_stream_len - _stream_off);
+
+#endif
+
+  return 0;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncClient::_pumpStream()
+{
+#if ASYNC_TCP_SEND_STREAM
+
+  if (!_stream_buf)
+    return;
+
+  bool written = false;
+
+  while (_pcb)
+  {
+    if (_stream_off == _stream_len)
+    {
+      if (_stream_left == 0)
+        break;
+
+      // Read no more than lwIP takes now, nothing waits in the buffer
+      size_t want = space();
+
+      if (want == 0)
+        break;
+
+      if (want > ASYNC_TCP_STREAM_CHUNK)
+        want = ASYNC_TCP_STREAM_CHUNK;
+
+      if (want > _stream_left)
+        want = _stream_left;
+
+      size_t got = _stream_src((uint8_t *) _stream_buf, want, _stream_sent);
+
+      if (got == 0)
+        break;
+
+      if (got > want)
+        got = want;
+
+      _stream_off   = 0;
+      _stream_len   = got;
+      _stream_left -= got;
+    }
+
+    uint8_t flags = ASYNC_WRITE_FLAG_COPY;
+
+    if (_stream_left)
+      flags |= ASYNC_WRITE_FLAG_MORE;
+
+    size_t n = add(_stream_buf + _stream_off, _stream_len - _stream_off, flags);
+
+    if (n == 0)
+      break;
+
+    _stream_off  += n;
+    _stream_sent += n;
+    written = true;
+  }
+
+  if (written)
+    send();
+
+  if ( (_stream_left == 0) && (_stream_off == _stream_len) )
+    _endStream(true);
+
+#endif
+}
+
+/////////////////////////////////////////////////
+
+void AsyncClient::_endStream(bool complete)
+{
+#if ASYNC_TCP_SEND_STREAM
+
+  if (!_stream_buf)
+    return;
+
+  AsyncTCPMemory::free(_stream_buf);
+  _stream_buf = NULL;
+
+  if (_memUsage)
+    _memUsage->release(ATCP_MEM_TX_BUFFER, ASYNC_TCP_STREAM_CHUNK);
+
+  // The handler may start the next stream
+  AcStreamHandler cb;
+  cb.swap(_stream_cb);
+  _stream_src = 0;
+
+  if (cb)
+    cb(_stream_cb_arg, this, _stream_sent, complete);
+
+#else
+  (void) complete;
+#endif
+}
+
+/////////////////////////////////////////////////
+
+void AsyncClient::_touch()
+{
+#if ASYNC_TCP_IDLE_REAPER
+
+  if (_lru_owner && (_lru_owner->_lru_tail != this))
+  {
+    AsyncServer *server = _lru_owner;
+
+    server->_lruUnlink(this);
+    server->_lruLink(this);
+  }
+
+#endif
+}
+
+/////////////////////////////////////////////////
+
+void AsyncClient::_lruRemove()
+{
+#if ASYNC_TCP_IDLE_REAPER
+
+  if (_lru_owner)
+    _lru_owner->_lruUnlink(this);
+
+#endif
+}
+
+/////////////////////////////////////////////////
+
+bool AsyncClient::sendShared(AsyncTCPPayload *payload)
+{
+#if ASYNC_TCP_FANOUT
+
+  if (!payload || !_pcb || _close_pcb)
+    return false;
+
+  if (_fan_count == ASYNC_TCP_FANOUT_DEPTH)
+  {
+    atcpFanoutEntry_t &last = _fan[(_fan_head + _fan_count - 1) % ASYNC_TCP_FANOUT_DEPTH];
+
+    if ( (_fan_policy != ATCP_FANOUT_COALESCE) || (last.written > 0) )
+    {
+      _fan_stats.dropped++;
+
+      return false;
+    }
+
+    payload->ref();
+    last.payload->unref();
+    last.payload = payload;
+
+    _fan_stats.coalesced++;
+
+    return true;
+  }
+
+  atcpFanoutEntry_t &e = _fan[(_fan_head + _fan_count) % ASYNC_TCP_FANOUT_DEPTH];
+
+  payload->ref();
+  e.payload = payload;
+  e.written = 0;
+  e.seqEnd  = 0;
+
+  _fan_count++;
+  _fan_stats.queued++;
+
+  _pumpFanout();
+
+  return true;
+
+#else
+  (void) payload;
+
+  return false;
+#endif
+}
+
+/////////////////////////////////////////////////
+
+void AsyncClient::setFanoutPolicy(uint8_t policy)
+{
+#if ASYNC_TCP_FANOUT
+
+  if (policy < ATCP_FANOUT_POLICY_MAX)
+    _fan_policy = policy;
+
+#else
+  (void) policy;
+#endif
+}
+
+/////////////////////////////////////////////////
+
+size_t AsyncClient::fanoutPending() const
+{
+#if ASYNC_TCP_FANOUT
+  return _fan_count;
+#else
+  return 0;
+#endif
+}
+
+/////////////////////////////////////////////////
+
+const atcpFanoutStats_t * AsyncClient::fanoutStats() const
+{
+#if ASYNC_TCP_FANOUT
+  return &_fan_stats;
+#else
+  return NULL;
+#endif
+}
+
+/////////////////////////////////////////////////
+
+void AsyncClient::_pumpFanout()
+{
+#if ASYNC_TCP_FANOUT
+
+  bool written = false;
+
+  for (uint8_t i = 0; _pcb && (i < _fan_count); i++)
+  {
+    atcpFanoutEntry_t &e = _fan[(_fan_head + i) % ASYNC_TCP_FANOUT_DEPTH];
+    size_t left = e.payload->length() - e.written;
+
+    if (left == 0)
+      continue;
+
+    size_t room = space();
+
+    if (room == 0)
+      break;
+
+    // By reference, PSH at the end of each payload
+    uint8_t flags = (room < left) ? ASYNC_WRITE_FLAG_MORE : 0;
+    size_t n = add(e.payload->data() + e.written, (room < left) ? room : left, flags);
+
+    if (n == 0)
+      break;
+
+    e.written += n;
+    e.seqEnd   = _tx_seq;
+    written    = true;
+
+    if (n < left)
+      break;
+  }
+
+  if (written)
+    send();
+
+#endif
+}
+
+/////////////////////////////////////////////////
+
+#if ASYNC_TCP_FANOUT
+void AsyncClient::_releaseFanout(bool all)
+{
+  while (_fan_count)
+  {
+    atcpFanoutEntry_t &e = _fan[_fan_head];
+
+    if ( !all && ( (e.written < e.payload->length()) || ((int32_t) (_tx_acked_seq - e.seqEnd) < 0) ) )
+      break;
+
+    e.payload->unref();
+    e.payload = NULL;
+
+    _fan_head = (_fan_head + 1) % ASYNC_TCP_FANOUT_DEPTH;
+    _fan_count--;
+  }
+}
+
+/////////////////////////////////////////////////
+#endif
+
+void AsyncClient::ackPacket(struct pbuf * pb)
+{
+  if (!pb)
+  {
+    return;
+  }
+
+  tcp_recved(_pcb, pb->len);
+  pbuf_free(pb);
+}
+
+/////////////////////////////////////////////////
+
+const char * AsyncClient::errorToString(err_t error)
+{
+  switch (error)
+  {
+    case ERR_OK:
+      return "OK";
+
+    case ERR_MEM:
+      return "Out of memory error";
+
+    case ERR_BUF:
+      return "Buffer error";
+
+    case ERR_TIMEOUT:
+      return "Timeout";
+
+    case ERR_RTE:
+      return "Routing problem";
+
+    case ERR_INPROGRESS:
+      return "Operation in progress";
+
+    case ERR_VAL:
+      return "Illegal value";
+
+    case ERR_WOULDBLOCK:
+      return "Operation would block";
+
+    case ERR_USE:
+      return "Address in use";
+
+    case ERR_ALREADY:
+      return "Already connected";
+
+    case ERR_CONN:
+      return "Not connected";
+
+    case ERR_IF:
+      return "Low-level netif error";
+
+    case ERR_ABRT:
+      return "Connection aborted";
+
+    case ERR_RST:
+      return "Connection reset";
+
+    case ERR_CLSD:
+      return "Connection closed";
+
+    case ERR_ARG:
+      return "Illegal argument";
+
+    case -55:
+      return "DNS failed";
+
+    default:
+      return "UNKNOWN";
+  }
+}
+
+/////////////////////////////////////////////////
+
+/*****************************************************
+  // Defined in ./lwip/src/include/lwip/tcpbase.h
+  enum tcp_state
+  {
+  CLOSED      = 0,
+  LISTEN      = 1,
+  SYN_SENT    = 2,
+  SYN_RCVD    = 3,
+  ESTABLISHED = 4,
+  FIN_WAIT_1  = 5,
+  FIN_WAIT_2  = 6,
+  CLOSE_WAIT  = 7,
+  CLOSING     = 8,
+  LAST_ACK    = 9,
+  TIME_WAIT   = 10
+  };
+*****************************************************/
+
+/////////////////////////////////////////////////
+
+const char * AsyncClient::stateToString()
+{
+  switch (state())
+  {
+    case CLOSED:
+      return "Closed";
+
+    case LISTEN:
+      return "Listen";
+
+    case SYN_SENT:
+      return "SYN Sent";
+
+    case SYN_RCVD:
+      return "SYN Received";
+
+    case ESTABLISHED:
+      return "Established";
+
+    case FIN_WAIT_1:
+      return "FIN Wait 1";
 
     case FIN_WAIT_2:
       return "FIN Wait 2";
@@ -1686,6 +2589,12 @@ struct pending_pcb
 
 /////////////////////////////////////////////////
 
+#if ASYNC_TCP_IDLE_REAPER
+  size_t AsyncServer::_lru_total = 0;
+#endif
+
+/////////////////////////////////////////////////
+
 AsyncServer::AsyncServer(IPAddress addr, uint16_t port)
   : _port(port)
   , _addr(addr)
@@ -1693,12 +2602,26 @@ AsyncServer::AsyncServer(IPAddress addr, uint16_t port)
   , _pcb(0)
   , _connect_cb(0)
   , _connect_cb_arg(0)
+  , _refused(0)
 #if ASYNC_TCP_SSL_ENABLED
   , _pending(NULL)
   , _ssl_ctx(NULL)
   , _file_cb(0)
   , _file_cb_arg(0)
 #endif
+#if ASYNC_TCP_RATE_LIMIT
+  , _bucket(NULL)
+#endif
+#if ASYNC_TCP_IDLE_REAPER
+  , _lru_head(NULL)
+  , _lru_tail(NULL)
+  , _lru_count(0)
+  , _maxClients(0)
+  , _reapIdleMs(ASYNC_TCP_REAP_MIN_IDLE_MS)
+  , _reaped(0)
+  , _reapFreePcbs(ASYNC_TCP_REAP_FREE_PCBS)
+  , _reapFreePbufs(ASYNC_TCP_REAP_FREE_PBUFS)
+#endif
 {
 #ifdef DEBUG_MORE
 
@@ -1717,12 +2640,26 @@ AsyncServer::AsyncServer(uint16_t port)
   , _pcb(0)
   , _connect_cb(0)
   , _connect_cb_arg(0)
+  , _refused(0)
 #if ASYNC_TCP_SSL_ENABLED
   , _pending(NULL)
   , _ssl_ctx(NULL)
   , _file_cb(0)
   , _file_cb_arg(0)
 #endif
+#if ASYNC_TCP_RATE_LIMIT
+  , _bucket(NULL)
+#endif
+#if ASYNC_TCP_IDLE_REAPER
+  , _lru_head(NULL)
+  , _lru_tail(NULL)
+  , _lru_count(0)
+  , _maxClients(0)
+  , _reapIdleMs(ASYNC_TCP_REAP_MIN_IDLE_MS)
+  , _reaped(0)
+  , _reapFreePcbs(ASYNC_TCP_REAP_FREE_PCBS)
+  , _reapFreePbufs(ASYNC_TCP_REAP_FREE_PBUFS)
+#endif
 {
 #ifdef DEBUG_MORE
 
@@ -1737,6 +2674,18 @@ AsyncServer::AsyncServer(uint16_t port)
 AsyncServer::~AsyncServer()
 {
   end();
+
+#if ASYNC_TCP_IDLE_REAPER
+  // Clients outlive the server
+  _lruDetach();
+#endif
+
+#if ASYNC_TCP_RATE_LIMIT
+
+  if (_bucket)
+    _bucket->unref();
+
+#endif
 }
 
 /////////////////////////////////////////////////
@@ -1840,6 +2789,10 @@ void AsyncServer::end()
     _pcb = NULL;
   }
 
+#if ASYNC_TCP_DEFERRED_EVENTS
+  AsyncTCPEvents::purge(this);
+#endif
+
 #if ASYNC_TCP_SSL_ENABLED
 
   if (_ssl_ctx)
@@ -1871,6 +2824,196 @@ void AsyncServer::end()
 
 /////////////////////////////////////////////////
 
+bool AsyncServer::setRateLimit(uint32_t rate, uint32_t burst)
+{
+#if ASYNC_TCP_RATE_LIMIT
+
+  if (rate == 0)
+  {
+    // Clients accepted so far keep their reference
+    if (_bucket)
+    {
+      _bucket->unref();
+      _bucket = NULL;
+    }
+
+    return true;
+  }
+
+  if (_bucket)
+  {
+    _bucket->set(rate, burst);
+
+    return true;
+  }
+
+  _bucket = AsyncTCPTokenBucket::create(rate, burst);
+
+  return (_bucket != NULL);
+
+#else
+  (void) rate;
+  (void) burst;
+
+  return false;
+#endif
+}
+
+/////////////////////////////////////////////////
+
+void AsyncServer::setMaxClients(size_t maxClients)
+{
+#if ASYNC_TCP_IDLE_REAPER
+  _maxClients = maxClients;
+
+  _reap(0);
+#else
+  (void) maxClients;
+#endif
+}
+
+/////////////////////////////////////////////////
+
+void AsyncServer::setReapThreshold(uint16_t freePcbs, uint16_t freePbufs, uint32_t minIdleMs)
+{
+#if ASYNC_TCP_IDLE_REAPER
+  _reapFreePcbs   = freePcbs;
+  _reapFreePbufs  = freePbufs;
+  _reapIdleMs     = minIdleMs;
+#else
+  (void) freePcbs;
+  (void) freePbufs;
+  (void) minIdleMs;
+#endif
+}
+
+/////////////////////////////////////////////////
+
+size_t AsyncServer::clients() const
+{
+#if ASYNC_TCP_IDLE_REAPER
+  return _lru_count;
+#else
+  return 0;
+#endif
+}
+
+/////////////////////////////////////////////////
+
+uint32_t AsyncServer::reaped() const
+{
+#if ASYNC_TCP_IDLE_REAPER
+  return _reaped;
+#else
+  return 0;
+#endif
+}
+
+/////////////////////////////////////////////////
+
+#if ASYNC_TCP_IDLE_REAPER
+void AsyncServer::_lruLink(AsyncClient *c)
+{
+  c->_lru_owner = this;
+  c->_lru_prev  = _lru_tail;
+  c->_lru_next  = NULL;
+
+  if (_lru_tail)
+    _lru_tail->_lru_next = c;
+  else
+    _lru_head = c;
+
+  _lru_tail = c;
+  _lru_count++;
+  _lru_total++;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncServer::_lruUnlink(AsyncClient *c)
+{
+  if (c->_lru_prev)
+    c->_lru_prev->_lru_next = c->_lru_next;
+  else
+    _lru_head = c->_lru_next;
+
+  if (c->_lru_next)
+    c->_lru_next->_lru_prev = c->_lru_prev;
+  else
+    _lru_tail = c->_lru_prev;
+
+  c->_lru_owner = NULL;
+  c->_lru_prev  = NULL;
+  c->_lru_next  = NULL;
+
+  _lru_count--;
+  _lru_total--;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncServer::_lruDetach()
+{
+  while (_lru_head)
+    _lruUnlink(_lru_head);
+}
+
+/////////////////////////////////////////////////
+
+bool AsyncServer::_underPressure()
+{
+#if MEMP_STATS
+  const struct stats_mem *pcbs = lwip_stats.memp[MEMP_TCP_PCB];
+
+  if (_reapFreePcbs && ((int) pcbs->avail - (int) pcbs->used < (int) _reapFreePcbs))
+    return true;
+
+#if PBUF_POOL_SIZE
+  const struct stats_mem *pbufs = lwip_stats.memp[MEMP_PBUF_POOL];
+
+  if (_reapFreePbufs && ((int) pbufs->avail - (int) pbufs->used < (int) _reapFreePbufs))
+    return true;
+#endif
+
+#else
+
+  // Upper bound, connections opened by AsyncClient::connect() are not counted
+  if (_reapFreePcbs && ((int) MEMP_NUM_TCP_PCB - (int) _lru_total < (int) _reapFreePcbs))
+    return true;
+
+#endif
+
+  return false;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncServer::_reap(size_t incoming)
+{
+  uint32_t now = millis();
+
+  // Bounded, a client that fails to close is unlinked all the same
+  for (size_t n = _lru_count; n && _lru_head; n--)
+  {
+    AsyncClient *c = _lru_head;
+
+    if ( !_maxClients || (_lru_count + incoming <= _maxClients) )
+    {
+      if (!_underPressure() || ((now - c->_lastActive()) < _reapIdleMs))
+        break;
+    }
+
+    ATCP_LOGINFO1("_reap: closing idle ID =", c->getConnectionId());
+
+    _reaped++;
+    _lruUnlink(c);
+    c->close(true);
+  }
+}
+
+/////////////////////////////////////////////////
+#endif
+
 void AsyncServer::setNoDelay(bool nodelay)
 {
   _noDelay = nodelay;
@@ -1990,12 +3133,10 @@ err_t AsyncServer::_accept(tcp_pcb* pcb, err_t err)
         {
           ATCP_LOGDEBUG("_accept[_ssl_ctx]: new AsyncClient() failed, connection aborted!");
 
-          if (tcp_close(pcb) != ERR_OK)
-          {
-            tcp_abort(pcb);
+          _refused++;
+          tcp_abort(pcb);
 
-            return ERR_ABRT;
-          }
+          return ERR_ABRT;
         }
       }
 
@@ -2020,6 +3161,19 @@ err_t AsyncServer::_accept(tcp_pcb* pcb, err_t err)
 #endif
         ATCP_LOGDEBUG1("_accept: connected ID = ", errorTracker->getConnectionId());
 
+#if ASYNC_TCP_RATE_LIMIT
+        c->_setAggregate(_bucket);
+#endif
+
+#if ASYNC_TCP_IDLE_REAPER
+        // Room first, the new client is the most recently active one
+        _reap(1);
+        _lruLink(c);
+#endif
+
+        if (c->_defer(ATCP_EVENT_ACCEPT, this))
+          return ERR_OK;
+
         _connect_cb(_connect_cb_arg, c);
 
         return errorTracker->getCallbackCloseError();
@@ -2028,12 +3182,11 @@ err_t AsyncServer::_accept(tcp_pcb* pcb, err_t err)
       {
         ATCP_LOGDEBUG("_accept: new AsyncClient() failed, connection aborted!");
 
-        if (tcp_close(pcb) != ERR_OK)
-        {
-          tcp_abort(pcb);
+        // Refuse with a reset, nothing of the client was constructed
+        _refused++;
+        tcp_abort(pcb);
 
-          return ERR_ABRT;
-        }
+        return ERR_ABRT;
       }
 
 #if ASYNC_TCP_SSL_ENABLED
@@ -2220,4 +3373,6 @@ err_t AsyncServer::_s_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *pb, err_
 
 /////////////////////////////////////////////////
 
+#endif    // TEENSY41_ASYNC_TCP_COMPILED
+
 #endif    // _TEENSY41_ASYNC_TCP_IMPL_H_
@@ -0,0 +1,402 @@
+/****************************************************************************************************************************
+  Teensy41_AsyncTCP_Memory.hpp
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_MEMORY_HPP_
+#define _TEENSY41_ASYNC_TCP_MEMORY_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <new>
+
+/////////////////////////////////////////////////
+
+/*
+  Placement of library buffers. Each buffer class is mapped to a memory
+  region, and every region keeps its own usage accounting.
+
+  On Teensy 4.1 the default heap (malloc) already lives in RAM2 (DMAMEM),
+  ATCP_MEM_EXTMEM uses the optional 8/16 MB PSRAM through extmem_malloc()
+  (the core falls back to the heap without PSRAM). RAM1 (DTCM) has no heap,
+  so fast placement is done through ATCP_MEM_USER with an allocator over a
+  static pool, see setRegionAllocator(). Host builds treat ATCP_MEM_EXTMEM
+  as a plain heap arena.
+
+  ATCP_MEM_STATIC serves each class from fixed size blocks reserved at
+  compile time, see ASYNC_TCP_STATIC_MEMORY below.
+*/
+
+typedef enum
+{
+  ATCP_MEM_HEAP,
+  ATCP_MEM_EXTMEM,
+  ATCP_MEM_USER,
+  ATCP_MEM_STATIC,
+  ATCP_MEM_REGION_MAX
+} atcpMemRegion_t;
+
+typedef enum
+{
+  ATCP_MEM_CLIENT,          // AsyncClient objects
+  ATCP_MEM_TX_BUFFER,       // SyncClient / AsyncPrinter TX staging
+  ATCP_MEM_CBUF,            // other cbuf storage
+  ATCP_MEM_QUEUE_BLOCK,     // AsyncTCPByteQueue pool blocks
+  ATCP_MEM_FRAME,           // AsyncFrameCodec assembly buffers
+  ATCP_MEM_OBJECT,          // small library objects, cbuf, SyncClient refcount
+  ATCP_MEM_TRACKER,         // ACErrorTracker / AsyncTCPMemUsage bookkeeping
+  ATCP_MEM_PBUF,            // lwIP pbufs held by the library, accounting only
+  ATCP_MEM_CLASS_MAX
+} atcpMemClass_t;
+
+/////////////////////////////////////////////////
+
+/*
+  Heap free build. With ASYNC_TCP_STATIC_MEMORY every class defaults to
+  ATCP_MEM_STATIC, a pool of ASYNC_TCP_STATIC_<CLASS>S blocks of
+  ASYNC_TCP_STATIC_<CLASS>_SIZE bytes each. Requests larger than the block
+  size or beyond the count fail: the class "fails" counter is bumped, the
+  error is logged and the onExhausted() handler is called. Block sizes of
+  fixed size objects are checked with static_assert next to their type.
+*/
+#ifndef ASYNC_TCP_STATIC_MEMORY
+  #define ASYNC_TCP_STATIC_MEMORY             0
+#endif
+
+#ifndef ASYNC_TCP_STATIC_CLIENTS
+  #define ASYNC_TCP_STATIC_CLIENTS            8
+#endif
+
+#ifndef ASYNC_TCP_STATIC_CLIENT_SIZE
+  // Room for the send queues, stream and fan-out state of each client
+  #if (ASYNC_TCP_PRIORITY_QUEUES + ASYNC_TCP_SEND_STREAM + ASYNC_TCP_FANOUT) > 1
+    #define ASYNC_TCP_STATIC_CLIENT_SIZE      1024
+  #elif ASYNC_TCP_PRIORITY_QUEUES || ASYNC_TCP_SEND_STREAM || ASYNC_TCP_FANOUT
+    #define ASYNC_TCP_STATIC_CLIENT_SIZE      768
+  #else
+    #define ASYNC_TCP_STATIC_CLIENT_SIZE      512
+  #endif
+#endif
+
+#ifndef ASYNC_TCP_STATIC_TX_BUFFERS
+  #define ASYNC_TCP_STATIC_TX_BUFFERS         ASYNC_TCP_STATIC_CLIENTS
+#endif
+
+#ifndef ASYNC_TCP_STATIC_TX_BUFFER_SIZE
+  #define ASYNC_TCP_STATIC_TX_BUFFER_SIZE     1460
+#endif
+
+#ifndef ASYNC_TCP_STATIC_CBUFS
+  #define ASYNC_TCP_STATIC_CBUFS              0
+#endif
+
+#ifndef ASYNC_TCP_STATIC_CBUF_SIZE
+  #define ASYNC_TCP_STATIC_CBUF_SIZE          1460
+#endif
+
+#ifndef ASYNC_TCP_STATIC_QUEUE_BLOCKS
+  #define ASYNC_TCP_STATIC_QUEUE_BLOCKS       (4 * ASYNC_TCP_STATIC_CLIENTS)
+#endif
+
+#ifndef ASYNC_TCP_STATIC_QUEUE_BLOCK_SIZE
+  #define ASYNC_TCP_STATIC_QUEUE_BLOCK_SIZE   528
+#endif
+
+#ifndef ASYNC_TCP_STATIC_FRAMES
+  #define ASYNC_TCP_STATIC_FRAMES             2
+#endif
+
+#ifndef ASYNC_TCP_STATIC_FRAME_SIZE
+  #define ASYNC_TCP_STATIC_FRAME_SIZE         1040
+#endif
+
+// cbuf objects and SyncClient refcounts
+#ifndef ASYNC_TCP_STATIC_OBJECTS
+  #define ASYNC_TCP_STATIC_OBJECTS            (3 * ASYNC_TCP_STATIC_CLIENTS)
+#endif
+
+#ifndef ASYNC_TCP_STATIC_OBJECT_SIZE
+  #define ASYNC_TCP_STATIC_OBJECT_SIZE        64
+#endif
+
+// An ACErrorTracker (with its shared_ptr control block) and an
+// AsyncTCPMemUsage per client, plus trackers kept alive by callbacks
+#ifndef ASYNC_TCP_STATIC_TRACKERS
+  #define ASYNC_TCP_STATIC_TRACKERS           (2 * ASYNC_TCP_STATIC_CLIENTS + 2)
+#endif
+
+#ifndef ASYNC_TCP_STATIC_TRACKER_SIZE
+  #define ASYNC_TCP_STATIC_TRACKER_SIZE       160
+#endif
+
+#if ASYNC_TCP_STATIC_MEMORY
+  #define ATCP_MEM_DEFAULT_REGION             ATCP_MEM_STATIC
+#else
+  #define ATCP_MEM_DEFAULT_REGION             ATCP_MEM_HEAP
+#endif
+
+/////////////////////////////////////////////////
+
+// Compile time defaults of the class => region mapping
+
+#ifndef ASYNC_TCP_MEM_REGION_CLIENT
+  #define ASYNC_TCP_MEM_REGION_CLIENT         ATCP_MEM_DEFAULT_REGION
+#endif
+
+#ifndef ASYNC_TCP_MEM_REGION_TX_BUFFER
+  #define ASYNC_TCP_MEM_REGION_TX_BUFFER      ATCP_MEM_DEFAULT_REGION
+#endif
+
+#ifndef ASYNC_TCP_MEM_REGION_CBUF
+  #define ASYNC_TCP_MEM_REGION_CBUF           ATCP_MEM_DEFAULT_REGION
+#endif
+
+#ifndef ASYNC_TCP_MEM_REGION_QUEUE_BLOCK
+  #define ASYNC_TCP_MEM_REGION_QUEUE_BLOCK    ATCP_MEM_DEFAULT_REGION
+#endif
+
+#ifndef ASYNC_TCP_MEM_REGION_FRAME
+  #define ASYNC_TCP_MEM_REGION_FRAME          ATCP_MEM_DEFAULT_REGION
+#endif
+
+#ifndef ASYNC_TCP_MEM_REGION_OBJECT
+  #define ASYNC_TCP_MEM_REGION_OBJECT         ATCP_MEM_DEFAULT_REGION
+#endif
+
+#ifndef ASYNC_TCP_MEM_REGION_TRACKER
+  #define ASYNC_TCP_MEM_REGION_TRACKER        ATCP_MEM_DEFAULT_REGION
+#endif
+
+// Per connection usage (AsyncTCPMemUsage), 0 => global counters only
+#ifndef ASYNC_TCP_MEM_PER_CONNECTION
+  #define ASYNC_TCP_MEM_PER_CONNECTION        1
+#endif
+
+/////////////////////////////////////////////////
+
+typedef void* (*AtcpMemAllocFn)(size_t size);
+typedef void  (*AtcpMemFreeFn)(void *ptr);
+typedef void  (*AtcpMemExhaustedFn)(atcpMemClass_t memClass, size_t size);
+
+typedef struct
+{
+  size_t    current;        // bytes in use
+  size_t    highWater;      // max of current
+  uint32_t  allocs;         // successful allocations
+  uint32_t  fails;          // failed allocations
+} atcpMemStats_t;
+
+/////////////////////////////////////////////////
+
+class AsyncTCPMemory
+{
+  public:
+    // Returns NULL when the region is exhausted
+    static void * alloc(atcpMemClass_t memClass, size_t size);
+
+    // Frees to the region the block came from, whatever the mapping is now
+    static void free(void *ptr);
+
+    // Sets one block of the class aside for the next AsyncTCPAllocator
+    // request, so an object that cannot fail later is refused up front.
+    // Returns false when the region is exhausted.
+    static bool reserve(atcpMemClass_t memClass, size_t size);
+
+    // The reserved block if it holds size bytes, else NULL
+    static void * takeReserved(atcpMemClass_t memClass, size_t size);
+
+    static void unreserve(atcpMemClass_t memClass);
+
+    static void setRegion(atcpMemClass_t memClass, atcpMemRegion_t region);
+    static atcpMemRegion_t getRegion(atcpMemClass_t memClass);
+
+    // Replace the allocator of a region, NULL restores the default. Call
+    // before anything is allocated from that region.
+    static void setRegionAllocator(atcpMemRegion_t region, AtcpMemAllocFn allocFn, AtcpMemFreeFn freeFn);
+
+    // Called on every failed alloc(), after the error has been logged
+    static void onExhausted(AtcpMemExhaustedFn cb)
+    {
+      _exhausted_cb = cb;
+    }
+
+    static const atcpMemStats_t & stats(atcpMemRegion_t region)
+    {
+      return _stats[region];
+    }
+
+    // Same counters per buffer class, whatever region it is placed in
+    static const atcpMemStats_t & classStats(atcpMemClass_t memClass)
+    {
+      return _classStats[memClass];
+    }
+
+    static const char * className(atcpMemClass_t memClass);
+
+    // Account memory the library holds but did not allocate (pbufs). Only
+    // the class counters are updated.
+    static void charge(atcpMemClass_t memClass, size_t size);
+    static void release(atcpMemClass_t memClass, size_t size);
+
+  private:
+    static atcpMemRegion_t  _classRegion[ATCP_MEM_CLASS_MAX];
+    static AtcpMemAllocFn   _allocFn[ATCP_MEM_REGION_MAX];
+    static AtcpMemFreeFn    _freeFn[ATCP_MEM_REGION_MAX];
+    static atcpMemStats_t   _stats[ATCP_MEM_REGION_MAX];
+    static atcpMemStats_t   _classStats[ATCP_MEM_CLASS_MAX];
+    static AtcpMemExhaustedFn _exhausted_cb;
+    static void *           _reserved[ATCP_MEM_CLASS_MAX];
+
+    static void * _staticAlloc(atcpMemClass_t memClass, size_t size);
+    static void _staticFree(atcpMemClass_t memClass, void *block);
+};
+
+/////////////////////////////////////////////////
+
+/*
+  Standard allocator over a buffer class, for library objects created by
+  the standard library (std::allocate_shared). There is no way to return
+  NULL from here, so exhaustion ends in std::bad_alloc, or abort() without
+  exceptions, after the usual report. Callers that can fail earlier take
+  the block with AsyncTCPMemory::reserve() first, as AsyncClient does.
+*/
+template <typename T, atcpMemClass_t memClass>
+struct AsyncTCPAllocator
+{
+  typedef T value_type;
+
+  template <typename U>
+  struct rebind
+  {
+    typedef AsyncTCPAllocator<U, memClass> other;
+  };
+
+  AsyncTCPAllocator() {}
+
+  template <typename U>
+  AsyncTCPAllocator(const AsyncTCPAllocator<U, memClass>&) {}
+
+  T * allocate(size_t n)
+  {
+    void *ptr = AsyncTCPMemory::takeReserved(memClass, n * sizeof(T));
+
+    if (ptr == NULL)
+      ptr = AsyncTCPMemory::alloc(memClass, n * sizeof(T));
+
+    if (ptr == NULL)
+    {
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS)
+      throw std::bad_alloc();
+#else
+      abort();
+#endif
+    }
+
+    return (T *) ptr;
+  }
+
+  void deallocate(T *ptr, size_t n)
+  {
+    (void) n;
+    AsyncTCPMemory::free(ptr);
+  }
+
+  template <typename U>
+  bool operator==(const AsyncTCPAllocator<U, memClass>&) const
+  {
+    return true;
+  }
+
+  template <typename U>
+  bool operator!=(const AsyncTCPAllocator<U, memClass>&) const
+  {
+    return false;
+  }
+};
+
+/////////////////////////////////////////////////
+
+/*
+  Memory attributed to one connection, per buffer class. Created by the
+  AsyncClient and shared, reference counted, with the wrappers and buffers
+  working for it, so a buffer outliving its client still releases into a
+  valid object. allocs / fails are not tracked per connection.
+
+  Query it through AsyncClient::memUsage(). NULL when
+  ASYNC_TCP_MEM_PER_CONNECTION is 0 or the object could not be allocated,
+  callers check for it.
+*/
+class AsyncTCPMemUsage
+{
+  public:
+    static AsyncTCPMemUsage * create();
+
+    void ref()
+    {
+      _refs++;
+    }
+
+    void unref();
+
+    void charge(atcpMemClass_t memClass, size_t size);
+    void release(atcpMemClass_t memClass, size_t size);
+
+    size_t current(atcpMemClass_t memClass) const
+    {
+      return _current[memClass];
+    }
+
+    size_t highWater(atcpMemClass_t memClass) const
+    {
+      return _highWater[memClass];
+    }
+
+    // All classes together
+    size_t total() const
+    {
+      return _total;
+    }
+
+    size_t totalHighWater() const
+    {
+      return _totalHighWater;
+    }
+
+  private:
+    AsyncTCPMemUsage();
+    AsyncTCPMemUsage(const AsyncTCPMemUsage&);
+    AsyncTCPMemUsage& operator=(const AsyncTCPMemUsage&);
+
+    uint32_t  _refs;
+    size_t    _total;
+    size_t    _totalHighWater;
+    size_t    _current[ATCP_MEM_CLASS_MAX];
+    size_t    _highWater[ATCP_MEM_CLASS_MAX];
+};
+
+/////////////////////////////////////////////////
+
+#endif    // _TEENSY41_ASYNC_TCP_MEMORY_HPP_
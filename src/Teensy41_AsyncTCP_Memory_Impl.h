@@ -0,0 +1,404 @@
+/****************************************************************************************************************************
+  Teensy41_AsyncTCP_Memory_Impl.h
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_MEMORY_IMPL_H_
+#define _TEENSY41_ASYNC_TCP_MEMORY_IMPL_H_
+
+#if !TEENSY41_ASYNC_TCP_COMPILED || defined(_TEENSY41_ASYNC_TCP_LIBRARY_)
+
+#include <stdlib.h>
+#include <new>
+
+#include <Arduino.h>
+
+#include "Teensy41_AsyncTCP_Debug.h"
+#include "Teensy41_AsyncTCP_Memory.hpp"
+
+/////////////////////////////////////////////////
+
+#if defined(ARDUINO_TEENSY41)
+  extern "C" void *extmem_malloc(size_t size);
+  extern "C" void extmem_free(void *ptr);
+
+  #define ATCP_EXTMEM_MALLOC      extmem_malloc
+  #define ATCP_EXTMEM_FREE        extmem_free
+#else
+  // Host builds, a plain heap arena stands in for PSRAM
+  #define ATCP_EXTMEM_MALLOC      malloc
+  #define ATCP_EXTMEM_FREE        ::free
+#endif
+
+/////////////////////////////////////////////////
+
+// Prepended to every block, keeps 8 byte alignment of the payload
+typedef union
+{
+  struct
+  {
+    uint32_t  size;
+    uint8_t   region;
+    uint8_t   memClass;
+  } h;
+
+  uint64_t    align;
+} atcp_mem_hdr;
+
+/////////////////////////////////////////////////
+
+atcpMemRegion_t AsyncTCPMemory::_classRegion[ATCP_MEM_CLASS_MAX] =
+{
+  ASYNC_TCP_MEM_REGION_CLIENT,
+  ASYNC_TCP_MEM_REGION_TX_BUFFER,
+  ASYNC_TCP_MEM_REGION_CBUF,
+  ASYNC_TCP_MEM_REGION_QUEUE_BLOCK,
+  ASYNC_TCP_MEM_REGION_FRAME,
+  ASYNC_TCP_MEM_REGION_OBJECT,
+  ASYNC_TCP_MEM_REGION_TRACKER,
+  ATCP_MEM_HEAP               // ATCP_MEM_PBUF, accounting only
+};
+
+AtcpMemAllocFn AsyncTCPMemory::_allocFn[ATCP_MEM_REGION_MAX]  = { malloc, ATCP_EXTMEM_MALLOC, NULL, NULL };
+AtcpMemFreeFn  AsyncTCPMemory::_freeFn[ATCP_MEM_REGION_MAX]   = { ::free, ATCP_EXTMEM_FREE, NULL, NULL };
+atcpMemStats_t AsyncTCPMemory::_stats[ATCP_MEM_REGION_MAX]    = {};
+atcpMemStats_t AsyncTCPMemory::_classStats[ATCP_MEM_CLASS_MAX] = {};
+
+AtcpMemExhaustedFn AsyncTCPMemory::_exhausted_cb = NULL;
+void *             AsyncTCPMemory::_reserved[ATCP_MEM_CLASS_MAX] = {};
+
+/////////////////////////////////////////////////
+
+/*
+  ATCP_MEM_STATIC pools, one per class. Blocks are carved from the array in
+  order the first time and recycled through a free list afterwards.
+*/
+typedef struct
+{
+  uint64_t  *storage;
+  size_t    blockSize;        // payload bytes, header excluded
+  size_t    count;
+  size_t    carved;
+  void      *free;
+} atcp_static_pool;
+
+#define ATCP_STATIC_WORDS(size)     ((sizeof(atcp_mem_hdr) + (size) + 7) / 8)
+#define ATCP_STATIC_STORAGE(name, count, size) \
+  static uint64_t name[((count) > 0 ? (count) : 1) * ATCP_STATIC_WORDS(size)]
+#define ATCP_STATIC_POOL(name, count, size)     { name, (size), (count), 0, NULL }
+
+#if ASYNC_TCP_STATIC_MEMORY
+
+ATCP_STATIC_STORAGE(atcp_static_client,     ASYNC_TCP_STATIC_CLIENTS,       ASYNC_TCP_STATIC_CLIENT_SIZE);
+ATCP_STATIC_STORAGE(atcp_static_tx_buffer,  ASYNC_TCP_STATIC_TX_BUFFERS,    ASYNC_TCP_STATIC_TX_BUFFER_SIZE);
+ATCP_STATIC_STORAGE(atcp_static_cbuf,       ASYNC_TCP_STATIC_CBUFS,         ASYNC_TCP_STATIC_CBUF_SIZE);
+ATCP_STATIC_STORAGE(atcp_static_queue,      ASYNC_TCP_STATIC_QUEUE_BLOCKS,  ASYNC_TCP_STATIC_QUEUE_BLOCK_SIZE);
+ATCP_STATIC_STORAGE(atcp_static_frame,      ASYNC_TCP_STATIC_FRAMES,        ASYNC_TCP_STATIC_FRAME_SIZE);
+ATCP_STATIC_STORAGE(atcp_static_object,     ASYNC_TCP_STATIC_OBJECTS,       ASYNC_TCP_STATIC_OBJECT_SIZE);
+ATCP_STATIC_STORAGE(atcp_static_tracker,    ASYNC_TCP_STATIC_TRACKERS,      ASYNC_TCP_STATIC_TRACKER_SIZE);
+
+static atcp_static_pool atcp_static_pools[ATCP_MEM_CLASS_MAX] =
+{
+  ATCP_STATIC_POOL(atcp_static_client,    ASYNC_TCP_STATIC_CLIENTS,       ASYNC_TCP_STATIC_CLIENT_SIZE),
+  ATCP_STATIC_POOL(atcp_static_tx_buffer, ASYNC_TCP_STATIC_TX_BUFFERS,    ASYNC_TCP_STATIC_TX_BUFFER_SIZE),
+  ATCP_STATIC_POOL(atcp_static_cbuf,      ASYNC_TCP_STATIC_CBUFS,         ASYNC_TCP_STATIC_CBUF_SIZE),
+  ATCP_STATIC_POOL(atcp_static_queue,     ASYNC_TCP_STATIC_QUEUE_BLOCKS,  ASYNC_TCP_STATIC_QUEUE_BLOCK_SIZE),
+  ATCP_STATIC_POOL(atcp_static_frame,     ASYNC_TCP_STATIC_FRAMES,        ASYNC_TCP_STATIC_FRAME_SIZE),
+  ATCP_STATIC_POOL(atcp_static_object,    ASYNC_TCP_STATIC_OBJECTS,       ASYNC_TCP_STATIC_OBJECT_SIZE),
+  ATCP_STATIC_POOL(atcp_static_tracker,   ASYNC_TCP_STATIC_TRACKERS,      ASYNC_TCP_STATIC_TRACKER_SIZE),
+  { NULL, 0, 0, 0, NULL }     // ATCP_MEM_PBUF, accounting only
+};
+
+#else
+
+// Static region not built in, every request to it fails
+static atcp_static_pool atcp_static_pools[ATCP_MEM_CLASS_MAX] = {};
+
+#endif    // ASYNC_TCP_STATIC_MEMORY
+
+/////////////////////////////////////////////////
+
+static inline void atcp_mem_add(atcpMemStats_t &stats, size_t size)
+{
+  stats.allocs++;
+  stats.current += size;
+
+  if (stats.current > stats.highWater)
+    stats.highWater = stats.current;
+}
+
+/////////////////////////////////////////////////
+
+void * AsyncTCPMemory::alloc(atcpMemClass_t memClass, size_t size)
+{
+  atcpMemRegion_t region = _classRegion[memClass];
+  atcpMemStats_t &stats = _stats[region];
+  atcp_mem_hdr *hdr = NULL;
+
+  if (region == ATCP_MEM_STATIC)
+    hdr = (atcp_mem_hdr *) _staticAlloc(memClass, size);
+  else if (_allocFn[region] != NULL)
+    hdr = (atcp_mem_hdr *) _allocFn[region](sizeof(atcp_mem_hdr) + size);
+
+  if (hdr == NULL)
+  {
+    stats.fails++;
+    _classStats[memClass].fails++;
+
+    ATCP_LOGERROR3("AsyncTCPMemory: out of memory, class =", className(memClass), ", size =", size);
+
+    if (_exhausted_cb)
+      _exhausted_cb(memClass, size);
+
+    return NULL;
+  }
+
+  hdr->h.size = size;
+  hdr->h.region = region;
+  hdr->h.memClass = memClass;
+
+  atcp_mem_add(stats, size);
+  atcp_mem_add(_classStats[memClass], size);
+
+  return hdr + 1;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPMemory::free(void *ptr)
+{
+  if (ptr == NULL)
+    return;
+
+  atcp_mem_hdr *hdr = ((atcp_mem_hdr *) ptr) - 1;
+  atcpMemRegion_t region = (atcpMemRegion_t) hdr->h.region;
+
+  _stats[region].current -= hdr->h.size;
+  _classStats[hdr->h.memClass].current -= hdr->h.size;
+
+  if (region == ATCP_MEM_STATIC)
+    _staticFree((atcpMemClass_t) hdr->h.memClass, hdr);
+  else
+    _freeFn[region](hdr);
+}
+
+/////////////////////////////////////////////////
+
+bool AsyncTCPMemory::reserve(atcpMemClass_t memClass, size_t size)
+{
+  if (_reserved[memClass])
+  {
+    if ((((atcp_mem_hdr *) _reserved[memClass]) - 1)->h.size >= size)
+      return true;
+
+    unreserve(memClass);
+  }
+
+  _reserved[memClass] = alloc(memClass, size);
+
+  return (_reserved[memClass] != NULL);
+}
+
+/////////////////////////////////////////////////
+
+void * AsyncTCPMemory::takeReserved(atcpMemClass_t memClass, size_t size)
+{
+  void *ptr = _reserved[memClass];
+
+  if ( (ptr == NULL) || ((((atcp_mem_hdr *) ptr) - 1)->h.size < size) )
+    return NULL;
+
+  _reserved[memClass] = NULL;
+
+  return ptr;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPMemory::unreserve(atcpMemClass_t memClass)
+{
+  free(_reserved[memClass]);
+  _reserved[memClass] = NULL;
+}
+
+/////////////////////////////////////////////////
+
+void * AsyncTCPMemory::_staticAlloc(atcpMemClass_t memClass, size_t size)
+{
+  atcp_static_pool &pool = atcp_static_pools[memClass];
+
+  if (size > pool.blockSize)
+    return NULL;
+
+  void *block = pool.free;
+
+  if (block != NULL)
+  {
+    pool.free = *(void **) block;
+  }
+  else if (pool.carved < pool.count)
+  {
+    block = pool.storage + pool.carved * ATCP_STATIC_WORDS(pool.blockSize);
+    pool.carved++;
+  }
+
+  return block;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPMemory::_staticFree(atcpMemClass_t memClass, void *block)
+{
+  atcp_static_pool &pool = atcp_static_pools[memClass];
+
+  *(void **) block = pool.free;
+  pool.free = block;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPMemory::charge(atcpMemClass_t memClass, size_t size)
+{
+  atcp_mem_add(_classStats[memClass], size);
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPMemory::release(atcpMemClass_t memClass, size_t size)
+{
+  _classStats[memClass].current -= size;
+}
+
+/////////////////////////////////////////////////
+
+const char * AsyncTCPMemory::className(atcpMemClass_t memClass)
+{
+  static const char * const names[ATCP_MEM_CLASS_MAX] =
+  {
+    "client", "txBuffer", "cbuf", "queueBlock", "frame", "object", "tracker", "pbuf"
+  };
+
+  return (memClass < ATCP_MEM_CLASS_MAX) ? names[memClass] : "unknown";
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPMemory::setRegion(atcpMemClass_t memClass, atcpMemRegion_t region)
+{
+  _classRegion[memClass] = region;
+}
+
+/////////////////////////////////////////////////
+
+atcpMemRegion_t AsyncTCPMemory::getRegion(atcpMemClass_t memClass)
+{
+  return _classRegion[memClass];
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPMemory::setRegionAllocator(atcpMemRegion_t region, AtcpMemAllocFn allocFn, AtcpMemFreeFn freeFn)
+{
+  if (allocFn == NULL || freeFn == NULL)
+  {
+    // Back to the default
+    allocFn = (region == ATCP_MEM_HEAP) ? malloc : ((region == ATCP_MEM_EXTMEM) ? ATCP_EXTMEM_MALLOC : NULL);
+    freeFn  = (region == ATCP_MEM_HEAP) ? ::free : ((region == ATCP_MEM_EXTMEM) ? ATCP_EXTMEM_FREE : NULL);
+  }
+
+  _allocFn[region] = allocFn;
+  _freeFn[region] = freeFn;
+}
+
+/////////////////////////////////////////////////
+/////////////////////////////////////////////////
+
+AsyncTCPMemUsage::AsyncTCPMemUsage()
+  : _refs(1)
+  , _total(0)
+  , _totalHighWater(0)
+  , _current()
+  , _highWater()
+{
+}
+
+/////////////////////////////////////////////////
+
+AsyncTCPMemUsage * AsyncTCPMemUsage::create()
+{
+#if ASYNC_TCP_MEM_PER_CONNECTION
+  void *mem = AsyncTCPMemory::alloc(ATCP_MEM_TRACKER, sizeof(AsyncTCPMemUsage));
+
+  if (mem == NULL)
+    return NULL;
+
+  AsyncTCPMemUsage *usage = new (mem) AsyncTCPMemUsage();
+
+  usage->charge(ATCP_MEM_TRACKER, sizeof(AsyncTCPMemUsage));
+
+  return usage;
+#else
+  return NULL;
+#endif
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPMemUsage::unref()
+{
+  if (--_refs > 0)
+    return;
+
+  this->~AsyncTCPMemUsage();
+  AsyncTCPMemory::free(this);
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPMemUsage::charge(atcpMemClass_t memClass, size_t size)
+{
+  _current[memClass] += size;
+  _total += size;
+
+  if (_current[memClass] > _highWater[memClass])
+    _highWater[memClass] = _current[memClass];
+
+  if (_total > _totalHighWater)
+    _totalHighWater = _total;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPMemUsage::release(atcpMemClass_t memClass, size_t size)
+{
+  _current[memClass] -= size;
+  _total -= size;
+}
+
+/////////////////////////////////////////////////
+
+#endif    // TEENSY41_ASYNC_TCP_COMPILED
+
+#endif    // _TEENSY41_ASYNC_TCP_MEMORY_IMPL_H_
@@ -0,0 +1,156 @@
+/****************************************************************************************************************************
+  Teensy41_AsyncTCP_RateLimit.hpp
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_RATE_LIMIT_HPP_
+#define _TEENSY41_ASYNC_TCP_RATE_LIMIT_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/////////////////////////////////////////////////
+
+/*
+  Token bucket shaping of the send path. With ASYNC_TCP_RATE_LIMIT an
+  AsyncClient can be limited to rate bytes per second with bursts of up to
+  burst bytes (setRateLimit()), and an AsyncServer can share one bucket
+  among all the clients it accepts from then on.
+
+  AsyncClient::space() and add() never exceed the tokens of either bucket,
+  so writers see a full send buffer instead of an error and keep their data
+  queued. A client held back by its tokens is polled (onPoll) from an lwIP
+  timer every ASYNC_TCP_RATE_TICK_MS once enough tokens are back, so
+  AsyncPrinter, AsyncTCPbuffer and similar writers resume without waiting
+  for the 500 ms lwIP poll.
+
+  Buckets are ATCP_MEM_OBJECT blocks, count them in ASYNC_TCP_STATIC_OBJECTS.
+*/
+#ifndef ASYNC_TCP_RATE_LIMIT
+  #define ASYNC_TCP_RATE_LIMIT          0
+#endif
+
+#ifndef ASYNC_TCP_RATE_TICK_MS
+  #define ASYNC_TCP_RATE_TICK_MS        10
+#endif
+
+// A waiting client is woken once this many tokens, or its burst, are back
+#ifndef ASYNC_TCP_RATE_WAKE_BYTES
+  #define ASYNC_TCP_RATE_WAKE_BYTES     1460
+#endif
+
+/////////////////////////////////////////////////
+
+class AsyncClient;
+
+/////////////////////////////////////////////////
+
+class AsyncTCPTokenBucket
+{
+  public:
+    // rate in bytes per second, burst in bytes. Starts full.
+    static AsyncTCPTokenBucket * create(uint32_t rate, uint32_t burst);
+
+    void ref()
+    {
+      _refs++;
+    }
+
+    void unref();
+
+    // Tokens already earned are kept, up to the new burst
+    void set(uint32_t rate, uint32_t burst);
+
+    uint32_t rate() const
+    {
+      return _rate;
+    }
+
+    uint32_t burst() const
+    {
+      return _burst;
+    }
+
+    // Refills from the time elapsed since the last call
+    size_t available();
+
+    void take(size_t bytes);
+
+    // Bytes let through, and how often a sender found it empty
+    uint64_t passed() const
+    {
+      return _passed;
+    }
+
+    uint32_t throttled() const
+    {
+      return _throttled;
+    }
+
+  private:
+    friend class AsyncClient;
+
+    AsyncTCPTokenBucket(uint32_t rate, uint32_t burst);
+    AsyncTCPTokenBucket(const AsyncTCPTokenBucket&);
+    AsyncTCPTokenBucket& operator=(const AsyncTCPTokenBucket&);
+
+    uint64_t  _passed;
+    uint32_t  _rate;
+    uint32_t  _burst;
+    uint32_t  _tokens;
+    uint32_t  _frac;        // token fraction, in millionths
+    uint32_t  _lastUs;
+    uint32_t  _throttled;
+    uint16_t  _refs;
+};
+
+/////////////////////////////////////////////////
+
+// Clients held back by their buckets, woken from an lwIP timer
+class AsyncTCPShaper
+{
+  public:
+    static size_t waiting()
+    {
+      return _count;
+    }
+
+  protected:
+    friend class AsyncClient;
+
+    static void wait(AsyncClient *c);
+    static void forget(AsyncClient *c);
+
+  private:
+    static AsyncClient *_head;
+    static size_t       _count;
+    static bool         _armed;
+
+    static void _s_tick(void *arg);
+};
+
+/////////////////////////////////////////////////
+
+#endif    // _TEENSY41_ASYNC_TCP_RATE_LIMIT_HPP_
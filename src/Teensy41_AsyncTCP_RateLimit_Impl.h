@@ -0,0 +1,220 @@
+/****************************************************************************************************************************
+  Teensy41_AsyncTCP_RateLimit_Impl.h
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_RATE_LIMIT_IMPL_H_
+#define _TEENSY41_ASYNC_TCP_RATE_LIMIT_IMPL_H_
+
+#if !TEENSY41_ASYNC_TCP_COMPILED || defined(_TEENSY41_ASYNC_TCP_LIBRARY_)
+
+#if ASYNC_TCP_RATE_LIMIT
+
+#include <Arduino.h>
+
+extern "C"
+{
+#include "lwip/timeouts.h"
+}
+
+#include "Teensy41_AsyncTCP_Debug.h"
+#include "Teensy41_AsyncTCP_RateLimit.hpp"
+
+/////////////////////////////////////////////////
+
+#if ASYNC_TCP_STATIC_MEMORY
+  static_assert(sizeof(AsyncTCPTokenBucket) <= ASYNC_TCP_STATIC_OBJECT_SIZE, "Increase ASYNC_TCP_STATIC_OBJECT_SIZE");
+#endif
+
+/////////////////////////////////////////////////
+
+AsyncTCPTokenBucket::AsyncTCPTokenBucket(uint32_t rate, uint32_t burst)
+  : _passed(0)
+  , _rate(rate)
+  , _burst(burst)
+  , _tokens(burst)
+  , _frac(0)
+  , _lastUs(micros())
+  , _throttled(0)
+  , _refs(1)
+{
+}
+
+/////////////////////////////////////////////////
+
+AsyncTCPTokenBucket * AsyncTCPTokenBucket::create(uint32_t rate, uint32_t burst)
+{
+  void *mem = AsyncTCPMemory::alloc(ATCP_MEM_OBJECT, sizeof(AsyncTCPTokenBucket));
+
+  if (mem == NULL)
+    return NULL;
+
+  return new (mem) AsyncTCPTokenBucket(rate, burst);
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPTokenBucket::unref()
+{
+  if (--_refs > 0)
+    return;
+
+  this->~AsyncTCPTokenBucket();
+  AsyncTCPMemory::free(this);
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPTokenBucket::set(uint32_t rate, uint32_t burst)
+{
+  available();
+
+  _rate = rate;
+  _burst = burst;
+
+  if (_tokens > _burst)
+    _tokens = _burst;
+}
+
+/////////////////////////////////////////////////
+
+size_t AsyncTCPTokenBucket::available()
+{
+  uint32_t now = micros();
+
+  // Fractions are carried over, slow rates still add up
+  uint64_t earned = (uint64_t) (now - _lastUs) * _rate + _frac;
+
+  _lastUs = now;
+
+  if (_tokens + (earned / 1000000) >= _burst)
+  {
+    _tokens = _burst;
+    _frac = 0;
+  }
+  else
+  {
+    _tokens += earned / 1000000;
+    _frac = earned % 1000000;
+  }
+
+  return _tokens;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPTokenBucket::take(size_t bytes)
+{
+  _tokens -= (bytes < _tokens) ? bytes : _tokens;
+  _passed += bytes;
+}
+
+/////////////////////////////////////////////////
+/////////////////////////////////////////////////
+
+AsyncClient * AsyncTCPShaper::_head   = NULL;
+size_t        AsyncTCPShaper::_count  = 0;
+bool          AsyncTCPShaper::_armed  = false;
+
+/////////////////////////////////////////////////
+
+void AsyncTCPShaper::wait(AsyncClient *c)
+{
+  if (c->_shaped_waiting)
+    return;
+
+  c->_shaped_waiting = true;
+  c->_shaped_next = _head;
+  _head = c;
+  _count++;
+
+  if (!_armed)
+  {
+    _armed = true;
+    sys_timeout(ASYNC_TCP_RATE_TICK_MS, _s_tick, NULL);
+  }
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPShaper::forget(AsyncClient *c)
+{
+  if (!c->_shaped_waiting)
+    return;
+
+  AsyncClient **link = &_head;
+
+  while (*link && (*link != c))
+    link = &(*link)->_shaped_next;
+
+  if (*link)
+  {
+    *link = c->_shaped_next;
+    _count--;
+  }
+
+  c->_shaped_next = NULL;
+  c->_shaped_waiting = false;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPShaper::_s_tick(void *arg)
+{
+  (void) arg;
+
+  _armed = false;
+
+  // A poll handler may write, close or delete any client, so start over
+  // from the head after each one. Clients only wait while below their wake
+  // level, the bound is a safety net.
+  for (size_t wakes = _count; wakes > 0; wakes--)
+  {
+    AsyncClient *c = _head;
+
+    while (c && (c->_shapedTokens() < c->_shapedWake()))
+      c = c->_shaped_next;
+
+    if (c == NULL)
+      break;
+
+    forget(c);
+    c->_shapedPoll();
+  }
+
+  if (_head && !_armed)
+  {
+    _armed = true;
+    sys_timeout(ASYNC_TCP_RATE_TICK_MS, _s_tick, NULL);
+  }
+}
+
+/////////////////////////////////////////////////
+
+#endif    // ASYNC_TCP_RATE_LIMIT
+
+#endif    // TEENSY41_ASYNC_TCP_COMPILED
+
+#endif    // _TEENSY41_ASYNC_TCP_RATE_LIMIT_IMPL_H_
@@ -0,0 +1,168 @@
+/****************************************************************************************************************************
+  Teensy41_AsyncTCP_Scheduler.hpp
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_SCHEDULER_HPP_
+#define _TEENSY41_ASYNC_TCP_SCHEDULER_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/////////////////////////////////////////////////
+
+/*
+  Transmit scheduler. Without it every AsyncPrinter / AsyncTCPbuffer fills
+  its whole send buffer each time its own onAck / onPoll fires, and one bulk
+  transfer can hold most of the shared lwIP segment and pbuf pools.
+
+  With ASYNC_TCP_TX_SCHEDULER each of them owns an AsyncTCPFlow. Writes and
+  acks only mark the flow ready, AsyncTCPScheduler::run() then visits the
+  ready flows by deficit round robin: a flow may hand to lwIP up to
+  quantum * weight bytes per visit, plus what it could not use before while
+  it stays backlogged. run() is called on every ready(), it can also be
+  called from loop().
+*/
+#ifndef ASYNC_TCP_TX_SCHEDULER
+  #define ASYNC_TCP_TX_SCHEDULER        0
+#endif
+
+// Bytes per visit and unit of weight
+#ifndef ASYNC_TCP_SCHED_QUANTUM
+  #define ASYNC_TCP_SCHED_QUANTUM       1460
+#endif
+
+#ifndef ASYNC_TCP_SCHED_WEIGHT
+  #define ASYNC_TCP_SCHED_WEIGHT        1
+#endif
+
+/////////////////////////////////////////////////
+
+// Hands up to budget bytes to lwIP, returns what was queued
+typedef size_t (*AtcpFlowSendFn)(void *arg, size_t budget);
+
+// Bytes still waiting to be sent
+typedef size_t (*AtcpFlowPendingFn)(void *arg);
+
+typedef struct
+{
+  uint64_t  bytes;
+  uint32_t  turns;          // visits that sent something
+  uint32_t  delayCount;
+  uint32_t  delayMaxUs;     // ready to served, per turn
+  uint64_t  delayTotalUs;
+} atcpFlowStats_t;
+
+/////////////////////////////////////////////////
+
+class AsyncTCPFlow
+{
+  public:
+    AsyncTCPFlow(AtcpFlowSendFn sendFn, AtcpFlowPendingFn pendingFn, void *arg,
+                 uint16_t weight = ASYNC_TCP_SCHED_WEIGHT);
+    ~AsyncTCPFlow();
+
+    AsyncTCPFlow(const AsyncTCPFlow &) = delete;
+    AsyncTCPFlow & operator=(const AsyncTCPFlow &) = delete;
+
+    // Data is waiting, join the round if not already in
+    void ready();
+
+    // 0 is taken as 1
+    void setWeight(uint16_t weight)
+    {
+      _weight = weight ? weight : 1;
+    }
+
+    uint16_t weight() const
+    {
+      return _weight;
+    }
+
+    bool isReady() const
+    {
+      return _ready;
+    }
+
+    const atcpFlowStats_t & stats() const
+    {
+      return _stats;
+    }
+
+  private:
+    friend class AsyncTCPScheduler;
+
+    AtcpFlowSendFn    _sendFn;
+    AtcpFlowPendingFn _pendingFn;
+    void             *_arg;
+    AsyncTCPFlow     *_next;
+    uint32_t          _deficit;
+    uint32_t          _readySince;
+    uint16_t          _weight;
+    bool              _ready;
+    atcpFlowStats_t   _stats;
+};
+
+/////////////////////////////////////////////////
+
+class AsyncTCPScheduler
+{
+  public:
+    // One round over the flows ready now, each visited once
+    static void run();
+
+    static void setQuantum(uint32_t bytes)
+    {
+      _quantum = bytes ? bytes : 1;
+    }
+
+    static uint32_t quantum()
+    {
+      return _quantum;
+    }
+
+    // Flows waiting for a turn
+    static size_t ready()
+    {
+      return _count;
+    }
+
+  private:
+    friend class AsyncTCPFlow;
+
+    static AsyncTCPFlow  *_head;
+    static AsyncTCPFlow  *_tail;
+    static AsyncTCPFlow  *_current;
+    static size_t         _count;
+    static uint32_t       _quantum;
+    static bool           _running;
+
+    static void _push(AsyncTCPFlow *flow);
+    static void _remove(AsyncTCPFlow *flow);
+};
+
+/////////////////////////////////////////////////
+
+#endif    // _TEENSY41_ASYNC_TCP_SCHEDULER_HPP_
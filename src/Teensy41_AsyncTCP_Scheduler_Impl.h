@@ -0,0 +1,216 @@
+/****************************************************************************************************************************
+  Teensy41_AsyncTCP_Scheduler_Impl.h
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_SCHEDULER_IMPL_H_
+#define _TEENSY41_ASYNC_TCP_SCHEDULER_IMPL_H_
+
+#if !TEENSY41_ASYNC_TCP_COMPILED || defined(_TEENSY41_ASYNC_TCP_LIBRARY_)
+
+#if ASYNC_TCP_TX_SCHEDULER
+
+#include <Arduino.h>
+
+#include "Teensy41_AsyncTCP_Debug.h"
+#include "Teensy41_AsyncTCP_Scheduler.hpp"
+
+/////////////////////////////////////////////////
+
+AsyncTCPFlow * AsyncTCPScheduler::_head     = NULL;
+AsyncTCPFlow * AsyncTCPScheduler::_tail     = NULL;
+AsyncTCPFlow * AsyncTCPScheduler::_current  = NULL;
+size_t         AsyncTCPScheduler::_count    = 0;
+uint32_t       AsyncTCPScheduler::_quantum  = ASYNC_TCP_SCHED_QUANTUM;
+bool           AsyncTCPScheduler::_running  = false;
+
+/////////////////////////////////////////////////
+
+AsyncTCPFlow::AsyncTCPFlow(AtcpFlowSendFn sendFn, AtcpFlowPendingFn pendingFn, void *arg, uint16_t weight)
+  : _sendFn(sendFn)
+  , _pendingFn(pendingFn)
+  , _arg(arg)
+  , _next(NULL)
+  , _deficit(0)
+  , _readySince(0)
+  , _weight(weight ? weight : 1)
+  , _ready(false)
+  , _stats()
+{
+}
+
+/////////////////////////////////////////////////
+
+AsyncTCPFlow::~AsyncTCPFlow()
+{
+  if (_ready)
+    AsyncTCPScheduler::_remove(this);
+
+  // Deleted from its own send, e.g. through a disconnect handler
+  if (AsyncTCPScheduler::_current == this)
+    AsyncTCPScheduler::_current = NULL;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPFlow::ready()
+{
+  if (!_ready)
+  {
+    _readySince = micros();
+    AsyncTCPScheduler::_push(this);
+  }
+
+  AsyncTCPScheduler::run();
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPScheduler::_push(AsyncTCPFlow *flow)
+{
+  flow->_next = NULL;
+  flow->_ready = true;
+
+  if (_tail)
+    _tail->_next = flow;
+  else
+    _head = flow;
+
+  _tail = flow;
+  _count++;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPScheduler::_remove(AsyncTCPFlow *flow)
+{
+  AsyncTCPFlow *prev = NULL;
+
+  for (AsyncTCPFlow *f = _head; f != NULL; prev = f, f = f->_next)
+  {
+    if (f == flow)
+    {
+      if (prev)
+        prev->_next = f->_next;
+      else
+        _head = f->_next;
+
+      if (_tail == f)
+        _tail = prev;
+
+      _count--;
+      break;
+    }
+  }
+
+  flow->_next = NULL;
+  flow->_ready = false;
+}
+
+/////////////////////////////////////////////////
+
+void AsyncTCPScheduler::run()
+{
+  // Sends never call back into run(), but a handler of a nested lwIP
+  // callback could
+  if (_running)
+    return;
+
+  _running = true;
+
+  for (size_t visits = _count; (visits > 0) && (_head != NULL); visits--)
+  {
+    AsyncTCPFlow *flow = _head;
+
+    _head = flow->_next;
+
+    if (_head == NULL)
+      _tail = NULL;
+
+    _count--;
+    flow->_next = NULL;
+    flow->_ready = false;
+
+    if (flow->_pendingFn(flow->_arg) == 0)
+    {
+      // Idle flows keep no credit
+      flow->_deficit = 0;
+      continue;
+    }
+
+    uint32_t share = _quantum * flow->_weight;
+
+    flow->_deficit += share;
+
+    _current = flow;
+    size_t sent = flow->_sendFn(flow->_arg, flow->_deficit);
+
+    if (_current == NULL)
+      continue;
+
+    _current = NULL;
+
+    if (sent > 0)
+    {
+      uint32_t now = micros();
+      uint32_t delay = now - flow->_readySince;
+
+      flow->_stats.bytes += sent;
+      flow->_stats.turns++;
+      flow->_stats.delayCount++;
+      flow->_stats.delayTotalUs += delay;
+
+      if (delay > flow->_stats.delayMaxUs)
+        flow->_stats.delayMaxUs = delay;
+
+      flow->_readySince = now;
+    }
+
+    flow->_deficit -= (sent < flow->_deficit) ? sent : flow->_deficit;
+
+    if (flow->_pendingFn(flow->_arg) == 0)
+    {
+      flow->_deficit = 0;
+    }
+    else
+    {
+      // Held back by its own window, do not hoard credit meanwhile
+      if ( (sent == 0) && (flow->_deficit > share) )
+        flow->_deficit = share;
+
+      _push(flow);
+    }
+  }
+
+  _running = false;
+}
+
+/////////////////////////////////////////////////
+
+#endif    // ASYNC_TCP_TX_SCHEDULER
+
+#endif    // TEENSY41_ASYNC_TCP_COMPILED
+
+#endif    // _TEENSY41_ASYNC_TCP_SCHEDULER_IMPL_H_
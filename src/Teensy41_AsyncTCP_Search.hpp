@@ -0,0 +1,113 @@
+/****************************************************************************************************************************
+  Teensy41_AsyncTCP_Search.hpp
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_SEARCH_HPP_
+#define _TEENSY41_ASYNC_TCP_SEARCH_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/////////////////////////////////////////////////
+
+// Index of the first byte equal to terminator or 0x00, len if none.
+// Scans a 32-bit word at a time.
+size_t atcp_find_terminator(const char *data, size_t len, char terminator);
+
+/////////////////////////////////////////////////
+
+#ifndef ASYNC_TCP_DELIMITER_MAX_LEN
+  // Fits a "\r\n--" + 70 char multipart boundary
+  #define ASYNC_TCP_DELIMITER_MAX_LEN     80
+#endif
+
+#if (ASYNC_TCP_DELIMITER_MAX_LEN > 255)
+  #error ASYNC_TCP_DELIMITER_MAX_LEN must be <= 255
+#endif
+
+/*
+  Incremental multi-byte delimiter matcher, e.g. "\r\n\r\n".
+
+  Data is fed chunk by chunk as it arrives (pbuf payloads, ring buffer
+  spans, onData() buffers). A partial match at the end of one chunk is
+  carried into the next one, so a delimiter split across pbufs or a
+  wrap point is still found, no byte is looked at again on a later call
+  and nothing has to be linearized.
+
+  Bytes continuing a carried partial match go through a KMP automaton,
+  the rest of the chunk is searched with Horspool skips.
+*/
+class AsyncTCPDelimiter
+{
+  public:
+    AsyncTCPDelimiter();
+    AsyncTCPDelimiter(const char *delimiter);
+    AsyncTCPDelimiter(const char *delimiter, size_t len);
+
+    // false if empty or longer than ASYNC_TCP_DELIMITER_MAX_LEN
+    bool set(const char *delimiter, size_t len);
+
+    inline bool set(const char *delimiter)
+    {
+      return set(delimiter, strlen(delimiter));
+    }
+
+    inline size_t length() const
+    {
+      return _len;
+    }
+
+    // Delimiter bytes matched at the end of the data fed so far
+    inline size_t matched() const
+    {
+      return _matched;
+    }
+
+    // Forget a carried partial match
+    inline void reset()
+    {
+      _matched = 0;
+    }
+
+    // Scans len bytes. On a match *found is set and the offset just past the
+    // delimiter's last byte is returned; the delimiter may have started in an
+    // earlier chunk. Otherwise returns len. Matching restarts after a hit.
+    size_t feed(const char *data, size_t len, bool *found);
+
+  private:
+    inline uint8_t _step(uint8_t state, uint8_t c) const;
+
+    uint8_t _len;
+    uint8_t _matched;
+    uint8_t _delim[ASYNC_TCP_DELIMITER_MAX_LEN];
+    uint8_t _fail[ASYNC_TCP_DELIMITER_MAX_LEN];
+    uint8_t _skip[256];
+};
+
+/////////////////////////////////////////////////
+
+#endif    // _TEENSY41_ASYNC_TCP_SEARCH_HPP_
@@ -0,0 +1,226 @@
+/****************************************************************************************************************************
+  Teensy41_AsyncTCP_Search_Impl.h
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_SEARCH_IMPL_H_
+#define _TEENSY41_ASYNC_TCP_SEARCH_IMPL_H_
+
+#if !TEENSY41_ASYNC_TCP_COMPILED || defined(_TEENSY41_ASYNC_TCP_LIBRARY_)
+
+#include "Teensy41_AsyncTCP_Search.hpp"
+
+/////////////////////////////////////////////////
+
+// Non-zero if any byte of v is 0x00
+#define ATCP_HAS_ZERO_BYTE(v)     (((v) - 0x01010101UL) & ~(v) & 0x80808080UL)
+
+/////////////////////////////////////////////////
+
+size_t atcp_find_terminator(const char *data, size_t len, char terminator)
+{
+  const uint8_t *p = (const uint8_t *) data;
+  size_t i = 0;
+
+  // Bytewise up to word alignment
+  while ((i < len) && (((uintptr_t) (p + i)) & 3))
+  {
+    if ((p[i] == (uint8_t) terminator) || (p[i] == 0))
+      return i;
+
+    i++;
+  }
+
+  const uint32_t pattern = 0x01010101UL * (uint8_t) terminator;
+
+  while (i + 4 <= len)
+  {
+    uint32_t w;
+
+    memcpy(&w, p + i, 4);
+
+    if (ATCP_HAS_ZERO_BYTE(w) || ATCP_HAS_ZERO_BYTE(w ^ pattern))
+      break;
+
+    i += 4;
+  }
+
+  // Locate the hit inside the word, or finish the tail
+  while (i < len)
+  {
+    if ((p[i] == (uint8_t) terminator) || (p[i] == 0))
+      return i;
+
+    i++;
+  }
+
+  return len;
+}
+
+/////////////////////////////////////////////////
+
+AsyncTCPDelimiter::AsyncTCPDelimiter()
+  : _len(0), _matched(0)
+{
+}
+
+/////////////////////////////////////////////////
+
+AsyncTCPDelimiter::AsyncTCPDelimiter(const char *delimiter)
+  : _len(0), _matched(0)
+{
+  set(delimiter);
+}
+
+/////////////////////////////////////////////////
+
+AsyncTCPDelimiter::AsyncTCPDelimiter(const char *delimiter, size_t len)
+  : _len(0), _matched(0)
+{
+  set(delimiter, len);
+}
+
+/////////////////////////////////////////////////
+
+bool AsyncTCPDelimiter::set(const char *delimiter, size_t len)
+{
+  _matched = 0;
+
+  if (!delimiter || (len == 0) || (len > ASYNC_TCP_DELIMITER_MAX_LEN))
+  {
+    _len = 0;
+
+    return false;
+  }
+
+  _len = len;
+  memcpy(_delim, delimiter, len);
+
+  // KMP failure function: longest proper prefix that is also a suffix of _delim[0..i]
+  _fail[0] = 0;
+
+  uint8_t k = 0;
+
+  for (size_t i = 1; i < len; i++)
+  {
+    while ((k > 0) && (_delim[i] != _delim[k]))
+      k = _fail[k - 1];
+
+    if (_delim[i] == _delim[k])
+      k++;
+
+    _fail[i] = k;
+  }
+
+  // Horspool bad character shifts
+  memset(_skip, len, sizeof(_skip));
+
+  for (size_t i = 0; i + 1 < len; i++)
+    _skip[_delim[i]] = len - 1 - i;
+
+  return true;
+}
+
+/////////////////////////////////////////////////
+
+inline uint8_t AsyncTCPDelimiter::_step(uint8_t state, uint8_t c) const
+{
+  while ((state > 0) && (_delim[state] != c))
+    state = _fail[state - 1];
+
+  if (_delim[state] == c)
+    state++;
+
+  return state;
+}
+
+/////////////////////////////////////////////////
+
+size_t AsyncTCPDelimiter::feed(const char *data, size_t len, bool *found)
+{
+  const uint8_t *p = (const uint8_t *) data;
+  const size_t m = _len;
+
+  *found = false;
+
+  if ((m == 0) || (len == 0))
+    return len;
+
+  // 1) Continue a match carried from earlier chunks. Any such match ends
+  //    within the first m - 1 bytes; stop as soon as it falls apart.
+  size_t resume = 0;
+
+  while ((_matched > 0) && (resume < len) && (resume < m - 1))
+  {
+    _matched = _step(_matched, p[resume++]);
+
+    if (_matched == m)
+    {
+      _matched = 0;
+      *found = true;
+
+      return resume;
+    }
+  }
+
+  // 2) Matches lying completely inside this chunk
+  const uint8_t last = _delim[m - 1];
+  size_t pos = 0;
+
+  while (pos + m <= len)
+  {
+    uint8_t c = p[pos + m - 1];
+
+    if ((c == last) && (memcmp(p + pos, _delim, m - 1) == 0))
+    {
+      _matched = 0;
+      *found = true;
+
+      return pos + m;
+    }
+
+    pos += _skip[c];
+  }
+
+  // 3) Carry a partial match at the end of the chunk. It is at most m - 1
+  //    bytes long, so older bytes need not be looked at.
+  size_t start = (len > m - 1) ? len - (m - 1) : 0;
+
+  if (start > resume)
+    _matched = 0;
+  else
+    start = resume;
+
+  for (size_t i = start; i < len; i++)
+    _matched = _step(_matched, p[i]);
+
+  return len;
+}
+
+/////////////////////////////////////////////////
+
+#endif    // TEENSY41_ASYNC_TCP_COMPILED
+
+#endif    // _TEENSY41_ASYNC_TCP_SEARCH_IMPL_H_
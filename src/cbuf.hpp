@@ -35,15 +35,24 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <new>
+
+#include "Teensy41_AsyncTCP_Memory.hpp"
 
 /////////////////////////////////////////////////
 
 class cbuf 
 {
   public:
-    cbuf(size_t size);
+    cbuf(size_t size, atcpMemClass_t memClass = ATCP_MEM_CBUF);
     ~cbuf();
 
+    // The object itself is placed according to ATCP_MEM_OBJECT, new cbuf
+    // returns NULL on exhaustion
+    static void * operator new(size_t size) noexcept;
+    static void * operator new(size_t size, const std::nothrow_t&) noexcept;
+    static void operator delete(void *ptr);
+
     size_t resizeAdd(size_t addSize);
     size_t resize(size_t newSize);
     size_t available() const;
@@ -58,7 +67,7 @@ class cbuf
 
     inline bool full() const 
     {
-      return wrap_if_bufend(_end + 1) == _begin;
+      return (_size == 0) || (wrap_if_bufend(_end + 1) == _begin);
     }
 
     int peek();
@@ -73,6 +82,18 @@ class cbuf
     void flush();
     size_t remove(size_t size);
 
+    // Readable / writable regions as up to two contiguous spans (second one
+    // only after the wrap point). Return the total length of the spans.
+    size_t readSpans(const char **data1, size_t *len1, const char **data2 = NULL, size_t *len2 = NULL) const;
+    size_t writeSpans(char **data1, size_t *len1, char **data2 = NULL, size_t *len2 = NULL);
+
+    // Consume / publish bytes accessed through the spans above
+    size_t commitRead(size_t size);
+    size_t commitWrite(size_t size);
+
+    // Attribute the storage to a connection, NULL detaches. Holds a reference.
+    void setUsage(AsyncTCPMemUsage *usage);
+
     cbuf *next;
 
   private:
@@ -81,6 +102,15 @@ class cbuf
       return (ptr == _bufend) ? _buf : ptr;
     }
 
+    inline char* advance(char* ptr, size_t size) const 
+    {
+      size_t top_size = _bufend - ptr;
+
+      return (size < top_size) ? (ptr + size) : (_buf + (size - top_size));
+    }
+
+    atcpMemClass_t _memClass;
+    AsyncTCPMemUsage *_usage;
     size_t _size;
     char* _buf;
     const char* _bufend;
@@ -32,20 +32,78 @@
 #ifndef _TEENSY41_ASYNC_TCP_CBUF_IMPL_H_
 #define _TEENSY41_ASYNC_TCP_CBUF_IMPL_H_
 
+#if !TEENSY41_ASYNC_TCP_COMPILED || defined(_TEENSY41_ASYNC_TCP_LIBRARY_)
+
 #include "cbuf.hpp"
 
 /////////////////////////////////////////////////
 
-cbuf::cbuf(size_t size) : next(NULL), _size(size), _buf(new char[size]), _bufend(_buf + size), _begin(_buf),
-  _end(_begin)
+#if ASYNC_TCP_STATIC_MEMORY
+  static_assert(sizeof(cbuf) <= ASYNC_TCP_STATIC_OBJECT_SIZE, "Increase ASYNC_TCP_STATIC_OBJECT_SIZE");
+#endif
+
+/////////////////////////////////////////////////
+
+cbuf::cbuf(size_t size, atcpMemClass_t memClass) : next(NULL), _memClass(memClass), _usage(NULL), _size(size),
+  _buf((char *) AsyncTCPMemory::alloc(memClass, size)), _bufend(_buf + size), _begin(_buf), _end(_begin)
 {
+  if (!_buf)
+  {
+    // Out of memory, behave as a zero sized buffer
+    _size = 0;
+    _bufend = NULL;
+  }
 }
 
 /////////////////////////////////////////////////
 
 cbuf::~cbuf()
 {
-  delete[] _buf;
+  setUsage(NULL);
+  AsyncTCPMemory::free(_buf);
+}
+
+/////////////////////////////////////////////////
+
+void * cbuf::operator new(size_t size) noexcept
+{
+  return AsyncTCPMemory::alloc(ATCP_MEM_OBJECT, size);
+}
+
+/////////////////////////////////////////////////
+
+void * cbuf::operator new(size_t size, const std::nothrow_t&) noexcept
+{
+  return AsyncTCPMemory::alloc(ATCP_MEM_OBJECT, size);
+}
+
+/////////////////////////////////////////////////
+
+void cbuf::operator delete(void *ptr)
+{
+  AsyncTCPMemory::free(ptr);
+}
+
+/////////////////////////////////////////////////
+
+void cbuf::setUsage(AsyncTCPMemUsage *usage)
+{
+  if (usage == _usage)
+    return;
+
+  if (usage != NULL)
+  {
+    usage->ref();
+    usage->charge(_memClass, _size);
+  }
+
+  if (_usage != NULL)
+  {
+    _usage->release(_memClass, _size);
+    _usage->unref();
+  }
+
+  _usage = usage;
 }
 
 /////////////////////////////////////////////////
@@ -69,7 +127,7 @@ size_t cbuf::resize(size_t newSize)
     return _size;
   }
 
-  char *newbuf = new char[newSize];
+  char *newbuf = (char *) AsyncTCPMemory::alloc(_memClass, newSize);
   char *oldbuf = _buf;
 
   if (!newbuf)
@@ -83,6 +141,12 @@ size_t cbuf::resize(size_t newSize)
     memset((newbuf + bytes_available), 0x00, (newSize - bytes_available));
   }
 
+  if (_usage != NULL)
+  {
+    _usage->release(_memClass, _size);
+    _usage->charge(_memClass, newSize);
+  }
+
   _begin = newbuf;
   _end = newbuf + bytes_available;
   _bufend = newbuf + newSize;
@@ -90,7 +154,7 @@ size_t cbuf::resize(size_t newSize)
 
   _buf = newbuf;
 
-  delete[] oldbuf;
+  AsyncTCPMemory::free(oldbuf);
 
   return _size;
 }
@@ -118,6 +182,9 @@ size_t cbuf::size()
 
 size_t cbuf::room() const
 {
+  if (_size == 0)
+    return 0;
+
   if (_end >= _begin)
   {
     return _size - (_end - _begin) - 1;
@@ -269,4 +336,112 @@ size_t cbuf::remove(size_t size)
 
 /////////////////////////////////////////////////
 
+size_t cbuf::readSpans(const char **data1, size_t *len1, const char **data2, size_t *len2) const
+{
+  size_t size1 = 0;
+  size_t size2 = 0;
+
+  if (_end >= _begin)
+  {
+    size1 = _end - _begin;
+  }
+  else
+  {
+    size1 = _bufend - _begin;
+    size2 = _end - _buf;
+  }
+
+  *data1 = _begin;
+  *len1 = size1;
+
+  if (data2 && len2)
+  {
+    *data2 = _buf;
+    *len2 = size2;
+  }
+  else
+  {
+    size2 = 0;
+  }
+
+  return size1 + size2;
+}
+
+/////////////////////////////////////////////////
+
+size_t cbuf::writeSpans(char **data1, size_t *len1, char **data2, size_t *len2)
+{
+  size_t size1 = 0;
+  size_t size2 = 0;
+
+  if (_size == 0)
+  {
+    // nothing allocated
+  }
+  else if (_end >= _begin)
+  {
+    // One byte is always kept free to tell full from empty
+    if (_begin == _buf)
+    {
+      size1 = _bufend - _end - 1;
+    }
+    else
+    {
+      size1 = _bufend - _end;
+      size2 = _begin - _buf - 1;
+    }
+  }
+  else
+  {
+    size1 = _begin - _end - 1;
+  }
+
+  *data1 = _end;
+  *len1 = size1;
+
+  if (data2 && len2)
+  {
+    *data2 = _buf;
+    *len2 = size2;
+  }
+  else
+  {
+    size2 = 0;
+  }
+
+  return size1 + size2;
+}
+
+/////////////////////////////////////////////////
+
+size_t cbuf::commitRead(size_t size)
+{
+  size_t bytes_available = available();
+
+  if (size > bytes_available)
+    size = bytes_available;
+
+  _begin = advance(_begin, size);
+
+  return size;
+}
+
+/////////////////////////////////////////////////
+
+size_t cbuf::commitWrite(size_t size)
+{
+  size_t bytes_available = room();
+
+  if (size > bytes_available)
+    size = bytes_available;
+
+  _end = advance(_end, size);
+
+  return size;
+}
+
+/////////////////////////////////////////////////
+
+#endif    // TEENSY41_ASYNC_TCP_COMPILED
+
 #endif    // _TEENSY41_ASYNC_TCP_CBUF_IMPL_H_
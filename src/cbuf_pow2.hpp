@@ -0,0 +1,397 @@
+/****************************************************************************************************************************
+  cbuf_pow2.hpp
+
+  cbuf_pow2.hpp - Power-of-two circular buffer with optional lock-free SPSC mode
+
+  Teensy41_AsyncTCP is a library for Teensy4.1 using LwIP-based QNEthernet
+
+  Based on and modified from :
+
+  1) ESPAsyncTCP    (https://github.com/me-no-dev/ESPAsyncTCP)
+  2) AsyncTCP       (https://github.com/me-no-dev/AsyncTCP)
+
+  Built by Khoi Hoang https://github.com/khoih-prog/Teensy41_AsyncTCP
+
+  This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  Version: 1.1.0
+
+  Version Modified By   Date      Comments
+  ------- -----------  ---------- -----------
+  1.0.0    K Hoang     17/03/2022 Initial coding to support only Teensy4.1 using QNEthernet
+  1.1.0    K Hoang     26/09/2022 Fix issue with slow browsers or network. Clean up. Remove hard-code if possible
+ *****************************************************************************************************************************/
+
+#pragma once
+
+#ifndef _TEENSY41_ASYNC_TCP_CBUF_POW2_HPP_
+#define _TEENSY41_ASYNC_TCP_CBUF_POW2_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+
+/////////////////////////////////////////////////
+
+/*
+  Fixed size ring of N bytes, N a power of two. The head / tail indices only
+  ever increase and are masked on access, so all N bytes are usable and
+  full / empty never need a reserved byte.
+
+  CBUF_MODE_SPSC makes the ring safe for exactly one producer and one
+  consumer running in different contexts, e.g. a UART ISR writing and
+  loop() reading, without disabling interrupts. The producer may only call
+  write() / writeSpans() / commitWrite() / room() / full(), the consumer
+  everything else. Data is published with release stores and observed with
+  acquire loads, which emit the required barriers on Cortex-M7.
+
+  Storage is inline, so the whole ring can be placed statically.
+*/
+
+typedef enum
+{
+  CBUF_MODE_PLAIN,
+  CBUF_MODE_SPSC
+} cbufMode_t;
+
+/////////////////////////////////////////////////
+
+template <cbufMode_t MODE> class cbuf_index;
+
+template <> class cbuf_index<CBUF_MODE_PLAIN>
+{
+  public:
+    cbuf_index() : _v(0) {}
+
+    inline size_t load() const
+    {
+      return _v;
+    }
+
+    inline void store(size_t v)
+    {
+      _v = v;
+    }
+
+  private:
+    size_t _v;
+};
+
+template <> class cbuf_index<CBUF_MODE_SPSC>
+{
+  public:
+    cbuf_index() : _v(0) {}
+
+    inline size_t load() const
+    {
+      return _v.load(std::memory_order_acquire);
+    }
+
+    inline void store(size_t v)
+    {
+      _v.store(v, std::memory_order_release);
+    }
+
+  private:
+    std::atomic<size_t> _v;
+};
+
+/////////////////////////////////////////////////
+
+template <size_t N, cbufMode_t MODE = CBUF_MODE_PLAIN>
+class cbuf_pow2
+{
+    static_assert((N >= 2) && ((N & (N - 1)) == 0), "cbuf_pow2 size must be a power of two");
+
+  public:
+    cbuf_pow2() {}
+
+    inline size_t size() const
+    {
+      return N;
+    }
+
+    inline size_t available() const
+    {
+      return _head.load() - _tail.load();
+    }
+
+    inline size_t room() const
+    {
+      return N - (_head.load() - _tail.load());
+    }
+
+    inline bool empty() const
+    {
+      return _head.load() == _tail.load();
+    }
+
+    inline bool full() const
+    {
+      return (_head.load() - _tail.load()) == N;
+    }
+
+    int peek();
+    size_t peek(char *dst, size_t size);
+
+    int read();
+    size_t read(char* dst, size_t size);
+
+    size_t write(char c);
+    size_t write(const char* src, size_t size);
+
+    void flush();
+    size_t remove(size_t size);
+
+    size_t readSpans(const char **data1, size_t *len1, const char **data2 = NULL, size_t *len2 = NULL) const;
+    size_t writeSpans(char **data1, size_t *len1, char **data2 = NULL, size_t *len2 = NULL);
+
+    size_t commitRead(size_t size);
+    size_t commitWrite(size_t size);
+
+  private:
+    static const size_t _mask = N - 1;
+
+    cbuf_pow2(const cbuf_pow2&);
+    cbuf_pow2& operator=(const cbuf_pow2&);
+
+    size_t _copyOut(size_t tail, char *dst, size_t size) const;
+
+    char _buf[N];
+    cbuf_index<MODE> _head;     // written by the producer only
+    cbuf_index<MODE> _tail;     // written by the consumer only
+};
+
+/////////////////////////////////////////////////
+
+template <size_t N, cbufMode_t MODE>
+size_t cbuf_pow2<N, MODE>::_copyOut(size_t tail, char *dst, size_t size) const
+{
+  size_t offset = tail & _mask;
+  size_t top_size = N - offset;
+
+  if (size > top_size)
+  {
+    memcpy(dst, _buf + offset, top_size);
+    memcpy(dst + top_size, _buf, size - top_size);
+  }
+  else
+  {
+    memcpy(dst, _buf + offset, size);
+  }
+
+  return size;
+}
+
+/////////////////////////////////////////////////
+
+template <size_t N, cbufMode_t MODE>
+int cbuf_pow2<N, MODE>::peek()
+{
+  size_t tail = _tail.load();
+
+  if (_head.load() == tail)
+    return -1;
+
+  return static_cast<int>(_buf[tail & _mask]);
+}
+
+/////////////////////////////////////////////////
+
+template <size_t N, cbufMode_t MODE>
+size_t cbuf_pow2<N, MODE>::peek(char *dst, size_t size)
+{
+  size_t tail = _tail.load();
+  size_t bytes_available = _head.load() - tail;
+
+  if (size > bytes_available)
+    size = bytes_available;
+
+  return _copyOut(tail, dst, size);
+}
+
+/////////////////////////////////////////////////
+
+template <size_t N, cbufMode_t MODE>
+int cbuf_pow2<N, MODE>::read()
+{
+  size_t tail = _tail.load();
+
+  if (_head.load() == tail)
+    return -1;
+
+  char result = _buf[tail & _mask];
+  _tail.store(tail + 1);
+
+  return static_cast<int>(result);
+}
+
+/////////////////////////////////////////////////
+
+template <size_t N, cbufMode_t MODE>
+size_t cbuf_pow2<N, MODE>::read(char* dst, size_t size)
+{
+  size_t tail = _tail.load();
+  size_t bytes_available = _head.load() - tail;
+
+  if (size > bytes_available)
+    size = bytes_available;
+
+  _copyOut(tail, dst, size);
+  _tail.store(tail + size);
+
+  return size;
+}
+
+/////////////////////////////////////////////////
+
+template <size_t N, cbufMode_t MODE>
+size_t cbuf_pow2<N, MODE>::write(char c)
+{
+  size_t head = _head.load();
+
+  if ((head - _tail.load()) == N)
+    return 0;
+
+  _buf[head & _mask] = c;
+  _head.store(head + 1);
+
+  return 1;
+}
+
+/////////////////////////////////////////////////
+
+template <size_t N, cbufMode_t MODE>
+size_t cbuf_pow2<N, MODE>::write(const char* src, size_t size)
+{
+  size_t head = _head.load();
+  size_t bytes_available = N - (head - _tail.load());
+
+  if (size > bytes_available)
+    size = bytes_available;
+
+  size_t offset = head & _mask;
+  size_t top_size = N - offset;
+
+  if (size > top_size)
+  {
+    memcpy(_buf + offset, src, top_size);
+    memcpy(_buf, src + top_size, size - top_size);
+  }
+  else
+  {
+    memcpy(_buf + offset, src, size);
+  }
+
+  _head.store(head + size);
+
+  return size;
+}
+
+/////////////////////////////////////////////////
+
+// Consumer side: drops everything currently readable
+template <size_t N, cbufMode_t MODE>
+void cbuf_pow2<N, MODE>::flush()
+{
+  _tail.store(_head.load());
+}
+
+/////////////////////////////////////////////////
+
+template <size_t N, cbufMode_t MODE>
+size_t cbuf_pow2<N, MODE>::remove(size_t size)
+{
+  commitRead(size);
+
+  return available();
+}
+
+/////////////////////////////////////////////////
+
+template <size_t N, cbufMode_t MODE>
+size_t cbuf_pow2<N, MODE>::readSpans(const char **data1, size_t *len1, const char **data2, size_t *len2) const
+{
+  size_t tail = _tail.load();
+  size_t bytes_available = _head.load() - tail;
+  size_t offset = tail & _mask;
+  size_t size1 = (bytes_available < (N - offset)) ? bytes_available : (N - offset);
+
+  *data1 = _buf + offset;
+  *len1 = size1;
+
+  if (data2 && len2)
+  {
+    *data2 = _buf;
+    *len2 = bytes_available - size1;
+
+    return bytes_available;
+  }
+
+  return size1;
+}
+
+/////////////////////////////////////////////////
+
+template <size_t N, cbufMode_t MODE>
+size_t cbuf_pow2<N, MODE>::writeSpans(char **data1, size_t *len1, char **data2, size_t *len2)
+{
+  size_t head = _head.load();
+  size_t bytes_available = N - (head - _tail.load());
+  size_t offset = head & _mask;
+  size_t size1 = (bytes_available < (N - offset)) ? bytes_available : (N - offset);
+
+  *data1 = _buf + offset;
+  *len1 = size1;
+
+  if (data2 && len2)
+  {
+    *data2 = _buf;
+    *len2 = bytes_available - size1;
+
+    return bytes_available;
+  }
+
+  return size1;
+}
+
+/////////////////////////////////////////////////
+
+template <size_t N, cbufMode_t MODE>
+size_t cbuf_pow2<N, MODE>::commitRead(size_t size)
+{
+  size_t tail = _tail.load();
+  size_t bytes_available = _head.load() - tail;
+
+  if (size > bytes_available)
+    size = bytes_available;
+
+  _tail.store(tail + size);
+
+  return size;
+}
+
+/////////////////////////////////////////////////
+
+template <size_t N, cbufMode_t MODE>
+size_t cbuf_pow2<N, MODE>::commitWrite(size_t size)
+{
+  size_t head = _head.load();
+  size_t bytes_available = N - (head - _tail.load());
+
+  if (size > bytes_available)
+    size = bytes_available;
+
+  _head.store(head + size);
+
+  return size;
+}
+
+/////////////////////////////////////////////////
+
+#endif    // _TEENSY41_ASYNC_TCP_CBUF_POW2_HPP_